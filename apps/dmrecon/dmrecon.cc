@@ -13,6 +13,7 @@
 
 #include "dmrecon/settings.h"
 #include "dmrecon/dmrecon.h"
+#include "dmrecon/image_pyramid.h"
 #include "mve/scene.h"
 #include "mve/view.h"
 #include "util/timer.h"
@@ -39,6 +40,7 @@ struct AppSettings
     int max_pixels = 1500000;
     bool force_recon = false;
     bool write_ply = false;
+    std::size_t pyramid_cache = 0;
 #ifdef _WIN32
     ProgressStyle progress_style = PROGRESS_SIMPLE;
 #else
@@ -141,6 +143,12 @@ main (int argc, char** argv)
         "specify source image embedding [undistorted]");
     args.add_option('\0', "local-neighbors", true,
         "amount of neighbors for local view selection [4]");
+    args.add_option('\0', "growing-batch", true,
+        "queue entries optimized in parallel per view [1]");
+    args.add_option('\0', "linear-pyramids", true,
+        "keep linearized float pyramids within budget in MB [disabled]");
+    args.add_option('\0', "pyramid-cache", true,
+        "keep unused image pyramids within budget in MB [0]");
     args.add_option('\0', "keep-dz", false,
         "store dz map into view");
     args.add_option('\0', "keep-conf", false,
@@ -176,6 +184,15 @@ main (int argc, char** argv)
             conf.mvs.filterWidth = arg->get_arg<unsigned int>();
         else if (arg->opt->lopt == "image")
             conf.mvs.imageEmbedding = arg->get_arg<std::string>();
+        else if (arg->opt->lopt == "growing-batch")
+            conf.mvs.growingBatchSize = arg->get_arg<unsigned int>();
+        else if (arg->opt->lopt == "linear-pyramids")
+        {
+            conf.mvs.useLinearPyramids = true;
+            conf.mvs.linearPyramidBudget = arg->get_arg<std::size_t>();
+        }
+        else if (arg->opt->lopt == "pyramid-cache")
+            conf.pyramid_cache = arg->get_arg<std::size_t>();
         else if (arg->opt->lopt == "keep-dz")
             conf.mvs.keepDzMap = true;
         else if (arg->opt->lopt == "keep-conf")
@@ -239,6 +256,7 @@ main (int argc, char** argv)
     }
 
     /* Settings for Multi-view stereo */
+    mvs::ImagePyramidCache::setMemoryBudget(conf.pyramid_cache << 20);
     conf.mvs.writePlyFile = conf.write_ply;
     conf.mvs.plyPath = util::fs::join_path(conf.scene_path, conf.ply_dest);
 
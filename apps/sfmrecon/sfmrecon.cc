@@ -9,6 +9,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <ctime>
 #include <cstdlib>
@@ -43,6 +44,7 @@ struct AppSettings
     std::string undistorted_name = "undistorted";
     std::string exif_name = "exif";
     std::string prebundle_file = "prebundle.sfm";
+    std::string feature_cache_name;
     std::string survey_file;
     std::string log_file;
     int max_image_size = 6000000;
@@ -50,6 +52,8 @@ struct AppSettings
     bool normalize_scene = false;
     bool skip_sfm = false;
     bool always_full_ba = false;
+    bool local_ba = false;
+    int next_views_batch = 1;
     bool fixed_intrinsics = false;
     //bool shared_intrinsics = false;
     bool intrinsics_from_views = false;
@@ -60,7 +64,12 @@ struct AppSettings
     int initial_pair_2 = -1;
     int min_views_per_track = 3;
     bool cascade_hashing = false;
+    bool kdtree_matching = false;
+    int kdtree_checks = 128;
+    int retrieval_candidates = 0;
     bool verbose_ba = false;
+    bool verbose_matching = false;
+    bool implicit_schur = false;
 };
 
 void
@@ -94,6 +103,7 @@ features_and_matching (mve::Scene::Ptr scene, AppSettings const& conf,
     feature_opts.image_embedding = conf.original_name;
     feature_opts.max_image_size = conf.max_image_size;
     feature_opts.feature_options.feature_types = sfm::FeatureSet::FEATURE_ALL;
+    feature_opts.feature_cache_embedding = conf.feature_cache_name;
 
     std::cout << "Computing image features..." << std::endl;
     {
@@ -117,6 +127,12 @@ features_and_matching (mve::Scene::Ptr scene, AppSettings const& conf,
     matching_opts.matcher_type = conf.cascade_hashing
         ? sfm::bundler::Matching::MATCHER_CASCADE_HASHING
         : sfm::bundler::Matching::MATCHER_EXHAUSTIVE;
+    if (conf.kdtree_matching)
+        matching_opts.matcher_type = sfm::bundler::Matching::MATCHER_KDTREE;
+    matching_opts.kdtree_opts.max_checks = conf.kdtree_checks;
+    matching_opts.retrieval_opts.num_candidates = conf.retrieval_candidates;
+    matching_opts.retrieval_opts.verbose_output = true;
+    matching_opts.verbose_output = conf.verbose_matching;
 
     std::cout << "Performing feature matching..." << std::endl;
     {
@@ -173,6 +189,8 @@ sfm_reconstruct (AppSettings const& conf)
         = util::fs::join_path(scene->get_path(), conf.prebundle_file);
     sfm::bundler::ViewportList viewports;
     sfm::bundler::PairwiseMatching pairwise_matching;
+    sfm::bundler::PairwiseMatchingRef matching_refs;
+    std::unique_ptr<sfm::bundler::MappedPrebundle> prebundle;
     if (!util::fs::file_exists(prebundle_path.c_str()))
     {
         log_message(conf, "Starting feature matching.");
@@ -182,13 +200,16 @@ sfm_reconstruct (AppSettings const& conf)
         std::cout << "Saving pre-bundle to file..." << std::endl;
         sfm::bundler::save_prebundle_to_file(
             viewports, pairwise_matching,prebundle_path);
+        sfm::bundler::make_matching_refs(pairwise_matching, &matching_refs);
     }
     else if (!conf.skip_sfm)
     {
+        /* The matches are used in place from the mapped file. */
         log_message(conf, "Loading pairwise matching from file.");
         std::cout << "Loading pairwise matching from file..." << std::endl;
-        sfm::bundler::load_prebundle_from_file(
-            prebundle_path, &viewports, &pairwise_matching);
+        prebundle.reset(new sfm::bundler::MappedPrebundle(prebundle_path));
+        prebundle->get_viewports(&viewports);
+        prebundle->get_matching_refs(&matching_refs);
     }
 
     if (conf.skip_sfm)
@@ -203,7 +224,7 @@ sfm_reconstruct (AppSettings const& conf)
         viewports[i].features.clear_descriptors();
 
     /* Check if there are some matching images. */
-    if (pairwise_matching.empty())
+    if (matching_refs.empty())
     {
         std::cerr << "No matching image pairs. Exiting." << std::endl;
         std::exit(EXIT_FAILURE);
@@ -244,7 +265,7 @@ sfm_reconstruct (AppSettings const& conf)
 
         sfm::bundler::Tracks bundler_tracks(tracks_options);
         std::cout << "Computing feature tracks..." << std::endl;
-        bundler_tracks.compute(pairwise_matching, &viewports, &tracks);
+        bundler_tracks.compute(matching_refs, &viewports, &tracks);
         std::cout << "Created a total of " << tracks.size()
             << " tracks." << std::endl;
     }
@@ -252,44 +273,9 @@ sfm_reconstruct (AppSettings const& conf)
     /* Remove color data and pairwise matching to save memory. */
     for (std::size_t i = 0; i < viewports.size(); ++i)
         viewports[i].features.colors.clear();
+    matching_refs.clear();
     pairwise_matching.clear();
-
-    /* Search for a good initial pair, or use the user-specified one. */
-    sfm::bundler::InitialPair::Result init_pair_result;
-    sfm::bundler::InitialPair::Options init_pair_opts;
-    if (conf.initial_pair_1 < 0 || conf.initial_pair_2 < 0)
-    {
-        //init_pair_opts.homography_opts.max_iterations = 1000;
-        //init_pair_opts.homography_opts.threshold = 0.005f;
-        init_pair_opts.homography_opts.verbose_output = false;
-        init_pair_opts.max_homography_inliers = 0.8f;
-        init_pair_opts.verbose_output = true;
-
-        sfm::bundler::InitialPair init_pair(init_pair_opts);
-        init_pair.initialize(viewports, tracks);
-        init_pair.compute_pair(&init_pair_result);
-    }
-    else
-    {
-        std::cout << "Reconstructing initial pair..." << std::endl;
-        sfm::bundler::InitialPair init_pair(init_pair_opts);
-        init_pair.initialize(viewports, tracks);
-        init_pair.compute_pair(conf.initial_pair_1, conf.initial_pair_2,
-            &init_pair_result);
-    }
-
-    if (init_pair_result.view_1_id < 0 || init_pair_result.view_2_id < 0
-        || init_pair_result.view_1_id >= static_cast<int>(viewports.size())
-        || init_pair_result.view_2_id >= static_cast<int>(viewports.size()))
-    {
-        std::cerr << "Error finding initial pair, exiting!" << std::endl;
-        std::cerr << "Try manually specifying an initial pair." << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-
-    std::cout << "Using views " << init_pair_result.view_1_id
-        << " and " << init_pair_result.view_2_id
-        << " as initial pair." << std::endl;
+    prebundle.reset();
 
     /* Incrementally compute full bundle. */
     sfm::bundler::Incremental::Options incremental_opts;
@@ -303,23 +289,109 @@ sfm_reconstruct (AppSettings const& conf)
     //incremental_opts.ba_shared_intrinsics = conf.shared_intrinsics;
     incremental_opts.verbose_output = true;
     incremental_opts.verbose_ba = conf.verbose_ba;
+    incremental_opts.ba_implicit_schur = conf.implicit_schur;
 
-    /* Initialize viewports with initial pair. */
-    viewports[init_pair_result.view_1_id].pose = init_pair_result.view_1_pose;
-    viewports[init_pair_result.view_2_id].pose = init_pair_result.view_2_pose;
+    /*
+     * Search for a good initial pair, or use the user-specified one.
+     * A searched pair is rejected if no further view can be added to it,
+     * and the search is repeated. The initial pair module keeps its
+     * evaluations, thus only pairs not evaluated before are computed.
+     */
+    sfm::bundler::InitialPair::Options init_pair_opts;
+    //init_pair_opts.homography_opts.max_iterations = 1000;
+    //init_pair_opts.homography_opts.threshold = 0.005f;
+    init_pair_opts.homography_opts.verbose_output = false;
+    init_pair_opts.max_homography_inliers = 0.8f;
+    init_pair_opts.verbose_output = true;
+    sfm::bundler::InitialPair init_pair(init_pair_opts);
+    init_pair.initialize(viewports, tracks);
+
+    /* Backup of tracks and track references, modified by each attempt. */
+    bool const search_init_pair
+        = conf.initial_pair_1 < 0 || conf.initial_pair_2 < 0;
+    sfm::bundler::TrackList tracks_backup;
+    std::vector<std::vector<int> > track_ids_backup;
+    if (search_init_pair)
+    {
+        tracks_backup = tracks;
+        track_ids_backup.resize(viewports.size());
+        for (std::size_t i = 0; i < viewports.size(); ++i)
+            track_ids_backup[i] = viewports[i].track_ids;
+    }
 
-    /* Initialize the incremental bundler and reconstruct first tracks. */
+    int const max_init_pair_attempts = 5;
     sfm::bundler::Incremental incremental(incremental_opts);
-    incremental.initialize(&viewports, &tracks, &survey);
-    incremental.triangulate_new_tracks(2);
-    incremental.invalidate_large_error_tracks();
+    for (int attempt = 1; true; ++attempt)
+    {
+        sfm::bundler::InitialPair::Result init_pair_result;
+        if (search_init_pair)
+            init_pair.compute_pair(&init_pair_result);
+        else
+        {
+            std::cout << "Reconstructing initial pair..." << std::endl;
+            init_pair.compute_pair(conf.initial_pair_1, conf.initial_pair_2,
+                &init_pair_result);
+        }
 
-    /* Run bundle adjustment. */
-    std::cout << "Running full bundle adjustment..." << std::endl;
-    incremental.bundle_adjustment_full();
+        if (init_pair_result.view_1_id < 0 || init_pair_result.view_2_id < 0
+            || init_pair_result.view_1_id >= static_cast<int>(viewports.size())
+            || init_pair_result.view_2_id >= static_cast<int>(viewports.size()))
+        {
+            std::cerr << "Error finding initial pair, exiting!" << std::endl;
+            std::cerr << "Try manually specifying an initial pair."
+                << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::cout << "Using views " << init_pair_result.view_1_id
+            << " and " << init_pair_result.view_2_id
+            << " as initial pair." << std::endl;
+
+        /* Initialize viewports with initial pair. */
+        viewports[init_pair_result.view_1_id].pose
+            = init_pair_result.view_1_pose;
+        viewports[init_pair_result.view_2_id].pose
+            = init_pair_result.view_2_pose;
+
+        /* Initialize the incremental bundler and reconstruct first tracks. */
+        incremental.initialize(&viewports, &tracks, &survey);
+        incremental.triangulate_new_tracks(2);
+        incremental.invalidate_large_error_tracks();
+
+        /* Run bundle adjustment. */
+        std::cout << "Running full bundle adjustment..." << std::endl;
+        incremental.bundle_adjustment_full();
+
+        /* Keep the pair if the reconstruction can be continued. */
+        if (!search_init_pair || attempt == max_init_pair_attempts
+            || viewports.size() <= 2)
+            break;
+        std::vector<int> next_views;
+        incremental.find_next_views(&next_views);
+        if (!next_views.empty())
+            break;
+
+        /* Reject the pair and restore the state before the attempt. */
+        std::cout << "No valid next view for initial pair, "
+            << "trying another pair..." << std::endl;
+        init_pair.reject_pair(init_pair_result.view_1_id,
+            init_pair_result.view_2_id);
+        tracks = tracks_backup;
+        for (std::size_t i = 0; i < viewports.size(); ++i)
+        {
+            sfm::bundler::Viewport& view = viewports[i];
+            view.pose = sfm::CameraPose();
+            std::fill(view.radial_distortion, view.radial_distortion + 2, 0.0f);
+            view.track_ids = track_ids_backup[i];
+            view.backup_tracks.clear();
+        }
+    }
+    tracks_backup.clear();
+    track_ids_backup.clear();
 
     /* Reconstruct remaining views. */
     int num_cameras_reconstructed = 2;
+    int num_cameras_full_ba = 2;
     int full_ba_num_skipped = 0;
     while (true)
     {
@@ -327,22 +399,25 @@ sfm_reconstruct (AppSettings const& conf)
         std::vector<int> next_views;
         incremental.find_next_views(&next_views);
 
-        /* Reconstruct the next view. */
-        int next_view_id = -1;
-        for (std::size_t i = 0; i < next_views.size(); ++i)
+        /* Reconstruct the next views, a batch of views at a time. */
+        std::vector<int> new_views;
+        std::size_t const batch_size = std::max(1, conf.next_views_batch);
+        for (std::size_t i = 0; new_views.empty() && i < next_views.size();
+            i += batch_size)
         {
+            std::vector<int> batch(next_views.begin() + i, next_views.begin()
+                + std::min(i + batch_size, next_views.size()));
             std::cout << std::endl;
-            std::cout << "Adding next view ID " << next_views[i]
-                << " (" << (num_cameras_reconstructed + 1) << " of "
+            std::cout << "Adding next view ID"
+                << (batch.size() > 1 ? "s" : "");
+            for (std::size_t j = 0; j < batch.size(); ++j)
+                std::cout << " " << batch[j];
+            std::cout << " (" << (num_cameras_reconstructed + 1) << " of "
                 << viewports.size() << ")..." << std::endl;
-            if (incremental.reconstruct_next_view(next_views[i]))
-            {
-                next_view_id = next_views[i];
-                break;
-            }
+            incremental.reconstruct_next_views(batch, &new_views);
         }
 
-        if (next_view_id < 0)
+        if (new_views.empty())
         {
             if (full_ba_num_skipped == 0)
             {
@@ -356,6 +431,7 @@ sfm_reconstruct (AppSettings const& conf)
                 std::cout << "Running full bundle adjustment..." << std::endl;
                 incremental.bundle_adjustment_full();
                 incremental.invalidate_large_error_tracks();
+                num_cameras_full_ba = num_cameras_reconstructed;
                 full_ba_num_skipped = 0;
                 continue;
             }
@@ -363,17 +439,31 @@ sfm_reconstruct (AppSettings const& conf)
 
         /* Run single-camera bundle adjustment. */
         std::cout << "Running single camera bundle adjustment..." << std::endl;
-        incremental.bundle_adjustment_single_cam(next_view_id);
-        num_cameras_reconstructed += 1;
+        for (std::size_t i = 0; i < new_views.size(); ++i)
+            incremental.bundle_adjustment_single_cam(new_views[i]);
+        num_cameras_reconstructed += new_views.size();
+
+        /* Run local bundle adjustment until the cameras grew by 25%. */
+        bool const use_local_ba = conf.local_ba && !conf.always_full_ba;
+        if (use_local_ba
+            && num_cameras_reconstructed * 4 < num_cameras_full_ba * 5)
+        {
+            incremental.triangulate_new_tracks(conf.min_views_per_track);
+            std::cout << "Running local bundle adjustment..." << std::endl;
+            incremental.bundle_adjustment_local(new_views);
+            incremental.invalidate_large_error_tracks();
+            full_ba_num_skipped += new_views.size();
+            continue;
+        }
 
         /* Run full bundle adjustment only after a couple of views. */
-        int const full_ba_skip_views = conf.always_full_ba ? 0
-            : std::min(100, num_cameras_reconstructed / 10);
+        int const full_ba_skip_views = conf.always_full_ba || use_local_ba
+            ? 0 : std::min(100, num_cameras_reconstructed / 10);
         if (full_ba_num_skipped < full_ba_skip_views)
         {
             std::cout << "Skipping full bundle adjustment (skipping "
                 << full_ba_skip_views << " views)." << std::endl;
-            full_ba_num_skipped += 1;
+            full_ba_num_skipped += new_views.size();
         }
         else
         {
@@ -382,6 +472,7 @@ sfm_reconstruct (AppSettings const& conf)
             std::cout << "Running full bundle adjustment..." << std::endl;
             incremental.bundle_adjustment_full();
             incremental.invalidate_large_error_tracks();
+            num_cameras_full_ba = num_cameras_reconstructed;
             full_ba_num_skipped = 0;
         }
     }
@@ -493,12 +584,15 @@ main (int argc, char** argv)
     args.add_option('m', "max-pixels", true, "Limit image size by iterative half-sizing [6000000]");
     args.add_option('u', "undistorted", true, "Undistorted image embedding [undistorted]");
     args.add_option('\0', "prebundle", true, "Load/store pre-bundle file [prebundle.sfm]");
+    args.add_option('\0', "feature-cache", true, "Load/store features in view BLOB ARG []");
     args.add_option('\0', "survey", true, "Load survey from file []");
     args.add_option('\0', "log-file", true, "Log some timings to file []");
     args.add_option('\0', "no-prediction", false, "Disable matchability prediction");
     args.add_option('\0', "normalize", false, "Normalize scene after reconstruction");
     args.add_option('\0', "skip-sfm", false, "Compute prebundle, skip SfM reconstruction");
     args.add_option('\0', "always-full-ba", false, "Run full bundle adjustment after every view");
+    args.add_option('\0', "local-ba", false, "Local BA after every view, full BA after 25% growth");
+    args.add_option('\0', "batch-views", true, "Register up to ARG next views concurrently [1]");
     args.add_option('\0', "video-matching", true, "Only match to ARG previous frames [0]");
     args.add_option('\0', "fixed-intrinsics", false, "Do not optimize camera intrinsics");
     //args.add_option('\0', "shared-intrinsics", false, "Share intrinsics between all cameras");
@@ -508,7 +602,12 @@ main (int argc, char** argv)
     args.add_option('\0', "use-2cam-tracks", false, "Triangulate tracks from only two cameras");
     args.add_option('\0', "initial-pair", true, "Manually specify initial pair IDs [-1,-1]");
     args.add_option('\0', "cascade-hashing", false, "Use cascade hashing for matching [false]");
+    args.add_option('\0', "kdtree-matching", false, "Use randomized kd-trees for matching [false]");
+    args.add_option('\0', "kdtree-checks", true, "Descriptors checked per kd-tree query [128]");
+    args.add_option('\0', "retrieval", true, "Only match to ARG retrieved views per view [0]");
     args.add_option('\0', "verbose-ba", false, "Print detailed BA information [false]");
+    args.add_option('\0', "verbose-matching", false, "Print the result of every image pair [false]");
+    args.add_option('\0', "implicit-schur", false, "Matrix-free Schur complement in BA [false]");
     args.parse(argc, argv);
 
     /* Setup defaults. */
@@ -529,6 +628,8 @@ main (int argc, char** argv)
             conf.max_image_size = i->get_arg<int>();
         else if (i->opt->lopt == "prebundle")
             conf.prebundle_file = i->arg;
+        else if (i->opt->lopt == "feature-cache")
+            conf.feature_cache_name = i->arg;
         else if (i->opt->lopt == "survey")
             conf.survey_file = i->arg;
         else if (i->opt->lopt == "log-file")
@@ -541,6 +642,10 @@ main (int argc, char** argv)
             conf.skip_sfm = true;
         else if (i->opt->lopt == "always-full-ba")
             conf.always_full_ba = true;
+        else if (i->opt->lopt == "local-ba")
+            conf.local_ba = true;
+        else if (i->opt->lopt == "batch-views")
+            conf.next_views_batch = i->get_arg<int>();
         else if (i->opt->lopt == "video-matching")
             conf.video_matching = i->get_arg<int>();
         else if (i->opt->lopt == "fixed-intrinsics")
@@ -571,8 +676,18 @@ main (int argc, char** argv)
         }
         else if (i->opt->lopt == "cascade-hashing")
             conf.cascade_hashing = true;
+        else if (i->opt->lopt == "kdtree-matching")
+            conf.kdtree_matching = true;
+        else if (i->opt->lopt == "kdtree-checks")
+            conf.kdtree_checks = i->get_arg<int>();
+        else if (i->opt->lopt == "retrieval")
+            conf.retrieval_candidates = i->get_arg<int>();
         else if (i->opt->lopt == "verbose-ba")
             conf.verbose_ba = true;
+        else if (i->opt->lopt == "verbose-matching")
+            conf.verbose_matching = true;
+        else if (i->opt->lopt == "implicit-schur")
+            conf.implicit_schur = true;
         else
         {
             std::cerr << "Error: Unexpected option: "
@@ -581,6 +696,13 @@ main (int argc, char** argv)
         }
     }
 
+    if (conf.cascade_hashing && conf.kdtree_matching)
+    {
+        std::cerr << "Error: Cascade hashing and kd-tree matching "
+            "cannot be combined." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
     try
     {
         check_prebundle(conf);
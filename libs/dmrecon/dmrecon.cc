@@ -12,6 +12,7 @@
 #include <iomanip>
 #include <stdexcept>
 #include <set>
+#include <algorithm>
 #include <ctime>
 
 #include "math/vector.h"
@@ -75,7 +76,7 @@ DMRecon::DMRecon(mve::Scene::Ptr _scene, Settings const& _settings)
         throw std::invalid_argument("Invalid master view");
 
     /* Prepare reconstruction */
-    refV->loadColorImage(this->settings.scale);
+    refV->loadColorImage(this->settings.scale, this->getLinearBudget());
     refV->prepareMasterView(settings.scale);
     mve::ByteImage::ConstPtr scaled_img = refV->getScaledImg();
     this->width = scaled_img->width();
@@ -237,7 +238,7 @@ DMRecon::globalViewSelection()
         std::cout << "Loading color images..." << std::endl;
     for (IndexSet::const_iterator iter = neighViews.begin();
         iter != neighViews.end() && !progress.cancelled; ++iter)
-        views[*iter]->loadColorImage(0);
+        views[*iter]->loadColorImage(0, this->getLinearBudget());
 }
 
 void
@@ -253,6 +254,7 @@ DMRecon::processFeatures()
         std::cout << "Processing " << features.size()
             << " features..." << std::endl;
 
+    PatchOptimization patch(views, settings, neighViews);
     std::size_t success = 0;
     std::size_t processed = 0;
     for (std::size_t i = 0; i < features.size() && !progress.cancelled; ++i)
@@ -290,8 +292,7 @@ DMRecon::processFeatures()
         int const x = math::round(pixPosF[0]);
         int const y = math::round(pixPosF[1]);
         float initDepth = (featPos - refV->camPos).norm();
-        PatchOptimization patch(views, settings, x, y, initDepth,
-            0.f, 0.f, neighViews, IndexSet());
+        patch.reset(x, y, initDepth, 0.f, 0.f, IndexSet());
         patch.doAutoOptimization();
         float conf = patch.computeConfidence();
         if (conf <= 0.0f)
@@ -350,6 +351,16 @@ DMRecon::processQueue()
                   << std::endl;
     lastStatus = progress.filled;
 
+    std::size_t const batchSize = std::max(1u, settings.growingBatchSize);
+    std::vector<QueueData> batch, results;
+    std::vector<math::Vec3f> normals;
+    std::vector<char> valid;
+    batch.reserve(batchSize);
+
+    /* Every batch slot reuses its own optimization for all its pixels. */
+    std::vector<PatchOptimization::Ptr> patches(batchSize);
+    for (std::size_t i = 0; i < batchSize; ++i)
+        patches[i] = PatchOptimization::create(views, settings, neighViews);
     while (!prQueue.empty() && !progress.cancelled)
     {
         progress.queueSize = prQueue.size();
@@ -362,73 +373,93 @@ DMRecon::processQueue()
                           << std::endl;
             lastStatus = progress.filled;
         }
-        QueueData tmpData = prQueue.top();
-        prQueue.pop();
-        ++count;
-        float x = tmpData.x;
-        float y = tmpData.y;
-        int index = y * this->width + x;
-        if (refV->confImg->at(index) > tmpData.confidence) {
-            continue ;
-        }
-        PatchOptimization patch(views, settings, x, y, tmpData.depth,
-            tmpData.dz_i, tmpData.dz_j, neighViews, tmpData.localViewIDs);
-        patch.doAutoOptimization();
-        tmpData.confidence = patch.computeConfidence();
-        if (tmpData.confidence == 0) {
-            continue;
+        /* Pop a batch of entries that are not outdated. */
+        batch.clear();
+        while (batch.size() < batchSize && !prQueue.empty())
+        {
+            QueueData const& top = prQueue.top();
+            int index = top.y * this->width + top.x;
+            if (refV->confImg->at(index) <= top.confidence)
+                batch.push_back(top);
+            prQueue.pop();
+            ++count;
         }
 
-        float new_depth = patch.getDepth();
-        tmpData.depth = new_depth;
-        tmpData.dz_i = patch.getDzI();
-        tmpData.dz_j = patch.getDzJ();
-        math::Vec3f normal = patch.getNormal();
-        tmpData.localViewIDs = patch.getLocalViewIDs();
-        if (refV->confImg->at(index) <= 0) {
-            ++progress.filled;
+        /* Optimize the batch concurrently, accept results in pop order. */
+        results = batch;
+        normals.resize(batch.size());
+        valid.resize(batch.size());
+#pragma omp parallel for schedule(dynamic, 1) if (batch.size() > 1)
+        for (std::size_t i = 0; i < batch.size(); ++i)
+            valid[i] = this->optimizeQueueData(&results[i], &normals[i],
+                patches[i]);
+
+        for (std::size_t i = 0; i < batch.size(); ++i)
+        {
+            /*
+             * An earlier entry of the same batch may have improved this
+             * pixel, in which case the serial loop would have skipped it.
+             */
+            int index = batch[i].y * this->width + batch[i].x;
+            if (refV->confImg->at(index) > batch[i].confidence)
+                continue;
+            if (valid[i])
+                this->commitQueueData(results[i], normals[i]);
         }
-        if (refV->confImg->at(index) < tmpData.confidence) {
-            refV->depthImg->at(index) = tmpData.depth;
-            refV->normalImg->at(index, 0) = normal[0];
-            refV->normalImg->at(index, 1) = normal[1];
-            refV->normalImg->at(index, 2) = normal[2];
-            refV->dzImg->at(index, 0) = tmpData.dz_i;
-            refV->dzImg->at(index, 1) = tmpData.dz_j;
-            refV->confImg->at(index) = tmpData.confidence;
-
-            // left
-            tmpData.x = x - 1; tmpData.y = y;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f)
-            {
-                prQueue.push(tmpData);
-            }
-            // right
-            tmpData.x = x + 1; tmpData.y = y;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f)
-            {
-                prQueue.push(tmpData);
-            }
-            // top
-            tmpData.x = x; tmpData.y = y - 1;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f)
-            {
-                prQueue.push(tmpData);
-            }
-            // bottom
-            tmpData.x = x; tmpData.y = y + 1;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f)
-            {
-                prQueue.push(tmpData);
-            }
+    }
+}
+
+bool
+DMRecon::optimizeQueueData(QueueData* data, math::Vec3f* normal,
+    PatchOptimization::Ptr patch) const
+{
+    patch->reset(data->x, data->y, data->depth, data->dz_i, data->dz_j,
+        data->localViewIDs);
+    patch->doAutoOptimization();
+    data->confidence = patch->computeConfidence();
+    if (data->confidence == 0)
+        return false;
+
+    data->depth = patch->getDepth();
+    data->dz_i = patch->getDzI();
+    data->dz_j = patch->getDzJ();
+    data->localViewIDs = patch->getLocalViewIDs();
+    *normal = patch->getNormal();
+    return true;
+}
+
+void
+DMRecon::commitQueueData(QueueData data, math::Vec3f const& normal)
+{
+    SingleView::Ptr refV = this->views[settings.refViewNr];
+    int const x = data.x;
+    int const y = data.y;
+    int index = y * this->width + x;
+    if (refV->confImg->at(index) <= 0) {
+        ++progress.filled;
+    }
+    if (refV->confImg->at(index) >= data.confidence)
+        return;
+
+    refV->depthImg->at(index) = data.depth;
+    refV->normalImg->at(index, 0) = normal[0];
+    refV->normalImg->at(index, 1) = normal[1];
+    refV->normalImg->at(index, 2) = normal[2];
+    refV->dzImg->at(index, 0) = data.dz_i;
+    refV->dzImg->at(index, 1) = data.dz_j;
+    refV->confImg->at(index) = data.confidence;
+
+    /* Push the left, right, top and bottom neighbors. */
+    int const offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    for (int i = 0; i < 4; ++i)
+    {
+        data.x = x + offsets[i][0];
+        data.y = y + offsets[i][1];
+        index = data.y * this->width + data.x;
+        if (refV->confImg->at(index) < data.confidence - 0.05f ||
+            refV->confImg->at(index) == 0.f)
+        {
+            prQueue.push(data);
         }
     }
 }
@@ -64,7 +64,11 @@ private:
     void globalViewSelection();
     void processFeatures();
     void processQueue();
+    bool optimizeQueueData(QueueData* data, math::Vec3f* normal,
+        PatchOptimization::Ptr patch) const;
+    void commitQueueData(QueueData data, math::Vec3f const& normal);
     void refillQueueFromLowRes();
+    std::size_t getLinearBudget() const;
 };
 
 /* ------------------------- Implementation ----------------------- */
@@ -93,6 +97,14 @@ DMRecon::getRefViewNr() const
     return settings.refViewNr;
 }
 
+inline std::size_t
+DMRecon::getLinearBudget() const
+{
+    if (!settings.useLinearPyramids)
+        return 0;
+    return settings.linearPyramidBudget << 20;
+}
+
 MVS_NAMESPACE_END
 
 #endif
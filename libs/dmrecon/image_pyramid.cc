@@ -8,9 +8,14 @@
  */
 
 #include "dmrecon/image_pyramid.h"
+#include "dmrecon/mvs_tools.h"
 
 #include "mve/image_tools.h"
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <list>
+#include <tuple>
 
 MVS_NAMESPACE_BEGIN
 
@@ -18,6 +23,51 @@ namespace
 {
     int const MIN_IMAGE_DIM = 30;
 
+    /** Total size of all linearized levels that are still referenced. */
+    std::atomic<std::size_t> linearBytes(0);
+    /** Total size of all cached pyramids over all shards. */
+    std::atomic<std::size_t> cachedBytes(0);
+    /** Counter to order the entries of all shards by their last use. */
+    std::atomic<std::uint64_t> useCounter(0);
+    /** Serializes eviction, which visits all shards. */
+    std::mutex evictMutex;
+
+    /*
+     * Creates the linearized copy of a level if it fits the budget. The
+     * budget is reserved before the copy is created, and the copy releases
+     * its share of the budget when it is destroyed.
+     */
+    void
+    linearizeLevel(ImagePyramidLevel& level, std::size_t linearBudget)
+    {
+        std::size_t const bytes = sizeof(float)
+            * level.image->get_value_amount();
+        std::size_t current = linearBytes;
+        do
+        {
+            if (current + bytes > linearBudget)
+                return;
+        }
+        while (!linearBytes.compare_exchange_weak(current, current + bytes));
+
+        mve::FloatImage::Ptr linear;
+        try
+        {
+            linear = linearColorImage(*level.image);
+        }
+        catch (...)
+        {
+            linearBytes -= bytes;
+            throw;
+        }
+        level.linear = mve::FloatImage::ConstPtr(linear.get(),
+            [linear, bytes] (mve::FloatImage const*) mutable
+            {
+                linear.reset();
+                linearBytes -= bytes;
+            });
+    }
+
     ImagePyramid::Ptr
     buildPyramid(mve::View::Ptr view, std::string embeddingName)
     {
@@ -54,7 +104,7 @@ namespace
 
     void
     ensureImages(ImagePyramid& levels, mve::View::Ptr view,
-        std::string embeddingName, int minLevel)
+        std::string embeddingName, int minLevel, std::size_t linearBudget)
     {
         if (levels[minLevel].image != nullptr)
             return;
@@ -88,75 +138,239 @@ namespace
             }
 
             if (minLevel <= i)
+            {
                 levels[i].image = img;
+                if (linearBudget > 0)
+                    linearizeLevel(levels[i], linearBudget);
+            }
         }
 
         view->cache_cleanup();
     }
 }
 
+/*
+ * A cached pyramid. The entry mutex serializes loading of the pyramid
+ * images, so concurrent requests for the same pyramid wait for a single
+ * load while requests for other pyramids proceed.
+ */
+struct ImagePyramidCache::Entry
+{
+    std::mutex loadMutex;
+    std::weak_ptr<mve::Scene> scene;
+    std::weak_ptr<mve::View> view;
+    ImagePyramid::Ptr pyramid;
+
+    /* The fields below are protected by the shard mutex. */
+    std::size_t bytes = 0;
+    /** Number of get() calls using the entry, pinned entries stay cached. */
+    std::size_t pins = 0;
+    /** Value of the use counter at the last get() call. */
+    std::uint64_t lastUse = 0;
+    bool cached = true;
+
+    bool evictable() const;
+};
+
+inline bool
+ImagePyramidCache::Entry::evictable() const
+{
+    return this->pins == 0
+        && (this->pyramid == nullptr || this->pyramid.use_count() == 1);
+}
+
+struct ImagePyramidCache::Shard
+{
+    typedef std::tuple<mve::Scene const*, std::size_t, std::string> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<Entry>>> EntryList;
+
+    std::mutex mutex;
+    /** Entries in least recently used order, most recent first. */
+    EntryList entries;
+    std::map<Key, EntryList::iterator> lookup;
+};
+
 ImagePyramid::ConstPtr
 ImagePyramidCache::get(mve::Scene::Ptr scene, mve::View::Ptr view,
-    std::string embeddingName, int minLevel)
+    std::string embeddingName, int minLevel, std::size_t linearBudget)
 {
-    std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
+    Shard::Key const key(scene.get(), view->get_id(), embeddingName);
+    std::size_t const hash = std::hash<std::string>()(embeddingName)
+        ^ std::hash<mve::Scene const*>()(scene.get())
+        ^ (std::hash<std::size_t>()(view->get_id()) << 1);
+    Shard& shard = ImagePyramidCache::shards[hash % NUM_SHARDS];
 
-    /* Initialize on first access. */
-    if (ImagePyramidCache::cachedScene == nullptr)
+    /*
+     * Find the entry, mark it as most recently used and pin it, so that
+     * it is not evicted while its pyramid is loaded.
+     */
+    std::shared_ptr<Entry> entry;
     {
-        ImagePyramidCache::cachedScene = scene;
-        ImagePyramidCache::cachedEmbedding = embeddingName;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = shard.lookup.find(key);
+        if (iter != shard.lookup.end()
+            && iter->second->second->scene.lock() != scene)
+        {
+            /* The scene pointer has been reused by another scene. */
+            cachedBytes -= iter->second->second->bytes;
+            iter->second->second->cached = false;
+            shard.entries.erase(iter->second);
+            shard.lookup.erase(iter);
+            iter = shard.lookup.end();
+        }
+
+        if (iter == shard.lookup.end())
+        {
+            entry = std::make_shared<Entry>();
+            entry->scene = scene;
+            entry->view = view;
+            shard.entries.emplace_front(key, entry);
+            shard.lookup[key] = shard.entries.begin();
+        }
+        else
+        {
+            shard.entries.splice(shard.entries.begin(), shard.entries,
+                iter->second);
+            entry = iter->second->second;
+        }
+        entry->pins += 1;
+        entry->lastUse = ++useCounter;
     }
 
+    /* Load missing pyramid levels. */
     ImagePyramid::Ptr pyramid;
+    std::size_t bytes = 0;
+    try
+    {
+        std::lock_guard<std::mutex> lock(entry->loadMutex);
+        if (entry->pyramid == nullptr)
+            entry->pyramid = buildPyramid(view, embeddingName);
+        ensureImages(*entry->pyramid, view, embeddingName, minLevel,
+            linearBudget);
+        pyramid = entry->pyramid;
 
-    if (scene != ImagePyramidCache::cachedScene
-        || embeddingName != ImagePyramidCache::cachedEmbedding)
+        for (std::size_t i = 0; i < pyramid->size(); ++i)
+        {
+            ImagePyramidLevel const& level = pyramid->at(i);
+            if (level.image != nullptr)
+                bytes += level.image->get_byte_size();
+            if (level.linear != nullptr)
+                bytes += level.linear->get_byte_size();
+        }
+    }
+    catch (...)
     {
-        /* create own pyramid because shared pyramid is incompatible. */
-        pyramid = buildPyramid(view, embeddingName);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        entry->pins -= 1;
+        throw;
     }
-    else
+
+    /* Update the memory usage and release the pin. */
     {
-        /* Either re-recreate or use cached entry. */
-        pyramid = ImagePyramidCache::entries[view->get_id()];
-        if (pyramid == nullptr)
-        {
-            pyramid = buildPyramid(view, embeddingName);
-            ImagePyramidCache::entries[view->get_id()] = pyramid;
-        }
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        cachedBytes += bytes;
+        cachedBytes -= entry->bytes;
+        entry->bytes = bytes;
+        entry->pins -= 1;
     }
 
-    ensureImages(*pyramid, view, embeddingName, minLevel);
+    /* Keep the cache within its budget. */
+    std::size_t const budget = ImagePyramidCache::memoryBudget;
+    if (budget > 0 && cachedBytes > budget)
+        ImagePyramidCache::evict(budget);
+
     return pyramid;
 }
 
 void
-ImagePyramidCache::cleanup()
+ImagePyramidCache::evict(std::size_t budget)
 {
-    std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
-
-    if (ImagePyramidCache::cachedScene == nullptr)
-        return;
-
-    for (std::map<int, ImagePyramid::Ptr>::iterator it = ImagePyramidCache::entries.begin();
-         it != ImagePyramidCache::entries.end(); ++it)
+    std::lock_guard<std::mutex> evictLock(evictMutex);
+    while (cachedBytes > budget)
     {
-        if (it->second == nullptr)
-            continue;
+        /*
+         * Find the least recently used unused pyramid over all shards.
+         * Within a shard, it is the last unused entry of the list.
+         */
+        std::size_t shardID = NUM_SHARDS;
+        std::shared_ptr<Entry> oldest;
+        std::uint64_t oldestUse = 0;
+        Shard::Key key;
+        for (std::size_t i = 0; i < NUM_SHARDS; ++i)
+        {
+            Shard& shard = ImagePyramidCache::shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto iter = shard.entries.rbegin();
+                iter != shard.entries.rend(); ++iter)
+            {
+                if (!iter->second->evictable())
+                    continue;
+                if (oldest == nullptr || iter->second->lastUse < oldestUse)
+                {
+                    shardID = i;
+                    oldest = iter->second;
+                    oldestUse = oldest->lastUse;
+                    key = iter->first;
+                }
+                break;
+            }
+        }
+        if (oldest == nullptr)
+            break;
 
-        if (it->second.use_count() == 1)
+        /* Remove the entry unless it has been used meanwhile. */
+        ImagePyramid::Ptr pyramid;
         {
-            it->second.reset();
-            ImagePyramidCache::cachedScene->get_view_by_id(it->first)->cache_cleanup();
+            Shard& shard = ImagePyramidCache::shards[shardID];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!oldest->cached || oldest->lastUse != oldestUse
+                || !oldest->evictable())
+                continue;
+
+            pyramid.swap(oldest->pyramid);
+            cachedBytes -= oldest->bytes;
+            oldest->bytes = 0;
+            oldest->cached = false;
+            auto iter = shard.lookup.find(key);
+            shard.entries.erase(iter->second);
+            shard.lookup.erase(iter);
         }
+
+        /* Release the images outside of the shard lock. */
+        pyramid.reset();
+        mve::View::Ptr view = oldest->view.lock();
+        if (view != nullptr)
+            view->cache_cleanup();
     }
 }
 
+void
+ImagePyramidCache::cleanup()
+{
+    ImagePyramidCache::evict(ImagePyramidCache::memoryBudget);
+}
+
+void
+ImagePyramidCache::setMemoryBudget(std::size_t bytes)
+{
+    ImagePyramidCache::memoryBudget = bytes;
+    ImagePyramidCache::cleanup();
+}
+
+std::size_t
+ImagePyramidCache::getMemoryUsage()
+{
+    return cachedBytes;
+}
+
+std::size_t
+ImagePyramidCache::getLinearBytes()
+{
+    return linearBytes;
+}
+
 /* static fields of ImgPyramidCache: */
-std::mutex ImagePyramidCache::metadataMutex;
-mve::Scene::Ptr ImagePyramidCache::cachedScene;
-std::string ImagePyramidCache::cachedEmbedding = "";
-std::map<int, ImagePyramid::Ptr> ImagePyramidCache::entries;
+ImagePyramidCache::Shard ImagePyramidCache::shards[ImagePyramidCache::NUM_SHARDS];
+std::atomic<std::size_t> ImagePyramidCache::memoryBudget(0);
 
 MVS_NAMESPACE_END
@@ -10,6 +10,7 @@
 #ifndef DMRECON_IMAGE_PYRAMID_H
 #define DMRECON_IMAGE_PYRAMID_H
 
+#include <atomic>
 #include <vector>
 #include <memory>
 #include <map>
@@ -17,6 +18,7 @@
 
 #include "mve/scene.h"
 #include "mve/view.h"
+#include "mve/image.h"
 #include "mve/image_base.h"
 
 #include "mve/camera.h"
@@ -29,6 +31,8 @@ struct ImagePyramidLevel
 {
     int width, height;
     mve::ByteImage::ConstPtr image;
+    /** Optional linearized copy of the image, see ImagePyramidCache. */
+    mve::FloatImage::ConstPtr linear;
     math::Matrix3f proj;
     math::Matrix3f invproj;
 
@@ -65,19 +69,42 @@ public:
     typedef std::shared_ptr<ImagePyramid const> ConstPtr;
 };
 
+/**
+  * Shares image pyramids between views, keyed by scene, view ID and
+  * embedding. Entries are spread over independently locked shards, and
+  * concurrent requests for the same pyramid wait for a single load.
+  * Pyramids that are no longer used are kept while the total size of all
+  * shards fits the memory budget, and are released least recently used
+  * first. A budget of zero releases them in cleanup() as soon as the last
+  * user is gone.
+  *
+  * If a linear budget in bytes is given, newly loaded levels also get
+  * a linearized float copy as long as the total size of all linearized
+  * levels fits that budget.
+  */
 class ImagePyramidCache
 {
 public:
     static ImagePyramid::ConstPtr get(mve::Scene::Ptr scene,
-        mve::View::Ptr view, std::string embeddingName, int minLevel);
+        mve::View::Ptr view, std::string embeddingName, int minLevel,
+        std::size_t linearBudget = 0);
     static void cleanup();
+    /** Sets the memory budget for unused pyramids in bytes. */
+    static void setMemoryBudget(std::size_t bytes);
+    /** Returns the memory currently held by cached pyramids. */
+    static std::size_t getMemoryUsage();
+    /** Returns the memory currently used by linearized levels. */
+    static std::size_t getLinearBytes();
 
 private:
-    static std::mutex metadataMutex;
-    static mve::Scene::Ptr cachedScene;
-    static std::string cachedEmbedding;
+    struct Entry;
+    struct Shard;
+
+    static std::size_t const NUM_SHARDS = 16;
+    static Shard shards[NUM_SHARDS];
+    static std::atomic<std::size_t> memoryBudget;
 
-    static std::map<int, ImagePyramid::Ptr> entries;
+    static void evict(std::size_t budget);
 };
 
 MVS_NAMESPACE_END
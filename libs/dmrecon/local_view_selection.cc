@@ -22,14 +22,39 @@ LocalViewSelection::LocalViewSelection(
     IndexSet const& globalViewIDs,
     IndexSet const& propagated,
     PatchSampler::Ptr sampler)
+    : LocalViewSelection(views, settings, globalViewIDs, sampler)
+{
+    this->reset(propagated);
+}
+
+LocalViewSelection::LocalViewSelection(
+    std::vector<SingleView::Ptr> const& views,
+    Settings const& settings,
+    IndexSet const& globalViewIDs,
+    PatchSampler::Ptr sampler)
     :
     ViewSelection(settings),
     success(false),
     views(views),
-    sampler(sampler)
+    sampler(sampler),
+    globalAvailable(views.size(), false),
+    viewDir(views.size()),
+    epipolarPlane(views.size()),
+    ncc(views.size(), 0.f)
+{
+    IndexSet::const_iterator id;
+    for (id = globalViewIDs.begin(); id != globalViewIDs.end(); ++id) {
+        globalAvailable[*id] = true;
+    }
+}
+
+void
+LocalViewSelection::reset(IndexSet const& propagated)
 {
     // inherited attribute
     this->selected = propagated;
+    this->available = globalAvailable;
+    success = false;
 
     if (!sampler->success[settings.refViewNr]) {
         return;
@@ -41,12 +66,6 @@ LocalViewSelection::LocalViewSelection(
         selected.clear();
     }
 
-    available.clear();
-    available.resize(views.size(), false);
-    IndexSet::const_iterator id;
-    for (id = globalViewIDs.begin(); id != globalViewIDs.end(); ++id) {
-        available[*id] = true;
-    }
     IndexSet::const_iterator sel;
     for (sel = selected.begin(); sel != selected.end(); ++sel) {
         available[*sel] = false;
@@ -66,9 +85,6 @@ LocalViewSelection::performVS()
     // pixel print in reference view
     float mfp = refV->footPrintScaled(p);
     math::Vec3f refDir = (p - refV->camPos).normalized();
-    std::map<std::size_t, math::Vec3f> viewDir;
-    std::map<std::size_t, math::Vec3f> epipolarPlane; // plane normal
-    std::map<std::size_t, float> ncc;
 
     for (std::size_t i = 0; i < views.size(); ++i) {
         if (!available[i])
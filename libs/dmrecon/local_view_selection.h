@@ -25,6 +25,19 @@ public:
         IndexSet const& globalViews,
         IndexSet const& propagated,
         PatchSampler::Ptr sampler);
+
+    /**
+     * Constructs the selection without propagated views. It must be
+     * initialized with reset() for the current patch of the sampler.
+     */
+    LocalViewSelection(
+        std::vector<SingleView::Ptr> const& views,
+        Settings const& settings,
+        IndexSet const& globalViews,
+        PatchSampler::Ptr sampler);
+
+    /** Restarts the selection with the given propagated views. */
+    void reset(IndexSet const& propagated);
     void performVS();
     void replaceViews(IndexSet const& toBeReplaced);
 
@@ -33,6 +46,14 @@ public:
 private:
     std::vector<SingleView::Ptr> const& views;
     PatchSampler::Ptr sampler;
+
+    /** views available from the global view selection */
+    std::vector<bool> globalAvailable;
+
+    /** scratch buffers for performVS(), indexed by view ID */
+    std::vector<math::Vec3f> viewDir;
+    std::vector<math::Vec3f> epipolarPlane; // plane normal
+    std::vector<float> ncc;
 };
 
 MVS_NAMESPACE_END
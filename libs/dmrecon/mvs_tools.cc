@@ -8,6 +8,8 @@
  */
 
 #include <cassert>
+#include <cmath>
+#include <stdexcept>
 #include <string>
 
 #include "mve/image_tools.h"
@@ -92,56 +94,126 @@ namespace
         0.938685715f, 0.947306514f, 0.955973327f, 0.964686275f,
         0.973445296f, 0.982250571f, 0.991102099f, 1.0f };
 
+    /* Linear color of a pixel value, bytes are sRGB encoded. */
+    inline float
+    toLinear(unsigned char value)
+    {
+        return srgb2lin[value];
+    }
+
+    inline float
+    toLinear(float value)
+    {
+        return value;
+    }
+
+    template <typename T>
+    void
+    colAndExactDerivImpl(mve::Image<T> const& img, PixelCoords const& imgPos,
+        PixelCoords const& gradDir, Samples& color, Samples& deriv)
+    {
+        int const width = img.width();
+        int const height = img.height();
+        for (std::size_t i = 0; i < imgPos.size(); ++i)
+        {
+            int const left = std::floor(imgPos[i][0]);
+            int const top = std::floor(imgPos[i][1]);
+            if (left < 0 || left > width-1 || top < 0 || top > height-1)
+                throw std::runtime_error("Image position out of bounds");
+        }
+
+        /*
+         * Each of the four neighboring pixels is converted once per
+         * channel and shared between color interpolation and derivative.
+         * Samples are processed on flat arrays so the loop can be
+         * vectorized.
+         */
+        std::size_t const num = imgPos.size();
+        T const* data = img.get_data_pointer();
+        float const* pos = *imgPos[0];
+        float const* grad = *gradDir[0];
+        float* col = *color[0];
+        float* der = *deriv[0];
+        int const stride = width * 3;
+#pragma omp simd
+        for (std::size_t i = 0; i < num; ++i)
+        {
+            int const left = std::floor(pos[2 * i]);
+            int const top = std::floor(pos[2 * i + 1]);
+            float const x = pos[2 * i] - left;
+            float const y = pos[2 * i + 1] - top;
+            float const u = grad[2 * i];
+            float const v = grad[2 * i + 1];
+
+            /* data position pointer */
+            int const p0 = (top * width + left) * 3;
+            int const p1 = p0 + stride;
+            for (int c = 0; c < 3; ++c)
+            {
+                float const c00 = toLinear(data[p0 + c]);
+                float const c01 = toLinear(data[p0 + 3 + c]);
+                float const c10 = toLinear(data[p1 + c]);
+                float const c11 = toLinear(data[p1 + 3 + c]);
+
+                /* bilinear interpolation to determine color value */
+                float const x0 = (1.f - x) * c00 + x * c01;
+                float const x1 = (1.f - x) * c10 + x * c11;
+                col[3 * i + c] = (1.f - y) * x0 + y * x1;
+
+                /* derivative in direction gradDir */
+                der[3 * i + c] = u * (c01 - c00) + v * (c10 - c00)
+                    + (v * x + u * y) * (c00 - c01 - c10 + c11);
+            }
+        }
+    }
+
+    template <typename T>
+    void
+    getXYZColorAtPosImpl(mve::Image<T> const& img, PixelCoords const& imgPos,
+        Samples* color)
+    {
+        int const width = img.width();
+        std::size_t const num = imgPos.size();
+        T const* data = img.get_data_pointer();
+        float const* pos = *imgPos[0];
+        float* col = *color->at(0);
+        int const stride = width * 3;
+
+#pragma omp simd
+        for (std::size_t n = 0; n < num; ++n)
+        {
+            int const i = std::floor(pos[2 * n]);
+            int const j = std::floor(pos[2 * n + 1]);
+            assert(i < width-1 && j < img.height()-1);
+
+            float const u = pos[2 * n] - i;
+            float const v = pos[2 * n + 1] - j;
+            int const p0 = (j * width + i) * 3;
+            int const p1 = p0 + stride;
+            for (int c = 0; c < 3; ++c)
+            {
+                float const x0 = (1.f-u) * toLinear(data[p0 + c])
+                    + u * toLinear(data[p0 + 3 + c]);
+                float const x1 = (1.f-u) * toLinear(data[p1 + c])
+                    + u * toLinear(data[p1 + 3 + c]);
+                col[3 * n + c] = (1.f - v) * x0 + v * x1;
+            }
+        }
+    }
 }
 
 void
 colAndExactDeriv(mve::ByteImage const& img, PixelCoords const& imgPos,
     PixelCoords const& gradDir, Samples& color, Samples& deriv)
 {
-    int const width = img.width();
-    int const height = img.height();
-    for (std::size_t i = 0; i < imgPos.size(); ++i)
-    {
-        int const left = std::floor(imgPos[i][0]);
-        int const top = std::floor(imgPos[i][1]);
-        float const x = imgPos[i][0] - left;
-        float const y = imgPos[i][1] - top;
-
-        if (left < 0 || left > width-1 || top < 0 || top > height-1)
-            throw std::runtime_error("Image position out of bounds");
-
-        /* data position pointer */
-        int p0 = (top * width + left) * 3;
-        int p1 = ((top+1) * width + left) * 3;
-
-        /* bilinear interpolation to determine color value */
-        float x0, x1, x2, x3, x4, x5;
-        x0 = (1.f-x) * srgb2lin[img.at(p0  )] + x * srgb2lin[img.at(p0+3)];
-        x1 = (1.f-x) * srgb2lin[img.at(p0+1)] + x * srgb2lin[img.at(p0+4)];
-        x2 = (1.f-x) * srgb2lin[img.at(p0+2)] + x * srgb2lin[img.at(p0+5)];
-        x3 = (1.f-x) * srgb2lin[img.at(p1  )] + x * srgb2lin[img.at(p1+3)];
-        x4 = (1.f-x) * srgb2lin[img.at(p1+1)] + x * srgb2lin[img.at(p1+4)];
-        x5 = (1.f-x) * srgb2lin[img.at(p1+2)] + x * srgb2lin[img.at(p1+5)];
-
-        color[i][0] = (1.f - y) * x0 + y * x3;
-        color[i][1] = (1.f - y) * x1 + y * x4;
-        color[i][2] = (1.f - y) * x2 + y * x5;
-
-        /* derivative in direction gradDir */
-        float u = gradDir[i][0];
-        float v = gradDir[i][1];
-        for (int c = 0; c < 3; ++c)
-        {
-            deriv[i][c] =
-                u * (srgb2lin[img.at(p0+3)] - srgb2lin[img.at(p0)])
-                + v * (srgb2lin[img.at(p1)] - srgb2lin[img.at(p0)])
-                + (v * x + u * y) *
-                    (srgb2lin[img.at(p0)] - srgb2lin[img.at(p0+3)]
-                     - srgb2lin[img.at(p1)] + srgb2lin[img.at(p1+3)]);
-            ++p0;
-            ++p1;
-        }
-    }
+    colAndExactDerivImpl(img, imgPos, gradDir, color, deriv);
+}
+
+void
+colAndExactDeriv(mve::FloatImage const& img, PixelCoords const& imgPos,
+    PixelCoords const& gradDir, Samples& color, Samples& deriv)
+{
+    colAndExactDerivImpl(img, imgPos, gradDir, color, deriv);
 }
 
 /* ------------------------------------------------------------------ */
@@ -169,33 +241,26 @@ void
 getXYZColorAtPos(mve::ByteImage const& img, PixelCoords const& imgPos,
     Samples* color)
 {
-    int width = img.width();
-    int height = img.height();
-    PixelCoords::const_iterator citPos;
-    Samples::iterator itCol = color->begin();
+    getXYZColorAtPosImpl(img, imgPos, color);
+}
 
-    for (citPos = imgPos.begin(); citPos != imgPos.end(); ++citPos, ++itCol)
-    {
-        int const i = floor((*citPos)[0]);
-        int const j = floor((*citPos)[1]);
-        assert(i < width-1 && j < height-1);
-
-        float const u = (*citPos)[0] - i;
-        float const v = (*citPos)[1] - j;
-        int const p0 = (j * width + i) * 3;
-        int const p1 = ((j+1) * width + i) * 3;
-        float x0, x1, x2, x3, x4, x5;
-        x0 = (1.f-u) * srgb2lin[img.at(p0  )] + u * srgb2lin[img.at(p0+3)];
-        x1 = (1.f-u) * srgb2lin[img.at(p0+1)] + u * srgb2lin[img.at(p0+4)];
-        x2 = (1.f-u) * srgb2lin[img.at(p0+2)] + u * srgb2lin[img.at(p0+5)];
-        x3 = (1.f-u) * srgb2lin[img.at(p1  )] + u * srgb2lin[img.at(p1+3)];
-        x4 = (1.f-u) * srgb2lin[img.at(p1+1)] + u * srgb2lin[img.at(p1+4)];
-        x5 = (1.f-u) * srgb2lin[img.at(p1+2)] + u * srgb2lin[img.at(p1+5)];
-
-        (*itCol)[0] = (1.f - v) * x0 + v * x3;
-        (*itCol)[1] = (1.f - v) * x1 + v * x4;
-        (*itCol)[2] = (1.f - v) * x2 + v * x5;
-    }
+void
+getXYZColorAtPos(mve::FloatImage const& img, PixelCoords const& imgPos,
+    Samples* color)
+{
+    getXYZColorAtPosImpl(img, imgPos, color);
+}
+
+/* ------------------------------------------------------------------ */
+
+mve::FloatImage::Ptr
+linearColorImage(mve::ByteImage const& img)
+{
+    mve::FloatImage::Ptr linear = mve::FloatImage::create(img.width(),
+        img.height(), img.channels());
+    for (int64_t i = 0; i < img.get_value_amount(); ++i)
+        linear->at(i) = srgb2lin[img.at(i)];
+    return linear;
 }
 
 MVS_NAMESPACE_END
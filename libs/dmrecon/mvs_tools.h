@@ -25,6 +25,11 @@ void colAndExactDeriv(mve::ByteImage const& img,
     PixelCoords const& imgPos, PixelCoords const& gradDir,
     Samples& color, Samples& deriv);
 
+/** same as above for images that are already linearized */
+void colAndExactDeriv(mve::FloatImage const& img,
+    PixelCoords const& imgPos, PixelCoords const& gradDir,
+    Samples& color, Samples& deriv);
+
 /** get color at given pixel positions (no interpolation) */
 void getXYZColorAtPix(mve::ByteImage const& img,
     std::vector<math::Vec2i> const& imgPos, Samples* color);
@@ -33,6 +38,13 @@ void getXYZColorAtPix(mve::ByteImage const& img,
 void getXYZColorAtPos(mve::ByteImage const& img,
     PixelCoords const& imgPos, Samples* color);
 
+/** same as above for images that are already linearized */
+void getXYZColorAtPos(mve::FloatImage const& img,
+    PixelCoords const& imgPos, Samples* color);
+
+/** convert sRGB colors to linear colors in [0, 1] */
+mve::FloatImage::Ptr linearColorImage(mve::ByteImage const& img);
+
 /** Computes the parallax between two views with respect to some 3D point p */
 float parallax(math::Vec3f p, mvs::SingleView::Ptr v1, mvs::SingleView::Ptr v2);
 
@@ -28,40 +28,63 @@ PatchOptimization::PatchOptimization(
     float _dzJ,
     IndexSet const & _globalViewIDs,
     IndexSet const & _localViewIDs)
+    : PatchOptimization(_views, _settings, _globalViewIDs)
+{
+    reset(_x, _y, _depth, _dzI, _dzJ, _localViewIDs);
+}
+
+PatchOptimization::PatchOptimization(
+    std::vector<SingleView::Ptr> const& _views,
+    Settings const& _settings,
+    IndexSet const & _globalViewIDs)
     :
     views(_views),
     settings(_settings),
-    midx(_x),
-    midy(_y),
-    depth(_depth),
-    dzI(_dzI),
-    dzJ(_dzJ),
-    sampler(PatchSampler::create(views, settings, midx, midy, depth, dzI, dzJ)),
+    midx(0),
+    midy(0),
+    depth(0.f),
+    dzI(0.f),
+    dzJ(0.f),
+    sampler(PatchSampler::create(views, settings)),
     ii(sqr(settings.filterWidth)),
     jj(sqr(settings.filterWidth)),
-    localVS(views, settings, _globalViewIDs, _localViewIDs, sampler)
+    pixel_weight(sqr(settings.filterWidth), 1.f),
+    localVS(views, settings, _globalViewIDs, sampler)
 {
     status.iterationCount = 0;
-    status.optiSuccess = true;
+    status.optiSuccess = false;
     status.converged = false;
 
-    if (!sampler->success[settings.refViewNr]) {
-        // Sampler could not be initialized properly
-        status.optiSuccess = false;
-        return;
-    }
-
     std::size_t count = 0;
-
     int halfFW = (int) settings.filterWidth / 2;
-    pixel_weight.resize(sampler->getNrSamples());
     for (int j = -halfFW; j <= halfFW; ++j)
         for (int i = -halfFW; i <= halfFW; ++i) {
             ii[count] = i;
             jj[count] = j;
-            pixel_weight[count] = 1.f;
             ++count;
         }
+}
+
+void
+PatchOptimization::reset(int x, int y, float newDepth, float newDzI,
+    float newDzJ, IndexSet const& localViewIDs)
+{
+    midx = x;
+    midy = y;
+    depth = newDepth;
+    dzI = newDzI;
+    dzJ = newDzJ;
+    status.iterationCount = 0;
+    status.optiSuccess = true;
+    status.converged = false;
+
+    sampler->reset(midx, midy, depth, dzI, dzJ);
+    localVS.reset(localViewIDs);
+    if (!sampler->success[settings.refViewNr]) {
+        // Sampler could not be initialized properly
+        status.optiSuccess = false;
+        return;
+    }
 
     localVS.performVS();
     if (!localVS.success) {
@@ -71,9 +94,7 @@ PatchOptimization::PatchOptimization(
 
     // brute force initialize all colorScale entries
     float masterMeanCol = sampler->getMasterMeanColor();
-    for (std::size_t idx = 0; idx < views.size(); ++idx) {
-        colorScale[idx] = math::Vec3f(1.f / masterMeanCol);
-    }
+    colorScale.assign(views.size(), math::Vec3f(1.f / masterMeanCol));
     computeColorScale();
 }
 
@@ -151,7 +172,6 @@ PatchOptimization::derivNorm()
     float norm(0);
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id)
     {
-        Samples nCol, nDeriv;
         sampler->fastColAndDeriv(*id, nCol, nDeriv);
         if (!sampler->success[*id]) {
             status.optiSuccess = false;
@@ -273,7 +293,6 @@ PatchOptimization::optimizeDepthOnly()
 
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id)
     {
-        Samples nCol, nDeriv;
         sampler->fastColAndDeriv(*id, nCol, nDeriv);
         if (!sampler->success[*id]) {
             status.optiSuccess = false;
@@ -315,7 +334,6 @@ PatchOptimization::optimizeDepthAndNormal()
     IndexSet::const_iterator id;
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id)
     {
-        Samples nCol, nDeriv;
         sampler->fastColAndDeriv(*id, nCol, nDeriv);
         if (!sampler->success[*id]) {
             status.optiSuccess = false;
@@ -11,6 +11,7 @@
 #define DMRECON_PATCH_OPTIMIZATION_H
 
 #include <iostream>
+#include <memory>
 
 #include "math/vector.h"
 #include "dmrecon/defines.h"
@@ -29,6 +30,9 @@ struct Status
 
 class PatchOptimization
 {
+public:
+    typedef std::shared_ptr<PatchOptimization> Ptr;
+
 public:
     PatchOptimization(
         std::vector<SingleView::Ptr> const& _views,
@@ -41,6 +45,24 @@ public:
         IndexSet const& _globalViewIDs,
         IndexSet const& _localViewIDs);
 
+    /**
+     * Constructs the optimization without a pixel. The sampler, the local
+     * view selection and all buffers are kept, and the optimization must
+     * be initialized with reset() for each pixel.
+     */
+    PatchOptimization(
+        std::vector<SingleView::Ptr> const& _views,
+        Settings const& _settings,
+        IndexSet const& _globalViewIDs);
+
+    /** Smart pointer PatchOptimization constructor without a pixel. */
+    static Ptr create(std::vector<SingleView::Ptr> const& views,
+        Settings const& settings, IndexSet const& globalViewIDs);
+
+    /** Moves the optimization to a new pixel, reusing all buffers. */
+    void reset(int x, int y, float newDepth, float newDzI, float newDzJ,
+        IndexSet const& localViewIDs);
+
     void computeColorScale();
     float computeConfidence();
     float derivNorm();
@@ -58,20 +80,30 @@ private:
     std::vector<SingleView::Ptr> const& views;
     Settings const& settings;
     // initial values and settings
-    const int midx;
-    const int midy;
+    int midx;
+    int midy;
 
     float depth;
     float dzI, dzJ;                 // represents patch normal
-    std::map<std::size_t, math::Vec3f, std::less<std::size_t> > colorScale;
+    std::vector<math::Vec3f> colorScale;
     Status status;
 
     PatchSampler::Ptr sampler;
     std::vector<int> ii, jj;
     std::vector<float> pixel_weight;
     LocalViewSelection localVS;
+
+    /** scratch buffers for neighbor colors and derivatives */
+    Samples nCol, nDeriv;
 };
 
+inline PatchOptimization::Ptr
+PatchOptimization::create(std::vector<SingleView::Ptr> const& views,
+    Settings const& settings, IndexSet const& globalViewIDs)
+{
+    return Ptr(new PatchOptimization(views, settings, globalViewIDs));
+}
+
 inline float
 PatchOptimization::getDepth() const
 {
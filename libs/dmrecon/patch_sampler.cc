@@ -16,21 +16,72 @@
 
 MVS_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Per-channel mean of the color samples. */
+    math::Vec3f
+    mean_color (Samples const& samples)
+    {
+        std::size_t const num = samples.size();
+        float const* y = *samples[0];
+        float r = 0.f, g = 0.f, b = 0.f;
+#pragma omp simd reduction(+:r,g,b)
+        for (std::size_t i = 0; i < num; ++i)
+        {
+            r += y[3 * i];
+            g += y[3 * i + 1];
+            b += y[3 * i + 2];
+        }
+        return math::Vec3f(r, g, b) / static_cast<float>(num);
+    }
+
+    /*
+     * Sums of squared deviations from the mean of both sample sets and
+     * the sum of their products. The first sum is skipped if sqr_dev_x
+     * is null.
+     */
+    void
+    deviations (Samples const& samples_x, math::Vec3f const& mean_x,
+        Samples const& samples_y, math::Vec3f const& mean_y,
+        float* sqr_dev_x, float* sqr_dev_y, float* dev_xy)
+    {
+        std::size_t const num = samples_x.size();
+        float const* x = *samples_x[0];
+        float const* y = *samples_y[0];
+        float sxx = 0.f, syy = 0.f, sxy = 0.f;
+#pragma omp simd reduction(+:sxx,syy,sxy)
+        for (std::size_t i = 0; i < num; ++i)
+        {
+            float const dx0 = x[3 * i] - mean_x[0];
+            float const dx1 = x[3 * i + 1] - mean_x[1];
+            float const dx2 = x[3 * i + 2] - mean_x[2];
+            float const dy0 = y[3 * i] - mean_y[0];
+            float const dy1 = y[3 * i + 1] - mean_y[1];
+            float const dy2 = y[3 * i + 2] - mean_y[2];
+            sxx += dx0 * dx0 + dx1 * dx1 + dx2 * dx2;
+            syy += dy0 * dy0 + dy1 * dy1 + dy2 * dy2;
+            sxy += dx0 * dy0 + dx1 * dy1 + dx2 * dy2;
+        }
+        if (sqr_dev_x != nullptr)
+            *sqr_dev_x = sxx;
+        *sqr_dev_y = syy;
+        *dev_xy = sxy;
+    }
+}
+
 PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
-    Settings const& _settings,
-    int _x, int _y, float _depth, float _dzI, float _dzJ)
+    Settings const& _settings)
     : views(_views)
     , settings(_settings)
-    , midPix(_x,_y)
     , masterMeanCol(0.f)
-    , depth(_depth)
-    , dzI(_dzI)
-    , dzJ(_dzJ)
+    , depth(0.f)
+    , dzI(0.f)
+    , dzJ(0.f)
+    , neighColorSamples(views.size())
+    , neighPosSamples(views.size())
+    , neighSampled(views.size(), false)
     , success(views.size(), false)
 {
-    SingleView::Ptr refV(views[settings.refViewNr]);
-    mve::ByteImage::ConstPtr masterImg(refV->getScaledImg());
-
     offset = settings.filterWidth / 2;
     nrSamples = sqr(settings.filterWidth);
 
@@ -38,6 +89,32 @@ PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
     patchPoints.resize(nrSamples);
     masterColorSamples.resize(nrSamples);
     masterViewDirs.resize(nrSamples);
+    masterPosSamples.resize(nrSamples);
+    gradDirSamples.resize(nrSamples);
+    stepPoints.resize(nrSamples);
+}
+
+PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
+    Settings const& _settings,
+    int _x, int _y, float _depth, float _dzI, float _dzJ)
+    : PatchSampler(_views, _settings)
+{
+    this->reset(_x, _y, _depth, _dzI, _dzJ);
+}
+
+void
+PatchSampler::reset(int x, int y, float newDepth, float newDzI, float newDzJ)
+{
+    SingleView::Ptr refV(views[settings.refViewNr]);
+    mve::ByteImage::ConstPtr masterImg(refV->getScaledImg());
+
+    midPix = math::Vec2i(x, y);
+    masterMeanCol = 0.f;
+    depth = newDepth;
+    dzI = newDzI;
+    dzJ = newDzJ;
+    success.assign(views.size(), false);
+    neighSampled.assign(views.size(), false);
 
     /* compute patch position and check if it's valid */
     math::Vec2i h;
@@ -93,11 +170,11 @@ PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv)
     /* compute step size for derivative */
     math::Vec3f p1(p0 + masterViewDirs[nrSamples/2]);
     float d = (views[v]->worldToScreen(p1, mmLevel)
-        - views[v]->worldToScreen(patchPoints[12], mmLevel)).norm();
+        - views[v]->worldToScreen(p0, mmLevel)).norm();
     if (!(d > 0.f)) {
         return;
     }
-    stepSize[v] = 1.f / d;
+    float const stepSize = 1.f / d;
 
     /* request according undistorted color image */
     mve::ByteImage::ConstPtr img(views[v]->getPyramidImg(mmLevel));
@@ -106,28 +183,34 @@ PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv)
 
     /* compute image position and gradient direction for each sample
        point in neighbor image v */
-    std::vector<math::Vec2f> gradDir(nrSamples);
+    for (std::size_t i = 0; i < nrSamples; ++i)
+        stepPoints[i] = patchPoints[i] + masterViewDirs[i] * stepSize;
+    views[v]->worldToScreen(&patchPoints[0], nrSamples, mmLevel, &imgPos[0]);
+    views[v]->worldToScreen(&stepPoints[0], nrSamples, mmLevel,
+        &gradDirSamples[0]);
     for (std::size_t i = 0; i < nrSamples; ++i)
     {
-        math::Vec3f p0(patchPoints[i]);
-        math::Vec3f p1(patchPoints[i] + masterViewDirs[i] * stepSize[v]);
-        imgPos[i] = views[v]->worldToScreen(p0, mmLevel);
         // imgPos should be away from image border
         if (!(imgPos[i][0] > 0 && imgPos[i][0] < w-1 &&
                 imgPos[i][1] > 0 && imgPos[i][1] < h-1)) {
             return;
         }
-        gradDir[i] = views[v]->worldToScreen(p1, mmLevel) - imgPos[i];
+        gradDirSamples[i] -= imgPos[i];
     }
 
     /* draw the samples in the image */
-    color.resize(nrSamples, math::Vec3f(0.f));
-    deriv.resize(nrSamples, math::Vec3f(0.f));
-    colAndExactDeriv(*img, imgPos, gradDir, color, deriv);
+    color.assign(nrSamples, math::Vec3f(0.f));
+    deriv.assign(nrSamples, math::Vec3f(0.f));
+    mve::FloatImage::ConstPtr const& linear
+        = views[v]->getLinearPyramidImg(mmLevel);
+    if (linear != nullptr)
+        colAndExactDeriv(*linear, imgPos, gradDirSamples, color, deriv);
+    else
+        colAndExactDeriv(*img, imgPos, gradDirSamples, color, deriv);
 
     /* normalize the gradient */
     for (std::size_t i = 0; i < nrSamples; ++i)
-        deriv[i] /= stepSize[v];
+        deriv[i] /= stepSize;
 
     success[v] = true;
 }
@@ -135,25 +218,18 @@ PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv)
 float
 PatchSampler::getFastNCC(std::size_t v)
 {
-    if (neighColorSamples[v].empty())
+    if (!neighSampled[v])
         computeNeighColorSamples(v);
     if (!success[v])
         return -1.f;
     assert(success[settings.refViewNr]);
-    math::Vec3f meanY(0.f);
-    for (std::size_t i = 0; i < nrSamples; ++i)
-        meanY += neighColorSamples[v][i];
-    meanY /= (float) nrSamples;
 
-    float sqrDevY = 0.f;
-    float devXY = 0.f;
-    for (std::size_t i = 0; i < nrSamples; ++i)
-    {
-        sqrDevY += (neighColorSamples[v][i] - meanY).square_norm();
-        // Note: master color samples are normalized!
-        devXY += (masterColorSamples[i] - meanX)
-            .dot(neighColorSamples[v][i] - meanY);
-    }
+    // Note: master color samples are normalized!
+    math::Vec3f const meanY = mean_color(neighColorSamples[v]);
+    float sqrDevY, devXY;
+    deviations(masterColorSamples, meanX, neighColorSamples[v], meanY,
+        nullptr, &sqrDevY, &devXY);
+
     float tmp = sqrt(sqrDevX * sqrDevY);
     assert(!MATH_ISNAN(tmp) && !MATH_ISNAN(devXY));
     if (tmp > 0)
@@ -165,33 +241,18 @@ PatchSampler::getFastNCC(std::size_t v)
 float
 PatchSampler::getNCC(std::size_t u, std::size_t v)
 {
-    if (neighColorSamples[u].empty())
+    if (!neighSampled[u])
         computeNeighColorSamples(u);
-    if (neighColorSamples[v].empty())
+    if (!neighSampled[v])
         computeNeighColorSamples(v);
     if (!success[u] || !success[v])
             return -1.f;
 
-    math::Vec3f meanX(0.f);
-    math::Vec3f meanY(0.f);
-    for (std::size_t i = 0; i < nrSamples; ++i)
-    {
-        meanX += neighColorSamples[u][i];
-        meanY += neighColorSamples[v][i];
-    }
-    meanX /= nrSamples;
-    meanY /= nrSamples;
-
-    float sqrDevX = 0.f;
-    float sqrDevY = 0.f;
-    float devXY = 0.f;
-    for (std::size_t i = 0; i < nrSamples; ++i)
-    {
-        sqrDevX += (neighColorSamples[u][i] - meanX).square_norm();
-        sqrDevY += (neighColorSamples[v][i] - meanY).square_norm();
-        devXY += (neighColorSamples[u][i] - meanX)
-            .dot(neighColorSamples[v][i] - meanY);
-    }
+    math::Vec3f const meanX = mean_color(neighColorSamples[u]);
+    math::Vec3f const meanY = mean_color(neighColorSamples[v]);
+    float sqrDevX, sqrDevY, devXY;
+    deviations(neighColorSamples[u], meanX, neighColorSamples[v], meanY,
+        &sqrDevX, &sqrDevY, &devXY);
 
     float tmp = sqrt(sqrDevX * sqrDevY);
     if (tmp > 0)
@@ -203,7 +264,7 @@ PatchSampler::getNCC(std::size_t u, std::size_t v)
 float
 PatchSampler::getSAD(std::size_t v, math::Vec3f const& cs)
 {
-    if (neighColorSamples[v].empty())
+    if (!neighSampled[v])
         computeNeighColorSamples(v);
     if (!success[v])
         return -1.f;
@@ -221,7 +282,7 @@ PatchSampler::getSAD(std::size_t v, math::Vec3f const& cs)
 float
 PatchSampler::getSSD(std::size_t v, math::Vec3f const& cs)
 {
-    if (neighColorSamples[v].empty())
+    if (!neighSampled[v])
         computeNeighColorSamples(v);
     if (!success[v])
         return -1.f;
@@ -258,16 +319,13 @@ PatchSampler::getPatchNormal() const
 void
 PatchSampler::update(float newDepth, float newDzI, float newDzJ)
 {
-    success.clear();
-    success.resize(views.size(), false);
+    success.assign(views.size(), false);
     depth = newDepth;
     dzI = newDzI;
     dzJ = newDzJ;
     success[settings.refViewNr] = true;
     computePatchPoints();
-    neighColorSamples.clear();
-    neighDerivSamples.clear();
-    neighPosSamples.clear();
+    neighSampled.assign(views.size(), false);
 }
 
 void
@@ -302,7 +360,7 @@ PatchSampler::computeMasterSamples()
 
     /* draw color samples from image and compute mean color */
     std::size_t count = 0;
-    std::vector<math::Vec2i> imgPos(nrSamples);
+    std::vector<math::Vec2i>& imgPos = masterPosSamples;
     for (int j = topLeft[1]; j <= bottomRight[1]; ++j)
         for (int i = topLeft[0]; i <= bottomRight[0]; ++i)
         {
@@ -351,6 +409,7 @@ PatchSampler::computeNeighColorSamples(std::size_t v)
 
     Samples & color = neighColorSamples[v];
     PixelCoords & imgPos = neighPosSamples[v];
+    neighSampled[v] = true;
     success[v] = false;
 
     /* compute pixel prints and decide on which MipMap-Level to draw
@@ -380,15 +439,20 @@ PatchSampler::computeNeighColorSamples(std::size_t v)
     color.resize(nrSamples);
     imgPos.resize(nrSamples);
 
+    views[v]->worldToScreen(&patchPoints[0], nrSamples, mmLevel, &imgPos[0]);
     for (std::size_t i = 0; i < nrSamples; ++i) {
-        imgPos[i] = views[v]->worldToScreen(patchPoints[i], mmLevel);
         // imgPos should be away from image border
         if (!(imgPos[i][0] > 0 && imgPos[i][0] < w-1 &&
                 imgPos[i][1] > 0 && imgPos[i][1] < h-1)) {
             return;
         }
     }
-    getXYZColorAtPos(*img, imgPos, &color);
+    mve::FloatImage::ConstPtr const& linear
+        = views[v]->getLinearPyramidImg(mmLevel);
+    if (linear != nullptr)
+        getXYZColorAtPos(*linear, imgPos, &color);
+    else
+        getXYZColorAtPos(*img, imgPos, &color);
     success[v] = true;
 }
 
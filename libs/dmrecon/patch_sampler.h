@@ -10,8 +10,8 @@
 #ifndef DMRECON_PATCH_SAMPLER_H
 #define DMRECON_PATCH_SAMPLER_H
 
-#include <map>
 #include <memory>
+#include <vector>
 
 #include "math/vector.h"
 #include "dmrecon/defines.h"
@@ -26,8 +26,12 @@ public:
     typedef std::shared_ptr<PatchSampler> Ptr;
 
 public:
-    /** Default constructor */
-    PatchSampler();
+    /**
+     * Constructs a sampler without a patch. The sampler must be
+     * initialized with reset() before use.
+     */
+    PatchSampler(std::vector<SingleView::Ptr> const& _views,
+        Settings const& _settings);
 
     /** Constructor */
     PatchSampler(
@@ -39,11 +43,21 @@ public:
         float _dzI,
         float _dzJ);
 
+    /** Smart pointer PatchSampler constructor without a patch. */
+    static PatchSampler::Ptr create(std::vector<SingleView::Ptr> const& views,
+        Settings const& settings);
+
     /** Smart pointer PatchSampler constructor. */
     static PatchSampler::Ptr create(std::vector<SingleView::Ptr> const& views,
         Settings const& settings, int x, int _y,
         float _depth, float _dzI, float _dzJ);
 
+    /**
+     * Moves the patch to a new pixel position. All buffers are reused,
+     * so a single sampler can process many pixels without allocations.
+     */
+    void reset(int x, int y, float newDepth, float newDzI, float newDzJ);
+
     /** Draw color samples and derivatives in neighbor view v */
     void fastColAndDeriv(std::size_t v, Samples & color,
         Samples& deriv);
@@ -124,12 +138,15 @@ private:
     /** pixel colors of patch in master image */
     Samples masterColorSamples;
 
-    /** samples in neighbor images */
-    std::map<std::size_t, Samples> neighColorSamples;
-    std::map<std::size_t, Samples> neighDerivSamples;
-    std::map<std::size_t, PixelCoords> neighPosSamples;
+    /** samples in neighbor images, indexed by view ID */
+    std::vector<Samples> neighColorSamples;
+    std::vector<PixelCoords> neighPosSamples;
+    std::vector<bool> neighSampled;
 
-    std::map<std::size_t, float> stepSize;
+    /** scratch buffers for sample positions */
+    std::vector<math::Vec2i> masterPosSamples;
+    PixelCoords gradDirSamples;
+    Samples stepPoints;
 
     void computePatchPoints();
     void computeMasterSamples();
@@ -139,6 +156,13 @@ public:
     std::vector<bool> success;
 };
 
+inline PatchSampler::Ptr
+PatchSampler::create(std::vector<SingleView::Ptr> const& views,
+    Settings const& settings)
+{
+    return PatchSampler::Ptr(new PatchSampler(views, settings));
+}
+
 inline PatchSampler::Ptr
 PatchSampler::create(std::vector<SingleView::Ptr> const& views, Settings const& settings,
     int x, int y, float depth, float dzI, float dzJ)
@@ -156,7 +180,7 @@ PatchSampler::getMasterColorSamples() const
 inline Samples const&
 PatchSampler::getNeighColorSamples(std::size_t v)
 {
-    if (neighColorSamples[v].empty())
+    if (!neighSampled[v])
         computeNeighColorSamples(v);
     return neighColorSamples[v];
 }
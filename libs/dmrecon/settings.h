@@ -46,6 +46,23 @@ struct Settings
 
     std::string plyPath;
 
+    /**
+     * Number of queue entries that are optimized concurrently during
+     * region growing. Entries are popped in priority order, optimized in
+     * parallel and then accepted in pop order. A value of 1 processes the
+     * queue strictly serially.
+     */
+    unsigned int growingBatchSize = 1;
+
+    /**
+     * Keep linearized float copies of the image pyramids, which avoids
+     * the sRGB conversion for every color sample. The copies need four
+     * times the memory of the byte images and are only created while
+     * their total size stays below the budget (in MB).
+     */
+    bool useLinearPyramids = false;
+    std::size_t linearPyramidBudget = 1024;
+
     bool keepDzMap = false;
     bool keepConfidenceMap = false;
     bool quiet = false;
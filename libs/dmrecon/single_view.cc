@@ -58,10 +58,11 @@ SingleView::~SingleView()
 }
 
 void
-SingleView::loadColorImage(int _minLevel)
+SingleView::loadColorImage(int _minLevel, std::size_t linearBudget)
 {
     minLevel = _minLevel;
-    img_pyramid = ImagePyramidCache::get(this->scene, this->view, this->embedding, minLevel);
+    img_pyramid = ImagePyramidCache::get(this->scene, this->view,
+        this->embedding, minLevel, linearBudget);
 }
 
 void
@@ -119,6 +120,31 @@ SingleView::pointInFrustum(math::Vec3f const& wp) const
             && y >= 0 && y <= this->source_level.height - 1;
 }
 
+void
+SingleView::worldToScreen(math::Vec3f const* points, std::size_t num,
+    int level, math::Vec2f* result) const
+{
+    /* Combine camera pose and calibration into a single 3x4 matrix. */
+    math::Matrix3f const& proj = this->img_pyramid->at(level).proj;
+    float m[12];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            m[r * 4 + c] = proj(r, 0) * worldToCam(0, c)
+                + proj(r, 1) * worldToCam(1, c)
+                + proj(r, 2) * worldToCam(2, c);
+
+    float const* p = *points[0];
+    float* res = *result[0];
+#pragma omp simd
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        float const x = p[3 * i], y = p[3 * i + 1], z = p[3 * i + 2];
+        float const w = m[8] * x + m[9] * y + m[10] * z + m[11];
+        res[2 * i] = (m[0] * x + m[1] * y + m[2] * z + m[3]) / w - 0.5f;
+        res[2 * i + 1] = (m[4] * x + m[5] * y + m[6] * z + m[7]) / w - 0.5f;
+    }
+}
+
 void
 SingleView::saveReconAsPly(std::string const& path, float scale) const
 {
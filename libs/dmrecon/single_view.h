@@ -41,6 +41,8 @@ public:
     int clampLevel(int level) const;
     mve::ByteImage::ConstPtr const& getScaledImg() const;
     mve::ByteImage::ConstPtr const& getPyramidImg(int level) const;
+    /** Returns the linearized pyramid image, which may be null. */
+    mve::FloatImage::ConstPtr const& getLinearPyramidImg(int level) const;
     mve::View::Ptr getMVEView() const;
 
     std::string createFileName(float scale) const;
@@ -49,12 +51,15 @@ public:
     math::Vec3f viewRay(int x, int y, int level) const;
     math::Vec3f viewRay(float x, float y, int level) const;
     math::Vec3f viewRayScaled(int x, int y) const;
-    void loadColorImage(int minLevel);
+    void loadColorImage(int minLevel, std::size_t linearBudget = 0);
     bool pointInFrustum(math::Vec3f const& wp) const;
     void saveReconAsPly(std::string const& path, float scale) const;
     bool seesFeature(std::size_t idx) const;
     void prepareMasterView(int scale);
     math::Vec2f worldToScreen(math::Vec3f const& point, int level);
+    /** Projects many points into the given pyramid level at once. */
+    void worldToScreen(math::Vec3f const* points, std::size_t num,
+        int level, math::Vec2f* result) const;
     math::Vec2f worldToScreenScaled(math::Vec3f const& point);
     std::size_t getViewID() const;
 
@@ -134,6 +139,12 @@ SingleView::getPyramidImg(int level) const
     return this->img_pyramid->at(level).image;
 }
 
+inline mve::FloatImage::ConstPtr const&
+SingleView::getLinearPyramidImg(int level) const
+{
+    return this->img_pyramid->at(level).linear;
+}
+
 inline mve::ByteImage::ConstPtr const&
 SingleView::getScaledImg() const
 {
@@ -0,0 +1,524 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann, Fabian Langguth
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_BLOCK_SPARSE_MATRIX_HEADER
+#define SFM_BLOCK_SPARSE_MATRIX_HEADER
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "sfm/ba_cholesky.h"
+#include "sfm/ba_dense_vector.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+SFM_BA_NAMESPACE_BEGIN
+
+/**
+ * Sparse matrix class in block compressed row (BSR) format with dense
+ * blocks of compile-time size BR x BC. Blocks are stored row-major and
+ * contiguously, block columns within a block row are sorted.
+ *
+ * The structure of bundle adjustment problems is purely blockwise, e.g.,
+ * 2x9 camera and 2x3 point blocks in the Jacobian, and 9x9 and 3x3 blocks
+ * in the Hessian. Operating on blocks avoids per-element index arithmetic
+ * and lets the compiler unroll the block kernels. Matrix-vector and
+ * matrix-matrix products are computed in parallel over block rows, the
+ * result does not depend on the number of threads.
+ */
+template <typename T, int BR, int BC>
+class BlockSparseMatrix
+{
+public:
+    enum
+    {
+        BLOCK_ROWS = BR,
+        BLOCK_COLS = BC,
+        BLOCK_SIZE = BR * BC
+    };
+
+    typedef BlockSparseMatrix<T, BC, BR> TransposeType;
+
+public:
+    BlockSparseMatrix (void);
+    BlockSparseMatrix (std::size_t block_rows, std::size_t block_cols);
+
+    /** Allocates an empty matrix with the given number of blocks. */
+    void allocate (std::size_t block_rows, std::size_t block_cols);
+
+    /**
+     * Sets the sparsity pattern of the matrix. 'outer' has one entry per
+     * block row plus one, with the offsets into 'inner', which contains the
+     * sorted block column indices. All block values are set to zero.
+     */
+    void set_pattern (std::vector<std::size_t> outer,
+        std::vector<std::size_t> inner);
+
+    /** Computes y = A * x. */
+    DenseVector<T> multiply (DenseVector<T> const& rhs) const;
+    /** Computes the sparse product of this matrix with 'rhs'. */
+    template <int BC2>
+    BlockSparseMatrix<T, BR, BC2> multiply (
+        BlockSparseMatrix<T, BC, BC2> const& rhs) const;
+    TransposeType transpose (void) const;
+    BlockSparseMatrix subtract (BlockSparseMatrix const& rhs) const;
+
+    /* Operations for square blocks only. */
+    /** Multiplies the scalar diagonal of the matrix with 'factor'. */
+    void mult_diagonal (T const& factor);
+    /** Returns the scalar diagonal of the matrix. */
+    DenseVector<T> diagonal (void) const;
+    /**
+     * Inverts a block diagonal matrix in place using Cholesky decomposition,
+     * i.e., all blocks must be symmetric and positive definite. Non-finite
+     * values of singular blocks are set to zero.
+     */
+    void invert_block_diagonal (void);
+
+    std::size_t num_block_rows (void) const;
+    std::size_t num_block_cols (void) const;
+    std::size_t num_rows (void) const;
+    std::size_t num_cols (void) const;
+    std::size_t num_blocks (void) const;
+
+    /** Block index range of a block row. */
+    std::size_t row_begin (std::size_t block_row) const;
+    std::size_t row_end (std::size_t block_row) const;
+    /** Block column of the block with the given index. */
+    std::size_t block_col (std::size_t index) const;
+    /** Row-major values of the block with the given index. */
+    T* block (std::size_t index);
+    T const* block (std::size_t index) const;
+
+private:
+    template <typename, int, int> friend class BlockSparseMatrix;
+
+private:
+    std::size_t block_rows;
+    std::size_t block_cols;
+    std::vector<T> values;
+    std::vector<std::size_t> outer;
+    std::vector<std::size_t> inner;
+};
+
+SFM_BA_NAMESPACE_END
+SFM_NAMESPACE_END
+
+/* ------------------------ Implementation ------------------------ */
+
+SFM_NAMESPACE_BEGIN
+SFM_BA_NAMESPACE_BEGIN
+
+template <typename T, int BR, int BC>
+BlockSparseMatrix<T, BR, BC>::BlockSparseMatrix (void)
+    : block_rows(0)
+    , block_cols(0)
+    , outer(1, 0)
+{
+}
+
+template <typename T, int BR, int BC>
+BlockSparseMatrix<T, BR, BC>::BlockSparseMatrix (std::size_t block_rows,
+    std::size_t block_cols)
+{
+    this->allocate(block_rows, block_cols);
+}
+
+template <typename T, int BR, int BC>
+void
+BlockSparseMatrix<T, BR, BC>::allocate (std::size_t block_rows,
+    std::size_t block_cols)
+{
+    this->block_rows = block_rows;
+    this->block_cols = block_cols;
+    this->values.clear();
+    this->inner.clear();
+    this->outer.clear();
+    this->outer.resize(block_rows + 1, 0);
+}
+
+template <typename T, int BR, int BC>
+void
+BlockSparseMatrix<T, BR, BC>::set_pattern (std::vector<std::size_t> outer,
+    std::vector<std::size_t> inner)
+{
+    if (outer.size() != this->block_rows + 1 || outer.back() != inner.size())
+        throw std::invalid_argument("Invalid block pattern");
+    this->outer.swap(outer);
+    this->inner.swap(inner);
+    this->values.clear();
+    this->values.resize(this->inner.size() * BLOCK_SIZE, T(0));
+}
+
+template <typename T, int BR, int BC>
+DenseVector<T>
+BlockSparseMatrix<T, BR, BC>::multiply (DenseVector<T> const& rhs) const
+{
+    if (rhs.size() != this->num_cols())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    DenseVector<T> ret(this->num_rows(), T(0));
+    std::ptrdiff_t const num_block_rows = this->block_rows;
+#pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t row = 0; row < num_block_rows; ++row)
+    {
+        T sum[BR] = { T(0) };
+        for (std::size_t i = this->outer[row]; i < this->outer[row + 1]; ++i)
+        {
+            T const* b = this->values.data() + i * BLOCK_SIZE;
+            T const* x = rhs.data() + this->inner[i] * BC;
+            for (int r = 0; r < BR; ++r)
+                for (int c = 0; c < BC; ++c)
+                    sum[r] += b[r * BC + c] * x[c];
+        }
+        std::copy(sum, sum + BR, ret.data() + row * BR);
+    }
+    return ret;
+}
+
+template <typename T, int BR, int BC>
+template <int BC2>
+BlockSparseMatrix<T, BR, BC2>
+BlockSparseMatrix<T, BR, BC>::multiply (
+    BlockSparseMatrix<T, BC, BC2> const& rhs) const
+{
+    if (this->block_cols != rhs.block_rows)
+        throw std::invalid_argument("Incompatible matrix dimensions");
+
+    typedef BlockSparseMatrix<T, BR, BC2> ResultType;
+    ResultType ret(this->block_rows, rhs.block_cols);
+    std::ptrdiff_t const num_block_rows = this->block_rows;
+    std::size_t const no_entry = std::numeric_limits<std::size_t>::max();
+
+    /* Count the distinct result blocks of every block row. */
+#pragma omp parallel
+    {
+        std::vector<std::size_t> marker(rhs.block_cols, no_entry);
+#pragma omp for schedule(dynamic, 64)
+        for (std::ptrdiff_t row = 0; row < num_block_rows; ++row)
+        {
+            std::size_t count = 0;
+            for (std::size_t i = this->outer[row];
+                i < this->outer[row + 1]; ++i)
+            {
+                std::size_t const k = this->inner[i];
+                for (std::size_t j = rhs.outer[k]; j < rhs.outer[k + 1]; ++j)
+                {
+                    std::size_t const col = rhs.inner[j];
+                    if (marker[col] == static_cast<std::size_t>(row))
+                        continue;
+                    marker[col] = row;
+                    count += 1;
+                }
+            }
+            ret.outer[row + 1] = count;
+        }
+    }
+    for (std::size_t row = 0; row < this->block_rows; ++row)
+        ret.outer[row + 1] += ret.outer[row];
+    ret.inner.resize(ret.outer.back());
+    ret.values.resize(ret.outer.back() * ResultType::BLOCK_SIZE, T(0));
+
+    /* Collect and sort the block columns, then accumulate the blocks. */
+#pragma omp parallel
+    {
+        std::vector<std::size_t> marker(rhs.block_cols, no_entry);
+#pragma omp for schedule(dynamic, 64)
+        for (std::ptrdiff_t row = 0; row < num_block_rows; ++row)
+        {
+            std::size_t* cols = ret.inner.data() + ret.outer[row];
+            std::size_t num_cols = 0;
+            for (std::size_t i = this->outer[row];
+                i < this->outer[row + 1]; ++i)
+            {
+                std::size_t const k = this->inner[i];
+                for (std::size_t j = rhs.outer[k]; j < rhs.outer[k + 1]; ++j)
+                {
+                    std::size_t const col = rhs.inner[j];
+                    if (marker[col] == static_cast<std::size_t>(row))
+                        continue;
+                    marker[col] = row;
+                    cols[num_cols++] = col;
+                }
+            }
+            std::sort(cols, cols + num_cols);
+            for (std::size_t i = 0; i < num_cols; ++i)
+                marker[cols[i]] = ret.outer[row] + i;
+
+            for (std::size_t i = this->outer[row];
+                i < this->outer[row + 1]; ++i)
+            {
+                std::size_t const k = this->inner[i];
+                T const* a = this->values.data() + i * BLOCK_SIZE;
+                for (std::size_t j = rhs.outer[k]; j < rhs.outer[k + 1]; ++j)
+                {
+                    T const* b = rhs.values.data() + j * (BC * BC2);
+                    T* c = ret.values.data()
+                        + marker[rhs.inner[j]] * ResultType::BLOCK_SIZE;
+                    for (int r = 0; r < BR; ++r)
+                        for (int l = 0; l < BC; ++l)
+                        {
+                            T const a_rl = a[r * BC + l];
+                            for (int s = 0; s < BC2; ++s)
+                                c[r * BC2 + s] += a_rl * b[l * BC2 + s];
+                        }
+                }
+            }
+
+            /* Reset markers to row IDs, which are never reached again. */
+            for (std::size_t i = 0; i < num_cols; ++i)
+                marker[cols[i]] = row;
+        }
+    }
+
+    return ret;
+}
+
+template <typename T, int BR, int BC>
+typename BlockSparseMatrix<T, BR, BC>::TransposeType
+BlockSparseMatrix<T, BR, BC>::transpose (void) const
+{
+    TransposeType ret(this->block_cols, this->block_rows);
+    ret.inner.resize(this->num_blocks());
+    ret.values.resize(this->values.size());
+
+    /* Compute block row sizes of the transposed matrix with prefix sum. */
+    for (std::size_t i = 0; i < this->inner.size(); ++i)
+        ret.outer[this->inner[i] + 1] += 1;
+    for (std::size_t i = 0; i < this->block_cols; ++i)
+        ret.outer[i + 1] += ret.outer[i];
+
+    /* Write transposed blocks, block columns are implicitly sorted. */
+    std::vector<std::size_t> scratch(ret.outer.begin(), ret.outer.end() - 1);
+    for (std::size_t row = 0; row < this->block_rows; ++row)
+        for (std::size_t i = this->outer[row]; i < this->outer[row + 1]; ++i)
+        {
+            std::size_t const pos = scratch[this->inner[i]]++;
+            ret.inner[pos] = row;
+            T const* src = this->values.data() + i * BLOCK_SIZE;
+            T* dst = ret.values.data() + pos * BLOCK_SIZE;
+            for (int r = 0; r < BR; ++r)
+                for (int c = 0; c < BC; ++c)
+                    dst[c * BR + r] = src[r * BC + c];
+        }
+
+    return ret;
+}
+
+template <typename T, int BR, int BC>
+BlockSparseMatrix<T, BR, BC>
+BlockSparseMatrix<T, BR, BC>::subtract (BlockSparseMatrix const& rhs) const
+{
+    if (this->block_rows != rhs.block_rows
+        || this->block_cols != rhs.block_cols)
+        throw std::invalid_argument("Incompatible matrix dimensions");
+
+    BlockSparseMatrix ret(this->block_rows, this->block_cols);
+    std::ptrdiff_t const num_block_rows = this->block_rows;
+    std::size_t const no_col = std::numeric_limits<std::size_t>::max();
+
+    /* Count the union of blocks of every block row. */
+#pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t row = 0; row < num_block_rows; ++row)
+    {
+        std::size_t i1 = this->outer[row], i2 = rhs.outer[row];
+        std::size_t const i1_end = this->outer[row + 1];
+        std::size_t const i2_end = rhs.outer[row + 1];
+        std::size_t count = 0;
+        while (i1 < i1_end || i2 < i2_end)
+        {
+            std::size_t const id1 = i1 < i1_end ? this->inner[i1] : no_col;
+            std::size_t const id2 = i2 < i2_end ? rhs.inner[i2] : no_col;
+            i1 += static_cast<std::size_t>(id1 <= id2);
+            i2 += static_cast<std::size_t>(id2 <= id1);
+            count += 1;
+        }
+        ret.outer[row + 1] = count;
+    }
+    for (std::size_t row = 0; row < this->block_rows; ++row)
+        ret.outer[row + 1] += ret.outer[row];
+    ret.inner.resize(ret.outer.back());
+    ret.values.resize(ret.outer.back() * BLOCK_SIZE);
+
+    /* Merge the blocks of every block row. */
+#pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t row = 0; row < num_block_rows; ++row)
+    {
+        std::size_t i1 = this->outer[row], i2 = rhs.outer[row];
+        std::size_t const i1_end = this->outer[row + 1];
+        std::size_t const i2_end = rhs.outer[row + 1];
+        for (std::size_t pos = ret.outer[row]; pos < ret.outer[row + 1]; ++pos)
+        {
+            std::size_t const id1 = i1 < i1_end ? this->inner[i1] : no_col;
+            std::size_t const id2 = i2 < i2_end ? rhs.inner[i2] : no_col;
+            T* dst = ret.values.data() + pos * BLOCK_SIZE;
+            T const* b1 = this->values.data() + i1 * BLOCK_SIZE;
+            T const* b2 = rhs.values.data() + i2 * BLOCK_SIZE;
+            if (id1 < id2)
+                std::copy(b1, b1 + BLOCK_SIZE, dst);
+            else if (id2 < id1)
+                for (int k = 0; k < BLOCK_SIZE; ++k)
+                    dst[k] = -b2[k];
+            else
+                for (int k = 0; k < BLOCK_SIZE; ++k)
+                    dst[k] = b1[k] - b2[k];
+            ret.inner[pos] = std::min(id1, id2);
+            i1 += static_cast<std::size_t>(id1 <= id2);
+            i2 += static_cast<std::size_t>(id2 <= id1);
+        }
+    }
+
+    return ret;
+}
+
+template <typename T, int BR, int BC>
+void
+BlockSparseMatrix<T, BR, BC>::mult_diagonal (T const& factor)
+{
+    static_assert(BR == BC, "Square blocks required");
+    for (std::size_t row = 0; row < this->block_rows; ++row)
+        for (std::size_t i = this->outer[row]; i < this->outer[row + 1]; ++i)
+        {
+            if (this->inner[i] < row)
+                continue;
+            if (this->inner[i] == row)
+            {
+                T* b = this->values.data() + i * BLOCK_SIZE;
+                for (int k = 0; k < BR; ++k)
+                    b[k * BC + k] *= factor;
+            }
+            break;
+        }
+}
+
+template <typename T, int BR, int BC>
+DenseVector<T>
+BlockSparseMatrix<T, BR, BC>::diagonal (void) const
+{
+    static_assert(BR == BC, "Square blocks required");
+    DenseVector<T> ret(std::min(this->num_rows(), this->num_cols()), T(0));
+    for (std::size_t row = 0; row < this->block_rows; ++row)
+        for (std::size_t i = this->outer[row]; i < this->outer[row + 1]; ++i)
+        {
+            if (this->inner[i] < row)
+                continue;
+            if (this->inner[i] == row)
+            {
+                T const* b = this->values.data() + i * BLOCK_SIZE;
+                for (int k = 0; k < BR; ++k)
+                    ret[row * BR + k] = b[k * BC + k];
+            }
+            break;
+        }
+    return ret;
+}
+
+template <typename T, int BR, int BC>
+void
+BlockSparseMatrix<T, BR, BC>::invert_block_diagonal (void)
+{
+    static_assert(BR == BC, "Square blocks required");
+    if (this->block_rows != this->block_cols)
+        throw std::invalid_argument("Block matrix must be square");
+    for (std::size_t row = 0; row < this->block_rows; ++row)
+        if (this->outer[row + 1] - this->outer[row] > 1
+            || (this->outer[row + 1] > this->outer[row]
+            && this->inner[this->outer[row]] != row))
+            throw std::invalid_argument("Matrix is not block diagonal");
+
+    std::ptrdiff_t const num_blocks = this->num_blocks();
+#pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t i = 0; i < num_blocks; ++i)
+    {
+        T* b = this->values.data() + i * BLOCK_SIZE;
+        cholesky_invert_inplace(b, BR);
+        for (int k = 0; k < BLOCK_SIZE; ++k)
+            if (!std::isfinite(b[k]))
+                b[k] = T(0);
+    }
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::num_block_rows (void) const
+{
+    return this->block_rows;
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::num_block_cols (void) const
+{
+    return this->block_cols;
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::num_rows (void) const
+{
+    return this->block_rows * BR;
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::num_cols (void) const
+{
+    return this->block_cols * BC;
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::num_blocks (void) const
+{
+    return this->inner.size();
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::row_begin (std::size_t block_row) const
+{
+    return this->outer[block_row];
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::row_end (std::size_t block_row) const
+{
+    return this->outer[block_row + 1];
+}
+
+template <typename T, int BR, int BC>
+inline std::size_t
+BlockSparseMatrix<T, BR, BC>::block_col (std::size_t index) const
+{
+    return this->inner[index];
+}
+
+template <typename T, int BR, int BC>
+inline T*
+BlockSparseMatrix<T, BR, BC>::block (std::size_t index)
+{
+    return this->values.data() + index * BLOCK_SIZE;
+}
+
+template <typename T, int BR, int BC>
+inline T const*
+BlockSparseMatrix<T, BR, BC>::block (std::size_t index) const
+{
+    return this->values.data() + index * BLOCK_SIZE;
+}
+
+SFM_BA_NAMESPACE_END
+SFM_NAMESPACE_END
+
+#endif // SFM_BLOCK_SPARSE_MATRIX_HEADER
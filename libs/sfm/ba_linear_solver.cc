@@ -10,11 +10,7 @@
 #include <stdexcept>
 #include <iostream>
 
-#include "util/timer.h"
-#include "math/matrix.h"
-#include "math/matrix_tools.h"
 #include "sfm/ba_linear_solver.h"
-#include "sfm/ba_cholesky.h"
 #include "sfm/ba_conjugate_gradient.h"
 
 SFM_NAMESPACE_BEGIN
@@ -22,104 +18,134 @@ SFM_BA_NAMESPACE_BEGIN
 
 namespace
 {
-    /*
-     * Inverts a symmetric, positive definite matrix with NxN bocks on its
-     * diagonal using Cholesky decomposition. All other entries must be zero.
-     */
-    void
-    invert_block_matrix_NxN_inplace (SparseMatrix<double>* A, int blocksize)
+    typedef ConjugateGradient<double> CGSolver;
+    typedef DenseVector<double> DenseVectorType;
+
+    /* Adapter to use block sparse matrices in the CG solver. */
+    template <typename MATRIX>
+    class CGBlockMatrixFunctor : public CGSolver::Functor
     {
-        if (A->num_rows() != A->num_cols())
-            throw std::invalid_argument("Block matrix must be square");
-        if (A->num_non_zero() != A->num_rows() * blocksize)
-            throw std::invalid_argument("Invalid number of non-zeros");
-
-        int const bs2 = blocksize * blocksize;
-        std::vector<double> matrix_block(bs2);
-        for (double* iter = A->begin(); iter != A->end(); )
+    public:
+        CGBlockMatrixFunctor (MATRIX const& A) : A(&A) {}
+        DenseVectorType multiply (DenseVectorType const& x) const
         {
-            double* iter_backup = iter;
-            for (int i = 0; i < bs2; ++i)
-                matrix_block[i] = *(iter++);
-
-            cholesky_invert_inplace(matrix_block.data(), blocksize);
-
-            iter = iter_backup;
-            for (int i = 0; i < bs2; ++i)
-                if (std::isfinite(matrix_block[i]))
-                    *(iter++) = matrix_block[i];
-                else
-                    *(iter++) = 0.0;
+            return this->A->multiply(x);
         }
-    }
+        std::size_t input_size (void) const { return this->A->num_cols(); }
+        std::size_t output_size (void) const { return this->A->num_rows(); }
+
+    private:
+        MATRIX const* A;
+    };
+
+    /* Diagonal matrix for the CG solver, e.g., a Jacobi preconditioner. */
+    class CGDiagonalFunctor : public CGSolver::Functor
+    {
+    public:
+        CGDiagonalFunctor (DenseVectorType const& diagonal) : diag(&diagonal) {}
+        DenseVectorType multiply (DenseVectorType const& x) const
+        {
+            DenseVectorType ret(x.size());
+            for (std::size_t i = 0; i < x.size(); ++i)
+                ret[i] = this->diag->at(i) * x[i];
+            return ret;
+        }
+        std::size_t input_size (void) const { return this->diag->size(); }
+        std::size_t output_size (void) const { return this->diag->size(); }
+
+    private:
+        DenseVectorType const* diag;
+    };
 
     /*
-     * Inverts a matrix with 3x3 bocks on its diagonal. All other entries
-     * must be zero. Reading blocks is thus very efficient.
+     * Applies the Schur complement S = B - E C^-1 E^T with E = Jc^T Jp
+     * as S x = B x - Jc^T (Jp (C^-1 (Jp^T (Jc x)))) without forming E or S.
+     * Each product only touches one block per observation.
      */
-    void
-    invert_block_matrix_3x3_inplace (SparseMatrix<double>* A)
+    template <int N>
+    class CGImplicitSchurFunctor : public CGSolver::Functor
     {
-        if (A->num_rows() != A->num_cols())
-            throw std::invalid_argument("Block matrix must be square");
-        if (A->num_non_zero() != A->num_rows() * 3)
-            throw std::invalid_argument("Invalid number of non-zeros");
+    public:
+        typedef LinearSolver::CameraJacobianType<N> CameraJacobianType;
+        typedef LinearSolver::PointJacobianType PointJacobianType;
+        typedef BlockSparseMatrix<double, N, N> CameraBlockMatrix;
+        typedef BlockSparseMatrix<double, 3, 3> PointBlockMatrix;
+
+    public:
+        CGImplicitSchurFunctor (CameraBlockMatrix const& B,
+            PointBlockMatrix const& C_inv,
+            CameraJacobianType const& Jc,
+            typename CameraJacobianType::TransposeType const& JcT,
+            PointJacobianType const& Jp,
+            typename PointJacobianType::TransposeType const& JpT)
+            : B(&B), C_inv(&C_inv), Jc(&Jc), JcT(&JcT), Jp(&Jp), JpT(&JpT)
+        {
+        }
 
-        for (double* iter = A->begin(); iter != A->end(); )
+        DenseVectorType multiply (DenseVectorType const& x) const
         {
-            double* iter_backup = iter;
-            math::Matrix<double, 3, 3> rot;
-            for (int i = 0; i < 9; ++i)
-                rot[i] = *(iter++);
-
-            double det = math::matrix_determinant(rot);
-            if (MATH_DOUBLE_EQ(det, 0.0))
-                continue;
-
-            rot = math::matrix_inverse(rot, det);
-            iter = iter_backup;
-            for (int i = 0; i < 9; ++i)
-                *(iter++) = rot[i];
+            DenseVectorType z = this->C_inv->multiply(
+                this->JpT->multiply(this->Jc->multiply(x)));
+            return this->B->multiply(x).subtract(
+                this->JcT->multiply(this->Jp->multiply(z)));
         }
-    }
+
+        std::size_t input_size (void) const { return this->B->num_cols(); }
+        std::size_t output_size (void) const { return this->B->num_rows(); }
+
+    private:
+        CameraBlockMatrix const* B;
+        PointBlockMatrix const* C_inv;
+        CameraJacobianType const* Jc;
+        typename CameraJacobianType::TransposeType const* JcT;
+        PointJacobianType const* Jp;
+        typename PointJacobianType::TransposeType const* JpT;
+    };
 
     /*
-     * Computes for a given matrix A the square matrix A^T * A for the
-     * case that block columns of A only need to be multiplied with itself.
-     * Becase the resulting matrix is symmetric, only about half the work
-     * needs to be performed.
+     * Computes the predicted error decrease delta^T (D delta / r + g) for
+     * the Hessian diagonal D, trust region radius r and gradient g.
      */
-    void
-    matrix_block_column_multiply (SparseMatrix<double> const& A,
-        std::size_t block_size, SparseMatrix<double>* B)
+    double
+    predicted_decrease (DenseVectorType const& delta,
+        DenseVectorType const& diagonal, DenseVectorType const& g,
+        double trust_region_radius)
+    {
+        double ret = 0.0;
+        for (std::size_t i = 0; i < delta.size(); ++i)
+            ret += delta[i] * (diagonal[i] * delta[i]
+                / trust_region_radius + g[i]);
+        return ret;
+    }
+
+    bool
+    handle_cg_status (CGSolver::Status const& cg_status,
+        LinearSolver::Status* status)
     {
-        SparseMatrix<double>::Triplets triplets;
-        triplets.reserve(A.num_cols() * block_size);
-        for (std::size_t block = 0; block < A.num_cols(); block += block_size)
+        status->num_cg_iterations = cg_status.num_iterations;
+        switch (cg_status.info)
         {
-            std::vector<DenseVector<double>> columns(block_size);
-            for (std::size_t col = 0; col < block_size; ++col)
-                A.column_nonzeros(block + col, &columns[col]);
-            for (std::size_t col = 0; col < block_size; ++col)
-            {
-                double dot = columns[col].dot(columns[col]);
-                triplets.emplace_back(block + col, block + col, dot);
-                for (std::size_t row = col + 1; row < block_size; ++row)
-                {
-                    dot = columns[col].dot(columns[row]);
-                    triplets.emplace_back(block + row, block + col, dot);
-                    triplets.emplace_back(block + col, block + row, dot);
-                }
-            }
+            case CGSolver::CG_CONVERGENCE:
+                status->success = true;
+                break;
+            case CGSolver::CG_MAX_ITERATIONS:
+                status->success = true;
+                break;
+            case CGSolver::CG_INVALID_INPUT:
+                std::cout << "BA: CG failed (invalid input)" << std::endl;
+                status->success = false;
+                return false;
+            default:
+                break;
         }
-        B->allocate(A.num_cols(), A.num_cols());
-        B->set_from_triplets(triplets);
+        return true;
     }
 }
 
+template <int N>
 LinearSolver::Status
-LinearSolver::solve (SparseMatrixType const& jac_cams,
-    SparseMatrixType const& jac_points,
+LinearSolver::solve (CameraJacobianType<N> const& jac_cams,
+    PointJacobianType const& jac_points,
     DenseVectorType const& vector_f,
     DenseVectorType* delta_x)
 {
@@ -130,36 +156,37 @@ LinearSolver::solve (SparseMatrixType const& jac_cams,
     if (has_jac_cams && has_jac_points)
         return this->solve_schur(jac_cams, jac_points, vector_f, delta_x);
     else if (has_jac_cams && !has_jac_points)
-        return this->solve(jac_cams, vector_f, delta_x, 0);
+        return this->solve_cameras(jac_cams, vector_f, delta_x);
     else if (!has_jac_cams && has_jac_points)
-        return this->solve(jac_points, vector_f, delta_x, 3);
+        return this->solve_points(jac_points, vector_f, delta_x);
     else
         throw std::invalid_argument("No Jacobian given");
 }
 
+template <int N>
 LinearSolver::Status
-LinearSolver::solve_schur (SparseMatrixType const& jac_cams,
-    SparseMatrixType const& jac_points,
+LinearSolver::solve_schur (CameraJacobianType<N> const& jac_cams,
+    PointJacobianType const& jac_points,
     DenseVectorType const& values, DenseVectorType* delta_x)
 {
+    typedef BlockSparseMatrix<double, N, N> CameraBlockMatrix;
+    typedef BlockSparseMatrix<double, N, 3> MixedBlockMatrix;
+    typedef BlockSparseMatrix<double, 3, 3> PointBlockMatrix;
+
     /*
      * Jacobian J = [ Jc Jp ] with Jc camera block, Jp point block.
      * Hessian H = [ B E; E^T C ] = J^T J = [ Jc^T; Jp^T ] * [ Jc Jp ]
      * with  B = Jc^T * Jc  and  E = Jc^T * Jp  and  C = Jp^T Jp
      */
     DenseVectorType const& F = values;
-    SparseMatrixType const& Jc = jac_cams;
-    SparseMatrixType const& Jp = jac_points;
-    SparseMatrixType JcT = Jc.transpose();
-    SparseMatrixType JpT = Jp.transpose();
-
-    /* Compute the blocks of the Hessian. */
-    SparseMatrixType B, C;
-    /* Jc^T * Jc */
-    matrix_block_column_multiply(Jc, this->opts.camera_block_dim, &B);
-    /* Jp^T * Jp */
-    matrix_block_column_multiply(Jp, 3, &C);
-    SparseMatrixType E = JcT.multiply(Jp);
+    CameraJacobianType<N> const& Jc = jac_cams;
+    PointJacobianType const& Jp = jac_points;
+    typename CameraJacobianType<N>::TransposeType JcT = Jc.transpose();
+    PointJacobianType::TransposeType JpT = Jp.transpose();
+
+    /* Compute the blocks of the Hessian. B and C are block diagonal. */
+    CameraBlockMatrix B = JcT.multiply(Jc);
+    PointBlockMatrix C = JpT.multiply(Jp);
 
     /* Assemble two values vectors. */
     DenseVectorType v = JcT.multiply(F);
@@ -168,57 +195,61 @@ LinearSolver::solve_schur (SparseMatrixType const& jac_cams,
     w.negate_self();
 
     /* Save diagonal for computing predicted error decrease */
-    SparseMatrixType B_diag = B.diagonal_matrix();
-    SparseMatrixType C_diag = C.diagonal_matrix();
+    DenseVectorType B_diag = B.diagonal();
+    DenseVectorType C_diag = C.diagonal();
 
     /* Add regularization to C and B. */
     C.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
     B.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
 
     /* Invert C matrix. */
-    invert_block_matrix_3x3_inplace(&C);
-
-    /* Compute the Schur complement matrix S. */
-    SparseMatrixType ET = E.transpose();
-    SparseMatrixType S = B.subtract(E.multiply(C).multiply(ET));
-    DenseVectorType rhs = v.subtract(E.multiply(C.multiply(w)));
+    C.invert_block_diagonal();
 
     /* Compute pre-conditioner for linear system. */
-    //SparseMatrixType precond = S.diagonal_matrix();
-    //precond.cwise_invert();
-    SparseMatrixType precond = B;
-    invert_block_matrix_NxN_inplace(&precond, this->opts.camera_block_dim);
+    CameraBlockMatrix precond = B;
+    precond.invert_block_diagonal();
 
-    /* Solve linear system. */
-    DenseVectorType delta_y(Jc.num_cols());
-    typedef sfm::ba::ConjugateGradient<double> CGSolver;
     CGSolver::Options cg_opts;
     cg_opts.max_iterations = this->opts.cg_max_iterations;
     cg_opts.tolerance = 1e-20;
     CGSolver solver(cg_opts);
-    CGSolver::Status cg_status;
-    cg_status = solver.solve(S, rhs, &delta_y, &precond);
+    CGBlockMatrixFunctor<CameraBlockMatrix> P_functor(precond);
 
+    DenseVectorType delta_y(Jc.num_cols());
+    DenseVectorType delta_z;
     Status status;
-    status.num_cg_iterations = cg_status.num_iterations;
-    switch (cg_status.info)
+    if (this->opts.implicit_schur)
     {
-        case CGSolver::CG_CONVERGENCE:
-            status.success = true;
-            break;
-        case CGSolver::CG_MAX_ITERATIONS:
-            status.success = true;
-            break;
-        case CGSolver::CG_INVALID_INPUT:
-            std::cout << "BA: CG failed (invalid input)" << std::endl;
-            status.success = false;
+        /* Solve linear system with the Schur complement applied on the fly. */
+        DenseVectorType rhs = v.subtract(
+            JcT.multiply(Jp.multiply(C.multiply(w))));
+        CGImplicitSchurFunctor<N> S_functor(B, C, Jc, JcT, Jp, JpT);
+        CGSolver::Status cg_status
+            = solver.solve(S_functor, rhs, &delta_y, &P_functor);
+        if (!handle_cg_status(cg_status, &status))
             return status;
-        default:
-            break;
+
+        /* Substitute back to obtain delta z. */
+        delta_z = C.multiply(w.subtract(JpT.multiply(Jc.multiply(delta_y))));
     }
+    else
+    {
+        /* Compute the Schur complement matrix S. */
+        MixedBlockMatrix E = JcT.multiply(Jp);
+        typename MixedBlockMatrix::TransposeType ET = E.transpose();
+        CameraBlockMatrix S = B.subtract(E.multiply(C).multiply(ET));
+        DenseVectorType rhs = v.subtract(E.multiply(C.multiply(w)));
+
+        /* Solve linear system. */
+        CGBlockMatrixFunctor<CameraBlockMatrix> S_functor(S);
+        CGSolver::Status cg_status
+            = solver.solve(S_functor, rhs, &delta_y, &P_functor);
+        if (!handle_cg_status(cg_status, &status))
+            return status;
 
-    /* Substitute back to obtain delta z. */
-    DenseVectorType delta_z = C.multiply(w.subtract(ET.multiply(delta_y)));
+        /* Substitute back to obtain delta z. */
+        delta_z = C.multiply(w.subtract(ET.multiply(delta_y)));
+    }
 
     /* Fill output vector. */
     std::size_t const jac_cam_cols = Jc.num_cols();
@@ -234,24 +265,26 @@ LinearSolver::solve_schur (SparseMatrixType const& jac_cams,
 
     /* Compute predicted error decrease */
     status.predicted_error_decrease = 0.0;
-    status.predicted_error_decrease += delta_y.dot(B_diag.multiply(
-        delta_y).multiply(1.0 / this->opts.trust_region_radius).add(v));
-    status.predicted_error_decrease += delta_z.dot(C_diag.multiply(
-        delta_z).multiply(1.0 / this->opts.trust_region_radius).add(w));
+    status.predicted_error_decrease += predicted_decrease(delta_y, B_diag,
+        v, this->opts.trust_region_radius);
+    status.predicted_error_decrease += predicted_decrease(delta_z, C_diag,
+        w, this->opts.trust_region_radius);
 
     return status;
 }
 
+template <int N>
 LinearSolver::Status
-LinearSolver::solve (SparseMatrixType const& J,
+LinearSolver::solve_cameras (CameraJacobianType<N> const& jac_cams,
     DenseVectorType const& vector_f,
-    DenseVectorType* delta_x,
-    std::size_t block_size)
+    DenseVectorType* delta_x)
 {
+    typedef BlockSparseMatrix<double, N, N> CameraBlockMatrix;
+
     DenseVectorType const& F = vector_f;
-    SparseMatrixType Jt = J.transpose();
-    SparseMatrixType H = Jt.multiply(J);
-    SparseMatrixType H_diag = H.diagonal_matrix();
+    typename CameraJacobianType<N>::TransposeType Jt = jac_cams.transpose();
+    CameraBlockMatrix H = Jt.multiply(jac_cams);
+    DenseVectorType H_diag = H.diagonal();
 
     /* Compute RHS. */
     DenseVectorType g = Jt.multiply(F);
@@ -260,57 +293,67 @@ LinearSolver::solve (SparseMatrixType const& J,
     /* Add regularization to H. */
     H.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
 
+    /* Use preconditioned CG using the diagonal of H. */
+    DenseVectorType precond = H.diagonal();
+    for (std::size_t i = 0; i < precond.size(); ++i)
+        precond[i] = precond[i] == 0.0 ? 0.0 : 1.0 / precond[i];
+
+    CGSolver::Options cg_opts;
+    cg_opts.max_iterations = this->opts.cg_max_iterations;
+    cg_opts.tolerance = 1e-20;
+    CGSolver solver(cg_opts);
+    CGBlockMatrixFunctor<CameraBlockMatrix> H_functor(H);
+    CGDiagonalFunctor P_functor(precond);
+    CGSolver::Status cg_status
+        = solver.solve(H_functor, g, delta_x, &P_functor);
+
     Status status;
-    if (block_size == 0)
-    {
-        /* Use preconditioned CG using the diagonal of H. */
-        SparseMatrixType precond = H.diagonal_matrix();
-        precond.cwise_invert();
-
-        typedef sfm::ba::ConjugateGradient<double> CGSolver;
-        CGSolver::Options cg_opts;
-        cg_opts.max_iterations = this->opts.cg_max_iterations;
-        cg_opts.tolerance = 1e-20;
-        CGSolver solver(cg_opts);
-        CGSolver::Status cg_status;
-        cg_status = solver.solve(H, g, delta_x, &precond);
-        status.num_cg_iterations = cg_status.num_iterations;
+    if (!handle_cg_status(cg_status, &status))
+        return status;
 
-        switch (cg_status.info)
-        {
-            case CGSolver::CG_CONVERGENCE:
-                status.success = true;
-                break;
-            case CGSolver::CG_MAX_ITERATIONS:
-                status.success = true;
-                break;
-            case CGSolver::CG_INVALID_INPUT:
-                std::cout << "BA: CG failed (invalid input)" << std::endl;
-                status.success = false;
-                return status;
-            default:
-                break;
-        }
-    }
-    else if (block_size == 3)
-    {
-        /* Invert blocks of H directly */
-        invert_block_matrix_3x3_inplace(&H);
-        *delta_x = H.multiply(g);
-        status.success = true;
-        status.num_cg_iterations = 0;
-    }
-    else
-    {
-        status.success = false;
-        throw std::invalid_argument("Unsupported block_size in linear solver");
-    }
+    status.predicted_error_decrease = predicted_decrease(*delta_x, H_diag,
+        g, this->opts.trust_region_radius);
+
+    return status;
+}
+
+LinearSolver::Status
+LinearSolver::solve_points (PointJacobianType const& jac_points,
+    DenseVectorType const& vector_f,
+    DenseVectorType* delta_x)
+{
+    DenseVectorType const& F = vector_f;
+    PointJacobianType::TransposeType Jt = jac_points.transpose();
+    BlockSparseMatrix<double, 3, 3> H = Jt.multiply(jac_points);
+    DenseVectorType H_diag = H.diagonal();
 
-    status.predicted_error_decrease = delta_x->dot(H_diag.multiply(
-        *delta_x).multiply(1.0 / this->opts.trust_region_radius).add(g));
+    /* Compute RHS. */
+    DenseVectorType g = Jt.multiply(F);
+    g.negate_self();
+
+    /* Add regularization to H. */
+    H.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
+
+    /* Invert blocks of H directly */
+    H.invert_block_diagonal();
+    *delta_x = H.multiply(g);
+
+    Status status;
+    status.success = true;
+    status.num_cg_iterations = 0;
+    status.predicted_error_decrease = predicted_decrease(*delta_x, H_diag,
+        g, this->opts.trust_region_radius);
 
     return status;
 }
 
+/* Explicit instantiation for cameras with and without intrinsics. */
+template LinearSolver::Status
+LinearSolver::solve<6> (CameraJacobianType<6> const&,
+    PointJacobianType const&, DenseVectorType const&, DenseVectorType*);
+template LinearSolver::Status
+LinearSolver::solve<9> (CameraJacobianType<9> const&,
+    PointJacobianType const&, DenseVectorType const&, DenseVectorType*);
+
 SFM_BA_NAMESPACE_END
 SFM_NAMESPACE_END
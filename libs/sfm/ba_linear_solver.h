@@ -13,7 +13,7 @@
 #include <vector>
 
 #include "sfm/defines.h"
-#include "sfm/ba_sparse_matrix.h"
+#include "sfm/ba_block_sparse_matrix.h"
 #include "sfm/ba_dense_vector.h"
 
 SFM_NAMESPACE_BEGIN
@@ -28,7 +28,13 @@ public:
 
         double trust_region_radius;
         int cg_max_iterations;
-        int camera_block_dim;
+        /**
+         * Applies the Schur complement S = B - E C^-1 E^T on the fly
+         * through the Jacobians instead of forming S explicitly. Memory
+         * scales with the observations instead of the co-visible camera
+         * pairs, at the cost of more work per CG iteration.
+         */
+        bool implicit_schur;
     };
 
     struct Status
@@ -40,8 +46,12 @@ public:
         bool success;
     };
 
-    typedef SparseMatrix<double> SparseMatrixType;
     typedef DenseVector<double> DenseVectorType;
+    /** Jacobian with 2xN blocks for N camera parameters. */
+    template <int N>
+    using CameraJacobianType = BlockSparseMatrix<double, 2, N>;
+    /** Jacobian with 2x3 blocks for the 3D points. */
+    typedef BlockSparseMatrix<double, 2, 3> PointJacobianType;
 
 public:
     LinearSolver (Options const& options);
@@ -51,34 +61,44 @@ public:
      * If the Jacobian for cameras is empty, only points are optimized.
      * If the Jacobian for points is empty, only cameras are optimized.
      * If both, Jacobian for cams and points is given, the Schur complement
-     * trick is used to solve the linear system.
+     * trick is used to solve the linear system. The number of camera
+     * parameters N must be 6 or 9.
      */
-    Status solve (SparseMatrixType const& jac_cams,
-        SparseMatrixType const& jac_points,
+    template <int N>
+    Status solve (CameraJacobianType<N> const& jac_cams,
+        PointJacobianType const& jac_points,
         DenseVectorType const& vector_f,
         DenseVectorType* delta_x);
 
 private:
     /**
      * Conjugate Gradient on Schur-complement by exploiting the block
-     * structure of H = J^T * J.
+     * structure of H = J^T * J. The Schur complement is either formed
+     * explicitly or applied implicitly, see Options::implicit_schur.
      */
-    Status solve_schur (SparseMatrixType const& jac_cams,
-        SparseMatrixType const& jac_points,
+    template <int N>
+    Status solve_schur (CameraJacobianType<N> const& jac_cams,
+        PointJacobianType const& jac_points,
         DenseVectorType const& values,
         DenseVectorType* delta_x);
 
     /**
-     * J is the Jacobian of the problem. If H = J^T * J has a block diagonal
-     * structure (e.g. 'motion only' or 'structure only' problems in BA),
-     * block_size can be used to directly invert H. If block_size is 0
-     * the diagonal of H is used as a preconditioner and the linear system
+     * Solves for the cameras only. H = J^T * J is block diagonal, the
+     * diagonal of H is used as a preconditioner and the linear system
      * is solved via conjugate gradient.
      */
-    Status solve (SparseMatrixType const& J,
+    template <int N>
+    Status solve_cameras (CameraJacobianType<N> const& jac_cams,
         DenseVectorType const& vector_f,
-        DenseVectorType* delta_x,
-        std::size_t block_size = 0);
+        DenseVectorType* delta_x);
+
+    /**
+     * Solves for the points only. H = J^T * J is block diagonal with
+     * 3x3 blocks and is inverted directly.
+     */
+    Status solve_points (PointJacobianType const& jac_points,
+        DenseVectorType const& vector_f,
+        DenseVectorType* delta_x);
 
 private:
     Options opts;
@@ -90,6 +110,7 @@ inline
 LinearSolver::Options::Options (void)
     : trust_region_radius(1.0)
     , cg_max_iterations(1000)
+    , implicit_schur(false)
 {
 }
 
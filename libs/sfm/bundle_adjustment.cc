@@ -13,7 +13,6 @@
 
 #include "math/matrix_tools.h"
 #include "util/timer.h"
-#include "sfm/ba_sparse_matrix.h"
 #include "sfm/ba_dense_vector.h"
 #include "sfm/bundle_adjustment.h"
 
@@ -35,7 +34,10 @@ BundleAdjustment::optimize (void)
     util::WallTimer timer;
     this->sanity_checks();
     this->status = Status();
-    this->lm_optimize();
+    if (this->num_cam_params == 9)
+        this->lm_optimize<9>();
+    else
+        this->lm_optimize<6>();
     this->status.runtime_ms = timer.get_elapsed();
     return this->status;
 }
@@ -69,6 +71,7 @@ BundleAdjustment::sanity_checks (void)
     }
 }
 
+template <int N>
 void
 BundleAdjustment::lm_optimize (void)
 {
@@ -77,6 +80,33 @@ BundleAdjustment::lm_optimize (void)
     pcg_opts = this->opts.linear_opts;
     pcg_opts.trust_region_radius = TRUST_REGION_RADIUS_INIT;
 
+    /*
+     * The sparsity pattern of the Jacobian only depends on the observations
+     * and is set up once. The values are updated in place whenever the
+     * parameters change, i.e., after successful iterations only.
+     */
+    CameraJacobianType<N> Jc;
+    PointJacobianType Jp;
+    CameraJacobianType<N>* jac_cam = nullptr;
+    PointJacobianType* jac_points = nullptr;
+    switch (this->opts.bundle_mode)
+    {
+        case BA_CAMERAS_AND_POINTS:
+            jac_cam = &Jc;
+            jac_points = &Jp;
+            break;
+        case BA_CAMERAS:
+            jac_cam = &Jc;
+            break;
+        case BA_POINTS:
+            jac_points = &Jp;
+            break;
+        default:
+            throw std::runtime_error("Invalid bundle mode");
+    }
+    this->jacobian_pattern<N>(jac_cam, jac_points);
+    bool jacobian_outdated = true;
+
     /* Compute reprojection error for the first time. */
     DenseVectorType F, F_new;
     this->compute_reprojection_errors(&F);
@@ -94,24 +124,12 @@ BundleAdjustment::lm_optimize (void)
             break;
         }
 
-        /* Compute Jacobian. */
-        SparseMatrixType Jc, Jp;
-        switch (this->opts.bundle_mode)
+        /* Compute Jacobian and perform linear step. */
+        if (jacobian_outdated)
         {
-            case BA_CAMERAS_AND_POINTS:
-                this->analytic_jacobian(&Jc, &Jp);
-                break;
-            case BA_CAMERAS:
-                this->analytic_jacobian(&Jc, nullptr);
-                break;
-            case BA_POINTS:
-                this->analytic_jacobian(nullptr, &Jp);
-                break;
-            default:
-                throw std::runtime_error("Invalid bundle mode");
+            this->analytic_jacobian<N>(jac_cam, jac_points);
+            jacobian_outdated = false;
         }
-
-        /* Perform linear step. */
         DenseVectorType delta_x;
         LinearSolver pcg(pcg_opts);
         LinearSolver::Status cg_status = pcg.solve(Jc, Jp, F, &delta_x);
@@ -150,6 +168,7 @@ BundleAdjustment::lm_optimize (void)
             this->status.num_lm_iterations += 1;
             this->status.num_lm_successful_iterations += 1;
             this->update_parameters(delta_x);
+            jacobian_outdated = true;
             std::swap(F, F_new);
             current_mse = new_mse;
 
@@ -303,27 +322,49 @@ BundleAdjustment::rodrigues_to_matrix (double const* r, double* m)
     m[8] = 1.0 - (r[0] * r[0] + r[1] * r[1]) * ct;
 }
 
+template <int N>
 void
-BundleAdjustment::analytic_jacobian (SparseMatrixType* jac_cam,
-    SparseMatrixType* jac_points)
+BundleAdjustment::jacobian_pattern (CameraJacobianType<N>* jac_cam,
+    PointJacobianType* jac_points)
 {
-    std::size_t const camera_cols = this->cameras->size()
-        * this->num_cam_params;
-    std::size_t const point_cols = this->points->size() * 3;
-    std::size_t const jacobi_rows = this->observations->size() * 2;
-
-    SparseMatrixType::Triplets cam_triplets, point_triplets;
+    /*
+     * Every observation is a block row with a single 2xN camera block
+     * and a single 2x3 point block.
+     */
+    std::size_t const num_observations = this->observations->size();
+    std::vector<std::size_t> outer(num_observations + 1);
+    for (std::size_t i = 0; i <= num_observations; ++i)
+        outer[i] = i;
     if (jac_cam != nullptr)
-        cam_triplets.resize(this->observations->size() * 2
-            * this->num_cam_params);
+    {
+        std::vector<std::size_t> inner(num_observations);
+        for (std::size_t i = 0; i < num_observations; ++i)
+            inner[i] = this->observations->at(i).camera_id;
+        jac_cam->allocate(num_observations, this->cameras->size());
+        jac_cam->set_pattern(outer, std::move(inner));
+    }
     if (jac_points != nullptr)
-        point_triplets.resize(this->observations->size() * 3 * 2);
+    {
+        std::vector<std::size_t> inner(num_observations);
+        for (std::size_t i = 0; i < num_observations; ++i)
+            inner[i] = this->observations->at(i).point_id;
+        jac_points->allocate(num_observations, this->points->size());
+        jac_points->set_pattern(std::move(outer), std::move(inner));
+    }
+}
 
+template <int N>
+void
+BundleAdjustment::analytic_jacobian (CameraJacobianType<N>* jac_cam,
+    PointJacobianType* jac_points)
+{
+    /* Block i belongs to observation i, see jacobian_pattern(). */
+    std::size_t const num_observations = this->observations->size();
 #pragma omp parallel
     {
         double cam_x_ptr[9], cam_y_ptr[9], point_x_ptr[3], point_y_ptr[3];
 #pragma omp for
-        for (std::size_t i = 0; i < this->observations->size(); ++i)
+        for (std::size_t i = 0; i < num_observations; ++i)
         {
             Observation const& obs = this->observations->at(i);
             Point3D const& p3d = this->points->at(obs.point_id);
@@ -336,42 +377,23 @@ BundleAdjustment::analytic_jacobian (SparseMatrixType* jac_cam,
                 std::fill(point_x_ptr, point_x_ptr + 3, 0.0);
                 std::fill(point_y_ptr, point_y_ptr + 3, 0.0);
             }
-
-            std::size_t row_x = i * 2, row_y = row_x + 1;
-            std::size_t cam_col = obs.camera_id * this->num_cam_params;
-            std::size_t point_col = obs.point_id * 3;
-            std::size_t cam_offset = i * this->num_cam_params * 2;
-            for (int j = 0; jac_cam != nullptr && j < this->num_cam_params; ++j)
-            {
-                cam_triplets[cam_offset + j * 2 + 0] =
-                    SparseMatrixType::Triplet(row_x, cam_col + j, cam_x_ptr[j]);
-                cam_triplets[cam_offset + j * 2 + 1] =
-                    SparseMatrixType::Triplet(row_y, cam_col + j, cam_y_ptr[j]);
-            }
-            std::size_t point_offset = i * 3 * 2;
-            for (int j = 0; jac_points != nullptr && j < 3; ++j)
+            if (cam.is_constant)
             {
-                point_triplets[point_offset + j * 2 + 0] =
-                    SparseMatrixType::Triplet(row_x, point_col + j, point_x_ptr[j]);
-                point_triplets[point_offset + j * 2 + 1] =
-                    SparseMatrixType::Triplet(row_y, point_col + j, point_y_ptr[j]);
+                std::fill(cam_x_ptr, cam_x_ptr + 9, 0.0);
+                std::fill(cam_y_ptr, cam_y_ptr + 9, 0.0);
             }
-        }
 
-#pragma omp sections
-        {
-#pragma omp section
             if (jac_cam != nullptr)
             {
-                jac_cam->allocate(jacobi_rows, camera_cols);
-                jac_cam->set_from_triplets(cam_triplets);
+                double* block = jac_cam->block(i);
+                std::copy(cam_x_ptr, cam_x_ptr + N, block);
+                std::copy(cam_y_ptr, cam_y_ptr + N, block + N);
             }
-
-#pragma omp section
             if (jac_points != nullptr)
             {
-                jac_points->allocate(jacobi_rows, point_cols);
-                jac_points->set_from_triplets(point_triplets);
+                double* block = jac_points->block(i);
+                std::copy(point_x_ptr, point_x_ptr + 3, block);
+                std::copy(point_y_ptr, point_y_ptr + 3, block + 3);
             }
         }
     }
@@ -662,6 +684,13 @@ void
 BundleAdjustment::update_camera (Camera const& cam,
     double const* update, Camera* out)
 {
+    /* Constant cameras have a zero Jacobian and are never updated. */
+    if (cam.is_constant)
+    {
+        *out = cam;
+        return;
+    }
+
     if (opts.fixed_intrinsics)
     {
         out->focal_length = cam.focal_length;
@@ -14,7 +14,6 @@
 
 #include "util/logging.h"
 #include "sfm/defines.h"
-#include "sfm/ba_sparse_matrix.h"
 #include "sfm/ba_dense_vector.h"
 #include "sfm/ba_linear_solver.h"
 #include "sfm/ba_types.h"
@@ -25,16 +24,16 @@
  * - PBA normalizes focal length and depth values before LM optimization,
  *   and denormalizes afterwards. Is this necessary with double?
  * - PBA exits the LM main loop if norm of -JF is small. Useful?
- * - The slowest part is computing the Schur complement because of matrix
- *   multiplications. How can this be improved?
+ * - The slowest part is the Schur complement. It is either formed with
+ *   block sparse products or, for large problems, applied implicitly
+ *   through the Jacobians (LinearSolver::Options::implicit_schur).
+ * - CG is preconditioned with the inverted camera blocks of B. The blocks
+ *   of S were tried, but did not reduce the number of CG iterations.
  *
  * Actual TODOs.
  *
- * - Better preconditioner for conjugate gradient, i.e., use the 9x9 diagonal
- *   blocks of S instead of B. Requires method in matrix.
  * - Properly implement and test BA_POINTS mode.
  * - More accurate implementations for the Jacobian (currently approximated).
- * - Implement block_size = 9 in linear solver, no need for CG
  */
 
 SFM_NAMESPACE_BEGIN
@@ -97,11 +96,14 @@ public:
     void print_status (bool detailed = false) const;
 
 private:
-    typedef SparseMatrix<double> SparseMatrixType;
     typedef DenseVector<double> DenseVectorType;
+    typedef LinearSolver::PointJacobianType PointJacobianType;
+    template <int N>
+    using CameraJacobianType = LinearSolver::CameraJacobianType<N>;
 
 private:
     void sanity_checks (void);
+    template <int N>
     void lm_optimize (void);
 
     /* Helper functions. */
@@ -111,9 +113,15 @@ private:
     void radial_distort (double* x, double* y, double const* dist);
     void rodrigues_to_matrix (double const* r, double* rot);
 
-    /* Analytic Jacobian. */
-    void analytic_jacobian (SparseMatrixType* jac_cam,
-        SparseMatrixType* jac_points);
+    /* Sparsity pattern of the Jacobian, N camera params. */
+    template <int N>
+    void jacobian_pattern (CameraJacobianType<N>* jac_cam,
+        PointJacobianType* jac_points);
+
+    /* Analytic Jacobian, written into the preallocated pattern. */
+    template <int N>
+    void analytic_jacobian (CameraJacobianType<N>* jac_cam,
+        PointJacobianType* jac_points);
     void analytic_jacobian_entries (Camera const& cam, Point3D const& point,
         double* cam_x_ptr, double* cam_y_ptr,
         double* point_x_ptr, double* point_y_ptr);
@@ -168,7 +176,6 @@ BundleAdjustment::BundleAdjustment (Options const& options)
     , observations(nullptr)
     , num_cam_params(options.fixed_intrinsics ? 6 : 9)
 {
-    this->opts.linear_opts.camera_block_dim = this->num_cam_params;
 }
 
 inline void
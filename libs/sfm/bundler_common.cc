@@ -15,12 +15,19 @@
 #include <vector>
 #include <cstring>
 #include <cerrno>
+#include <cstdint>
+#include <stdexcept>
 
 #include "util/exception.h"
 #include "sfm/bundler_common.h"
 
-#define PREBUNDLE_SIGNATURE "MVE_PREBUNDLE\n"
-#define PREBUNDLE_SIGNATURE_LEN 14
+#define PREBUNDLE_SIGNATURE "MVE_PREBUNDLE_2\n"
+#define PREBUNDLE_SIGNATURE_LEN 16
+#define PREBUNDLE_BYTE_ORDER 0x01020304
+#define PREBUNDLE_ALIGNMENT 8
+
+#define PREBUNDLE_LEGACY_SIGNATURE "MVE_PREBUNDLE\n"
+#define PREBUNDLE_LEGACY_SIGNATURE_LEN 14
 
 #define SURVEY_SIGNATURE "MVE_SURVEY\n"
 #define SURVEY_SIGNATURE_LEN 11
@@ -54,125 +61,131 @@ Track::remove_view (int view_id)
 /* ------------------ Input/Output for Prebundle ------------------ */
 
 void
-save_prebundle_data (ViewportList const& viewports,
-    PairwiseMatching const& matching, std::ostream& out)
+make_matching_refs (PairwiseMatching const& matching,
+    PairwiseMatchingRef* refs)
 {
-    /* Write signature. */
-    out.write(PREBUNDLE_SIGNATURE, PREBUNDLE_SIGNATURE_LEN);
-
-    /* Write number of viewports. */
-    int32_t num_viewports = static_cast<int32_t>(viewports.size());
-    out.write(reinterpret_cast<char const*>(&num_viewports), sizeof(int32_t));
-
-    /* Write per-viewport data. */
-    for (std::size_t i = 0; i < viewports.size(); ++i)
-    {
-        FeatureSet const& vpf = viewports[i].features;
-
-        /* Write positions. */
-        int32_t num_positions = static_cast<int32_t>(vpf.positions.size());
-        out.write(reinterpret_cast<char const*>(&num_positions), sizeof(int32_t));
-        for (std::size_t j = 0; j < vpf.positions.size(); ++j)
-            out.write(reinterpret_cast<char const*>(&vpf.positions[j]), sizeof(math::Vec2f));
-
-        /* Write colors. */
-        int32_t num_colors = static_cast<int32_t>(vpf.colors.size());
-        out.write(reinterpret_cast<char const*>(&num_colors), sizeof(int32_t));
-        for (std::size_t j = 0; j < vpf.colors.size(); ++j)
-            out.write(reinterpret_cast<char const*>(&vpf.colors[j]), sizeof(math::Vec3uc));
-    }
-
-    /* Write number of matching pairs. */
-    int32_t num_pairs = static_cast<int32_t>(matching.size());
-    out.write(reinterpret_cast<char const*>(&num_pairs), sizeof(int32_t));
-
-    /* Write per-matching pair data. */
+    refs->resize(matching.size());
     for (std::size_t i = 0; i < matching.size(); ++i)
     {
-        TwoViewMatching const& tvr = matching[i];
-        int32_t id1 = static_cast<int32_t>(tvr.view_1_id);
-        int32_t id2 = static_cast<int32_t>(tvr.view_2_id);
-        int32_t num_matches = static_cast<int32_t>(tvr.matches.size());
-        out.write(reinterpret_cast<char const*>(&id1), sizeof(int32_t));
-        out.write(reinterpret_cast<char const*>(&id2), sizeof(int32_t));
-        out.write(reinterpret_cast<char const*>(&num_matches), sizeof(int32_t));
-        for (std::size_t j = 0; j < tvr.matches.size(); ++j)
-        {
-            CorrespondenceIndex const& c = tvr.matches[j];
-            int32_t i1 = static_cast<int32_t>(c.first);
-            int32_t i2 = static_cast<int32_t>(c.second);
-            out.write(reinterpret_cast<char const*>(&i1), sizeof(int32_t));
-            out.write(reinterpret_cast<char const*>(&i2), sizeof(int32_t));
-        }
+        TwoViewMatching const& tvm = matching[i];
+        TwoViewMatchingRef& ref = refs->at(i);
+        ref.view_1_id = tvm.view_1_id;
+        ref.view_2_id = tvm.view_2_id;
+        ref.matches = tvm.matches.data();
+        ref.num_matches = tvm.matches.size();
     }
 }
 
-void
-load_prebundle_data (std::istream& in, ViewportList* viewports,
-    PairwiseMatching* matching)
+namespace
 {
-    /* Read and check file signature. */
-    char signature[PREBUNDLE_SIGNATURE_LEN + 1];
-    in.read(signature, PREBUNDLE_SIGNATURE_LEN);
-    signature[PREBUNDLE_SIGNATURE_LEN] = '\0';
-    if (std::string(PREBUNDLE_SIGNATURE) != signature)
-        throw std::invalid_argument("Invalid prebundle file signature");
-
-    viewports->clear();
-    matching->clear();
-
-    /* Read number of viewports. */
-    int32_t num_viewports;
-    in.read(reinterpret_cast<char*>(&num_viewports), sizeof(int32_t));
-    viewports->resize(num_viewports);
+    /* File header, followed by the viewport table and the pair table. */
+    struct PrebundleHeader
+    {
+        char signature[PREBUNDLE_SIGNATURE_LEN];
+        uint32_t byte_order;
+        uint32_t reserved;
+        uint64_t file_size;
+        uint64_t num_viewports;
+        uint64_t viewport_table_offset;
+        uint64_t num_pairs;
+        uint64_t pair_table_offset;
+    };
+
+    struct PrebundleViewportEntry
+    {
+        uint64_t num_positions;
+        uint64_t positions_offset;
+        uint64_t num_colors;
+        uint64_t colors_offset;
+    };
 
-    /* Read per-viewport data. */
-    for (int i = 0; i < num_viewports; ++i)
+    struct PrebundlePairEntry
     {
-        FeatureSet& vpf = viewports->at(i).features;
+        int32_t view_1_id;
+        int32_t view_2_id;
+        uint64_t num_matches;
+        uint64_t matches_offset;
+    };
+
+    static_assert(sizeof(PrebundleHeader) == 64, "Unexpected header size");
+    static_assert(sizeof(PrebundleViewportEntry) == 32,
+        "Unexpected viewport entry size");
+    static_assert(sizeof(PrebundlePairEntry) == 24,
+        "Unexpected pair entry size");
+    static_assert(sizeof(math::Vec2f) == 2 * sizeof(float),
+        "Vec2f must be tightly packed");
+    static_assert(sizeof(math::Vec3uc) == 3,
+        "Vec3uc must be tightly packed");
+    static_assert(sizeof(CorrespondenceIndex) == 2 * sizeof(int32_t),
+        "CorrespondenceIndex must be two tightly packed 32 bit integers");
+
+    uint64_t
+    align_offset (uint64_t offset)
+    {
+        return (offset + PREBUNDLE_ALIGNMENT - 1)
+            & ~static_cast<uint64_t>(PREBUNDLE_ALIGNMENT - 1);
+    }
 
-        /* Read positions. */
-        int32_t num_positions;
-        in.read(reinterpret_cast<char*>(&num_positions), sizeof(int32_t));
-        vpf.positions.resize(num_positions);
-        for (int j = 0; j < num_positions; ++j)
-            in.read(reinterpret_cast<char*>(&vpf.positions[j]), sizeof(math::Vec2f));
-
-        /* Read colors. */
-        int32_t num_colors;
-        in.read(reinterpret_cast<char*>(&num_colors), sizeof(int32_t));
-        vpf.colors.resize(num_colors);
-        for (int j = 0; j < num_colors; ++j)
-            in.read(reinterpret_cast<char*>(&vpf.colors[j]), sizeof(math::Vec3uc));
+    /* Reserves an aligned section for 'bytes' and returns its offset. */
+    uint64_t
+    append_section (uint64_t bytes, uint64_t* file_size)
+    {
+        uint64_t const offset = align_offset(*file_size);
+        *file_size = offset + bytes;
+        return offset;
     }
 
-    /* Read number of matching pairs. */
-    int32_t num_pairs;
-    in.read(reinterpret_cast<char*>(&num_pairs), sizeof(int32_t));
+    void
+    write_section (std::ostream& out, void const* data, uint64_t offset,
+        uint64_t bytes)
+    {
+        /* Zero-pad to the section offset. */
+        char const padding[PREBUNDLE_ALIGNMENT] = { 0 };
+        std::streamoff const pos = out.tellp();
+        out.write(padding, static_cast<std::streamoff>(offset) - pos);
+        if (bytes > 0)
+            out.write(static_cast<char const*>(data), bytes);
+    }
 
-    /* Read per-matching pair data. */
-    for (int32_t i = 0; i < num_pairs; ++i)
+    /* Bounds-checked sequential reader for the previous file format. */
+    class LegacyReader
     {
-        int32_t id1, id2, num_matches;
-        in.read(reinterpret_cast<char*>(&id1), sizeof(int32_t));
-        in.read(reinterpret_cast<char*>(&id2), sizeof(int32_t));
-        in.read(reinterpret_cast<char*>(&num_matches), sizeof(int32_t));
-
-        TwoViewMatching tvr;
-        tvr.view_1_id = static_cast<int>(id1);
-        tvr.view_2_id = static_cast<int>(id2);
-        tvr.matches.reserve(num_matches);
-        for (int32_t j = 0; j < num_matches; ++j)
+    public:
+        LegacyReader (char const* data, std::size_t size)
+            : ptr(data), end(data + size) {}
+
+        void read (void* dst, std::size_t bytes)
+        {
+            if (static_cast<std::size_t>(this->end - this->ptr) < bytes)
+                throw util::Exception("Premature EOF");
+            if (bytes > 0)
+                std::memcpy(dst, this->ptr, bytes);
+            this->ptr += bytes;
+        }
+
+        std::size_t read_count (std::size_t element_size)
         {
-            int32_t i1, i2;
-            in.read(reinterpret_cast<char*>(&i1), sizeof(int32_t));
-            in.read(reinterpret_cast<char*>(&i2), sizeof(int32_t));
-            CorrespondenceIndex c;
-            c.first = static_cast<int>(i1);
-            c.second = static_cast<int>(i2);
-            tvr.matches.push_back(c);
+            int32_t value;
+            this->read(&value, sizeof(int32_t));
+            if (value < 0 || static_cast<std::size_t>(this->end - this->ptr)
+                / element_size < static_cast<std::size_t>(value))
+                throw util::Exception("Premature EOF");
+            return static_cast<std::size_t>(value);
         }
-        matching->push_back(tvr);
+
+    private:
+        char const* ptr;
+        char const* end;
+    };
+
+    /* Checks that an array lies within the file and is aligned. */
+    void
+    check_section (uint64_t offset, uint64_t num, std::size_t element_size,
+        std::size_t file_size)
+    {
+        if (offset % PREBUNDLE_ALIGNMENT != 0 || offset > file_size
+            || num > (file_size - offset) / element_size)
+            throw util::Exception("Invalid prebundle section offset");
     }
 }
 
@@ -180,10 +193,75 @@ void
 save_prebundle_to_file (ViewportList const& viewports,
     PairwiseMatching const& matching, std::string const& filename)
 {
+    /* Lay out the tables and data sections. */
+    PrebundleHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.signature, PREBUNDLE_SIGNATURE,
+        PREBUNDLE_SIGNATURE_LEN);
+    header.byte_order = PREBUNDLE_BYTE_ORDER;
+    header.num_viewports = viewports.size();
+    header.num_pairs = matching.size();
+
+    uint64_t file_size = sizeof(PrebundleHeader);
+    header.viewport_table_offset = append_section(
+        viewports.size() * sizeof(PrebundleViewportEntry), &file_size);
+    header.pair_table_offset = append_section(
+        matching.size() * sizeof(PrebundlePairEntry), &file_size);
+
+    std::vector<PrebundleViewportEntry> viewport_table(viewports.size());
+    for (std::size_t i = 0; i < viewports.size(); ++i)
+    {
+        FeatureSet const& vpf = viewports[i].features;
+        PrebundleViewportEntry& entry = viewport_table[i];
+        entry.num_positions = vpf.positions.size();
+        entry.positions_offset = append_section(
+            vpf.positions.size() * sizeof(math::Vec2f), &file_size);
+        entry.num_colors = vpf.colors.size();
+        entry.colors_offset = append_section(
+            vpf.colors.size() * sizeof(math::Vec3uc), &file_size);
+    }
+
+    std::vector<PrebundlePairEntry> pair_table(matching.size());
+    for (std::size_t i = 0; i < matching.size(); ++i)
+    {
+        TwoViewMatching const& tvm = matching[i];
+        PrebundlePairEntry& entry = pair_table[i];
+        entry.view_1_id = static_cast<int32_t>(tvm.view_1_id);
+        entry.view_2_id = static_cast<int32_t>(tvm.view_2_id);
+        entry.num_matches = tvm.matches.size();
+        entry.matches_offset = append_section(
+            tvm.matches.size() * sizeof(CorrespondenceIndex), &file_size);
+    }
+    header.file_size = file_size;
+
+    /* Write everything in file order with one call per array. */
     std::ofstream out(filename.c_str(), std::ios::binary);
     if (!out.good())
         throw util::FileException(filename, std::strerror(errno));
-    save_prebundle_data(viewports, matching, out);
+
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    write_section(out, viewport_table.data(), header.viewport_table_offset,
+        viewport_table.size() * sizeof(PrebundleViewportEntry));
+    write_section(out, pair_table.data(), header.pair_table_offset,
+        pair_table.size() * sizeof(PrebundlePairEntry));
+    for (std::size_t i = 0; i < viewports.size(); ++i)
+    {
+        FeatureSet const& vpf = viewports[i].features;
+        PrebundleViewportEntry const& entry = viewport_table[i];
+        write_section(out, vpf.positions.data(), entry.positions_offset,
+            entry.num_positions * sizeof(math::Vec2f));
+        write_section(out, vpf.colors.data(), entry.colors_offset,
+            entry.num_colors * sizeof(math::Vec3uc));
+    }
+    for (std::size_t i = 0; i < matching.size(); ++i)
+    {
+        PrebundlePairEntry const& entry = pair_table[i];
+        write_section(out, matching[i].matches.data(), entry.matches_offset,
+            entry.num_matches * sizeof(CorrespondenceIndex));
+    }
+
+    if (!out.good())
+        throw util::FileException(filename, std::strerror(errno));
     out.close();
 }
 
@@ -191,26 +269,173 @@ void
 load_prebundle_from_file (std::string const& filename,
     ViewportList* viewports, PairwiseMatching* matching)
 {
-    std::ifstream in(filename.c_str(), std::ios::binary);
-    if (!in.good())
-        throw util::FileException(filename, std::strerror(errno));
+    MappedPrebundle prebundle(filename);
+    prebundle.get_viewports(viewports);
+    prebundle.get_matching(matching);
+}
+
+/* ---------------------------------------------------------------- */
+
+MappedPrebundle::MappedPrebundle (std::string const& filename)
+    : file(filename)
+{
+    char const* data = this->file.data();
+    std::size_t const size = this->file.size();
+    if (size >= PREBUNDLE_SIGNATURE_LEN && std::equal(data,
+        data + PREBUNDLE_SIGNATURE_LEN, PREBUNDLE_SIGNATURE))
+        this->parse_mapped(filename);
+    else if (size >= PREBUNDLE_LEGACY_SIGNATURE_LEN && std::equal(data,
+        data + PREBUNDLE_LEGACY_SIGNATURE_LEN, PREBUNDLE_LEGACY_SIGNATURE))
+        this->parse_legacy();
+    else
+        throw std::invalid_argument("Invalid prebundle file signature");
+}
+
+void
+MappedPrebundle::parse_mapped (std::string const& filename)
+{
+    char const* data = this->file.data();
+    std::size_t const size = this->file.size();
 
-    try
+    PrebundleHeader header;
+    if (size < sizeof(header))
+        throw util::Exception("Premature EOF");
+    std::memcpy(&header, data, sizeof(header));
+    if (header.byte_order != PREBUNDLE_BYTE_ORDER)
+        throw util::FileException(filename, "Unsupported byte order");
+    if (header.file_size != size)
+        throw util::Exception("Premature EOF");
+
+    check_section(header.viewport_table_offset, header.num_viewports,
+        sizeof(PrebundleViewportEntry), size);
+    check_section(header.pair_table_offset, header.num_pairs,
+        sizeof(PrebundlePairEntry), size);
+
+    /* The mapping is page aligned, all sections are 8 byte aligned. */
+    PrebundleViewportEntry const* viewport_table
+        = reinterpret_cast<PrebundleViewportEntry const*>(
+        data + header.viewport_table_offset);
+    this->viewport_data.resize(header.num_viewports);
+    for (std::size_t i = 0; i < this->viewport_data.size(); ++i)
     {
-        load_prebundle_data(in, viewports, matching);
+        PrebundleViewportEntry const& entry = viewport_table[i];
+        check_section(entry.positions_offset, entry.num_positions,
+            sizeof(math::Vec2f), size);
+        check_section(entry.colors_offset, entry.num_colors,
+            sizeof(math::Vec3uc), size);
+        ViewportData& vd = this->viewport_data[i];
+        vd.positions = reinterpret_cast<math::Vec2f const*>(
+            data + entry.positions_offset);
+        vd.num_positions = entry.num_positions;
+        vd.colors = reinterpret_cast<math::Vec3uc const*>(
+            data + entry.colors_offset);
+        vd.num_colors = entry.num_colors;
     }
-    catch (...)
+
+    PrebundlePairEntry const* pair_table
+        = reinterpret_cast<PrebundlePairEntry const*>(
+        data + header.pair_table_offset);
+    this->matching_refs.resize(header.num_pairs);
+    for (std::size_t i = 0; i < this->matching_refs.size(); ++i)
     {
-        in.close();
-        throw;
+        PrebundlePairEntry const& entry = pair_table[i];
+        check_section(entry.matches_offset, entry.num_matches,
+            sizeof(CorrespondenceIndex), size);
+        TwoViewMatchingRef& ref = this->matching_refs[i];
+        ref.view_1_id = entry.view_1_id;
+        ref.view_2_id = entry.view_2_id;
+        ref.matches = reinterpret_cast<CorrespondenceIndex const*>(
+            data + entry.matches_offset);
+        ref.num_matches = entry.num_matches;
     }
+}
 
-    if (in.eof())
+void
+MappedPrebundle::parse_legacy (void)
+{
+    /*
+     * The previous format stores counts followed by unaligned arrays.
+     * The arrays are copied in bulk to owned memory.
+     */
+    LegacyReader reader(this->file.data() + PREBUNDLE_LEGACY_SIGNATURE_LEN,
+        this->file.size() - PREBUNDLE_LEGACY_SIGNATURE_LEN);
+
+    std::size_t const num_viewports = reader.read_count(2 * sizeof(int32_t));
+    this->legacy_viewports.resize(num_viewports);
+    for (std::size_t i = 0; i < num_viewports; ++i)
     {
-        in.close();
-        throw util::Exception("Premature EOF");
+        FeatureSet& vpf = this->legacy_viewports[i].features;
+        vpf.positions.resize(reader.read_count(sizeof(math::Vec2f)));
+        reader.read(vpf.positions.data(),
+            vpf.positions.size() * sizeof(math::Vec2f));
+        vpf.colors.resize(reader.read_count(sizeof(math::Vec3uc)));
+        reader.read(vpf.colors.data(),
+            vpf.colors.size() * sizeof(math::Vec3uc));
     }
-    in.close();
+
+    std::size_t const num_pairs = reader.read_count(3 * sizeof(int32_t));
+    this->legacy_matching.resize(num_pairs);
+    for (std::size_t i = 0; i < num_pairs; ++i)
+    {
+        TwoViewMatching& tvm = this->legacy_matching[i];
+        int32_t ids[2];
+        reader.read(ids, sizeof(ids));
+        tvm.view_1_id = ids[0];
+        tvm.view_2_id = ids[1];
+        tvm.matches.resize(reader.read_count(sizeof(CorrespondenceIndex)));
+        reader.read(tvm.matches.data(),
+            tvm.matches.size() * sizeof(CorrespondenceIndex));
+    }
+
+    this->viewport_data.resize(num_viewports);
+    for (std::size_t i = 0; i < num_viewports; ++i)
+    {
+        FeatureSet const& vpf = this->legacy_viewports[i].features;
+        ViewportData& vd = this->viewport_data[i];
+        vd.positions = vpf.positions.data();
+        vd.num_positions = vpf.positions.size();
+        vd.colors = vpf.colors.data();
+        vd.num_colors = vpf.colors.size();
+    }
+    make_matching_refs(this->legacy_matching, &this->matching_refs);
+
+    /* All data is owned, the mapping is not needed anymore. */
+    this->file.close();
+}
+
+void
+MappedPrebundle::get_viewports (ViewportList* viewports) const
+{
+    viewports->clear();
+    viewports->resize(this->viewport_data.size());
+    for (std::size_t i = 0; i < this->viewport_data.size(); ++i)
+    {
+        ViewportData const& vd = this->viewport_data[i];
+        FeatureSet& vpf = viewports->at(i).features;
+        vpf.positions.assign(vd.positions, vd.positions + vd.num_positions);
+        vpf.colors.assign(vd.colors, vd.colors + vd.num_colors);
+    }
+}
+
+void
+MappedPrebundle::get_matching (PairwiseMatching* matching) const
+{
+    matching->clear();
+    matching->resize(this->matching_refs.size());
+    for (std::size_t i = 0; i < this->matching_refs.size(); ++i)
+    {
+        TwoViewMatchingRef const& ref = this->matching_refs[i];
+        TwoViewMatching& tvm = matching->at(i);
+        tvm.view_1_id = ref.view_1_id;
+        tvm.view_2_id = ref.view_2_id;
+        tvm.matches.assign(ref.matches, ref.matches + ref.num_matches);
+    }
+}
+
+void
+MappedPrebundle::get_matching_refs (PairwiseMatchingRef* refs) const
+{
+    *refs = this->matching_refs;
 }
 
 void
@@ -10,12 +10,14 @@
 #ifndef SFM_BUNDLER_COMMON_HEADER
 #define SFM_BUNDLER_COMMON_HEADER
 
+#include <cstddef>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "math/vector.h"
 #include "util/aligned_memory.h"
+#include "util/mapped_file.h"
 #include "mve/image.h"
 #include "sfm/camera_pose.h"
 #include "sfm/correspondence.h"
@@ -127,11 +129,39 @@ struct TwoViewMatching
 /** The matching result between several pairs of views. */
 typedef std::vector<TwoViewMatching> PairwiseMatching;
 
+/**
+ * Non-owning reference to the matching result between two views.
+ * The matches are owned by a PairwiseMatching or a MappedPrebundle.
+ */
+struct TwoViewMatchingRef
+{
+    int view_1_id;
+    int view_2_id;
+    CorrespondenceIndex const* matches;
+    std::size_t num_matches;
+};
+
+/** References to the matching result between several pairs of views. */
+typedef std::vector<TwoViewMatchingRef> PairwiseMatchingRef;
+
+/** Creates references to all pairs in 'matching', which must outlive them. */
+void
+make_matching_refs (PairwiseMatching const& matching,
+    PairwiseMatchingRef* refs);
+
 /* ------------------ Input/Output for Prebundle ------------------ */
 
 /**
  * Saves the pre-bundle data to file, which records all viewport and
  * matching data necessary for incremental structure-from-motion.
+ *
+ * The file starts with the signature MVE_PREBUNDLE_2 followed by a newline
+ * and a fixed size header with the number of viewports and pairs and the
+ * offsets of the viewport and pair tables. The table entries contain the
+ * element counts and file offsets of the per-viewport positions and colors
+ * and the per-pair matches. All arrays are stored contiguously in native
+ * layout and aligned to 8 bytes, so that they can be used in place from a
+ * memory mapping of the file.
  */
 void
 save_prebundle_to_file (ViewportList const& viewports,
@@ -139,11 +169,59 @@ save_prebundle_to_file (ViewportList const& viewports,
 
 /**
  * Loads the pre-bundle data from file, initializing viewports and matching.
+ * Files in the previous MVE_PREBUNDLE format are also supported.
  */
 void
 load_prebundle_from_file (std::string const& filename,
     ViewportList* viewports, PairwiseMatching* matching);
 
+/**
+ * Read access to a memory mapped pre-bundle file. Matches are used in place
+ * from the mapping, which avoids loading and copying all matching data,
+ * and are only paged in by the operating system when accessed. Files in the
+ * previous MVE_PREBUNDLE format are supported, but are parsed into memory.
+ */
+class MappedPrebundle
+{
+public:
+    /** Maps and validates the file, throws on error. */
+    explicit MappedPrebundle (std::string const& filename);
+
+    MappedPrebundle (MappedPrebundle const& other) = delete;
+    MappedPrebundle& operator= (MappedPrebundle const& other) = delete;
+
+    std::size_t get_num_viewports (void) const;
+    std::size_t get_num_pairs (void) const;
+
+    /** Initializes viewports with feature positions and colors. */
+    void get_viewports (ViewportList* viewports) const;
+    /** Copies the pairwise matching. */
+    void get_matching (PairwiseMatching* matching) const;
+    /** Provides references to the matches, valid while this object lives. */
+    void get_matching_refs (PairwiseMatchingRef* refs) const;
+
+private:
+    struct ViewportData
+    {
+        math::Vec2f const* positions;
+        std::size_t num_positions;
+        math::Vec3uc const* colors;
+        std::size_t num_colors;
+    };
+
+private:
+    void parse_mapped (std::string const& filename);
+    void parse_legacy (void);
+
+private:
+    util::fs::MappedFile file;
+    std::vector<ViewportData> viewport_data;
+    PairwiseMatchingRef matching_refs;
+    /* Owned data for files in the previous format. */
+    ViewportList legacy_viewports;
+    PairwiseMatching legacy_matching;
+};
+
 /**
  * Loads survey points and their observations from file.
  *
@@ -206,6 +284,18 @@ Viewport::Viewport (void)
     std::fill(this->principal_point, this->principal_point + 2, 0.5f);
 }
 
+inline std::size_t
+MappedPrebundle::get_num_viewports (void) const
+{
+    return this->viewport_data.size();
+}
+
+inline std::size_t
+MappedPrebundle::get_num_pairs (void) const
+{
+    return this->matching_refs.size();
+}
+
 inline bool
 Track::is_valid (void) const
 {
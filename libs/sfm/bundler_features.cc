@@ -7,6 +7,9 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <cstring>
+#include <exception>
+
 #include "util/timer.h"
 #include "mve/image.h"
 #include "mve/image_exif.h"
@@ -15,9 +18,127 @@
 #include "sfm/extract_focal_length.h"
 #include "sfm/bundler_features.h"
 
+#define FEATURE_CACHE_SIGNATURE "MVE_FEATURE_CACHE_2\n"
+#define FEATURE_CACHE_SIGNATURE_LEN 20
+
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
+namespace
+{
+    /* FNV-1a hash over a sequence of bytes. */
+    uint64_t
+    hash_bytes (uint64_t hash, void const* data, std::size_t size)
+    {
+        unsigned char const* bytes = static_cast<unsigned char const*>(data);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    uint64_t
+    hash_value (uint64_t hash, T const& value)
+    {
+        return hash_bytes(hash, &value, sizeof(T));
+    }
+
+    template <typename T>
+    void
+    write_values (std::string* buffer, T const* values, std::size_t num)
+    {
+        buffer->append(reinterpret_cast<char const*>(values), num * sizeof(T));
+    }
+
+    /* Reads values and advances the read position, checks the size. */
+    template <typename T>
+    bool
+    read_values (char const** pos, char const* end, T* values, std::size_t num)
+    {
+        std::size_t const size = num * sizeof(T);
+        if (static_cast<std::size_t>(end - *pos) < size)
+            return false;
+        std::memcpy(static_cast<void*>(values), *pos, size);
+        *pos += size;
+        return true;
+    }
+
+    void
+    write_descriptors (std::string* buffer,
+        FeatureSet::SiftDescriptors const& descrs,
+        FeatureSet::KeypointGeometry const& geometry)
+    {
+        uint32_t const num = descrs.size();
+        if (geometry.scales.size() != num || geometry.orientations.size() != num)
+            throw std::invalid_argument("SIFT descriptors and geometry mismatch");
+        write_values(buffer, &num, 1);
+        write_values(buffer, geometry.scales.data(), num);
+        write_values(buffer, geometry.orientations.data(), num);
+        write_values(buffer, descrs.data(), num);
+    }
+
+    bool
+    read_descriptors (char const** pos, char const* end,
+        FeatureSet::SiftDescriptors* descrs,
+        FeatureSet::KeypointGeometry* geometry)
+    {
+        /* Check the size before allocating memory for corrupt data. */
+        uint32_t num = 0;
+        std::size_t const feature_size = 2 * sizeof(float)
+            + sizeof(math::Vec128uc);
+        if (!read_values(pos, end, &num, 1)
+            || static_cast<std::size_t>(end - *pos) < num * feature_size)
+            return false;
+        descrs->resize(num);
+        geometry->scales.resize(num);
+        geometry->orientations.resize(num);
+        return read_values(pos, end, geometry->scales.data(), num)
+            && read_values(pos, end, geometry->orientations.data(), num)
+            && read_values(pos, end, descrs->data(), num);
+    }
+
+    template <typename DESCRIPTORS>
+    void
+    write_descriptors (std::string* buffer, DESCRIPTORS const& descrs)
+    {
+        uint32_t const num = descrs.size();
+        write_values(buffer, &num, 1);
+        for (std::size_t i = 0; i < descrs.size(); ++i)
+        {
+            float const header[4] = { descrs[i].x, descrs[i].y,
+                descrs[i].scale, descrs[i].orientation };
+            write_values(buffer, header, 4);
+            write_values(buffer, descrs[i].data.begin(), descrs[i].data.dim);
+        }
+    }
+
+    template <typename DESCRIPTORS>
+    bool
+    read_descriptors (char const** pos, char const* end, DESCRIPTORS* descrs)
+    {
+        uint32_t num = 0;
+        if (!read_values(pos, end, &num, 1))
+            return false;
+        descrs->resize(num);
+        for (std::size_t i = 0; i < descrs->size(); ++i)
+        {
+            typename DESCRIPTORS::value_type& descr = descrs->at(i);
+            float header[4];
+            if (!read_values(pos, end, header, 4)
+                || !read_values(pos, end, descr.data.begin(), descr.data.dim))
+                return false;
+            descr.x = header[0];
+            descr.y = header[1];
+            descr.scale = header[2];
+            descr.orientation = header[3];
+        }
+        return true;
+    }
+}
+
 void
 Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
 {
@@ -35,6 +156,7 @@ Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
     std::size_t num_views = viewports->size();
     std::size_t num_done = 0;
     std::size_t total_features = 0;
+    std::exception_ptr error;
 
     /* Iterate the scene and compute features. */
 #pragma omp parallel for schedule(dynamic,1)
@@ -51,45 +173,193 @@ Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
         if (views[i] == nullptr)
             continue;
 
-        mve::View::Ptr view = views[i];
-        mve::ByteImage::Ptr image = view->get_byte_image
-            (this->opts.image_embedding);
-        if (image == nullptr)
-            continue;
+        /*
+         * Exceptions must not leave the parallel region. The first one
+         * is kept and rethrown after the loop.
+         */
+        try
+        {
+            mve::View::Ptr view = views[i];
+            mve::ByteImage::Ptr image = view->get_byte_image
+                (this->opts.image_embedding);
+            if (image == nullptr)
+                continue;
 
-        /* Rescale image until maximum image size is met. */
-        util::WallTimer timer;
-        while (this->opts.max_image_size > 0
-            && image->width() * image->height() > this->opts.max_image_size)
-            image = mve::image::rescale_half_size<uint8_t>(image);
+            /* Try to load the features from the cache. */
+            util::WallTimer timer;
+            Viewport* viewport = &viewports->at(i);
+            viewport->features.set_options(this->opts.feature_options);
+            std::string const& cache_name
+                = this->opts.feature_cache_embedding;
+            bool const use_cache = !cache_name.empty()
+                && !view->get_directory().empty();
+            uint64_t cache_key = 0;
+            bool cache_hit = false;
+            if (use_cache)
+            {
+                cache_key = feature_cache_key(*image,
+                    this->opts.max_image_size, this->opts.feature_options);
+                try
+                {
+                    mve::ByteImage::Ptr blob = view->has_blob(cache_name)
+                        ? view->get_blob(cache_name) : nullptr;
+                    cache_hit = blob != nullptr && feature_cache_from_blob(
+                        *blob, cache_key, &viewport->features);
+                }
+                catch (std::exception&)
+                {
+                    cache_hit = false;
+                }
+            }
 
-        /* Compute features for view. */
-        Viewport* viewport = &viewports->at(i);
-        viewport->features.set_options(this->opts.feature_options);
-        viewport->features.compute_features(image);
-        viewport->features.normalize_feature_positions(
-            viewport->principal_point[0], viewport->principal_point[1]);
+            if (!cache_hit)
+            {
+                /* Rescale image until maximum image size is met. */
+                while (this->opts.max_image_size > 0
+                    && image->width() * image->height()
+                    > this->opts.max_image_size)
+                    image = mve::image::rescale_half_size<uint8_t>(image);
+
+                /* Compute features for view. */
+                viewport->features.compute_features(image);
+                if (use_cache)
+                {
+                    view->set_blob(feature_cache_to_blob(viewport->features,
+                        cache_key), cache_name);
+                    view->save_view();
+                }
+            }
+            viewport->features.normalize_feature_positions(
+                viewport->principal_point[0], viewport->principal_point[1]);
 
 #pragma omp critical
+            {
+                std::size_t const num_feats
+                    = viewport->features.positions.size();
+                std::cout << "\rView ID "
+                    << util::string::get_filled(view->get_id(), 4, '0')
+                    << " (" << viewport->features.width << "x"
+                    << viewport->features.height << "), "
+                    << util::string::get_filled(num_feats, 5, ' ')
+                    << " features" << (cache_hit ? ", cached" : "")
+                    << ", took " << timer.get_elapsed() << " ms." << std::endl;
+                total_features += viewport->features.positions.size();
+            }
+
+            /* Clean up unused embeddings. */
+            image.reset();
+            view->cache_cleanup();
+        }
+        catch (...)
         {
-            std::size_t const num_feats = viewport->features.positions.size();
-            std::cout << "\rView ID "
-                << util::string::get_filled(view->get_id(), 4, '0') << " ("
-                << image->width() << "x" << image->height() << "), "
-                << util::string::get_filled(num_feats, 5, ' ') << " features"
-                << ", took " << timer.get_elapsed() << " ms." << std::endl;
-            total_features += viewport->features.positions.size();
+#pragma omp critical
+            if (error == nullptr)
+                error = std::current_exception();
         }
-
-        /* Clean up unused embeddings. */
-        image.reset();
-        view->cache_cleanup();
     }
 
+    if (error != nullptr)
+        std::rethrow_exception(error);
+
     std::cout << "\rComputed " << total_features << " features "
         << "for " << num_views << " views (average "
         << (total_features / num_views) << ")." << std::endl;
 }
 
+/* ---------------------------------------------------------------- */
+
+uint64_t
+feature_cache_key (mve::ByteImage const& image, int max_image_size,
+    FeatureSet::Options const& options)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash = hash_bytes(hash, FEATURE_CACHE_SIGNATURE,
+        FEATURE_CACHE_SIGNATURE_LEN);
+
+    /* Image content. */
+    hash = hash_value(hash, image.width());
+    hash = hash_value(hash, image.height());
+    hash = hash_value(hash, image.channels());
+    hash = hash_bytes(hash, image.get_data_pointer(), image.get_byte_size());
+    hash = hash_value(hash, max_image_size);
+
+    /* Feature options. */
+    Sift::Options const& sift = options.sift_opts;
+    Surf::Options const& surf = options.surf_opts;
+    hash = hash_value(hash, static_cast<int>(options.feature_types));
+    hash = hash_value(hash, options.use_root_sift);
+    hash = hash_value(hash, sift.num_samples_per_octave);
+    hash = hash_value(hash, sift.min_octave);
+    hash = hash_value(hash, sift.max_octave);
+    hash = hash_value(hash, sift.contrast_threshold);
+    hash = hash_value(hash, sift.edge_ratio_threshold);
+    hash = hash_value(hash, sift.base_blur_sigma);
+    hash = hash_value(hash, sift.inherent_blur_sigma);
+    hash = hash_value(hash, surf.contrast_threshold);
+    hash = hash_value(hash, surf.use_upright_descriptor);
+    return hash;
+}
+
+mve::ByteImage::Ptr
+feature_cache_to_blob (FeatureSet const& features, uint64_t key)
+{
+    std::string buffer(FEATURE_CACHE_SIGNATURE, FEATURE_CACHE_SIGNATURE_LEN);
+    write_values(&buffer, &key, 1);
+    int32_t const dimensions[2] = { features.width, features.height };
+    write_values(&buffer, dimensions, 2);
+
+    uint32_t const num_features = features.positions.size();
+    if (features.colors.size() != num_features)
+        throw std::invalid_argument("Feature positions and colors mismatch");
+    write_values(&buffer, &num_features, 1);
+    write_values(&buffer, features.positions.data(), num_features);
+    write_values(&buffer, features.colors.data(), num_features);
+    write_descriptors(&buffer, features.sift_descriptors,
+        features.sift_geometry);
+    write_descriptors(&buffer, features.surf_descriptors);
+
+    mve::ByteImage::Ptr blob = mve::ByteImage::create(buffer.size(), 1, 1);
+    std::copy(buffer.begin(), buffer.end(), blob->begin());
+    return blob;
+}
+
+bool
+feature_cache_from_blob (mve::ByteImage const& blob, uint64_t key,
+    FeatureSet* features)
+{
+    char const* pos = reinterpret_cast<char const*>(blob.get_data_pointer());
+    char const* end = pos + blob.get_byte_size();
+
+    char signature[FEATURE_CACHE_SIGNATURE_LEN];
+    uint64_t blob_key = 0;
+    if (!read_values(&pos, end, signature, FEATURE_CACHE_SIGNATURE_LEN)
+        || !std::equal(signature, signature + FEATURE_CACHE_SIGNATURE_LEN,
+        FEATURE_CACHE_SIGNATURE)
+        || !read_values(&pos, end, &blob_key, 1) || blob_key != key)
+        return false;
+
+    int32_t dimensions[2];
+    uint32_t num_features = 0;
+    if (!read_values(&pos, end, dimensions, 2)
+        || !read_values(&pos, end, &num_features, 1))
+        return false;
+
+    FeatureSet result = *features;
+    result.width = dimensions[0];
+    result.height = dimensions[1];
+    result.positions.resize(num_features);
+    result.colors.resize(num_features);
+    if (!read_values(&pos, end, result.positions.data(), num_features)
+        || !read_values(&pos, end, result.colors.data(), num_features)
+        || !read_descriptors(&pos, end, &result.sift_descriptors,
+            &result.sift_geometry)
+        || !read_descriptors(&pos, end, &result.surf_descriptors)
+        || pos != end)
+        return false;
+
+    std::swap(*features, result);
+    return true;
+}
+
 SFM_BUNDLER_NAMESPACE_END
 SFM_NAMESPACE_END
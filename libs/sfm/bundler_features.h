@@ -10,6 +10,7 @@
 #ifndef SFM_BUNDLER_FEATURES_HEADER
 #define SFM_BUNDLER_FEATURES_HEADER
 
+#include <cstdint>
 #include <string>
 #include <limits>
 
@@ -24,6 +25,12 @@ SFM_BUNDLER_NAMESPACE_BEGIN
 /**
  * Bundler Component: Computes image features for every view in the scene
  * and stores the features in the viewports.
+ *
+ * If a feature cache embedding is configured, the features (positions,
+ * colors and descriptors) of every view are stored as BLOB in the view.
+ * The BLOB is keyed by a hash of the source image and the feature options,
+ * and the features are loaded from the BLOB instead of being recomputed
+ * on later runs if the key matches.
  */
 class Features
 {
@@ -38,6 +45,8 @@ public:
         int max_image_size;
         /** Feature set options. */
         FeatureSet::Options feature_options;
+        /** The BLOB name for the feature cache. Empty disables caching. */
+        std::string feature_cache_embedding;
     };
 
 public:
@@ -50,6 +59,31 @@ private:
     Options opts;
 };
 
+/* ------------------------- Feature Cache ------------------------ */
+
+/**
+ * Computes the feature cache key from the image content, the maximum image
+ * size and the feature options (excluding console output flags).
+ */
+uint64_t
+feature_cache_key (mve::ByteImage const& image, int max_image_size,
+    FeatureSet::Options const& options);
+
+/**
+ * Serializes the features to a BLOB with the given key. The feature
+ * positions are expected to be not normalized.
+ */
+mve::ByteImage::Ptr
+feature_cache_to_blob (FeatureSet const& features, uint64_t key);
+
+/**
+ * Restores the features from the BLOB. Returns false if the BLOB is
+ * invalid or has been created with a different key.
+ */
+bool
+feature_cache_from_blob (mve::ByteImage const& blob, uint64_t key,
+    FeatureSet* features);
+
 /* ------------------------ Implementation ------------------------ */
 
 inline
@@ -7,6 +7,7 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
 #include <limits>
 #include <iostream>
 #include <utility>
@@ -47,6 +48,7 @@ Incremental::initialize (ViewportList* viewports, TrackList* tracks,
         Track& track = tracks->at(i);
         track.invalidate();
     }
+    this->num_valid_track_refs.assign(this->viewports->size(), 0);
 }
 
 /* ---------------------------------------------------------------- */
@@ -54,24 +56,13 @@ Incremental::initialize (ViewportList* viewports, TrackList* tracks,
 void
 Incremental::find_next_views (std::vector<int>* next_views)
 {
-    /* Create mapping from valid tracks to view ID. */
+    /* Create mapping from valid tracks to unreconstructed view ID. */
     std::vector<std::pair<int, int> > valid_tracks(this->viewports->size());
     for (std::size_t i = 0; i < valid_tracks.size(); ++i)
-        valid_tracks[i] = std::make_pair(0, static_cast<int>(i));
-
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
-            continue;
-
-        for (std::size_t j = 0; j < track.features.size(); ++j)
-        {
-            int const view_id = track.features[j].view_id;
-            if (this->viewports->at(view_id).pose.is_valid())
-                continue;
-            valid_tracks[view_id].first += 1;
-        }
+        int const num_refs = this->viewports->at(i).pose.is_valid()
+            ? 0 : this->num_valid_track_refs[i];
+        valid_tracks[i] = std::make_pair(num_refs, static_cast<int>(i));
     }
 
     /* Sort descending by number of valid tracks. */
@@ -90,6 +81,59 @@ Incremental::find_next_views (std::vector<int>* next_views)
 
 bool
 Incremental::reconstruct_next_view (int view_id)
+{
+    ViewPose view_pose;
+    this->compute_view_pose(view_id, &view_pose);
+    if (!this->accept_view_pose(view_pose))
+        return false;
+    this->commit_view_pose(view_id, view_pose);
+
+    if (this->survey_points != nullptr && !registered)
+        this->try_registration();
+
+    return true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::reconstruct_next_views (std::vector<int> const& view_ids,
+    std::vector<int>* reconstructed_views)
+{
+    /*
+     * The poses are computed from a read-only snapshot of the tracks.
+     * The views are committed afterwards, as committing a view modifies
+     * the tracks and the viewport.
+     */
+    std::vector<ViewPose> view_poses(view_ids.size());
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+        this->compute_view_pose(view_ids[i], &view_poses[i]);
+
+    reconstructed_views->clear();
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        if (this->opts.verbose_output && view_ids.size() > 1)
+            std::cout << "View ID " << view_ids[i] << ":" << std::endl;
+        if (!this->accept_view_pose(view_poses[i]))
+            continue;
+        this->commit_view_pose(view_ids[i], view_poses[i]);
+        reconstructed_views->push_back(view_ids[i]);
+    }
+
+    /*
+     * Registration transforms all cameras and tracks. It is done once
+     * after the whole batch is committed, otherwise the poses still
+     * pending in the batch would be committed in the old frame.
+     */
+    if (this->survey_points != nullptr && !registered)
+        this->try_registration();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::compute_view_pose (int view_id, ViewPose* view_pose) const
 {
     Viewport const& viewport = this->viewports->at(view_id);
     FeatureSet const& features = viewport.features;
@@ -114,14 +158,8 @@ Incremental::reconstruct_next_view (int view_id)
         feature_ids.push_back(i);
     }
 
-    if (this->opts.verbose_output)
-    {
-        std::cout << "Collected " << corr.size()
-            << " 2D-3D correspondences." << std::endl;
-    }
-
     /* Initialize a temporary camera. */
-    CameraPose temp_camera;
+    CameraPose& temp_camera = view_pose->pose;
     temp_camera.set_k_matrix(viewport.focal_length, 0.0, 0.0);
 
     /* Compute pose from 2D-3D correspondences using P3P. */
@@ -131,65 +169,90 @@ Incremental::reconstruct_next_view (int view_id)
         RansacPoseP3P ransac(this->opts.pose_p3p_opts);
         ransac.estimate(corr, temp_camera.K, &ransac_result);
     }
+    view_pose->num_correspondences = corr.size();
+    view_pose->num_inliers = ransac_result.inliers.size();
+    view_pose->runtime_ms = timer.get_elapsed();
+
+    temp_camera.R = ransac_result.pose.delete_col(3);
+    temp_camera.t = ransac_result.pose.col(3);
+
+    /* Collect outlier tracks to be removed from the viewport. */
+    for (std::size_t i = 0; i < ransac_result.inliers.size(); ++i)
+        track_ids[ransac_result.inliers[i]] = -1;
+    for (std::size_t i = 0; i < track_ids.size(); ++i)
+    {
+        if (track_ids[i] < 0)
+            continue;
+        view_pose->outlier_track_ids.push_back(track_ids[i]);
+        view_pose->outlier_feature_ids.push_back(feature_ids[i]);
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+bool
+Incremental::accept_view_pose (ViewPose const& view_pose) const
+{
+    if (this->opts.verbose_output)
+    {
+        std::cout << "Collected " << view_pose.num_correspondences
+            << " 2D-3D correspondences." << std::endl;
+    }
 
-    /* Cancel if inliers are below a 33% threshold. */
-    if (3 * ransac_result.inliers.size() < corr.size())
+    /* Reject the pose if inliers are below a 33% threshold. */
+    if (3 * view_pose.num_inliers < view_pose.num_correspondences)
     {
         if (this->opts.verbose_output)
-            std::cout << "Only " << ransac_result.inliers.size()
+            std::cout << "Only " << view_pose.num_inliers
                 << " 2D-3D correspondences inliers ("
-                << (100 * ransac_result.inliers.size() / corr.size())
+                << (100 * view_pose.num_inliers
+                / view_pose.num_correspondences)
                 << "%). Skipping view." << std::endl;
         return false;
     }
     else if (this->opts.verbose_output)
     {
-        std::cout << "Selected " << ransac_result.inliers.size()
+        std::cout << "Selected " << view_pose.num_inliers
             << " 2D-3D correspondences inliers ("
-            << (100 * ransac_result.inliers.size() / corr.size())
-            << "%), took " << timer.get_elapsed() << "ms." << std::endl;
+            << (100 * view_pose.num_inliers / view_pose.num_correspondences)
+            << "%), took " << view_pose.runtime_ms << "ms." << std::endl;
     }
 
+    return true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::commit_view_pose (int view_id, ViewPose const& view_pose)
+{
     /*
      * Remove outliers from tracks and tracks from viewport.
      * Once single cam BA has been performed and parameters for this
      * camera are optimized, tracks are evaluated again and restored.
      */
-    for (std::size_t i = 0; i < ransac_result.inliers.size(); ++i)
-        track_ids[ransac_result.inliers[i]] = -1;
-    for (std::size_t i = 0; i < track_ids.size(); ++i)
+    Viewport& viewport = this->viewports->at(view_id);
+    for (std::size_t i = 0; i < view_pose.outlier_track_ids.size(); ++i)
     {
-        if (track_ids[i] < 0)
-            continue;
-        this->tracks->at(track_ids[i]).remove_view(view_id);
-        this->viewports->at(view_id).track_ids[feature_ids[i]] = -1;
-        this->viewports->at(view_id).backup_tracks.emplace(
-            feature_ids[i], track_ids[i]);
+        int const track_id = view_pose.outlier_track_ids[i];
+        int const feature_id = view_pose.outlier_feature_ids[i];
+        this->remove_view_from_track(view_id, &this->tracks->at(track_id));
+        viewport.track_ids[feature_id] = -1;
+        viewport.backup_tracks.emplace(feature_id, track_id);
     }
-    track_ids.clear();
-    feature_ids.clear();
 
     /* Commit camera using known K and computed R and t. */
+    viewport.pose = view_pose.pose;
+    if (this->opts.verbose_output)
     {
-        CameraPose& pose = this->viewports->at(view_id).pose;
-        pose = temp_camera;
-        pose.R = ransac_result.pose.delete_col(3);
-        pose.t = ransac_result.pose.col(3);
-
-        if (this->opts.verbose_output)
-        {
-            std::cout << "Reconstructed camera "
-                << view_id << " with focal length "
-                << pose.get_focal_length() << std::endl;
-        }
+        std::cout << "Reconstructed camera "
+            << view_id << " with focal length "
+            << viewport.pose.get_focal_length() << std::endl;
     }
-
-    if (this->survey_points != nullptr && !registered)
-        this->try_registration();
-
-    return true;
 }
 
+/* ---------------------------------------------------------------- */
+
 void
 Incremental::try_restore_tracks_for_views (void)
 {
@@ -223,6 +286,7 @@ Incremental::try_restore_tracks_for_views (void)
             {
                 viewport.track_ids[feature_id] = track_id;
                 this->tracks->at(track_id).features.emplace_back(i, feature_id);
+                this->num_valid_track_refs[i] += 1;
             }
         }
     }
@@ -230,6 +294,32 @@ Incremental::try_restore_tracks_for_views (void)
 
 /* ---------------------------------------------------------------- */
 
+void
+Incremental::add_valid_track (Track const& track)
+{
+    for (std::size_t i = 0; i < track.features.size(); ++i)
+        this->num_valid_track_refs[track.features[i].view_id] += 1;
+}
+
+void
+Incremental::remove_valid_track (Track const& track)
+{
+    for (std::size_t i = 0; i < track.features.size(); ++i)
+        this->num_valid_track_refs[track.features[i].view_id] -= 1;
+}
+
+void
+Incremental::remove_view_from_track (int view_id, Track* track)
+{
+    std::size_t const num_features = track->features.size();
+    track->remove_view(view_id);
+    if (track->is_valid())
+        this->num_valid_track_refs[view_id] -= static_cast<int>(
+            num_features - track->features.size());
+}
+
+/* ---------------------------------------------------------------- */
+
 void
 Incremental::try_registration () {
     std::vector<math::Vec3d> p0;
@@ -350,6 +440,7 @@ Incremental::triangulate_new_tracks (int min_num_views)
         if (!triangulator.triangulate(poses, pos, &track_pos, &stats, &outlier))
             continue;
         this->tracks->at(i).pos = track_pos;
+        this->add_valid_track(this->tracks->at(i));
 
         /* Check if track contains outliers */
         if (outlier.size() == 0)
@@ -365,7 +456,7 @@ Incremental::triangulate_new_tracks (int min_num_views)
             int const view_id = view_ids[outlier[i]];
             int const feature_id = feature_ids[outlier[i]];
             /* Remove outlier from inlier track */
-            inlier_track.remove_view(view_id);
+            this->remove_view_from_track(view_id, &inlier_track);
             /* Add features to new track */
             outlier_track.features.emplace_back(view_id, feature_id);
             /* Change TrackID in viewports */
@@ -393,6 +484,75 @@ Incremental::bundle_adjustment_full (void)
 
 /* ---------------------------------------------------------------- */
 
+void
+Incremental::bundle_adjustment_local (std::vector<int> const& view_ids)
+{
+    std::vector<bool> local_views(this->viewports->size(), false);
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        int const view_id = view_ids[i];
+        if (view_id < 0 || std::size_t(view_id) >= this->viewports->size()
+            || !this->viewports->at(view_id).pose.is_valid())
+            throw std::invalid_argument("Invalid view ID");
+        local_views[view_id] = true;
+    }
+
+    /*
+     * The local tracks are found through the track references of the
+     * views, which avoids iterating over all tracks and observations.
+     */
+    std::vector<int> local_tracks;
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+        this->collect_valid_tracks(view_ids[i], &local_tracks);
+
+    /* Count tracks shared between the given views and all other views. */
+    std::vector<int> covisibility(this->viewports->size(), 0);
+    for (std::size_t i = 0; i < local_tracks.size(); ++i)
+    {
+        Track const& track = this->tracks->at(local_tracks[i]);
+        for (std::size_t j = 0; j < track.features.size(); ++j)
+            covisibility[track.features[j].view_id] += 1;
+    }
+
+    /* Add the most co-visible views with a valid pose as neighbors. */
+    std::vector<std::pair<int, int> > neighbors;
+    for (std::size_t i = 0; i < covisibility.size(); ++i)
+        if (covisibility[i] > 0 && !local_views[i]
+            && this->viewports->at(i).pose.is_valid())
+            neighbors.push_back(std::make_pair(-covisibility[i], int(i)));
+    std::size_t const num_neighbors = std::min(neighbors.size(),
+        std::size_t(std::max(0, this->opts.ba_local_num_neighbors)));
+    std::partial_sort(neighbors.begin(), neighbors.begin() + num_neighbors,
+        neighbors.end());
+    for (std::size_t i = 0; i < num_neighbors; ++i)
+    {
+        local_views[neighbors[i].second] = true;
+        this->collect_valid_tracks(neighbors[i].second, &local_tracks);
+    }
+
+    /* Tracks observed by several local views are only added once. */
+    std::sort(local_tracks.begin(), local_tracks.end());
+    local_tracks.erase(std::unique(local_tracks.begin(), local_tracks.end()),
+        local_tracks.end());
+
+    this->bundle_adjustment_intern(-3, &local_views, &local_tracks);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::collect_valid_tracks (int view_id,
+    std::vector<int>* track_ids) const
+{
+    std::vector<int> const& view_tracks
+        = this->viewports->at(view_id).track_ids;
+    for (std::size_t i = 0; i < view_tracks.size(); ++i)
+        if (view_tracks[i] >= 0 && this->tracks->at(view_tracks[i]).is_valid())
+            track_ids->push_back(view_tracks[i]);
+}
+
+/* ---------------------------------------------------------------- */
+
 void
 Incremental::bundle_adjustment_single_cam (int view_id)
 {
@@ -413,20 +573,41 @@ Incremental::bundle_adjustment_points_only (void)
 /* ---------------------------------------------------------------- */
 
 void
-Incremental::bundle_adjustment_intern (int single_camera_ba)
+Incremental::bundle_adjustment_intern (int single_camera_ba,
+    std::vector<bool> const* local_views, std::vector<int> const* local_tracks)
 {
     ba::BundleAdjustment::Options ba_opts;
     ba_opts.fixed_intrinsics = this->opts.ba_fixed_intrinsics;
     ba_opts.verbose_output = this->opts.verbose_ba;
+    ba_opts.linear_opts.implicit_schur = this->opts.ba_implicit_schur;
     if (single_camera_ba >= 0)
         ba_opts.bundle_mode = ba::BundleAdjustment::BA_CAMERAS;
     else if (single_camera_ba == -2)
         ba_opts.bundle_mode = ba::BundleAdjustment::BA_POINTS;
     else if (single_camera_ba == -1)
         ba_opts.bundle_mode = ba::BundleAdjustment::BA_CAMERAS_AND_POINTS;
+    else if (single_camera_ba == -3 && local_views != nullptr
+        && local_tracks != nullptr)
+        ba_opts.bundle_mode = ba::BundleAdjustment::BA_CAMERAS_AND_POINTS;
     else
         throw std::invalid_argument("Invalid BA mode selection");
 
+    /*
+     * For local BA, only tracks observed by the local views are optimized.
+     * The remaining cameras observing these tracks are kept constant.
+     */
+    std::vector<bool> used_views;
+    if (local_views != nullptr)
+    {
+        used_views = *local_views;
+        for (std::size_t i = 0; i < local_tracks->size(); ++i)
+        {
+            Track const& track = this->tracks->at(local_tracks->at(i));
+            for (std::size_t j = 0; j < track.features.size(); ++j)
+                used_views[track.features[j].view_id] = true;
+        }
+    }
+
     /* Convert camera to BA data structures. */
     std::vector<ba::Camera> ba_cameras;
     std::vector<int> ba_cameras_mapping(this->viewports->size(), -1);
@@ -434,6 +615,8 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
     {
         if (single_camera_ba >= 0 && int(i) != single_camera_ba)
             continue;
+        if (local_views != nullptr && !used_views[i])
+            continue;
 
         Viewport const& view = this->viewports->at(i);
         CameraPose const& pose = view.pose;
@@ -446,6 +629,7 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
         std::copy(pose.R.begin(), pose.R.end(), cam.rotation);
         std::copy(view.radial_distortion,
             view.radial_distortion + 2, cam.distortion);
+        cam.is_constant = local_views != nullptr && !local_views->at(i);
         ba_cameras_mapping[i] = ba_cameras.size();
         ba_cameras.push_back(cam);
     }
@@ -453,9 +637,12 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
     /* Convert tracks and observations to BA data structures. */
     std::vector<ba::Observation> ba_points_2d;
     std::vector<ba::Point3D> ba_points_3d;
-    std::vector<int> ba_tracks_mapping(this->tracks->size(), -1);
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    std::vector<int> ba_track_ids;
+    std::size_t const num_tracks = local_tracks != nullptr
+        ? local_tracks->size() : this->tracks->size();
+    for (std::size_t k = 0; k < num_tracks; ++k)
     {
+        int const i = local_tracks != nullptr ? local_tracks->at(k) : int(k);
         Track const& track = this->tracks->at(i);
         if (!track.is_valid())
             continue;
@@ -463,7 +650,7 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
         /* Add corresponding 3D point to BA. */
         ba::Point3D point;
         std::copy(track.pos.begin(), track.pos.end(), point.pos);
-        ba_tracks_mapping[i] = ba_points_3d.size();
+        ba_track_ids.push_back(i);
         ba_points_3d.push_back(point);
 
         /* Add all observations to BA. */
@@ -482,7 +669,7 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
             ba::Observation point;
             std::copy(f2d.begin(), f2d.end(), point.pos);
             point.camera_id = ba_cameras_mapping[view_id];
-            point.point_id = ba_tracks_mapping[i];
+            point.point_id = ba_points_3d.size() - 1;
             ba_points_2d.push_back(point);
         }
     }
@@ -502,9 +689,7 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
         {
             SurveyObservation const& obs = survey_point.observations[j];
             int const view_id = obs.view_id;
-            if (!this->viewports->at(view_id).pose.is_valid())
-                continue;
-            if (single_camera_ba >= 0 && view_id != single_camera_ba)
+            if (ba_cameras_mapping[view_id] < 0)
                 continue;
 
             ba::Observation point;
@@ -533,6 +718,9 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
         Viewport& view = this->viewports->at(i);
         CameraPose& pose = view.pose;
         ba::Camera const& cam = ba_cameras[ba_cam_counter];
+        ba_cam_counter += 1;
+        if (cam.is_constant)
+            continue;
 
         if (this->opts.verbose_output && !this->opts.ba_fixed_intrinsics)
         {
@@ -551,7 +739,6 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
         std::copy(cam.rotation, cam.rotation + 9, pose.R.begin());
         std::copy(cam.distortion, cam.distortion + 2, view.radial_distortion);
         pose.set_k_matrix(cam.focal_length, 0.0, 0.0);
-        ba_cam_counter += 1;
     }
 
     /* Exit if single camera BA is used. */
@@ -559,16 +746,11 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
         return;
 
     /* Transfer tracks back to SfM data structures. */
-    std::size_t ba_track_counter = 0;
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    for (std::size_t i = 0; i < ba_track_ids.size(); ++i)
     {
-        Track& track = this->tracks->at(i);
-        if (!track.is_valid())
-            continue;
-
-        ba::Point3D const& point = ba_points_3d[ba_track_counter];
+        Track& track = this->tracks->at(ba_track_ids[i]);
+        ba::Point3D const& point = ba_points_3d[i];
         std::copy(point.pos, point.pos + 3, track.pos.begin());
-        ba_track_counter += 1;
     }
 }
 
@@ -634,7 +816,9 @@ Incremental::invalidate_large_error_tracks (void)
     {
         if (all_errors[i].first > square_threshold)
         {
-            this->tracks->at(all_errors[i].second).invalidate();
+            Track& track = this->tracks->at(all_errors[i].second);
+            this->remove_valid_track(track);
+            track.invalidate();
             num_deleted_tracks += 1;
         }
     }
@@ -10,6 +10,8 @@
 #ifndef SFM_BUNDLER_INCREMENTAL_HEADER
 #define SFM_BUNDLER_INCREMENTAL_HEADER
 
+#include <vector>
+
 #include "mve/bundle.h"
 #include "sfm/fundamental.h"
 #include "sfm/ransac_fundamental.h"
@@ -43,6 +45,10 @@ public:
         bool ba_fixed_intrinsics;
         /** Bundle Adjustment with shared intrinsics. */
         bool ba_shared_intrinsics;
+        /** Bundle Adjustment with matrix-free (implicit) Schur complement. */
+        bool ba_implicit_schur;
+        /** Maximum number of co-visible neighbors in local BA. */
+        int ba_local_num_neighbors;
         /** Produce status messages on the console. */
         bool verbose_output;
         /** Produce detailed BA messages on the console. */
@@ -59,6 +65,8 @@ public:
      *   so that initial tracks can be triangulated. Radial distortion and
      *   the camera pose is regularly updated.
      * - tracks: The tracks are triangulated and regularly updated.
+     *   Tracks must not be validated or invalidated externally afterwards,
+     *   as the number of valid tracks per view is maintained incrementally.
      */
     void initialize (ViewportList* viewports, TrackList* tracks,
         SurveyPointList* survey_points = nullptr);
@@ -70,6 +78,13 @@ public:
     void find_next_views (std::vector<int>* next_views);
     /** Incrementally adds the given view to the bundle. */
     bool reconstruct_next_view (int view_id);
+    /**
+     * Computes the poses of the given views concurrently from the current
+     * tracks and adds all successfully posed views to the bundle. The IDs
+     * of the added views are returned in the order of the given views.
+     */
+    void reconstruct_next_views (std::vector<int> const& view_ids,
+        std::vector<int>* reconstructed_views);
     /** Restore tracks for views after intrinsics are optimized. */
     void try_restore_tracks_for_views (void);
     /** Triangulates tracks without 3D position and at least N views. */
@@ -78,6 +93,12 @@ public:
     void invalidate_large_error_tracks (void);
     /** Runs bundle adjustment on both, structure and motion. */
     void bundle_adjustment_full (void);
+    /**
+     * Runs bundle adjustment on the given views, their most co-visible
+     * neighbors and the tracks observed by these views. All other cameras
+     * observing these tracks are included as constant cameras.
+     */
+    void bundle_adjustment_local (std::vector<int> const& view_ids);
     /** Runs bundle adjustment on a single camera without structure. */
     void bundle_adjustment_single_cam (int view_id);
     /** Runs bundle adjustment on the structure (3D points) only. */
@@ -94,13 +115,37 @@ public:
     mve::Bundle::Ptr create_bundle (void) const;
 
 private:
-    void bundle_adjustment_intern (int single_camera_ba);
+    /** Pose of a view from 2D-3D correspondences and its outliers. */
+    struct ViewPose
+    {
+        CameraPose pose;
+        std::size_t num_correspondences = 0;
+        std::size_t num_inliers = 0;
+        std::size_t runtime_ms = 0;
+        std::vector<int> outlier_track_ids;
+        std::vector<int> outlier_feature_ids;
+    };
+
+private:
+    void compute_view_pose (int view_id, ViewPose* view_pose) const;
+    bool accept_view_pose (ViewPose const& view_pose) const;
+    void commit_view_pose (int view_id, ViewPose const& view_pose);
+    void add_valid_track (Track const& track);
+    void remove_valid_track (Track const& track);
+    void remove_view_from_track (int view_id, Track* track);
+    void collect_valid_tracks (int view_id,
+        std::vector<int>* track_ids) const;
+    void bundle_adjustment_intern (int single_camera_ba,
+        std::vector<bool> const* local_views = nullptr,
+        std::vector<int> const* local_tracks = nullptr);
 
 private:
     Options opts;
     ViewportList* viewports;
     TrackList* tracks;
     SurveyPointList* survey_points;
+    /** Per view number of feature references in valid tracks. */
+    std::vector<int> num_valid_track_refs;
     bool registered = false;
 };
 
@@ -113,6 +158,8 @@ Incremental::Options::Options (void)
     , min_triangulation_angle(MATH_DEG2RAD(1.0))
     , ba_fixed_intrinsics(false)
     , ba_shared_intrinsics(false)
+    , ba_implicit_schur(false)
+    , ba_local_num_neighbors(20)
     , verbose_output(false)
     , verbose_ba(false)
 {
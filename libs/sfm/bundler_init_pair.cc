@@ -7,7 +7,10 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <limits>
 #include <vector>
 #include <sstream>
 #include <random>
@@ -29,30 +32,28 @@ InitialPair::compute_pair (Result* result)
     result->view_1_id = -1;
     result->view_2_id = -1;
 
-    /* Convert tracks to pairwise information. */
-    std::vector<CandidatePair> candidates;
-    this->compute_candidate_pairs(&candidates);
-
-    /* Sort the candidate pairs by number of matches. */
-    std::sort(candidates.rbegin(), candidates.rend());
+    /* Convert tracks to pairwise information, sorted by priority. */
+    this->prepare_candidates();
 
     /*
      * Search for a good initial pair and return the first pair that
      * satisfies all thresholds (min matches, max homography inliers,
-     * min triangulation angle). If no pair satisfies all thresholds, the
-     * pair with the best score is returned.
+     * min triangulation angle). Candidates after a pair satisfying all
+     * thresholds are skipped, candidates before are still evaluated, which
+     * makes the result independent of the number of threads. If no pair
+     * satisfies all thresholds, the pair with the best score is returned.
      */
-    bool found_pair = false;
-    std::size_t found_pair_id = std::numeric_limits<std::size_t>::max();
-    std::vector<float> pair_scores(candidates.size(), 0.0f);
+    std::size_t const no_pair = std::numeric_limits<std::size_t>::max();
+    std::atomic<std::size_t> found_pair_id(no_pair);
 #pragma omp parallel for schedule(dynamic)
-    for (std::size_t i = 0; i < candidates.size(); ++i)
+    for (std::size_t i = 0; i < this->candidates.size(); ++i)
     {
-        if (found_pair)
+        CandidatePair const& candidate = this->candidates[i];
+        CandidateEvaluation& eval = this->evaluations[i];
+        if (eval.rejected || i > found_pair_id)
             continue;
 
         /* Reject pairs with 8 or fewer matches. */
-        CandidatePair const& candidate = candidates[i];
         std::size_t num_matches = candidate.matches.size();
         if (num_matches < static_cast<std::size_t>(this->opts.min_num_matches))
         {
@@ -61,7 +62,13 @@ InitialPair::compute_pair (Result* result)
         }
 
         /* Reject pairs with too high percentage of homograhy inliers. */
-        std::size_t num_inliers = this->compute_homography_inliers(candidate);
+        if (!eval.homography_computed)
+        {
+            eval.num_homography_inliers
+                = this->compute_homography_inliers(candidate);
+            eval.homography_computed = true;
+        }
+        std::size_t const num_inliers = eval.num_homography_inliers;
         float percentage = static_cast<float>(num_inliers) / num_matches;
         if (percentage > this->opts.max_homography_inliers)
         {
@@ -69,79 +76,74 @@ InitialPair::compute_pair (Result* result)
             continue;
         }
 
-        /* Compute initial pair pose. */
-        CameraPose pose1, pose2;
-        bool const found_pose = this->compute_pose(candidate, &pose1, &pose2);
-        if (!found_pose)
+        /* Cancel if a pair with higher priority has been found meanwhile. */
+        if (i > found_pair_id)
+            continue;
+
+        /* Compute initial pair pose, angle and triangulation statistics. */
+        if (!eval.pose_computed)
+        {
+            eval.found_pose = this->compute_pose(candidate,
+                &eval.pose1, &eval.pose2);
+            if (eval.found_pose)
+            {
+                eval.angle = this->angle_for_pose(candidate,
+                    eval.pose1, eval.pose2);
+                eval.score = this->score_for_pair(candidate,
+                    num_inliers, eval.angle);
+                if (eval.angle >= this->opts.min_triangulation_angle)
+                    eval.num_triangulated = this->compute_num_triangulated(
+                        candidate, eval.pose1, eval.pose2);
+            }
+            eval.pose_computed = true;
+        }
+        if (!eval.found_pose)
         {
             this->debug_output(candidate, num_inliers);
             continue;
         }
 
         /* Rejects pairs with bad triangulation angle. */
-        double const angle = this->angle_for_pose(candidate, pose1, pose2);
-        pair_scores[i] = this->score_for_pair(candidate, num_inliers, angle);
-        this->debug_output(candidate, num_inliers, angle);
-        if (angle < this->opts.min_triangulation_angle)
+        this->debug_output(candidate, num_inliers, eval.angle);
+        if (eval.angle < this->opts.min_triangulation_angle)
             continue;
 
-        /* Run triangulation to ensure correct pair */
-        Triangulate::Options triangulate_opts;
-        Triangulate triangulator(triangulate_opts);
-        std::vector<CameraPose const*> poses;
-        poses.push_back(&pose1);
-        poses.push_back(&pose2);
-        std::size_t successful_triangulations = 0;
-        std::vector<math::Vec2f> positions(2);
-        Triangulate::Statistics stats;
-        for (std::size_t j = 0; j < candidate.matches.size(); ++j)
-        {
-            positions[0] = math::Vec2f(candidate.matches[j].p1);
-            positions[1] = math::Vec2f(candidate.matches[j].p2);
-            math::Vec3d pos3d;
-            if (triangulator.triangulate(poses, positions, &pos3d, &stats))
-                successful_triangulations += 1;
-        }
-        if (successful_triangulations * 2 < candidate.matches.size())
+        /* Require triangulation of the majority of matches. */
+        if (eval.num_triangulated * 2 < candidate.matches.size())
             continue;
 
-#pragma omp critical
-        if (i < found_pair_id)
-        {
-            result->view_1_id = candidate.view_1_id;
-            result->view_2_id = candidate.view_2_id;
-            result->view_1_pose = pose1;
-            result->view_2_pose = pose2;
-            found_pair_id = i;
-            found_pair = true;
-        }
+        /* Keep the pair with the highest priority. */
+        std::size_t current_id = found_pair_id;
+        while (i < current_id
+            && !found_pair_id.compare_exchange_weak(current_id, i))
+            continue;
     }
 
     /* Return if a pair satisfying all thresholds has been found. */
-    if (found_pair)
-        return;
-
-    /* Return pair with best score (larger than 0.0). */
-    std::cout << "Searching for pair with best score..." << std::endl;
-    float best_score = 0.0f;
-    std::size_t best_pair_id = 0;
-    for (std::size_t i = 0; i < pair_scores.size(); ++i)
+    std::size_t pair_id = found_pair_id;
+    if (pair_id == no_pair)
     {
-        if (pair_scores[i] <= best_score)
-            continue;
+        /* Return pair with best score (larger than 0.0). */
+        std::cout << "Searching for pair with best score..." << std::endl;
+        float best_score = 0.0f;
+        for (std::size_t i = 0; i < this->evaluations.size(); ++i)
+        {
+            CandidateEvaluation const& eval = this->evaluations[i];
+            if (eval.rejected || eval.score <= best_score)
+                continue;
 
-        best_score = pair_scores[i];
-        best_pair_id = i;
+            best_score = eval.score;
+            pair_id = i;
+        }
+        if (pair_id == no_pair)
+            return;
     }
 
-    /* Recompute pose for pair with best score. */
-    if (best_score > 0.0f)
-    {
-        result->view_1_id = candidates[best_pair_id].view_1_id;
-        result->view_2_id = candidates[best_pair_id].view_2_id;
-        this->compute_pose(candidates[best_pair_id],
-            &result->view_1_pose, &result->view_2_pose);
-    }
+    /* The pose for the resulting pair is taken from the cache. */
+    result->view_1_id = this->candidates[pair_id].view_1_id;
+    result->view_2_id = this->candidates[pair_id].view_2_id;
+    result->view_1_pose = this->evaluations[pair_id].pose1;
+    result->view_2_pose = this->evaluations[pair_id].pose2;
 }
 
 void
@@ -151,29 +153,64 @@ InitialPair::compute_pair (int view_1_id, int view_2_id, Result* result)
         std::swap(view_1_id, view_2_id);
 
     /* Convert tracks to pairwise information. */
-    std::vector<CandidatePair> candidates;
-    this->compute_candidate_pairs(&candidates);
+    this->prepare_candidates();
 
     /* Find candidate pair. */
-    CandidatePair* candidate = nullptr;
-    for (std::size_t i = 0; candidate == nullptr && i < candidates.size(); ++i)
-    {
-        if (view_1_id == candidates[i].view_1_id
-            && view_2_id == candidates[i].view_2_id)
-            candidate = &candidates[i];
-    }
-    if (candidate == nullptr)
+    std::size_t pair_id = 0;
+    while (pair_id < this->candidates.size()
+        && (view_1_id != this->candidates[pair_id].view_1_id
+        || view_2_id != this->candidates[pair_id].view_2_id))
+        pair_id += 1;
+    if (pair_id == this->candidates.size())
         throw std::runtime_error("No matches for initial pair");
 
-    /* Compute initial pair pose. */
+    /* Compute initial pair pose, or use the cached pose. */
     result->view_1_id = view_1_id;
     result->view_2_id = view_2_id;
-    bool const found_pose = this->compute_pose(*candidate,
-        &result->view_1_pose, &result->view_2_pose);
+    CandidateEvaluation const& eval = this->evaluations[pair_id];
+    bool found_pose = eval.found_pose;
+    if (eval.pose_computed)
+    {
+        result->view_1_pose = eval.pose1;
+        result->view_2_pose = eval.pose2;
+    }
+    else
+    {
+        found_pose = this->compute_pose(this->candidates[pair_id],
+            &result->view_1_pose, &result->view_2_pose);
+    }
     if (!found_pose)
         throw std::runtime_error("Cannot compute pose for initial pair");
 }
 
+void
+InitialPair::reject_pair (int view_1_id, int view_2_id)
+{
+    if (view_1_id > view_2_id)
+        std::swap(view_1_id, view_2_id);
+
+    this->prepare_candidates();
+    for (std::size_t i = 0; i < this->candidates.size(); ++i)
+        if (view_1_id == this->candidates[i].view_1_id
+            && view_2_id == this->candidates[i].view_2_id)
+            this->evaluations[i].rejected = true;
+}
+
+void
+InitialPair::prepare_candidates (void)
+{
+    if (this->viewports == nullptr || this->tracks == nullptr)
+        throw std::invalid_argument("Null viewports or tracks");
+    if (!this->candidates.empty())
+        return;
+
+    /* Sort the candidate pairs by number of matches. */
+    this->compute_candidate_pairs(&this->candidates);
+    std::stable_sort(this->candidates.rbegin(), this->candidates.rend());
+    this->evaluations.clear();
+    this->evaluations.resize(this->candidates.size());
+}
+
 void
 InitialPair::compute_candidate_pairs (CandidatePairs* candidates)
 {
@@ -236,6 +273,30 @@ InitialPair::compute_homography_inliers (CandidatePair const& candidate)
     return ransac_result.inliers.size();
 }
 
+std::size_t
+InitialPair::compute_num_triangulated (CandidatePair const& candidate,
+    CameraPose const& pose1, CameraPose const& pose2)
+{
+    /* Run triangulation to ensure correct pair. */
+    Triangulate::Options triangulate_opts;
+    Triangulate triangulator(triangulate_opts);
+    std::vector<CameraPose const*> poses;
+    poses.push_back(&pose1);
+    poses.push_back(&pose2);
+    std::size_t successful_triangulations = 0;
+    std::vector<math::Vec2f> positions(2);
+    Triangulate::Statistics stats;
+    for (std::size_t j = 0; j < candidate.matches.size(); ++j)
+    {
+        positions[0] = math::Vec2f(candidate.matches[j].p1);
+        positions[1] = math::Vec2f(candidate.matches[j].p2);
+        math::Vec3d pos3d;
+        if (triangulator.triangulate(poses, positions, &pos3d, &stats))
+            successful_triangulations += 1;
+    }
+    return successful_triangulations;
+}
+
 bool
 InitialPair::compute_pose (CandidatePair const& candidate,
     CameraPose* pose1, CameraPose* pose2)
@@ -27,6 +27,12 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  * The implemented strategy sorts all pairwise matching results by the
  * number of matches and chooses the first pair where the matches cannot
  * be explained with a homography.
+ *
+ * Candidate pairs are evaluated in parallel in the order of priority, and
+ * the evaluation of lower priority pairs is cancelled once a pair satisfies
+ * all thresholds. Homography inliers and poses of evaluated pairs are cached
+ * so that a repeated search, e.g. after rejecting a pair that failed to
+ * start the reconstruction, does not recompute them.
  */
 class InitialPair
 {
@@ -82,6 +88,8 @@ public:
     void compute_pair (Result* result);
     /** Reconstructs the pose for a given intitial pair. */
     void compute_pair (int view_1_id, int view_2_id, Result* result);
+    /** Excludes a pair from subsequent searches for an initial pair. */
+    void reject_pair (int view_1_id, int view_2_id);
 
 private:
     struct CandidatePair
@@ -93,11 +101,29 @@ private:
     };
     typedef std::vector<CandidatePair> CandidatePairs;
 
+    /** Cached evaluation results of a candidate pair. */
+    struct CandidateEvaluation
+    {
+        bool rejected = false;
+        bool homography_computed = false;
+        bool pose_computed = false;
+        bool found_pose = false;
+        std::size_t num_homography_inliers = 0;
+        std::size_t num_triangulated = 0;
+        double angle = 0.0;
+        float score = 0.0f;
+        CameraPose pose1;
+        CameraPose pose2;
+    };
+
 private:
     std::size_t compute_homography_inliers (CandidatePair const& candidate);
     bool compute_pose (CandidatePair const& candidate,
         CameraPose* pose1, CameraPose* pose2);
     void compute_candidate_pairs (CandidatePairs* candidates);
+    void prepare_candidates (void);
+    std::size_t compute_num_triangulated (CandidatePair const& candidate,
+        CameraPose const& pose1, CameraPose const& pose2);
     double angle_for_pose (CandidatePair const& candidate,
         CameraPose const& pose1, CameraPose const& pose2);
     float score_for_pair (CandidatePair const& candidate,
@@ -109,6 +135,8 @@ private:
     Options opts;
     ViewportList const* viewports;
     TrackList const* tracks;
+    CandidatePairs candidates;
+    std::vector<CandidateEvaluation> evaluations;
 };
 
 /* ------------------------ Implementation ------------------------ */
@@ -135,6 +163,8 @@ InitialPair::initialize (ViewportList const& viewports, TrackList const& tracks)
 {
     this->viewports = &viewports;
     this->tracks = &tracks;
+    this->candidates.clear();
+    this->evaluations.clear();
 }
 
 inline bool
@@ -7,8 +7,11 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <cstring>
 #include <cerrno>
 #include <stdexcept>
@@ -20,6 +23,10 @@
 #include "sfm/bundler_matching.h"
 #include "sfm/cascade_hashing.h"
 #include "sfm/exhaustive_matching.h"
+#include "sfm/kdtree_matching.h"
+
+/* Minimum time between two progress reports in milli seconds. */
+#define MATCHING_REPORT_INTERVAL_MS 250
 
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
@@ -36,6 +43,9 @@ Matching::Matching (Options const& options, Progress* progress)
         case MATCHER_CASCADE_HASHING:
             this->matcher.reset(new CascadeHashing());
             break;
+        case MATCHER_KDTREE:
+            this->matcher.reset(new KdTreeMatching(this->opts.kdtree_opts));
+            break;
         default:
             throw std::runtime_error("Unhandled matcher type");
     }
@@ -50,6 +60,14 @@ Matching::init (ViewportList* viewports)
     this->viewports = viewports;
     this->matcher->init(viewports);
 
+    /* Retrieve candidate pairs while descriptors are available. */
+    this->candidate_pairs.clear();
+    if (this->opts.retrieval_opts.num_candidates > 0)
+    {
+        Retrieval retrieval(this->opts.retrieval_opts);
+        retrieval.compute(*viewports, &this->candidate_pairs);
+    }
+
     /* Free descriptors. */
     for (std::size_t i = 0; i < viewports->size(); i++)
         viewports->at(i).features.clear_descriptors();
@@ -61,9 +79,11 @@ Matching::compute (PairwiseMatching* pairwise_matching)
     if (this->viewports == nullptr)
         throw std::runtime_error("Viewports must not be null");
 
+    bool const use_candidates = this->opts.retrieval_opts.num_candidates > 0;
     std::size_t num_viewports = this->viewports->size();
-    std::size_t num_pairs = num_viewports * (num_viewports - 1) / 2;
-    std::size_t num_done = 0;
+    std::size_t num_pairs = use_candidates ? this->candidate_pairs.size()
+        : num_viewports * (num_viewports - 1) / 2;
+    std::size_t const num_previous = pairwise_matching->size();
 
     if (this->progress != nullptr)
     {
@@ -71,64 +91,105 @@ Matching::compute (PairwiseMatching* pairwise_matching)
         this->progress->num_done = 0;
     }
 
-#pragma omp parallel for schedule(dynamic)
-    for (std::size_t i = 0; i < num_pairs; ++i)
+    /*
+     * Progress is tracked with atomic counters. Only the thread which
+     * advances the report time prints, and each thread collects its
+     * matching results in a private buffer which is merged at the end.
+     */
+    util::WallTimer timer;
+    std::atomic<std::size_t> num_done(0);
+    std::atomic<std::size_t> num_matched(0);
+    std::atomic<std::size_t> next_report_ms(0);
+    auto report_progress = [&] (std::size_t done)
     {
-#pragma omp critical
-        {
-            num_done += 1;
-            if (this->progress != nullptr)
-                this->progress->num_done += 1;
+        float const percent = num_pairs == 0 ? 100.0f
+            : (done * 1000 / num_pairs) / 10.0f;
+        std::cout << "\rMatching pair " << done << " of " << num_pairs
+            << " (" << percent << "%), " << num_matched
+            << " matched..." << std::flush;
+    };
 
-            float percent = (num_done * 1000 / num_pairs) / 10.0f;
-            std::cout << "\rMatching pair " << num_done << " of "
-                << num_pairs << " (" << percent << "%)..." << std::flush;
-        }
+#pragma omp parallel
+    {
+        PairwiseMatching thread_matching;
 
-        int const view_1_id = (int)(0.5 + std::sqrt(0.25 + 2.0 * i));
-        int const view_2_id = (int)i - view_1_id * (view_1_id - 1) / 2;
-        if (this->opts.match_num_previous_frames != 0
-            && view_2_id + this->opts.match_num_previous_frames < view_1_id)
-            continue;
-
-        FeatureSet const& view_1 = this->viewports->at(view_1_id).features;
-        FeatureSet const& view_2 = this->viewports->at(view_2_id).features;
-        if (view_1.positions.empty() || view_2.positions.empty())
-            continue;
-
-        /* Match the views. */
-        util::WallTimer timer;
-        std::stringstream message;
-        CorrespondenceIndices matches;
-        this->two_view_matching(view_1_id, view_2_id, &matches, message);
-        std::size_t matching_time = timer.get_elapsed();
-
-        if (matches.empty())
+#pragma omp for schedule(dynamic) nowait
+        for (std::size_t i = 0; i < num_pairs; ++i)
         {
-#pragma omp critical
-            std::cout << "\rPair (" << view_1_id << ","
-                << view_2_id << ") rejected, "
-                << message.str() << std::endl;
-            continue;
-        }
+            int view_1_id, view_2_id;
+            if (use_candidates)
+            {
+                view_1_id = this->candidate_pairs[i].first;
+                view_2_id = this->candidate_pairs[i].second;
+            }
+            else
+            {
+                view_1_id = (int)(0.5 + std::sqrt(0.25 + 2.0 * i));
+                view_2_id = (int)i - view_1_id * (view_1_id - 1) / 2;
+            }
 
-        /* Successful two view matching. Add the pair. */
-        TwoViewMatching matching;
-        matching.view_1_id = view_1_id;
-        matching.view_2_id = view_2_id;
-        std::swap(matching.matches, matches);
+            CorrespondenceIndices matches;
+            FeatureSet const& view_1 = this->viewports->at(view_1_id).features;
+            FeatureSet const& view_2 = this->viewports->at(view_2_id).features;
+            bool const skip_pair = (this->opts.match_num_previous_frames != 0
+                && view_2_id + this->opts.match_num_previous_frames < view_1_id)
+                || view_1.positions.empty() || view_2.positions.empty();
 
+            /* Match the views. */
+            if (!skip_pair)
+            {
+                std::stringstream message;
+                this->two_view_matching(view_1_id, view_2_id, &matches, message);
+                if (this->opts.verbose_output)
+                {
+                    if (matches.empty())
+                        message.str("rejected, " + message.str());
+                    else
+                        message << "matched, " << matches.size()
+                            << " inliers.";
 #pragma omp critical
-        {
-            pairwise_matching->push_back(matching);
-            std::cout << "\rPair (" << view_1_id << ","
-                << view_2_id << ") matched, " << matching.matches.size()
-                << " inliers, took " << matching_time << " ms." << std::endl;
+                    std::cout << "\rPair (" << view_1_id << ","
+                        << view_2_id << ") " << message.str() << std::endl;
+                }
+            }
+
+            /* Successful two view matching. Add the pair. */
+            if (!matches.empty())
+            {
+                thread_matching.push_back(TwoViewMatching());
+                TwoViewMatching& matching = thread_matching.back();
+                matching.view_1_id = view_1_id;
+                matching.view_2_id = view_2_id;
+                std::swap(matching.matches, matches);
+                num_matched += 1;
+            }
+
+            std::size_t const done = num_done.fetch_add(1) + 1;
+            if (this->progress != nullptr)
+                this->progress->num_done += 1;
+
+            /* Rate-limited progress report. */
+            std::size_t const now_ms = timer.get_elapsed();
+            std::size_t report_ms = next_report_ms.load();
+            if (now_ms >= report_ms && next_report_ms.compare_exchange_strong(
+                report_ms, now_ms + MATCHING_REPORT_INTERVAL_MS))
+                report_progress(done);
         }
+
+#pragma omp critical
+        pairwise_matching->insert(pairwise_matching->end(),
+            std::make_move_iterator(thread_matching.begin()),
+            std::make_move_iterator(thread_matching.end()));
     }
 
-    std::cout << "\rFound a total of " << pairwise_matching->size()
-        << " matching image pairs." << std::endl;
+    /* Order the results by pair independent of thread scheduling. */
+    std::sort(pairwise_matching->begin() + num_previous,
+        pairwise_matching->end());
+    report_progress(num_done);
+
+    std::cout << std::endl << "Found a total of "
+        << pairwise_matching->size() << " matching image pairs, took "
+        << timer.get_elapsed() << " ms." << std::endl;
 }
 
 void
@@ -167,15 +228,31 @@ Matching::two_view_matching (int view_1_id, int view_2_id,
         return;
     }
 
-    /* Build correspondences from feature matching result. */
+    /*
+     * Build correspondences from feature matching result. For guided
+     * sampling, the correspondences are ordered by increasing distance
+     * ratio, i.e., the most distinctive matches come first.
+     */
+    std::vector<int> const& m12 = matching_result.matches_1_2;
+    std::vector<float> const& ratios = matching_result.ratios_1_2;
+    bool const guided = this->opts.guided_sampling
+        && ratios.size() == m12.size();
     sfm::Correspondences2D2D unfiltered_matches;
     sfm::CorrespondenceIndices unfiltered_indices;
     {
-        std::vector<int> const& m12 = matching_result.matches_1_2;
+        std::vector<int> order;
+        order.reserve(num_matches);
         for (std::size_t i = 0; i < m12.size(); ++i)
+            if (m12[i] >= 0)
+                order.push_back(i);
+
+        if (guided)
+            std::stable_sort(order.begin(), order.end(),
+                [&ratios] (int a, int b) { return ratios[a] < ratios[b]; });
+
+        for (std::size_t j = 0; j < order.size(); ++j)
         {
-            if (m12[i] < 0)
-                continue;
+            int const i = order[j];
 
             sfm::Correspondence2D2D match;
             match.p1[0] = view_1.positions[i][0];
@@ -191,7 +268,9 @@ Matching::two_view_matching (int view_1_id, int view_2_id,
     sfm::RansacFundamental::Result ransac_result;
     int num_inliers = 0;
     {
-        sfm::RansacFundamental ransac(this->opts.ransac_opts);
+        sfm::RansacFundamental::Options ransac_opts = this->opts.ransac_opts;
+        ransac_opts.progressive_sampling = guided;
+        sfm::RansacFundamental ransac(ransac_opts);
         ransac.estimate(unfiltered_matches, &ransac_result);
         num_inliers = ransac_result.inliers.size();
     }
@@ -213,6 +292,7 @@ Matching::two_view_matching (int view_1_id, int view_2_id,
         int const inlier_id = ransac_result.inliers[i];
         matches->push_back(unfiltered_indices[inlier_id]);
     }
+    std::sort(matches->begin(), matches->end());
 }
 
 SFM_BUNDLER_NAMESPACE_END
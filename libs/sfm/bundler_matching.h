@@ -10,6 +10,7 @@
 #ifndef SFM_BUNDLER_MATCHING_HEADER
 #define SFM_BUNDLER_MATCHING_HEADER
 
+#include <atomic>
 #include <memory>
 #include <stdexcept>
 #include <vector>
@@ -18,7 +19,9 @@
 
 #include "sfm/ransac_fundamental.h"
 #include "sfm/bundler_common.h"
+#include "sfm/bundler_retrieval.h"
 #include "sfm/defines.h"
+#include "sfm/kdtree_matching.h"
 #include "sfm/matching_base.h"
 
 SFM_NAMESPACE_BEGIN
@@ -31,6 +34,8 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  * views with smaller ID (since the matching is symmetric). Two-view matching
  * involves RANSAC to compute the fundamental matrix (geometric filtering).
  * Only views with a minimum number of matches are considered "connected".
+ * If image retrieval is enabled, views are only matched to the candidate
+ * views selected by a vocabulary tree instead of all other views.
  *
  * The global matching result can be saved to and loaded from file.
  * The file format is a binary sequence of numbers and IDs (all int32_t):
@@ -52,7 +57,8 @@ public:
     enum MatcherType
     {
         MATCHER_EXHAUSTIVE,
-        MATCHER_CASCADE_HASHING
+        MATCHER_CASCADE_HASHING,
+        MATCHER_KDTREE
     };
 
     /** Options for feature matching. */
@@ -64,6 +70,11 @@ public:
         int min_feature_matches = 24;
         /** Minimum number of matching features after RANSAC. */
         int min_matching_inliers = 12;
+        /**
+         * Rank matches by descriptor distance ratio and sample the best
+         * matches first in RANSAC (PROSAC). Enabled by default.
+         */
+        bool guided_sampling = true;
         /** Perform low-resolution matching to reject unlikely pairs. */
         bool use_lowres_matching = false;
         /** Number of features used for low-res matching. */
@@ -74,12 +85,21 @@ public:
         int match_num_previous_frames = 0;
         /** Matcher type. Exhaustive by default. */
         MatcherType matcher_type = MATCHER_EXHAUSTIVE;
+        /** Options for the kd-tree matcher (speed/recall trade-off). */
+        KdTreeMatching::Options kdtree_opts;
+        /**
+         * Options for image retrieval. Retrieval is disabled by default
+         * and enabled with a positive number of candidates.
+         */
+        Retrieval::Options retrieval_opts;
+        /** Print the result of every matched pair. */
+        bool verbose_output = false;
     };
 
     struct Progress
     {
         std::size_t num_total;
-        std::size_t num_done;
+        std::atomic<std::size_t> num_done;
     };
 
 public:
@@ -87,12 +107,16 @@ public:
 
     /**
      * Initialize matching by passing features to the matcher for
-     * preprocessing.
+     * preprocessing. If enabled, the candidate pairs are retrieved.
+     * The descriptors are released from the viewports afterwards.
      */
     void init (ViewportList* viewports);
 
     /**
-     * Computes the pairwise matching between all pairs of views.
+     * Computes the pairwise matching between all pairs of views,
+     * or between the candidate pairs if retrieval is enabled. The results
+     * are appended in the order of the view IDs, independent of the
+     * number of threads.
      * Computation requires both descriptor data and 2D feature positions
      * in the viewports.
      */
@@ -107,6 +131,7 @@ private:
     Progress* progress;
     std::unique_ptr<MatchingBase> matcher;
     ViewportList const* viewports;
+    ViewPairList candidate_pairs;
 };
 
 SFM_BUNDLER_NAMESPACE_END
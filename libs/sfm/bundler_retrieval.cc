@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "util/timer.h"
+#include "sfm/bundler_retrieval.h"
+
+SFM_NAMESPACE_BEGIN
+SFM_BUNDLER_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Sparse visual word histogram as (word ID, weight) pairs. */
+    typedef std::vector<std::pair<int, float>> WordHistogram;
+}
+
+void
+Retrieval::compute (ViewportList const& viewports, ViewPairList* pairs)
+{
+    pairs->clear();
+    int const num_views = static_cast<int>(viewports.size());
+    if (this->opts.num_candidates <= 0 || num_views < 2)
+        return;
+
+    util::WallTimer timer;
+
+    /* Collect a uniform subset of all descriptors for training. */
+    std::size_t num_descriptors = 0;
+    for (int i = 0; i < num_views; ++i)
+        num_descriptors += viewports[i].features.sift_descriptors.size();
+    if (num_descriptors == 0)
+        return;
+
+    std::size_t const max_training = std::max(1,
+        this->opts.max_training_descriptors);
+    std::size_t const stride = (num_descriptors + max_training - 1)
+        / max_training;
+    std::vector<float> training;
+    training.reserve((num_descriptors / stride + 1) * 128);
+    std::size_t descriptor_id = 0;
+    for (int i = 0; i < num_views; ++i)
+    {
+        FeatureSet::SiftDescriptors const& descrs
+            = viewports[i].features.sift_descriptors;
+        for (std::size_t j = 0; j < descrs.size(); ++j, ++descriptor_id)
+            if (descriptor_id % stride == 0)
+                for (int k = 0; k < 128; ++k)
+                    training.push_back(static_cast<float>(descrs[j][k])
+                        / 255.0f);
+    }
+
+    if (this->opts.verbose_output)
+        std::cout << "Building vocabulary from " << training.size() / 128
+            << " descriptors..." << std::endl;
+
+    VocabularyTree vocabulary(this->opts.vocabulary_opts);
+    vocabulary.build(training.data(), training.size() / 128, 128);
+    training.clear();
+    training.shrink_to_fit();
+    int const num_words = vocabulary.get_num_words();
+
+    /* Quantize the descriptors of every view to visual word counts. */
+    std::vector<WordHistogram> histograms(num_views);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < num_views; ++i)
+    {
+        FeatureSet::SiftDescriptors const& descrs
+            = viewports[i].features.sift_descriptors;
+        std::vector<int> words(descrs.size());
+        math::Vec128f descr;
+        for (std::size_t j = 0; j < descrs.size(); ++j)
+        {
+            for (int k = 0; k < 128; ++k)
+                descr[k] = static_cast<float>(descrs[j][k]) / 255.0f;
+            words[j] = vocabulary.lookup(descr.begin());
+        }
+        std::sort(words.begin(), words.end());
+
+        WordHistogram& hist = histograms[i];
+        for (std::size_t j = 0; j < words.size(); ++j)
+        {
+            if (hist.empty() || hist.back().first != words[j])
+                hist.push_back(std::make_pair(words[j], 0.0f));
+            hist.back().second += 1.0f;
+        }
+    }
+
+    /* Compute inverse document frequencies. */
+    int num_documents = 0;
+    std::vector<int> document_frequency(num_words, 0);
+    for (int i = 0; i < num_views; ++i)
+    {
+        if (histograms[i].empty())
+            continue;
+        num_documents += 1;
+        for (std::size_t j = 0; j < histograms[i].size(); ++j)
+            document_frequency[histograms[i][j].first] += 1;
+    }
+
+    /* Apply TF-IDF weighting, normalize and build the inverted file. */
+    std::vector<WordHistogram> inverted_file(num_words);
+    for (int i = 0; i < num_views; ++i)
+    {
+        WordHistogram& hist = histograms[i];
+        float norm = 0.0f;
+        for (std::size_t j = 0; j < hist.size(); ++j)
+        {
+            float const idf = std::log(static_cast<float>(num_documents)
+                / static_cast<float>(document_frequency[hist[j].first]));
+            hist[j].second *= idf;
+            norm += hist[j].second * hist[j].second;
+        }
+        if (norm <= 0.0f)
+            continue;
+
+        norm = std::sqrt(norm);
+        for (std::size_t j = 0; j < hist.size(); ++j)
+        {
+            hist[j].second /= norm;
+            inverted_file[hist[j].first].push_back(
+                std::make_pair(i, hist[j].second));
+        }
+    }
+
+    /* Score all views against each other and select the best candidates. */
+    std::vector<std::vector<int>> candidates(num_views);
+#pragma omp parallel
+    {
+        std::vector<float> scores(num_views);
+        std::vector<std::pair<float, int>> ranking;
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < num_views; ++i)
+        {
+            std::fill(scores.begin(), scores.end(), 0.0f);
+            WordHistogram const& hist = histograms[i];
+            for (std::size_t j = 0; j < hist.size(); ++j)
+            {
+                WordHistogram const& postings = inverted_file[hist[j].first];
+                for (std::size_t k = 0; k < postings.size(); ++k)
+                    scores[postings[k].first] += hist[j].second
+                        * postings[k].second;
+            }
+
+            /* Rank by descending score, ties are broken by view ID. */
+            ranking.clear();
+            for (int j = 0; j < num_views; ++j)
+                if (j != i && scores[j] > 0.0f)
+                    ranking.push_back(std::make_pair(-scores[j], j));
+            std::size_t const num_selected = std::min(ranking.size(),
+                static_cast<std::size_t>(this->opts.num_candidates));
+            std::partial_sort(ranking.begin(), ranking.begin() + num_selected,
+                ranking.end());
+            for (std::size_t j = 0; j < num_selected; ++j)
+                candidates[i].push_back(ranking[j].second);
+        }
+    }
+
+    /* Symmetrize the candidate relation. */
+    for (int i = 0; i < num_views; ++i)
+        for (std::size_t j = 0; j < candidates[i].size(); ++j)
+            pairs->push_back(std::make_pair(
+                std::max(i, candidates[i][j]),
+                std::min(i, candidates[i][j])));
+    std::sort(pairs->begin(), pairs->end());
+    pairs->erase(std::unique(pairs->begin(), pairs->end()), pairs->end());
+
+    if (this->opts.verbose_output)
+        std::cout << "Retrieval selected " << pairs->size() << " of "
+            << (static_cast<std::size_t>(num_views) * (num_views - 1) / 2)
+            << " pairs (" << num_words << " words), took "
+            << timer.get_elapsed() << " ms." << std::endl;
+}
+
+SFM_BUNDLER_NAMESPACE_END
+SFM_NAMESPACE_END
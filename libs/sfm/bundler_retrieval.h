@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_BUNDLER_RETRIEVAL_HEADER
+#define SFM_BUNDLER_RETRIEVAL_HEADER
+
+#include <utility>
+#include <vector>
+
+#include "sfm/bundler_common.h"
+#include "sfm/vocabulary_tree.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+SFM_BUNDLER_NAMESPACE_BEGIN
+
+/** List of view pairs (view ID 1, view ID 2) with view ID 1 > view ID 2. */
+typedef std::vector<std::pair<int, int>> ViewPairList;
+
+/**
+ * Bundler Component: Image retrieval to select candidate pairs for matching.
+ *
+ * A vocabulary tree is built from a subset of the SIFT descriptors of all
+ * views. Every view is represented as a TF-IDF weighted, L2-normalized
+ * histogram of visual words, and the similarity of two views is the dot
+ * product of their histograms, which is evaluated using an inverted file.
+ * Every view is paired with its most similar views. Since the candidate
+ * relation is symmetrized, a view can have more than 'num_candidates'
+ * candidate pairs.
+ *
+ * This requires the SIFT descriptors in the viewports, views without
+ * SIFT descriptors do not have any candidates.
+ */
+class Retrieval
+{
+public:
+    struct Options
+    {
+        /** Number of most similar views each view is paired with. */
+        int num_candidates = 0;
+        /** Maximum number of descriptors used to build the vocabulary. */
+        int max_training_descriptors = 200000;
+        /** Options for building the vocabulary tree. */
+        VocabularyTree::Options vocabulary_opts;
+        /** Produce status messages on the console. */
+        bool verbose_output = false;
+    };
+
+public:
+    explicit Retrieval (Options const& options);
+
+    /**
+     * Computes the candidate pairs for all views. The resulting pairs are
+     * unique and sorted by the first, then by the second view ID.
+     */
+    void compute (ViewportList const& viewports, ViewPairList* pairs);
+
+private:
+    Options opts;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+Retrieval::Retrieval (Options const& options)
+    : opts(options)
+{
+}
+
+SFM_BUNDLER_NAMESPACE_END
+SFM_NAMESPACE_END
+
+#endif /* SFM_BUNDLER_RETRIEVAL_HEADER */
@@ -7,41 +7,74 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <set>
+#include <vector>
 
-#include "mve/image_tools.h"
-#include "mve/image_drawing.h"
 #include "sfm/bundler_tracks.h"
 
+/* Number of feature nodes per chunk for the parallel compaction. */
+#define TRACKS_CHUNK_SIZE 65536
+
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
-/*
- * Merges tracks and updates viewports accordingly.
- */
-void
-unify_tracks(int view1_tid, int view2_tid,
-    TrackList* tracks, ViewportList* viewports)
+namespace
 {
-    /* Unify in larger track. */
-    if (tracks->at(view1_tid).features.size()
-        < tracks->at(view2_tid).features.size())
-        std::swap(view1_tid, view2_tid);
+    typedef std::vector<std::atomic<int>> AtomicIntVector;
 
-    Track& track1 = tracks->at(view1_tid);
-    Track& track2 = tracks->at(view2_tid);
+    /*
+     * Returns the root of the set containing 'node'. Parent pointers are
+     * shortened with path halving. Parents always have smaller IDs than
+     * their children, so concurrent updates cannot create cycles.
+     */
+    int
+    find_root (AtomicIntVector& parent, int node)
+    {
+        while (true)
+        {
+            int p = parent[node].load(std::memory_order_relaxed);
+            if (p == node)
+                return node;
+            int const gp = parent[p].load(std::memory_order_relaxed);
+            if (p != gp)
+                parent[node].compare_exchange_weak(p, gp,
+                    std::memory_order_relaxed);
+            node = gp;
+        }
+    }
 
-    for (std::size_t k = 0; k < track2.features.size(); ++k)
+    /*
+     * Unifies the sets containing 'a' and 'b' by linking the root with the
+     * larger ID to the root with the smaller ID. If another thread changes
+     * the root concurrently, the linking is retried. The final root of every
+     * set is its smallest node, independent of the order of operations.
+     */
+    void
+    unite_sets (AtomicIntVector& parent, int a, int b)
     {
-        int const view_id = track2.features[k].view_id;
-        int const feat_id = track2.features[k].feature_id;
-        viewports->at(view_id).track_ids[feat_id] = view1_tid;
+        while (true)
+        {
+            a = find_root(parent, a);
+            b = find_root(parent, b);
+            if (a == b)
+                return;
+            if (a < b)
+                std::swap(a, b);
+            int expected = a;
+            if (parent[a].compare_exchange_strong(expected, b))
+                return;
+        }
+    }
+
+    bool
+    compare_references (FeatureReference const& a, FeatureReference const& b)
+    {
+        return a.view_id == b.view_id
+            ? a.feature_id < b.feature_id
+            : a.view_id < b.view_id;
     }
-    track1.features.insert(track1.features.end(),
-        track2.features.begin(), track2.features.end());
-    /* Free old track's memory. clear() does not work. */
-    track2.features = FeatureReferenceList();
 }
 
 /* ---------------------------------------------------------------- */
@@ -50,157 +83,205 @@ void
 Tracks::compute (PairwiseMatching const& matching,
     ViewportList* viewports, TrackList* tracks)
 {
-    /* Initialize per-viewport track IDs. */
-    for (std::size_t i = 0; i < viewports->size(); ++i)
-    {
-        Viewport& viewport = viewports->at(i);
-        viewport.track_ids.resize(viewport.features.positions.size(), -1);
-    }
+    PairwiseMatchingRef refs;
+    make_matching_refs(matching, &refs);
+    this->compute(refs, viewports, tracks);
+}
+
+void
+Tracks::compute (PairwiseMatchingRef const& matching,
+    ViewportList* viewports, TrackList* tracks)
+{
+    /*
+     * Every feature of every viewport is a node in a union-find structure.
+     * The node ID of a feature is the offset of the viewport plus the
+     * feature ID.
+     */
+    int const num_viewports = static_cast<int>(viewports->size());
+    std::vector<int> view_offsets(num_viewports + 1, 0);
+    for (int i = 0; i < num_viewports; ++i)
+        view_offsets[i + 1] = view_offsets[i]
+            + static_cast<int>(viewports->at(i).features.positions.size());
+    int const num_nodes = view_offsets.back();
 
     /* Propagate track IDs. */
     if (this->opts.verbose_output)
         std::cout << "Propagating track IDs..." << std::endl;
 
-    /* Iterate over all pairwise matchings and create tracks. */
-    tracks->clear();
+    /* Unify the sets of the two features of every match. */
+    AtomicIntVector parent(num_nodes);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_nodes; ++i)
+        parent[i].store(i, std::memory_order_relaxed);
+
+#pragma omp parallel for schedule(dynamic)
     for (std::size_t i = 0; i < matching.size(); ++i)
     {
-        TwoViewMatching const& tvm = matching[i];
-        Viewport& viewport1 = viewports->at(tvm.view_1_id);
-        Viewport& viewport2 = viewports->at(tvm.view_2_id);
+        TwoViewMatchingRef const& tvm = matching[i];
+        int const offset1 = view_offsets[tvm.view_1_id];
+        int const offset2 = view_offsets[tvm.view_2_id];
+        for (std::size_t j = 0; j < tvm.num_matches; ++j)
+        {
+            CorrespondenceIndex const& idx = tvm.matches[j];
+            unite_sets(parent, offset1 + idx.first, offset2 + idx.second);
+        }
+    }
+
+    /* Resolve the root of every node and count the set sizes. */
+    std::vector<int> labels(num_nodes);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_nodes; ++i)
+        labels[i] = find_root(parent, i);
+
+    AtomicIntVector& set_sizes = parent;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_nodes; ++i)
+        set_sizes[i].store(0, std::memory_order_relaxed);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_nodes; ++i)
+        set_sizes[labels[i]].fetch_add(1, std::memory_order_relaxed);
+
+    /*
+     * Every set with at least two features is a candidate track. Candidates
+     * are numbered in the order of their roots using per-chunk counts.
+     */
+    int const num_chunks = (num_nodes + TRACKS_CHUNK_SIZE - 1)
+        / TRACKS_CHUNK_SIZE;
+    std::vector<int> chunk_offsets(num_chunks + 1, 0);
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < num_chunks; ++c)
+    {
+        int const end = std::min(num_nodes, (c + 1) * TRACKS_CHUNK_SIZE);
+        int count = 0;
+        for (int i = c * TRACKS_CHUNK_SIZE; i < end; ++i)
+            if (labels[i] == i && set_sizes[i].load(
+                std::memory_order_relaxed) > 1)
+                count += 1;
+        chunk_offsets[c + 1] = count;
+    }
+    for (int c = 0; c < num_chunks; ++c)
+        chunk_offsets[c + 1] += chunk_offsets[c];
 
-        /* Iterate over matches for a pair. */
-        for (std::size_t j = 0; j < tvm.matches.size(); ++j)
+    TrackList candidates(chunk_offsets.back());
+    AtomicIntVector& track_ids = parent;
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < num_chunks; ++c)
+    {
+        int const end = std::min(num_nodes, (c + 1) * TRACKS_CHUNK_SIZE);
+        int next_id = chunk_offsets[c];
+        for (int i = c * TRACKS_CHUNK_SIZE; i < end; ++i)
         {
-            CorrespondenceIndex idx = tvm.matches[j];
-            int const view1_tid = viewport1.track_ids[idx.first];
-            int const view2_tid = viewport2.track_ids[idx.second];
-            if (view1_tid == -1 && view2_tid == -1)
-            {
-                /* No track ID associated with the match. Create track. */
-                viewport1.track_ids[idx.first] = tracks->size();
-                viewport2.track_ids[idx.second] = tracks->size();
-                tracks->push_back(Track());
-                tracks->back().features.push_back(
-                    FeatureReference(tvm.view_1_id, idx.first));
-                tracks->back().features.push_back(
-                    FeatureReference(tvm.view_2_id, idx.second));
-            }
-            else if (view1_tid == -1 && view2_tid != -1)
-            {
-                /* Propagate track ID from first to second view. */
-                viewport1.track_ids[idx.first] = view2_tid;
-                tracks->at(view2_tid).features.push_back(
-                    FeatureReference(tvm.view_1_id, idx.first));
-            }
-            else if (view1_tid != -1 && view2_tid == -1)
-            {
-                /* Propagate track ID from second to first view. */
-                viewport2.track_ids[idx.second] = view1_tid;
-                tracks->at(view1_tid).features.push_back(
-                    FeatureReference(tvm.view_2_id, idx.second));
-            }
-            else if (view1_tid == view2_tid)
+            if (labels[i] != i)
+                continue;
+            int const size = set_sizes[i].load(std::memory_order_relaxed);
+            if (size < 2)
             {
-                /* Track ID already propagated. */
-            }
-            else
-            {
-                /*
-                 * A track ID is already associated with both ends of a match,
-                 * however, is not consistent. Unify tracks.
-                 */
-                unify_tracks(view1_tid, view2_tid, tracks, viewports);
+                track_ids[i].store(-1, std::memory_order_relaxed);
+                continue;
             }
+            candidates[next_id].features.resize(size,
+                FeatureReference(-1, -1));
+            track_ids[i].store(next_id, std::memory_order_relaxed);
+            next_id += 1;
         }
     }
 
-    /* Find and remove invalid tracks or tracks with conflicts. */
-    if (this->opts.verbose_output)
-        std::cout << "Removing tracks with conflicts..." << std::flush;
-    std::size_t const num_invalid_tracks
-        = this->remove_invalid_tracks(viewports, tracks);
-    if (this->opts.verbose_output)
-        std::cout << " deleted " << num_invalid_tracks
-            << " tracks." << std::endl;
+    /* Label all nodes with the candidate track ID of their root. */
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_nodes; ++i)
+        labels[i] = track_ids[labels[i]].load(std::memory_order_relaxed);
 
-    /* Compute color for every track. */
-    if (this->opts.verbose_output)
-        std::cout << "Colorizing tracks..." << std::endl;
-    for (std::size_t i = 0; i < tracks->size(); ++i)
+    /* Distribute the features to the candidate tracks. */
+    std::vector<std::atomic<int>> fill_counts(candidates.size());
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < fill_counts.size(); ++i)
+        fill_counts[i].store(0, std::memory_order_relaxed);
+#pragma omp parallel for schedule(dynamic)
+    for (int v = 0; v < num_viewports; ++v)
     {
-        Track& track = tracks->at(i);
-        math::Vec4f color(0.0f, 0.0f, 0.0f, 0.0f);
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        for (int i = view_offsets[v]; i < view_offsets[v + 1]; ++i)
         {
-            FeatureReference const& ref = track.features[j];
-            FeatureSet const& features = viewports->at(ref.view_id).features;
-            math::Vec3f const feature_color(features.colors[ref.feature_id]);
-            color += math::Vec4f(feature_color, 1.0f);
+            int const tid = labels[i];
+            if (tid < 0)
+                continue;
+            int const slot = fill_counts[tid].fetch_add(1,
+                std::memory_order_relaxed);
+            candidates[tid].features[slot]
+                = FeatureReference(v, i - view_offsets[v]);
         }
-        track.color[0] = static_cast<uint8_t>(color[0] / color[3] + 0.5f);
-        track.color[1] = static_cast<uint8_t>(color[1] / color[3] + 0.5f);
-        track.color[2] = static_cast<uint8_t>(color[2] / color[3] + 0.5f);
     }
-}
+    fill_counts.clear();
+    fill_counts.shrink_to_fit();
 
-/* ---------------------------------------------------------------- */
-
-int
-Tracks::remove_invalid_tracks (ViewportList* viewports, TrackList* tracks)
-{
     /*
-     * Detect invalid tracks where a track contains no features, or
-     * multiple features from a single view.
+     * Sort the features of every track for a deterministic result, then
+     * detect tracks with multiple features from a single view and compute
+     * the color of all other tracks as the average color of its features.
      */
-    std::vector<bool> delete_tracks(tracks->size());
-    int num_invalid_tracks = 0;
-    for (std::size_t i = 0; i < tracks->size(); ++i)
+    if (this->opts.verbose_output)
+        std::cout << "Removing tracks with conflicts, colorizing tracks..."
+            << std::flush;
+    std::vector<char> valid(candidates.size(), 0);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (std::size_t i = 0; i < candidates.size(); ++i)
     {
-        if (tracks->at(i).features.empty())
-        {
-            num_invalid_tracks += 1;
-            delete_tracks[i] = true;
-            continue;
-        }
+        Track& track = candidates[i];
+        std::sort(track.features.begin(), track.features.end(),
+            &compare_references);
 
-        std::set<int> view_ids;
-        for (std::size_t j = 0; j < tracks->at(i).features.size(); ++j)
+        bool conflict = false;
+        math::Vec4f color(0.0f, 0.0f, 0.0f, 0.0f);
+        for (std::size_t j = 0; j < track.features.size(); ++j)
         {
-            FeatureReference const& ref = tracks->at(i).features[j];
-            if (view_ids.insert(ref.view_id).second == false)
+            FeatureReference const& ref = track.features[j];
+            if (j > 0 && track.features[j - 1].view_id == ref.view_id)
             {
-                num_invalid_tracks += 1;
-                delete_tracks[i] = true;
+                conflict = true;
                 break;
             }
+            FeatureSet const& features = viewports->at(ref.view_id).features;
+            math::Vec3f const feature_color(features.colors[ref.feature_id]);
+            color += math::Vec4f(feature_color, 1.0f);
         }
+        if (conflict)
+            continue;
+
+        valid[i] = 1;
+        track.color[0] = static_cast<uint8_t>(color[0] / color[3] + 0.5f);
+        track.color[1] = static_cast<uint8_t>(color[1] / color[3] + 0.5f);
+        track.color[2] = static_cast<uint8_t>(color[2] / color[3] + 0.5f);
     }
 
-    /* Create a mapping from old to new track IDs. */
-    std::vector<int> id_mapping(delete_tracks.size(), -1);
-    int valid_track_counter = 0;
-    for (std::size_t i = 0; i < delete_tracks.size(); ++i)
+    /* Move valid tracks to the result and create the ID mapping. */
+    std::vector<int> id_mapping(candidates.size(), -1);
+    tracks->clear();
+    for (std::size_t i = 0; i < candidates.size(); ++i)
     {
-        if (delete_tracks[i])
+        if (!valid[i])
             continue;
-        id_mapping[i] = valid_track_counter;
-        valid_track_counter += 1;
+        id_mapping[i] = static_cast<int>(tracks->size());
+        tracks->push_back(std::move(candidates[i]));
     }
+    std::size_t const num_invalid_tracks = candidates.size() - tracks->size();
+    candidates.clear();
+    candidates.shrink_to_fit();
 
-    /* Fix track IDs stored in the viewports. */
-    for (std::size_t i = 0; i < viewports->size(); ++i)
+    if (this->opts.verbose_output)
+        std::cout << " deleted " << num_invalid_tracks
+            << " tracks." << std::endl;
+
+    /* Store per-feature track IDs in the viewports. */
+#pragma omp parallel for schedule(dynamic)
+    for (int v = 0; v < num_viewports; ++v)
     {
-        std::vector<int>& track_ids = viewports->at(i).track_ids;
-        for (std::size_t j = 0; j < track_ids.size(); ++j)
-            if (track_ids[j] >= 0)
-                track_ids[j] = id_mapping[track_ids[j]];
+        std::vector<int>& vp_track_ids = viewports->at(v).track_ids;
+        vp_track_ids.resize(view_offsets[v + 1] - view_offsets[v]);
+        for (std::size_t j = 0; j < vp_track_ids.size(); ++j)
+        {
+            int const tid = labels[view_offsets[v] + j];
+            vp_track_ids[j] = tid < 0 ? -1 : id_mapping[tid];
+        }
     }
-
-    /* Clean the tracks from the vector. */
-    math::algo::vector_clean(delete_tracks, tracks);
-
-    return num_invalid_tracks;
 }
 
 SFM_BUNDLER_NAMESPACE_END
@@ -46,8 +46,9 @@ public:
     void compute (PairwiseMatching const& matching,
         ViewportList* viewports, TrackList* tracks);
 
-private:
-    int remove_invalid_tracks (ViewportList* viewports, TrackList* tracks);
+    /** Same as above, but reads the matches through references. */
+    void compute (PairwiseMatchingRef const& matching,
+        ViewportList* viewports, TrackList* tracks);
 
 private:
     Options opts;
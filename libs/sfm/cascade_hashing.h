@@ -75,7 +75,8 @@ private:
     void oneway_match (Matching::Options const& matching_opts,
         LocalData const& set_1, LocalData const& set_2,
         D const& set_1_descs, D const& set_2_descs,
-        std::vector<int>* result, Options const& cashash_opts) const;
+        std::vector<int>* result, std::vector<float>* ratios,
+        Options const& cashash_opts) const;
 
     /**
      * Cascade hashing projection matrices. T shall be a vector with the same
@@ -318,10 +319,10 @@ CascadeHashing::twoway_match (Matching::Options const& matching_opts,
     Matching::Result* matches, Options const& cashash_opts) const
 {
     oneway_match(matching_opts, set_1, set_2, set_1_descs, set_2_descs,
-        &matches->matches_1_2,
+        &matches->matches_1_2, &matches->ratios_1_2,
         cashash_opts);
     oneway_match(matching_opts, set_2, set_1, set_2_descs, set_1_descs,
-        &matches->matches_2_1,
+        &matches->matches_2_1, &matches->ratios_2_1,
         cashash_opts);
 }
 
@@ -330,7 +331,8 @@ void
 CascadeHashing::oneway_match (Matching::Options const& matching_opts,
     LocalData const& set_1, LocalData const& set_2,
     D const& set_1_descs, D const& set_2_descs,
-    std::vector<int>* result, Options const& cashash_opts) const
+    std::vector<int>* result, std::vector<float>* ratios,
+    Options const& cashash_opts) const
 {
     typedef typename D::value_type V;
     typedef typename V::ValueType T;
@@ -351,6 +353,7 @@ CascadeHashing::oneway_match (Matching::Options const& matching_opts,
     uint32_t const dim_comp_hash_data = dim_hash_data / 64;
 
     result->resize(set_1_size, -1);
+    ratios->resize(set_1_size, 1.0f);
     std::vector<bool> data_index_used(set_2_size);
     std::vector<std::vector<uint32_t> > grouped_features(dim_hash_data + 1);
     std::vector<uint32_t> top_candidates;
@@ -405,12 +408,13 @@ CascadeHashing::oneway_match (Matching::Options const& matching_opts,
         if (nn_result.dist_1st_best > square_dist_thres)
             continue;
 
-        if (static_cast<float>(nn_result.dist_1st_best)
-            / static_cast<float>(nn_result.dist_2nd_best)
-            > square_lowe_thres)
+        float const ratio = static_cast<float>(nn_result.dist_1st_best)
+            / static_cast<float>(nn_result.dist_2nd_best);
+        if (ratio > square_lowe_thres)
             continue;
 
         result->at(i) = top_candidates[nn_result.index_1st_best];
+        ratios->at(i) = ratio;
     }
 }
 
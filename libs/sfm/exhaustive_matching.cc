@@ -14,18 +14,6 @@ SFM_NAMESPACE_BEGIN
 namespace
 {
 #if DISCRETIZE_DESCRIPTORS
-    void
-    convert_descriptor (Sift::Descriptor const& descr, unsigned short* data)
-    {
-        for (int i = 0; i < 128; ++i)
-        {
-            float value = descr.data[i];
-            value = math::clamp(value, 0.0f, 1.0f);
-            value = math::round(value * 255.0f);
-            data[i] = static_cast<unsigned char>(value);
-        }
-    }
-
     void
     convert_descriptor (Surf::Descriptor const& descr, signed short* data)
     {
@@ -39,9 +27,10 @@ namespace
     }
 #else // DISCRETIZE_DESCRIPTORS
     void
-    convert_descriptor (Sift::Descriptor const& descr, float* data)
+    convert_descriptor (math::Vec128uc const& descr, float* data)
     {
-        std::copy(descr.data.begin(), descr.data.end(), data);
+        for (int i = 0; i < 128; ++i)
+            data[i] = static_cast<float>(descr[i]) / 255.0f;
     }
 
     void
@@ -71,21 +60,18 @@ ExhaustiveMatching::init (bundler::ViewportList* viewports)
 
 void
 ExhaustiveMatching::init_sift (SiftDescriptors* dst,
-    Sift::Descriptors const& src)
+    FeatureSet::SiftDescriptors const& src)
 {
-    /* Prepare and copy to data structures. */
-    dst->resize(src.size());
-
 #if DISCRETIZE_DESCRIPTORS
-    uint16_t* ptr = dst->data()->begin();
+    /* The nearest neighbor kernels search the 8-bit descriptors directly. */
+    *dst = src;
 #else
+    /* Prepare and copy to data structures. */
+    dst->resize(src.size());
     float* ptr = dst->data()->begin();
-#endif
     for (std::size_t i = 0; i < src.size(); ++i, ptr += 128)
-    {
-        Sift::Descriptor const& d = src[i];
-        convert_descriptor(d, ptr);
-    }
+        convert_descriptor(src[i], ptr);
+#endif
 }
 
 void
@@ -44,7 +44,7 @@ public:
 
 protected:
 #if DISCRETIZE_DESCRIPTORS
-    typedef util::AlignedMemory<math::Vec128us, 16> SiftDescriptors;
+    typedef FeatureSet::SiftDescriptors SiftDescriptors;
     typedef util::AlignedMemory<math::Vec64s, 16> SurfDescriptors;
 #else
     typedef util::AlignedMemory<math::Vec128f, 16> SiftDescriptors;
@@ -52,7 +52,8 @@ protected:
 #endif
 
     /** Internal initialization methods for SIFT/SURF features. */
-    void init_sift (SiftDescriptors* dst, Sift::Descriptors const& src);
+    void init_sift (SiftDescriptors* dst,
+        FeatureSet::SiftDescriptors const& src);
     void init_surf (SurfDescriptors* dst, Surf::Descriptors const& src);
 
     struct ProcessedFeatureSet
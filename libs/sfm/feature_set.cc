@@ -7,9 +7,11 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
-#include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <iostream>
 
+#include "math/functions.h"
 #include "sfm/feature_set.h"
 
 SFM_NAMESPACE_BEGIN
@@ -81,8 +83,45 @@ FeatureSet::compute_sift (mve::ByteImage::ConstPtr image)
         image->linear_at(d.x, d.y, this->colors[offset + i].begin());
     }
 
-    /* Keep SIFT descriptors. */
-    std::swap(descr, this->sift_descriptors);
+    /* Keep quantized SIFT descriptors. */
+    this->set_sift_descriptors(descr);
+}
+
+void
+FeatureSet::set_sift_descriptors (Sift::Descriptors const& descriptors)
+{
+    std::size_t const num = descriptors.size();
+    this->sift_descriptors.clear();
+    this->sift_descriptors.resize(num);
+    this->sift_geometry.scales.resize(num);
+    this->sift_geometry.orientations.resize(num);
+
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        Sift::Descriptor const& d = descriptors[i];
+        this->sift_geometry.scales[i] = d.scale;
+        this->sift_geometry.orientations[i] = d.orientation;
+
+        /* RootSIFT: Square root of the L1-normalized descriptor. */
+        math::Vec128f data = d.data;
+        if (this->opts.use_root_sift)
+        {
+            float l1_norm = 0.0f;
+            for (int j = 0; j < 128; ++j)
+                l1_norm += std::abs(data[j]);
+            for (int j = 0; j < 128 && l1_norm > 0.0f; ++j)
+                data[j] = std::sqrt(std::abs(data[j]) / l1_norm);
+        }
+
+        /* Linear quantization of the normalized values to 8 bit. */
+        math::Vec128uc& quantized = this->sift_descriptors[i];
+        for (int j = 0; j < 128; ++j)
+        {
+            float const value = math::clamp(data[j], 0.0f, 1.0f);
+            quantized[j] = static_cast<unsigned char>(
+                math::round(value * 255.0f));
+        }
+    }
 }
 
 void
@@ -121,6 +160,10 @@ FeatureSet::clear_descriptors (void)
 {
     this->sift_descriptors.clear();
     this->sift_descriptors.shrink_to_fit();
+    this->sift_geometry.scales.clear();
+    this->sift_geometry.scales.shrink_to_fit();
+    this->sift_geometry.orientations.clear();
+    this->sift_geometry.orientations.shrink_to_fit();
     this->surf_descriptors.clear();
     this->surf_descriptors.shrink_to_fit();
 }
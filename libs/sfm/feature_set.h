@@ -23,6 +23,10 @@ SFM_NAMESPACE_BEGIN
 /**
  * The FeatureSet holds per-feature information for a single view, and
  * allows to transparently compute and match multiple feature types.
+ *
+ * SIFT descriptors are quantized to 8 bit when they are computed, and the
+ * keypoint scale and orientation are kept in separate arrays. This takes
+ * 136 bytes per feature instead of 528 bytes for the float descriptors.
  */
 class FeatureSet
 {
@@ -35,12 +39,27 @@ public:
         FEATURE_ALL = 0xFF
     };
 
+    /** Quantized SIFT descriptors, 128 bytes per descriptor. */
+    typedef util::AlignedMemory<math::Vec128uc, 16> SiftDescriptors;
+
+    /** Keypoint geometry stored as structure of arrays. */
+    struct KeypointGeometry
+    {
+        std::vector<float> scales;
+        std::vector<float> orientations;
+    };
+
     /** Options for feature detection and matching. */
     struct Options
     {
         Options (void);
 
         FeatureTypes feature_types;
+        /**
+         * Maps SIFT descriptors to the square root of the L1-normalized
+         * descriptor (RootSIFT) before quantization. Defaults to false.
+         */
+        bool use_root_sift;
         Sift::Options sift_opts;
         Surf::Options surf_opts;
     };
@@ -53,6 +72,12 @@ public:
     /** Computes the features specified in the options. */
     void compute_features (mve::ByteImage::Ptr image);
 
+    /**
+     * Quantizes the SIFT descriptors to 8 bit and keeps their scale and
+     * orientation. Feature positions and colors are not modified.
+     */
+    void set_sift_descriptors (Sift::Descriptors const& descriptors);
+
     /** Normalizes the features positions w.r.t. the image dimensions. */
     void normalize_feature_positions (float px, float py);
 
@@ -66,8 +91,10 @@ public:
     std::vector<math::Vec2f> positions;
     /** Per-feature image color. */
     std::vector<math::Vec3uc> colors;
-    /** The SIFT descriptors. */
-    Sift::Descriptors sift_descriptors;
+    /** The quantized SIFT descriptors. */
+    SiftDescriptors sift_descriptors;
+    /** Scale and orientation of the SIFT keypoints. */
+    KeypointGeometry sift_geometry;
     /** The SURF descriptors. */
     Surf::Descriptors surf_descriptors;
 
@@ -84,6 +111,7 @@ private:
 inline
 FeatureSet::Options::Options (void)
     : feature_types(FEATURE_SIFT)
+    , use_root_sift(false)
 {
 }
 
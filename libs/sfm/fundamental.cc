@@ -246,4 +246,32 @@ sampson_distance (FundamentalMatrix const& F, Correspondence2D2D const& m)
     return p2_F_p1 / sum;
 }
 
+void
+sampson_distances (FundamentalMatrix const& F,
+    Correspondences2D2D const& matches, std::vector<double>* distances)
+{
+    double const f0 = F[0], f1 = F[1], f2 = F[2];
+    double const f3 = F[3], f4 = F[4], f5 = F[5];
+    double const f6 = F[6], f7 = F[7], f8 = F[8];
+    std::size_t const num_matches = matches.size();
+    distances->resize(num_matches);
+    Correspondence2D2D const* m = matches.data();
+    double* result = distances->data();
+
+#pragma omp simd
+    for (std::size_t i = 0; i < num_matches; ++i)
+    {
+        double const x1 = m[i].p1[0], y1 = m[i].p1[1];
+        double const x2 = m[i].p2[0], y2 = m[i].p2[1];
+        double const fx1 = x1 * f0 + y1 * f1 + f2;
+        double const fx2 = x1 * f3 + y1 * f4 + f5;
+        double const fx3 = x1 * f6 + y1 * f7 + f8;
+        double const ftx1 = x2 * f0 + y2 * f3 + f6;
+        double const ftx2 = x2 * f1 + y2 * f4 + f7;
+        double const p2_F_p1 = x2 * fx1 + y2 * fx2 + fx3;
+        result[i] = p2_F_p1 * p2_F_p1
+            / (fx1 * fx1 + fx2 * fx2 + ftx1 * ftx1 + ftx2 * ftx2);
+    }
+}
+
 SFM_NAMESPACE_END
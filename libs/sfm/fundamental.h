@@ -137,6 +137,14 @@ double
 sampson_distance (FundamentalMatrix const& fundamental,
     Correspondence2D2D const& match);
 
+/**
+ * Computes the Sampson distances for all image correspondences. This is
+ * equivalent to sampson_distance() but vectorized over the matches.
+ */
+void
+sampson_distances (FundamentalMatrix const& fundamental,
+    Correspondences2D2D const& matches, std::vector<double>* distances);
+
 /**
  * Computes a transformation for 2D points in homogeneous coordinates
  * such that the mean of the points is zero and the points fit in the unit
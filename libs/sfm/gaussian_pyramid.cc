@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
+
+#include "math/functions.h"
+#include "sfm/gaussian_pyramid.h"
+
+SFM_NAMESPACE_BEGIN
+
+void
+GaussianPyramid::reserve (int width, int height)
+{
+    this->row_pass.reserve(static_cast<std::size_t>(width) * height);
+}
+
+void
+GaussianPyramid::blur (mve::FloatImage const& in, float sigma,
+    mve::FloatImage* out)
+{
+    this->compute_kernel(sigma);
+    this->convolve(in, out, nullptr);
+}
+
+void
+GaussianPyramid::blur_dog (mve::FloatImage const& in, float sigma,
+    mve::FloatImage* out, mve::FloatImage* dog)
+{
+    this->compute_kernel(sigma);
+    this->convolve(in, out, dog);
+}
+
+void
+GaussianPyramid::build_octave (mve::FloatImage::ConstPtr image,
+    float has_sigma, float target_sigma, int num_samples,
+    ImageVector* img, ImageVector* dog)
+{
+    img->clear();
+    dog->clear();
+    this->reserve(image->width(), image->height());
+
+    /*
+     * First, bring the provided image to the target blur.
+     * Since L * g(sigma1) * g(sigma2) = L * g(sqrt(sigma1^2 + sigma2^2)),
+     * we need to blur with sigma = sqrt(target_sigma^2 - has_sigma^2).
+     */
+    int const width = image->width();
+    int const height = image->height();
+    mve::FloatImage::Ptr base = this->acquire_image(width, height);
+    if (target_sigma > has_sigma)
+    {
+        float const sigma = std::sqrt(MATH_POW2(target_sigma)
+            - MATH_POW2(has_sigma));
+        this->blur(*image, sigma, base.get());
+    }
+    else
+        std::copy(image->begin(), image->end(), base->begin());
+    img->push_back(base);
+
+    /* 'k' is the constant factor between the scales in scale space. */
+    float const k = std::pow(2.0f, 1.0f / num_samples);
+    float sigma = target_sigma;
+
+    /* Create other (s+2) samples of the octave to get a total of (s+3). */
+    for (int i = 1; i < num_samples + 3; ++i)
+    {
+        /* Blur the previous sample and create the DoG image. */
+        float const sigmak = sigma * k;
+        float const blur_sigma = std::sqrt(MATH_POW2(sigmak)
+            - MATH_POW2(sigma));
+        mve::FloatImage::Ptr next = this->acquire_image(width, height);
+        mve::FloatImage::Ptr diff = this->acquire_image(width, height);
+        this->blur_dog(*img->back(), blur_sigma, next.get(), diff.get());
+        img->push_back(next);
+        dog->push_back(diff);
+        sigma = sigmak;
+    }
+}
+
+mve::FloatImage::Ptr
+GaussianPyramid::acquire_image (int width, int height)
+{
+    if (this->pool.empty())
+        return mve::FloatImage::create(width, height, 1);
+
+    /* Prefer the smallest image which fits without reallocation. */
+    std::size_t const size = static_cast<std::size_t>(width) * height;
+    std::size_t best = this->pool.size() - 1;
+    std::size_t best_capacity = 0;
+    for (std::size_t i = 0; i < this->pool.size(); ++i)
+    {
+        std::size_t const capacity = this->pool[i]->get_data().capacity();
+        if (capacity >= size && (best_capacity == 0
+            || capacity < best_capacity))
+        {
+            best = i;
+            best_capacity = capacity;
+        }
+    }
+
+    mve::FloatImage::Ptr image = this->pool[best];
+    this->pool[best] = this->pool.back();
+    this->pool.pop_back();
+    image->resize(width, height, 1);
+    return image;
+}
+
+void
+GaussianPyramid::release_images (ImageVector* images)
+{
+    for (std::size_t i = 0; i < images->size(); ++i)
+        if (images->at(i) != nullptr && images->at(i).use_count() == 1)
+            this->pool.push_back(images->at(i));
+    images->clear();
+}
+
+void
+GaussianPyramid::compute_kernel (float sigma)
+{
+    /* Small sigmas result in literally no change. */
+    if (MATH_EPSILON_EQ(sigma, 0.0f, 0.1f))
+    {
+        this->kernel.assign(1, 1.0f);
+        return;
+    }
+
+    /* Cap kernel at 1/128 and normalize to unit sum. */
+    int const ks = static_cast<int>(std::ceil(sigma * 2.884f));
+    this->kernel.resize(ks + 1);
+    float sum = 0.0f;
+    for (int i = 0; i <= ks; ++i)
+    {
+        this->kernel[i] = math::gaussian(static_cast<float>(i), sigma);
+        sum += (i == 0 ? 1.0f : 2.0f) * this->kernel[i];
+    }
+    for (int i = 0; i <= ks; ++i)
+        this->kernel[i] /= sum;
+}
+
+void
+GaussianPyramid::convolve (mve::FloatImage const& in, mve::FloatImage* out,
+    mve::FloatImage* dog)
+{
+    if (in.channels() != 1)
+        throw std::invalid_argument("Single-channel image expected");
+    if (&in == out || &in == dog)
+        throw std::invalid_argument("Input and output must not alias");
+
+    int const w = in.width();
+    int const h = in.height();
+    int const ks = static_cast<int>(this->kernel.size()) - 1;
+    float const* kern = this->kernel.data();
+
+    /* All pixels are written below, no need to clear the images. */
+    out->resize(w, h, 1);
+    if (dog != nullptr)
+        dog->resize(w, h, 1);
+    if (w == 0 || h == 0)
+        return;
+
+    if (this->row_pass.size() < static_cast<std::size_t>(w) * h)
+        this->row_pass.resize(static_cast<std::size_t>(w) * h);
+
+#ifdef _OPENMP
+    if (this->padded_rows.size() < (std::size_t)omp_get_max_threads())
+        this->padded_rows.resize(omp_get_max_threads());
+#else
+    this->padded_rows.resize(1);
+#endif
+
+    /*
+     * Convolve in x direction using a border-padded copy of each row.
+     * Each thread has its own padded row buffer.
+     */
+#pragma omp parallel
+    {
+#ifdef _OPENMP
+        std::vector<float>& row_buffer
+            = this->padded_rows[omp_get_thread_num()];
+#else
+        std::vector<float>& row_buffer = this->padded_rows[0];
+#endif
+        if (row_buffer.size() < static_cast<std::size_t>(w + 2 * ks))
+            row_buffer.resize(w + 2 * ks);
+        float* padded = row_buffer.data();
+        float const* center = padded + ks;
+#pragma omp for schedule(static)
+        for (int y = 0; y < h; ++y)
+        {
+            float const* src = in.begin() + y * w;
+            std::fill(padded, padded + ks, src[0]);
+            std::copy(src, src + w, padded + ks);
+            std::fill(padded + ks + w, padded + 2 * ks + w, src[w - 1]);
+
+            float* dst = this->row_pass.data() + y * w;
+            for (int x = 0; x < w; ++x)
+                dst[x] = kern[0] * center[x];
+            for (int i = 1; i <= ks; ++i)
+            {
+                float const weight = kern[i];
+                float const* left = center - i;
+                float const* right = center + i;
+                for (int x = 0; x < w; ++x)
+                    dst[x] += weight * (left[x] + right[x]);
+            }
+        }
+    }
+
+    /* Convolve in y direction by accumulating rows, then compute DoG. */
+    float const* rows = this->row_pass.data();
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < h; ++y)
+    {
+        float* dst = out->begin() + y * w;
+        float const* mid = rows + y * w;
+        for (int x = 0; x < w; ++x)
+            dst[x] = kern[0] * mid[x];
+        for (int i = 1; i <= ks; ++i)
+        {
+            float const weight = kern[i];
+            float const* up = rows + std::max(0, y - i) * w;
+            float const* down = rows + std::min(h - 1, y + i) * w;
+            for (int x = 0; x < w; ++x)
+                dst[x] += weight * (up[x] + down[x]);
+        }
+
+        if (dog == nullptr)
+            continue;
+        float const* src = in.begin() + y * w;
+        float* diff = dog->begin() + y * w;
+        for (int x = 0; x < w; ++x)
+            diff[x] = dst[x] - src[x];
+    }
+}
+
+SFM_NAMESPACE_END
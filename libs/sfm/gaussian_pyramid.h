@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_GAUSSIAN_PYRAMID_HEADER
+#define SFM_GAUSSIAN_PYRAMID_HEADER
+
+#include <vector>
+
+#include "mve/image.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Builder for the octaves of a Gaussian scale space and the corresponding
+ * Difference of Gaussian (DoG) images for single-channel float images.
+ *
+ * Every scale is blurred incrementally from the previous scale using a
+ * separable Gaussian kernel. The row pass reads from a border-padded copy
+ * of each row and the column pass accumulates whole rows, so that both
+ * inner loops run over contiguous memory and are vectorized by the
+ * compiler. The DoG image is computed while the blurred row is still in
+ * cache. The intermediate row pass result and the padded rows (one per
+ * thread) are kept in an arena which is sized once for the largest image
+ * and reused for all scales of all octaves. Rows are processed in
+ * parallel, the result does not depend on the number of threads.
+ *
+ * Octave images are taken from a pool of released images. Images which
+ * are handed back with release_images() are reused for later octaves
+ * and images without reallocation if their capacity suffices.
+ *
+ * The result is equivalent to mve::image::blur_gaussian() (clamped
+ * borders, kernel capped at 1/128) up to floating point rounding.
+ */
+class GaussianPyramid
+{
+public:
+    typedef std::vector<mve::FloatImage::Ptr> ImageVector;
+
+public:
+    GaussianPyramid (void) = default;
+
+    /**
+     * Preallocates the arena for images up to the given size. This is
+     * optional, the arena grows on demand otherwise.
+     */
+    void reserve (int width, int height);
+
+    /** Blurs the single-channel image 'in' with 'sigma' into 'out'. */
+    void blur (mve::FloatImage const& in, float sigma,
+        mve::FloatImage* out);
+
+    /**
+     * Blurs the single-channel image 'in' with 'sigma' into 'out' and
+     * computes the difference 'dog' = 'out' - 'in' in the same pass.
+     */
+    void blur_dog (mve::FloatImage const& in, float sigma,
+        mve::FloatImage* out, mve::FloatImage* dog);
+
+    /**
+     * Builds an octave from 'image' which has blur 'has_sigma'. The image
+     * is first blurred to 'target_sigma', then (s+2) further scales with
+     * the corresponding DoG images are created, where s is the number of
+     * samples per octave. The result has (s+3) images and (s+2) DoGs.
+     * The images are taken from the pool.
+     */
+    void build_octave (mve::FloatImage::ConstPtr image, float has_sigma,
+        float target_sigma, int num_samples, ImageVector* img,
+        ImageVector* dog);
+
+    /**
+     * Returns a single-channel image of the given size from the pool.
+     * The image contents are undefined.
+     */
+    mve::FloatImage::Ptr acquire_image (int width, int height);
+
+    /**
+     * Hands the images back to the pool and clears the vector. Images
+     * which are still referenced elsewhere are not reused.
+     */
+    void release_images (ImageVector* images);
+
+private:
+    void compute_kernel (float sigma);
+    void convolve (mve::FloatImage const& in, mve::FloatImage* out,
+        mve::FloatImage* dog);
+
+private:
+    /** One half of the normalized, symmetric kernel including center. */
+    std::vector<float> kernel;
+    /** Result of the row pass for the whole image. */
+    std::vector<float> row_pass;
+    /** Border-padded row for each thread. */
+    std::vector<std::vector<float>> padded_rows;
+    /** Released images for reuse. */
+    ImageVector pool;
+};
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_GAUSSIAN_PYRAMID_HEADER */
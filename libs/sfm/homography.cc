@@ -87,4 +87,38 @@ symmetric_transfer_error(HomographyMatrix const& homography,
     return 0.5 * error;
 }
 
+void
+symmetric_transfer_errors (HomographyMatrix const& homography,
+    Correspondences2D2D const& matches, std::vector<double>* errors)
+{
+    math::Matrix3d const invH = math::matrix_inverse(homography);
+    double const h0 = homography[0], h1 = homography[1], h2 = homography[2];
+    double const h3 = homography[3], h4 = homography[4], h5 = homography[5];
+    double const h6 = homography[6], h7 = homography[7], h8 = homography[8];
+    double const i0 = invH[0], i1 = invH[1], i2 = invH[2];
+    double const i3 = invH[3], i4 = invH[4], i5 = invH[5];
+    double const i6 = invH[6], i7 = invH[7], i8 = invH[8];
+    std::size_t const num_matches = matches.size();
+    errors->resize(num_matches);
+    Correspondence2D2D const* m = matches.data();
+    double* result = errors->data();
+
+#pragma omp simd
+    for (std::size_t i = 0; i < num_matches; ++i)
+    {
+        double const x1 = m[i].p1[0], y1 = m[i].p1[1];
+        double const x2 = m[i].p2[0], y2 = m[i].p2[1];
+
+        double const w1 = i6 * x2 + i7 * y2 + i8;
+        double const dx1 = x1 - (i0 * x2 + i1 * y2 + i2) / w1;
+        double const dy1 = y1 - (i3 * x2 + i4 * y2 + i5) / w1;
+
+        double const w2 = h6 * x1 + h7 * y1 + h8;
+        double const dx2 = (h0 * x1 + h1 * y1 + h2) / w2 - x2;
+        double const dy2 = (h3 * x1 + h4 * y1 + h5) / w2 - y2;
+
+        result[i] = 0.5 * (dx1 * dx1 + dy1 * dy1 + dx2 * dx2 + dy2 * dy2);
+    }
+}
+
 SFM_NAMESPACE_END
@@ -10,6 +10,8 @@
 #ifndef SFM_HOMOGRAPHY_HEADER
 #define SFM_HOMOGRAPHY_HEADER
 
+#include <vector>
+
 #include "math/matrix.h"
 #include "sfm/defines.h"
 #include "sfm/correspondence.h"
@@ -34,6 +36,15 @@ double
 symmetric_transfer_error(HomographyMatrix const& homography,
     Correspondence2D2D const& match);
 
+/**
+ * Computes the symmetric transfer errors for all image correspondences.
+ * This is equivalent to symmetric_transfer_error() but inverts the
+ * homography only once and is vectorized over the matches.
+ */
+void
+symmetric_transfer_errors (HomographyMatrix const& homography,
+    Correspondences2D2D const& matches, std::vector<double>* errors);
+
 SFM_NAMESPACE_END
 
 #endif // SFM_HOMOGRAPHY_HEADER
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <random>
+
+#include "math/functions.h"
+#include "util/aligned_memory.h"
+#include "util/timer.h"
+#include "sfm/kdtree_matching.h"
+#include "sfm/nearest_neighbor.h"
+
+/* Number of descriptors used to estimate the variance at a node. */
+#define KDTREE_VARIANCE_SAMPLES 100
+/* Number of highest variance dimensions to choose the split from. */
+#define KDTREE_RANDOM_DIMS 5
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /* An unexplored branch of one of the trees. */
+    struct Branch
+    {
+        float dist;
+        int tree;
+        int node;
+
+        bool operator> (Branch const& other) const
+        {
+            return this->dist > other.dist;
+        }
+    };
+
+    typedef std::priority_queue<Branch, std::vector<Branch>,
+        std::greater<Branch>> BranchQueue;
+}
+
+void
+KdTreeMatching::init (bundler::ViewportList* viewports)
+{
+    ExhaustiveMatching::init(viewports);
+
+    util::WallTimer timer;
+    this->sift_forests.clear();
+    this->sift_forests.resize(viewports->size());
+    this->surf_forests.clear();
+    this->surf_forests.resize(viewports->size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < viewports->size(); i++)
+    {
+        ProcessedFeatureSet const& pfs = this->processed_feature_sets[i];
+        unsigned int const seed = static_cast<unsigned int>(i);
+        if (!pfs.sift_descr.empty())
+            this->build_forest(pfs.sift_descr.data()->begin(),
+                pfs.sift_descr.size(), 128, seed, &this->sift_forests[i]);
+        if (!pfs.surf_descr.empty())
+            this->build_forest(pfs.surf_descr.data()->begin(),
+                pfs.surf_descr.size(), 64, seed, &this->surf_forests[i]);
+    }
+    std::cout << "Building kd-trees took " << timer.get_elapsed()
+        << " ms" << std::endl;
+}
+
+void
+KdTreeMatching::pairwise_match (int view_1_id, int view_2_id,
+    Matching::Result* result) const
+{
+    ProcessedFeatureSet const& pfs_1 = this->processed_feature_sets[view_1_id];
+    ProcessedFeatureSet const& pfs_2 = this->processed_feature_sets[view_2_id];
+
+    /* SIFT matching. */
+    Matching::Result sift_result;
+    if (pfs_1.sift_descr.size() > 0)
+    {
+        this->twoway_match(this->opts.sift_matching_opts,
+            pfs_1.sift_descr.data()->begin(), pfs_1.sift_descr.size(),
+            this->sift_forests[view_1_id],
+            pfs_2.sift_descr.data()->begin(), pfs_2.sift_descr.size(),
+            this->sift_forests[view_2_id], &sift_result);
+        Matching::remove_inconsistent_matches(&sift_result);
+    }
+
+    /* SURF matching. */
+    Matching::Result surf_result;
+    if (pfs_1.surf_descr.size() > 0)
+    {
+        this->twoway_match(this->opts.surf_matching_opts,
+            pfs_1.surf_descr.data()->begin(), pfs_1.surf_descr.size(),
+            this->surf_forests[view_1_id],
+            pfs_2.surf_descr.data()->begin(), pfs_2.surf_descr.size(),
+            this->surf_forests[view_2_id], &surf_result);
+        Matching::remove_inconsistent_matches(&surf_result);
+    }
+
+    Matching::combine_results(sift_result, surf_result, result);
+}
+
+template <typename T>
+void
+KdTreeMatching::build_forest (T const* descriptors, int num_descriptors,
+    int dimensions, unsigned int seed, Forest* forest) const
+{
+    int const num_trees = std::max(1, this->kdtree_opts.num_trees);
+    int const max_leaf_size = std::max(1, this->kdtree_opts.max_leaf_size);
+    std::mt19937 generator(seed);
+
+    std::vector<float> mean(dimensions);
+    std::vector<float> variance(dimensions);
+    std::vector<int> dims(dimensions);
+
+    forest->clear();
+    forest->resize(num_trees);
+    for (int t = 0; t < num_trees; ++t)
+    {
+        Tree& tree = forest->at(t);
+        tree.indices.resize(num_descriptors);
+        for (int i = 0; i < num_descriptors; ++i)
+            tree.indices[i] = i;
+
+        /* Stack with pending nodes and their index ranges. */
+        struct PendingNode { int node, begin, end; };
+        std::vector<PendingNode> stack;
+        tree.nodes.push_back(Node());
+        stack.push_back({ 0, 0, num_descriptors });
+        while (!stack.empty())
+        {
+            PendingNode const pending = stack.back();
+            stack.pop_back();
+
+            int* begin = tree.indices.data() + pending.begin;
+            int* end = tree.indices.data() + pending.end;
+            int const size = pending.end - pending.begin;
+            if (size <= max_leaf_size)
+            {
+                Node& leaf = tree.nodes[pending.node];
+                leaf.split_dim = -1;
+                leaf.split_value = 0.0f;
+                leaf.left = pending.begin;
+                leaf.right = pending.end;
+                continue;
+            }
+
+            /* Estimate mean and variance from a subset of descriptors. */
+            int const num_samples = std::min(size, KDTREE_VARIANCE_SAMPLES);
+            std::fill(mean.begin(), mean.end(), 0.0f);
+            std::fill(variance.begin(), variance.end(), 0.0f);
+            for (int i = 0; i < num_samples; ++i)
+            {
+                T const* descr = descriptors + begin[i] * dimensions;
+                for (int d = 0; d < dimensions; ++d)
+                    mean[d] += static_cast<float>(descr[d]);
+            }
+            for (int d = 0; d < dimensions; ++d)
+                mean[d] /= static_cast<float>(num_samples);
+            for (int i = 0; i < num_samples; ++i)
+            {
+                T const* descr = descriptors + begin[i] * dimensions;
+                for (int d = 0; d < dimensions; ++d)
+                    variance[d] += MATH_POW2(descr[d] - mean[d]);
+            }
+
+            /* Randomly choose among the dimensions of highest variance. */
+            int const num_random_dims = std::min(dimensions,
+                KDTREE_RANDOM_DIMS);
+            for (int d = 0; d < dimensions; ++d)
+                dims[d] = d;
+            std::partial_sort(dims.begin(), dims.begin() + num_random_dims,
+                dims.end(), [&variance] (int a, int b)
+                { return variance[a] > variance[b]; });
+            int const split_dim = dims[generator() % num_random_dims];
+            float split_value = mean[split_dim];
+
+            /* Partition at the mean, or at the median if degenerate. */
+            int* middle = std::partition(begin, end, [&] (int index)
+                { return descriptors[index * dimensions + split_dim]
+                    < split_value; });
+            if (middle == begin || middle == end)
+            {
+                middle = begin + size / 2;
+                std::nth_element(begin, middle, end, [&] (int a, int b)
+                    { return descriptors[a * dimensions + split_dim]
+                        < descriptors[b * dimensions + split_dim]; });
+                split_value = descriptors[*middle * dimensions + split_dim];
+            }
+
+            int const left = tree.nodes.size();
+            int const right = left + 1;
+            tree.nodes.push_back(Node());
+            tree.nodes.push_back(Node());
+            Node& node = tree.nodes[pending.node];
+            node.split_dim = split_dim;
+            node.split_value = split_value;
+            node.left = left;
+            node.right = right;
+
+            int const middle_id = pending.begin + (middle - begin);
+            stack.push_back({ left, pending.begin, middle_id });
+            stack.push_back({ right, middle_id, pending.end });
+        }
+    }
+}
+
+template <typename T>
+void
+KdTreeMatching::twoway_match (Matching::Options const& matching_opts,
+    T const* set_1, int set_1_size, Forest const& forest_1,
+    T const* set_2, int set_2_size, Forest const& forest_2,
+    Matching::Result* matches) const
+{
+    this->oneway_match(matching_opts, set_1, set_1_size,
+        set_2, set_2_size, forest_2, &matches->matches_1_2,
+        &matches->ratios_1_2);
+    this->oneway_match(matching_opts, set_2, set_2_size,
+        set_1, set_1_size, forest_1, &matches->matches_2_1,
+        &matches->ratios_2_1);
+}
+
+template <typename T>
+void
+KdTreeMatching::oneway_match (Matching::Options const& matching_opts,
+    T const* set_1, int set_1_size,
+    T const* set_2, int set_2_size, Forest const& forest_2,
+    std::vector<int>* result, std::vector<float>* ratios) const
+{
+    result->clear();
+    result->resize(set_1_size, -1);
+    ratios->clear();
+    ratios->resize(set_1_size, 1.0f);
+    if (set_1_size == 0 || set_2_size == 0)
+        return;
+
+    float const square_lowe_thres = MATH_POW2(matching_opts.lowe_ratio_threshold);
+    float const square_dist_thres = MATH_POW2(matching_opts.distance_threshold);
+    int const descriptor_length = matching_opts.descriptor_length;
+    std::size_t const max_checks = std::max(2, this->kdtree_opts.max_checks);
+
+    std::vector<bool> data_index_used(set_2_size, false);
+    std::vector<int> candidates;
+    util::AlignedMemory<T, 16> candidate_descs;
+    BranchQueue branches;
+
+    NearestNeighbor<T> nn;
+    nn.set_element_dimensions(descriptor_length);
+
+    for (int i = 0; i < set_1_size; ++i)
+    {
+        T const* query = set_1 + i * descriptor_length;
+
+        /* Descends to a leaf and collects the unseen descriptors. */
+        auto descend = [&] (int tree_id, int node_id, float dist)
+        {
+            Tree const& tree = forest_2[tree_id];
+            Node const* node = &tree.nodes[node_id];
+            while (node->split_dim >= 0)
+            {
+                float const diff = static_cast<float>(query[node->split_dim])
+                    - node->split_value;
+                int const near = diff < 0.0f ? node->left : node->right;
+                int const far = diff < 0.0f ? node->right : node->left;
+                branches.push({ dist + diff * diff, tree_id, far });
+                node = &tree.nodes[near];
+            }
+            for (int j = node->left; j < node->right; ++j)
+            {
+                int const index = tree.indices[j];
+                if (data_index_used[index])
+                    continue;
+                data_index_used[index] = true;
+                candidates.push_back(index);
+            }
+        };
+
+        /* Search all trees, then the closest branches of any tree. */
+        candidates.clear();
+        branches = BranchQueue();
+        for (std::size_t t = 0; t < forest_2.size(); ++t)
+            descend(t, 0, 0.0f);
+        while (candidates.size() < max_checks && !branches.empty())
+        {
+            Branch const branch = branches.top();
+            branches.pop();
+            descend(branch.tree, branch.node, branch.dist);
+        }
+
+        /* Copy candidate descriptors into a contiguous array. */
+        candidate_descs.resize(candidates.size() * descriptor_length);
+        for (std::size_t j = 0; j < candidates.size(); ++j)
+        {
+            std::memcpy(candidate_descs.data() + j * descriptor_length,
+                set_2 + candidates[j] * descriptor_length,
+                descriptor_length * sizeof(T));
+            data_index_used[candidates[j]] = false;
+        }
+
+        typename NearestNeighbor<T>::Result nn_result;
+        nn.set_elements(candidate_descs.data());
+        nn.set_num_elements(candidates.size());
+        nn.find(query, &nn_result);
+
+        if (nn_result.dist_1st_best > square_dist_thres)
+            continue;
+        float const ratio = static_cast<float>(nn_result.dist_1st_best)
+            / static_cast<float>(nn_result.dist_2nd_best);
+        if (ratio > square_lowe_thres)
+            continue;
+
+        result->at(i) = candidates[nn_result.index_1st_best];
+        ratios->at(i) = ratio;
+    }
+}
+
+SFM_NAMESPACE_END
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_KDTREE_MATCHING_HEADER
+#define SFM_KDTREE_MATCHING_HEADER
+
+#include <vector>
+
+#include "sfm/bundler_common.h"
+#include "sfm/defines.h"
+#include "sfm/exhaustive_matching.h"
+#include "sfm/matching.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Approximate nearest neighbor matching using randomized kd-trees.
+ *
+ * A forest of randomized kd-trees is built over the discretized descriptors
+ * of every view in init(). Each tree splits on a dimension randomly chosen
+ * among the dimensions with highest variance. A query descends all trees
+ * and then continues in the branches closest to the query (using a single
+ * priority queue for all trees) until a maximum number of descriptors has
+ * been collected. The nearest neighbors among the collected descriptors are
+ * then determined exactly using NearestNeighbor.
+ *
+ * The number of checks bounds the search effort per query and trades speed
+ * for recall. Low-resolution matching uses only few features and is
+ * performed exhaustively.
+ */
+class KdTreeMatching : public ExhaustiveMatching
+{
+public:
+    struct Options
+    {
+        /** Number of randomized kd-trees per view. */
+        int num_trees = 4;
+
+        /**
+         * Maximum number of descriptors compared per query. Larger values
+         * increase the recall of the nearest neighbors but are slower.
+         */
+        int max_checks = 128;
+
+        /** Maximum number of descriptors in a leaf node. */
+        int max_leaf_size = 8;
+    };
+
+public:
+    explicit KdTreeMatching (Options const& options);
+    ~KdTreeMatching (void) override = default;
+
+    /** Initialize matcher by building the kd-trees for all views. */
+    void init (bundler::ViewportList* viewports) override;
+
+    /** Matches all feature types yielding a single matching result. */
+    void pairwise_match (int view_1_id, int view_2_id,
+        Matching::Result* result) const override;
+
+private:
+    /** Inner nodes split at a dimension, leafs reference a range. */
+    struct Node
+    {
+        /** The split dimension, or -1 for leaf nodes. */
+        int split_dim;
+        /** The split value, smaller values go to the left child. */
+        float split_value;
+        /** Child node IDs for inner nodes, index range for leaf nodes. */
+        int left;
+        int right;
+    };
+
+    struct Tree
+    {
+        /** The nodes of the tree, the root node is the first node. */
+        std::vector<Node> nodes;
+        /** Descriptor indices, each leaf references a range. */
+        std::vector<int> indices;
+    };
+
+    typedef std::vector<Tree> Forest;
+
+    template <typename T>
+    void build_forest (T const* descriptors, int num_descriptors,
+        int dimensions, unsigned int seed, Forest* forest) const;
+
+    template <typename T>
+    void twoway_match (Matching::Options const& matching_opts,
+        T const* set_1, int set_1_size, Forest const& forest_1,
+        T const* set_2, int set_2_size, Forest const& forest_2,
+        Matching::Result* matches) const;
+
+    template <typename T>
+    void oneway_match (Matching::Options const& matching_opts,
+        T const* set_1, int set_1_size,
+        T const* set_2, int set_2_size, Forest const& forest_2,
+        std::vector<int>* result, std::vector<float>* ratios) const;
+
+private:
+    Options kdtree_opts;
+    std::vector<Forest> sift_forests;
+    std::vector<Forest> surf_forests;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+KdTreeMatching::KdTreeMatching (Options const& options)
+    : kdtree_opts(options)
+{
+}
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_KDTREE_MATCHING_HEADER */
@@ -71,6 +71,20 @@ Matching::combine_results(Matching::Result const& sift_result,
     result->matches_2_1.insert(result->matches_2_1.end(),
         surf_result.matches_2_1.begin(), surf_result.matches_2_1.end());
 
+    result->ratios_1_2.clear();
+    result->ratios_1_2.reserve(num_matches_1);
+    result->ratios_1_2.insert(result->ratios_1_2.end(),
+        sift_result.ratios_1_2.begin(), sift_result.ratios_1_2.end());
+    result->ratios_1_2.insert(result->ratios_1_2.end(),
+        surf_result.ratios_1_2.begin(), surf_result.ratios_1_2.end());
+
+    result->ratios_2_1.clear();
+    result->ratios_2_1.reserve(num_matches_2);
+    result->ratios_2_1.insert(result->ratios_2_1.end(),
+        sift_result.ratios_2_1.begin(), sift_result.ratios_2_1.end());
+    result->ratios_2_1.insert(result->ratios_2_1.end(),
+        surf_result.ratios_2_1.begin(), surf_result.ratios_2_1.end());
+
     /* Fix offsets. */
     std::size_t surf_offset_1 = sift_result.matches_1_2.size();
     std::size_t surf_offset_2 = sift_result.matches_2_1.size();
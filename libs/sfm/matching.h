@@ -52,6 +52,8 @@ public:
     /**
      * Feature matching result reported as two lists, each with indices in the
      * other set. An unsuccessful match is indicated with a negative index.
+     * The squared distance ratios between the best and second best match
+     * are kept as match quality (smaller is better) for every valid match.
      */
     struct Result
     {
@@ -59,6 +61,10 @@ public:
         std::vector<int> matches_1_2;
         /* Matches from set 2 in set 1. */
         std::vector<int> matches_2_1;
+        /* Squared distance ratios of the matches from set 1 in set 2. */
+        std::vector<float> ratios_1_2;
+        /* Squared distance ratios of the matches from set 2 in set 1. */
+        std::vector<float> ratios_2_1;
     };
 
 public:
@@ -107,6 +113,17 @@ public:
     static void
     combine_results(Result const& sift_result,
         Result const& surf_result, Matching::Result* result);
+
+private:
+    /**
+     * Applies the matching thresholds to nearest neighbor results.
+     * The distance ratios of the matches are stored if ratios is not null.
+     */
+    template <typename T>
+    static void
+    threshold_matches (Options const& options,
+        std::vector<typename NearestNeighbor<T>::Result> const& nn_results,
+        std::vector<int>* result, std::vector<float>* ratios = nullptr);
 };
 
 /* ---------------------------------------------------------------- */
@@ -123,26 +140,14 @@ Matching::oneway_match (Options const& options,
     if (set_1_size == 0 || set_2_size == 0)
         return;
 
-    float const square_lowe_thres = MATH_POW2(options.lowe_ratio_threshold);
-    float const square_dist_thres = MATH_POW2(options.distance_threshold);
     NearestNeighbor<T> nn;
     nn.set_elements(set_2);
     nn.set_num_elements(set_2_size);
     nn.set_element_dimensions(options.descriptor_length);
 
-    for (int i = 0; i < set_1_size; ++i)
-    {
-        typename NearestNeighbor<T>::Result nn_result;
-        T const* query_pointer = set_1 + i * options.descriptor_length;
-        nn.find(query_pointer, &nn_result);
-        if (nn_result.dist_1st_best > square_dist_thres)
-            continue;
-        if (static_cast<float>(nn_result.dist_1st_best)
-            / static_cast<float>(nn_result.dist_2nd_best)
-            > square_lowe_thres)
-            continue;
-        result->at(i) = nn_result.index_1st_best;
-    }
+    std::vector<typename NearestNeighbor<T>::Result> nn_results(set_1_size);
+    nn.find_all(set_1, set_1_size, nn_results.data());
+    Matching::threshold_matches<T>(options, nn_results, result);
 }
 
 template <typename T>
@@ -152,10 +157,53 @@ Matching::twoway_match (Options const& options,
     T const* set_2, int set_2_size,
     Result* matches)
 {
-    Matching::oneway_match(options, set_1, set_1_size,
-        set_2, set_2_size, &matches->matches_1_2);
-    Matching::oneway_match(options, set_2, set_2_size,
-        set_1, set_1_size, &matches->matches_2_1);
+    matches->matches_1_2.clear();
+    matches->matches_1_2.resize(set_1_size, -1);
+    matches->matches_2_1.clear();
+    matches->matches_2_1.resize(set_2_size, -1);
+    matches->ratios_1_2.clear();
+    matches->ratios_1_2.resize(set_1_size, 1.0f);
+    matches->ratios_2_1.clear();
+    matches->ratios_2_1.resize(set_2_size, 1.0f);
+    if (set_1_size == 0 || set_2_size == 0)
+        return;
+
+    /* Both directions are computed from the same inner products. */
+    NearestNeighbor<T> nn;
+    nn.set_elements(set_2);
+    nn.set_num_elements(set_2_size);
+    nn.set_element_dimensions(options.descriptor_length);
+
+    std::vector<typename NearestNeighbor<T>::Result> nn_results_1(set_1_size);
+    std::vector<typename NearestNeighbor<T>::Result> nn_results_2(set_2_size);
+    nn.find_all(set_1, set_1_size, nn_results_1.data(), nn_results_2.data());
+    Matching::threshold_matches<T>(options, nn_results_1,
+        &matches->matches_1_2, &matches->ratios_1_2);
+    Matching::threshold_matches<T>(options, nn_results_2,
+        &matches->matches_2_1, &matches->ratios_2_1);
+}
+
+template <typename T>
+void
+Matching::threshold_matches (Options const& options,
+    std::vector<typename NearestNeighbor<T>::Result> const& nn_results,
+    std::vector<int>* result, std::vector<float>* ratios)
+{
+    float const square_lowe_thres = MATH_POW2(options.lowe_ratio_threshold);
+    float const square_dist_thres = MATH_POW2(options.distance_threshold);
+    for (std::size_t i = 0; i < nn_results.size(); ++i)
+    {
+        typename NearestNeighbor<T>::Result const& nn_result = nn_results[i];
+        if (nn_result.dist_1st_best > square_dist_thres)
+            continue;
+        float const ratio = static_cast<float>(nn_result.dist_1st_best)
+            / static_cast<float>(nn_result.dist_2nd_best);
+        if (ratio > square_lowe_thres)
+            continue;
+        result->at(i) = nn_result.index_1st_best;
+        if (ratios != nullptr)
+            ratios->at(i) = ratio;
+    }
 }
 
 SFM_NAMESPACE_END
@@ -22,6 +22,7 @@
  * - xmmintrin.h     X86 SSE1
  * - emmintrin.h     X86 SSE2
  * - pmmintrin.h     X86 SSE3
+ * - immintrin.h     X86 AVX/AVX2/AVX-512
  *
  * MMX/SSE Data Types:
  * - MMX:  __m64 64 bits of integers.
@@ -33,263 +34,1095 @@
  * - X86 SSE            __SSE__
  * - X86 SSE2           __SSE2__
  * - X86 SSE3           __SSE3__
+ * - X86 AVX2           __AVX2__
+ * - X86 AVX-512        __AVX512F__, __AVX512BW__, __AVX512VNNI__
  * - altivec functions  __VEC__
  * - neon functions     __ARM_NEON__
+ *
+ * The AVX2 and AVX-512 kernels are compiled using function target
+ * attributes, independent of the compiler flags, and are selected at
+ * runtime using CPUID (see util::system::cpu_supports).
  */
 
+
 #include <algorithm>
 #include <iostream>
+#include <type_traits>
+#include <vector>
 #if defined(__SSE2__)
 #   include <emmintrin.h> // SSE2
 #endif
 #if defined(__SSE3__)
 #   include <pmmintrin.h> // SSE3
 #endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   include <immintrin.h> // AVX2, AVX-512
+#   define NN_RUNTIME_DISPATCH 1
+#   define NN_TARGET(x) __attribute__((target(x)))
+#else
+#   define NN_RUNTIME_DISPATCH 0
+#endif
 
+#include "util/system.h"
 #include "sfm/nearest_neighbor.h"
 
+#if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
+#   define NN_HAVE_SSE2_KERNEL 1
+#else
+#   define NN_HAVE_SSE2_KERNEL 0
+#endif
+#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
+#   define NN_HAVE_SSE3_KERNEL 1
+#else
+#   define NN_HAVE_SSE3_KERNEL 0
+#endif
+#define NN_HAVE_AVX2_KERNEL (ENABLE_AVX2_NN_SEARCH && NN_RUNTIME_DISPATCH)
+#define NN_HAVE_AVX512_KERNEL (ENABLE_AVX512_NN_SEARCH && NN_RUNTIME_DISPATCH)
+
+/* Number of queries and elements in a block of inner products. */
+#define NN_QUERY_BLOCK_SIZE 32
+#define NN_ELEMENT_BLOCK_SIZE 256
+
 SFM_NAMESPACE_BEGIN
 
 namespace
 {
+    /* Kernel identifiers, identical for all NearestNeighbor<T>::Kernel. */
+    enum
+    {
+        KERNEL_AUTO = NearestNeighbor<float>::KERNEL_AUTO,
+        KERNEL_SCALAR = NearestNeighbor<float>::KERNEL_SCALAR,
+        KERNEL_SSE = NearestNeighbor<float>::KERNEL_SSE,
+        KERNEL_AVX2 = NearestNeighbor<float>::KERNEL_AVX2,
+        KERNEL_AVX512 = NearestNeighbor<float>::KERNEL_AVX512,
+        KERNEL_AVX512_VNNI = NearestNeighbor<float>::KERNEL_AVX512_VNNI
+    };
+
+    /*
+     * Returns whether the kernel is compiled in and supported by the CPU.
+     * The CPU is only queried once, the result is cached.
+     */
+    bool
+    kernel_available (int kernel, bool is_float)
+    {
+        using util::system::cpu_supports;
+        static bool const has_avx2 = NN_HAVE_AVX2_KERNEL
+            && cpu_supports(util::system::CPU_FEATURE_AVX2);
+        static bool const has_avx512f = NN_HAVE_AVX512_KERNEL
+            && cpu_supports(util::system::CPU_FEATURE_AVX512F);
+        static bool const has_avx512bw = has_avx512f
+            && cpu_supports(util::system::CPU_FEATURE_AVX512BW);
+        static bool const has_avx512vnni = has_avx512bw
+            && cpu_supports(util::system::CPU_FEATURE_AVX512VNNI);
+
+        switch (kernel)
+        {
+            case KERNEL_SCALAR:
+                return true;
+            case KERNEL_SSE:
+                return is_float ? NN_HAVE_SSE3_KERNEL : NN_HAVE_SSE2_KERNEL;
+            case KERNEL_AVX2:
+                return has_avx2;
+            case KERNEL_AVX512:
+                return is_float ? has_avx512f : has_avx512bw;
+            case KERNEL_AVX512_VNNI:
+                return !is_float && has_avx512vnni;
+            default:
+                return false;
+        }
+    }
+
+    /* Unsigned char values are widened to unsigned short in the registers. */
+    template <typename T>
+    struct Widened
+    {
+        typedef T Type;
+    };
+
+    template <>
+    struct Widened<unsigned char>
+    {
+        typedef unsigned short Type;
+    };
+
+    /* Returns the register width of the kernel in bytes. */
+    int
+    kernel_register_bytes (int kernel)
+    {
+        switch (kernel)
+        {
+            case KERNEL_SSE: return 16;
+            case KERNEL_AVX2: return 32;
+            case KERNEL_AVX512: return 64;
+            case KERNEL_AVX512_VNNI: return 64;
+            default: return 1;
+        }
+    }
+
+    /* Result distances are shamelessly misused to store inner products. */
+    template <typename T>
+    inline void
+    reset_result (typename NearestNeighbor<T>::Result* result)
+    {
+        result->dist_1st_best = 0;
+        result->dist_2nd_best = 0;
+        result->index_1st_best = 0;
+        result->index_2nd_best = 0;
+    }
+
+    /*
+     * Stores the inner product if it is the largest or second largest
+     * inner product found so far.
+     */
+    template <typename T, typename V>
+    inline void
+    update_result (V inner_product, int index,
+        typename NearestNeighbor<T>::Result* result)
+    {
+        /* Check if new largest inner product has been found. */
+        if (inner_product >= result->dist_2nd_best)
+        {
+            if (inner_product >= result->dist_1st_best)
+            {
+                result->index_2nd_best = result->index_1st_best;
+                result->dist_2nd_best = result->dist_1st_best;
+                result->index_1st_best = index;
+                result->dist_1st_best = inner_product;
+            }
+            else
+            {
+                result->index_2nd_best = index;
+                result->dist_2nd_best = inner_product;
+            }
+        }
+    }
+
+    /*
+     * Compute actual square distances.
+     * The distance with 'signed char' vectors is: 2 * 127^2 - 2 * <Q, Ci>.
+     * The maximum distance is (2*127)^2, which unfortunately does not fit
+     * in a signed short. Therefore, the distance is clapmed at 127^2.
+     */
+    void
+    convert_to_distances (NearestNeighbor<short>::Result* result)
+    {
+        result->dist_1st_best = std::min(16129, std::max(0, (int)result->dist_1st_best));
+        result->dist_2nd_best = std::min(16129, std::max(0, (int)result->dist_2nd_best));
+        result->dist_1st_best = 32258 - 2 * result->dist_1st_best;
+        result->dist_2nd_best = 32258 - 2 * result->dist_2nd_best;
+    }
+
+    /*
+     * Compute actual square distances.
+     * The distance with 'unsigned char' vectors is: 2 * 255^2 - 2 * <Q, Ci>.
+     * The maximum distance is (2*255)^2, which unfortunately does not fit
+     * in a unsigned short. Therefore, the result distance is clapmed:
+     * 2 * 255^2 - 2 * <Q, Ci> = 2 * (255^2 - <Q, Ci>) and (255^2 - <Q, Ci>)
+     * is clamped to 32767 and then multiplied by 2.
+     */
+    template <typename R>
+    void
+    convert_unsigned_distances (R* result)
+    {
+        result->dist_1st_best = std::min(65025, (int)result->dist_1st_best);
+        result->dist_2nd_best = std::min(65025, (int)result->dist_2nd_best);
+        result->dist_1st_best = 65025 - result->dist_1st_best;
+        result->dist_2nd_best = 65025 - result->dist_2nd_best;
+        result->dist_1st_best = std::min(32767, (int)result->dist_1st_best) * 2;
+        result->dist_2nd_best = std::min(32767, (int)result->dist_2nd_best) * 2;
+    }
+
+    void
+    convert_to_distances (NearestNeighbor<unsigned short>::Result* result)
+    {
+        convert_unsigned_distances(result);
+    }
+
+    void
+    convert_to_distances (NearestNeighbor<unsigned char>::Result* result)
+    {
+        convert_unsigned_distances(result);
+    }
+
+    /*
+     * Compute actual (square) distances.
+     */
+    void
+    convert_to_distances (NearestNeighbor<float>::Result* result)
+    {
+        result->dist_1st_best = std::max(0.0f, 2.0f - 2.0f * result->dist_1st_best);
+        result->dist_2nd_best = std::max(0.0f, 2.0f - 2.0f * result->dist_2nd_best);
+    }
+
+    /*
+     * The inner product kernels compute a block of inner products between
+     * 'num_queries' queries and 'num_elements' elements and store them row
+     * by row, i.e., the inner products of the first query are stored first.
+     * Each kernel consists of a single inner product, which is used for the
+     * borders of the block, and a register-blocked loop (similar to a small
+     * matrix multiplication) that computes inner products of several queries
+     * and elements at once, reusing all loaded registers.
+     */
+
+    /*
+     * Signed and unsigned short inner product implementation. The unsigned
+     * char kernels are the unsigned short kernels with widening loads.
+     */
+    template <typename T>
+    inline int
+    short_inner_prod_scalar (T const* a, T const* b, int dimensions)
+    {
+        int inner_product = 0;
+        for (int i = 0; i < dimensions; ++i)
+            inner_product += a[i] * b[i];
+        return inner_product;
+    }
+
+    template <typename T>
+    void
+    short_block_scalar (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* out)
+    {
+        for (int i = 0; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j, ++out)
+                *out = short_inner_prod_scalar(queries + i * dimensions,
+                    elements + j * dimensions, dimensions);
+    }
+
+#if NN_HAVE_SSE2_KERNEL
     /*
-     * Signed and unsigned short inner product implementation. Stores the
-     * largest and second largest inner product of query with elements.
-     *
      * For SSE query and result should be 16 byte aligned.
      * Otherwise loading and storing values into/from registers is slow.
      * The dimension size must be divisible by 8, each __m128i register
      * can load 8 shorts = 16 bytes = 128 bit.
      */
     template <typename T>
+    inline __m128i
+    load_sse2 (T const* ptr)
+    {
+        return _mm_load_si128(reinterpret_cast<__m128i const*>(ptr));
+    }
+
+    /* Loads 8 unsigned chars and widens them to unsigned shorts. */
+    inline __m128i
+    load_sse2 (unsigned char const* ptr)
+    {
+        return _mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<__m128i const*>(ptr)), _mm_setzero_si128());
+    }
+
+    template <typename T>
+    inline int
+    short_reduce_add_sse2 (__m128i reg)
+    {
+        typename Widened<T>::Type tmp[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(tmp), reg);
+        return tmp[0] + tmp[1] + tmp[2] + tmp[3]
+            + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+    }
+
+    template <typename T>
+    inline int
+    short_inner_prod_sse2 (T const* a, T const* b, int dimensions)
+    {
+        __m128i reg_result = _mm_set1_epi16(0);
+        for (int i = 0; i < dimensions; i += 8)
+            reg_result = _mm_add_epi16(reg_result,
+                _mm_mullo_epi16(load_sse2(a + i), load_sse2(b + i)));
+        return short_reduce_add_sse2<T>(reg_result);
+    }
+
+    /*
+     * Computes blocks of 2 queries x 4 elements in 8 accumulators. Like
+     * short_inner_prod_sse2(), the products are accumulated in 16 bit
+     * and the horizontal sums are identical.
+     */
+    template <typename T>
     void
-    short_inner_prod (T const* query,
-        typename NearestNeighbor<T>::Result* result,
-        T const* elements, int num_elements, int dimensions)
+    short_block_sse2 (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* out)
     {
-#if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
-        /* Using a constant number reduces computation time by about 1/3. */
-        int const dim_8 = dimensions / 8;
-        __m128i const* descr_ptr = reinterpret_cast<__m128i const*>(elements);
-        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        int i = 0;
+        for (; i + 2 <= num_queries; i += 2)
         {
-            /* Compute dot product between query and candidate. */
-            __m128i const* query_ptr = reinterpret_cast<__m128i const*>(query);
-            __m128i reg_result = _mm_set1_epi16(0);
-            for (int i = 0; i < dim_8; ++i, ++query_ptr, ++descr_ptr)
-            {
-                __m128i reg_query = _mm_load_si128(query_ptr);
-                __m128i reg_subject = _mm_load_si128(descr_ptr);
-                reg_result = _mm_add_epi16(reg_result,
-                    _mm_mullo_epi16(reg_query, reg_subject));
-            }
-            T const* tmp = reinterpret_cast<T const*>(&reg_result);
-            int inner_product = tmp[0] + tmp[1] + tmp[2] + tmp[3]
-                + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+            T const* query_0 = queries + i * dimensions;
+            T const* query_1 = query_0 + dimensions;
+            int* out_0 = out + i * num_elements;
+            int* out_1 = out_0 + num_elements;
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product >= result->dist_2nd_best)
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
             {
-                if (inner_product >= result->dist_1st_best)
+                T const* elems = elements + j * dimensions;
+                __m128i acc_0[4], acc_1[4];
+                for (int k = 0; k < 4; ++k)
+                    acc_0[k] = acc_1[k] = _mm_setzero_si128();
+                for (int d = 0; d < dimensions; d += 8)
                 {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = descr_iter;
-                    result->dist_1st_best = inner_product;
+                    __m128i const reg_query_0 = load_sse2(query_0 + d);
+                    __m128i const reg_query_1 = load_sse2(query_1 + d);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m128i const reg_subject
+                            = load_sse2(elems + k * dimensions + d);
+                        acc_0[k] = _mm_add_epi16(acc_0[k],
+                            _mm_mullo_epi16(reg_query_0, reg_subject));
+                        acc_1[k] = _mm_add_epi16(acc_1[k],
+                            _mm_mullo_epi16(reg_query_1, reg_subject));
+                    }
                 }
-                else
+                for (int k = 0; k < 4; ++k)
                 {
-                    result->index_2nd_best = descr_iter;
-                    result->dist_2nd_best = inner_product;
+                    out_0[j + k] = short_reduce_add_sse2<T>(acc_0[k]);
+                    out_1[j + k] = short_reduce_add_sse2<T>(acc_1[k]);
                 }
             }
+
+            for (; j < num_elements; ++j)
+            {
+                T const* elem = elements + j * dimensions;
+                out_0[j] = short_inner_prod_sse2(query_0, elem, dimensions);
+                out_1[j] = short_inner_prod_sse2(query_1, elem, dimensions);
+            }
         }
-#else
-        T const* descr_ptr = elements;
-        for (int i = 0; i < num_elements; ++i)
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = short_inner_prod_sse2(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
+    }
+#endif // NN_HAVE_SSE2_KERNEL
+
+#if NN_HAVE_AVX2_KERNEL
+    /*
+     * The AVX2 kernel multiplies pairs of shorts and accumulates them in
+     * 32 bit integers. Each __m256i register loads 16 shorts. Descriptors
+     * are only required to be 16 byte aligned, unaligned loads are used.
+     */
+    template <typename T>
+    NN_TARGET("avx2") inline __m256i
+    load_avx2 (T const* ptr)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(ptr));
+    }
+
+    /* Loads 16 unsigned chars and widens them to unsigned shorts. */
+    NN_TARGET("avx2") inline __m256i
+    load_avx2 (unsigned char const* ptr)
+    {
+        return _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(ptr)));
+    }
+
+    /* Horizontal sums of four registers, stored in one register. */
+    NN_TARGET("avx2") inline __m128i
+    reduce_add_avx2 (__m256i a, __m256i b, __m256i c, __m256i d)
+    {
+        __m256i const sum = _mm256_hadd_epi32(
+            _mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+        return _mm_add_epi32(_mm256_castsi256_si128(sum),
+            _mm256_extracti128_si256(sum, 1));
+    }
+
+    template <typename T>
+    NN_TARGET("avx2") inline int
+    short_inner_prod_avx2 (T const* a, T const* b, int dimensions)
+    {
+        __m256i reg_result = _mm256_setzero_si256();
+        for (int i = 0; i < dimensions; i += 16)
+            reg_result = _mm256_add_epi32(reg_result,
+                _mm256_madd_epi16(load_avx2(a + i), load_avx2(b + i)));
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(reg_result),
+            _mm256_extracti128_si256(reg_result, 1));
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        return _mm_cvtsi128_si32(sum);
+    }
+
+    /* Computes blocks of 2 queries x 4 elements in 8 accumulators. */
+    template <typename T>
+    NN_TARGET("avx2") void
+    short_block_avx2 (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* out)
+    {
+        int i = 0;
+        for (; i + 2 <= num_queries; i += 2)
         {
-            int inner_product = 0;
-            for (int i = 0; i < dimensions; ++i, ++descr_ptr)
-                inner_product += query[i] * *descr_ptr;
+            T const* query_0 = queries + i * dimensions;
+            T const* query_1 = query_0 + dimensions;
+            int* out_0 = out + i * num_elements;
+            int* out_1 = out_0 + num_elements;
+
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
+            {
+                T const* elems = elements + j * dimensions;
+                __m256i acc_0[4], acc_1[4];
+                for (int k = 0; k < 4; ++k)
+                    acc_0[k] = acc_1[k] = _mm256_setzero_si256();
+                for (int d = 0; d < dimensions; d += 16)
+                {
+                    __m256i const reg_query_0 = load_avx2(query_0 + d);
+                    __m256i const reg_query_1 = load_avx2(query_1 + d);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m256i const reg_subject
+                            = load_avx2(elems + k * dimensions + d);
+                        acc_0[k] = _mm256_add_epi32(acc_0[k],
+                            _mm256_madd_epi16(reg_query_0, reg_subject));
+                        acc_1[k] = _mm256_add_epi32(acc_1[k],
+                            _mm256_madd_epi16(reg_query_1, reg_subject));
+                    }
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out_0 + j),
+                    reduce_add_avx2(acc_0[0], acc_0[1], acc_0[2], acc_0[3]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out_1 + j),
+                    reduce_add_avx2(acc_1[0], acc_1[1], acc_1[2], acc_1[3]));
+            }
+
+            for (; j < num_elements; ++j)
+            {
+                T const* elem = elements + j * dimensions;
+                out_0[j] = short_inner_prod_avx2(query_0, elem, dimensions);
+                out_1[j] = short_inner_prod_avx2(query_1, elem, dimensions);
+            }
+        }
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = short_inner_prod_avx2(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
+    }
+#endif // NN_HAVE_AVX2_KERNEL
+
+#if NN_HAVE_AVX512_KERNEL
+    /*
+     * The AVX-512 kernels load 32 shorts per __m512i register. With VNNI
+     * the multiply and accumulate is a single instruction.
+     */
+    template <typename T>
+    NN_TARGET("avx512f") inline __m512i
+    load_avx512 (T const* ptr)
+    {
+        return _mm512_loadu_si512(ptr);
+    }
+
+    /* Loads 32 unsigned chars and widens them to unsigned shorts. */
+    NN_TARGET("avx512f,avx512bw") inline __m512i
+    load_avx512 (unsigned char const* ptr)
+    {
+        return _mm512_cvtepu8_epi16(
+            _mm256_loadu_si256(reinterpret_cast<__m256i const*>(ptr)));
+    }
+
+    /*
+     * Sum of the lower and upper half of a register. The zero-masked
+     * extracts are used because the unmasked ones (and the casts, which
+     * GCC implements with them) pass an undefined register to the
+     * builtin, which GCC reports as uninitialized.
+     */
+    NN_TARGET("avx512f") inline __m256i
+    fold_avx512 (__m512i a)
+    {
+        return _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xf, a, 0),
+            _mm512_maskz_extracti64x4_epi64(0xf, a, 1));
+    }
+
+    NN_TARGET("avx512f") inline __m256
+    fold_avx512 (__m512 a)
+    {
+        __m512d const b = _mm512_castps_pd(a);
+        return _mm256_add_ps(
+            _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, b, 0)),
+            _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, b, 1)));
+    }
+
+    /* Horizontal sums of four registers, stored in one register. */
+    NN_TARGET("avx512f") inline __m128i
+    reduce_add_avx512 (__m512i a, __m512i b, __m512i c, __m512i d)
+    {
+        return reduce_add_avx2(fold_avx512(a), fold_avx512(b),
+            fold_avx512(c), fold_avx512(d));
+    }
+
+    /* Horizontal sum of a single register. */
+    NN_TARGET("avx512f") inline int
+    reduce_add_avx512 (__m512i a)
+    {
+        __m256i const half = fold_avx512(a);
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half),
+            _mm256_extracti128_si256(half, 1));
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        return _mm_cvtsi128_si32(sum);
+    }
+
+    template <typename T>
+    NN_TARGET("avx512f,avx512bw") inline int
+    short_inner_prod_avx512 (T const* a, T const* b, int dimensions)
+    {
+        __m512i reg_result = _mm512_setzero_si512();
+        for (int i = 0; i < dimensions; i += 32)
+            reg_result = _mm512_add_epi32(reg_result,
+                _mm512_madd_epi16(load_avx512(a + i), load_avx512(b + i)));
+        return reduce_add_avx512(reg_result);
+    }
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product >= result->dist_2nd_best)
+    /* Computes blocks of 4 queries x 4 elements in 16 accumulators. */
+    template <typename T>
+    NN_TARGET("avx512f,avx512bw") void
+    short_block_avx512 (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* out)
+    {
+        int i = 0;
+        for (; i + 4 <= num_queries; i += 4)
+        {
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
             {
-                if (inner_product >= result->dist_1st_best)
+                __m512i acc[4][4];
+                for (int q = 0; q < 4; ++q)
+                    for (int k = 0; k < 4; ++k)
+                        acc[q][k] = _mm512_setzero_si512();
+                for (int d = 0; d < dimensions; d += 32)
                 {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = i;
-                    result->dist_1st_best = inner_product;
+                    __m512i reg_query[4];
+                    for (int q = 0; q < 4; ++q)
+                        reg_query[q] = load_avx512(
+                            queries + (i + q) * dimensions + d);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m512i const reg_subject = load_avx512(
+                            elements + (j + k) * dimensions + d);
+                        for (int q = 0; q < 4; ++q)
+                            acc[q][k] = _mm512_add_epi32(acc[q][k],
+                                _mm512_madd_epi16(reg_query[q], reg_subject));
+                    }
                 }
-                else
+                for (int q = 0; q < 4; ++q)
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(
+                        out + (i + q) * num_elements + j), reduce_add_avx512(
+                        acc[q][0], acc[q][1], acc[q][2], acc[q][3]));
+            }
+
+            for (; j < num_elements; ++j)
+                for (int q = 0; q < 4; ++q)
+                    out[(i + q) * num_elements + j] = short_inner_prod_avx512(
+                        queries + (i + q) * dimensions,
+                        elements + j * dimensions, dimensions);
+        }
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = short_inner_prod_avx512(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
+    }
+
+    template <typename T>
+    NN_TARGET("avx512f,avx512bw,avx512vnni") inline int
+    short_inner_prod_avx512_vnni (T const* a, T const* b, int dimensions)
+    {
+        __m512i reg_result = _mm512_setzero_si512();
+        for (int i = 0; i < dimensions; i += 32)
+            reg_result = _mm512_dpwssd_epi32(reg_result,
+                load_avx512(a + i), load_avx512(b + i));
+        return reduce_add_avx512(reg_result);
+    }
+
+    /* Same as short_block_avx512() using VNNI multiply-accumulate. */
+    template <typename T>
+    NN_TARGET("avx512f,avx512bw,avx512vnni") void
+    short_block_avx512_vnni (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* out)
+    {
+        int i = 0;
+        for (; i + 4 <= num_queries; i += 4)
+        {
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
+            {
+                __m512i acc[4][4];
+                for (int q = 0; q < 4; ++q)
+                    for (int k = 0; k < 4; ++k)
+                        acc[q][k] = _mm512_setzero_si512();
+                for (int d = 0; d < dimensions; d += 32)
                 {
-                    result->index_2nd_best = i;
-                    result->dist_2nd_best = inner_product;
+                    __m512i reg_query[4];
+                    for (int q = 0; q < 4; ++q)
+                        reg_query[q] = load_avx512(
+                            queries + (i + q) * dimensions + d);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m512i const reg_subject = load_avx512(
+                            elements + (j + k) * dimensions + d);
+                        for (int q = 0; q < 4; ++q)
+                            acc[q][k] = _mm512_dpwssd_epi32(acc[q][k],
+                                reg_query[q], reg_subject);
+                    }
                 }
+                for (int q = 0; q < 4; ++q)
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(
+                        out + (i + q) * num_elements + j), reduce_add_avx512(
+                        acc[q][0], acc[q][1], acc[q][2], acc[q][3]));
             }
+
+            for (; j < num_elements; ++j)
+                for (int q = 0; q < 4; ++q)
+                    out[(i + q) * num_elements + j]
+                        = short_inner_prod_avx512_vnni(
+                        queries + (i + q) * dimensions,
+                        elements + j * dimensions, dimensions);
         }
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = short_inner_prod_avx512_vnni(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
+    }
+#endif // NN_HAVE_AVX512_KERNEL
+
+    template <typename T>
+    void
+    inner_prod_block (int kernel, T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* out)
+    {
+        switch (kernel)
+        {
+#if NN_HAVE_AVX512_KERNEL
+            case KERNEL_AVX512_VNNI:
+                short_block_avx512_vnni<T>(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+            case KERNEL_AVX512:
+                short_block_avx512<T>(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
 #endif
+#if NN_HAVE_AVX2_KERNEL
+            case KERNEL_AVX2:
+                short_block_avx2<T>(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+#endif
+#if NN_HAVE_SSE2_KERNEL
+            case KERNEL_SSE:
+                short_block_sse2<T>(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+#endif
+            default:
+                short_block_scalar<T>(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+        }
+    }
+
+    /* Float inner product implementation. */
+    inline float
+    float_inner_prod_scalar (float const* a, float const* b, int dimensions)
+    {
+        float inner_product = 0.0f;
+        for (int i = 0; i < dimensions; ++i)
+            inner_product += a[i] * b[i];
+        return inner_product;
+    }
+
+    void
+    float_block_scalar (float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* out)
+    {
+        for (int i = 0; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j, ++out)
+                *out = float_inner_prod_scalar(queries + i * dimensions,
+                    elements + j * dimensions, dimensions);
     }
 
+#if NN_HAVE_SSE3_KERNEL
     /*
-     * Float inner product implementation. Stores the largest and
-     * second largest inner product of query with elements.
-     *
-     * For SSE query and result should be 16 byte aligned.
+     * SSE inner product implementation.
+     * Note that query and result should be 16 byte aligned.
      * Otherwise loading and storing values into/from registers is slow.
-     * The dimension size must be divisible by 4, each __m128i register
-     * can load 4 shorts = 16 bytes = 128 bit.
+     * The dimension size must be divisible by 4, each __m128 register
+     * can load 4 floats = 16 bytes = 128 bit.
      */
-    void
-    float_inner_prod (float const* query,
-        NearestNeighbor<float>::Result* result,
-        float const* elements, int num_elements, int dimensions)
+    inline float
+    float_inner_prod_sse3 (float const* a, float const* b, int dimensions)
     {
-#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
+        __m128 const* a_ptr = reinterpret_cast<__m128 const*>(a);
+        __m128 const* b_ptr = reinterpret_cast<__m128 const*>(b);
+        int const dim_4 = dimensions / 4;
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < dim_4; ++i, ++a_ptr, ++b_ptr)
+            sum = _mm_add_ps(sum, _mm_mul_ps(*a_ptr, *b_ptr));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        return _mm_cvtss_f32(sum);
+    }
+
     /*
-         * SSE inner product implementation.
-         * Note that query and result should be 16 byte aligned.
-         * Otherwise loading and storing values into/from registers is slow.
-         * The dimension size must be divisible by 4, each __m128 register
-         * can load 4 floats = 16 bytes = 128 bit.
-         */
-
-        __m128 const* descr_ptr = reinterpret_cast<__m128 const*>(elements);
+     * Horizontal sums of four registers, stored in one register. The
+     * additions are in the same order as in float_inner_prod_sse3().
+     */
+    inline __m128
+    reduce_add_sse3 (__m128 a, __m128 b, __m128 c, __m128 d)
+    {
+        return _mm_hadd_ps(_mm_hadd_ps(a, b), _mm_hadd_ps(c, d));
+    }
+
+    /* Computes blocks of 2 queries x 4 elements in 8 accumulators. */
+    void
+    float_block_sse3 (float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* out)
+    {
         int const dim_4 = dimensions / 4;
-        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        int i = 0;
+        for (; i + 2 <= num_queries; i += 2)
         {
-            /* Compute dot product between query and candidate. */
-            __m128 const* query_ptr = reinterpret_cast<__m128 const*>(query);
-            __m128 sum = _mm_setzero_ps();
-            for (int i = 0; i < dim_4; ++i, ++query_ptr, ++descr_ptr)
-                sum = _mm_add_ps(sum, _mm_mul_ps(*query_ptr, *descr_ptr));
-            sum = _mm_hadd_ps(sum, sum);
-            sum = _mm_hadd_ps(sum, sum);
-
-            /* Check if new largest inner product has been found. */
-            float inner_product = _mm_cvtss_f32(sum);
-            if (inner_product >= result->dist_2nd_best)
+            __m128 const* query_0
+                = reinterpret_cast<__m128 const*>(queries + i * dimensions);
+            __m128 const* query_1 = query_0 + dim_4;
+            float* out_0 = out + i * num_elements;
+            float* out_1 = out_0 + num_elements;
+
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
             {
-                if (inner_product >= result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = descr_iter;
-                    result->dist_1st_best = inner_product;
-                }
-                else
+                __m128 const* elems = reinterpret_cast<__m128 const*>(
+                    elements + j * dimensions);
+                __m128 acc_0[4], acc_1[4];
+                for (int k = 0; k < 4; ++k)
+                    acc_0[k] = acc_1[k] = _mm_setzero_ps();
+                for (int d = 0; d < dim_4; ++d)
                 {
-                    result->index_2nd_best = descr_iter;
-                    result->dist_2nd_best = inner_product;
+                    __m128 const reg_query_0 = query_0[d];
+                    __m128 const reg_query_1 = query_1[d];
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m128 const reg_subject = elems[k * dim_4 + d];
+                        acc_0[k] = _mm_add_ps(acc_0[k],
+                            _mm_mul_ps(reg_query_0, reg_subject));
+                        acc_1[k] = _mm_add_ps(acc_1[k],
+                            _mm_mul_ps(reg_query_1, reg_subject));
+                    }
                 }
+                _mm_storeu_ps(out_0 + j, reduce_add_sse3(
+                    acc_0[0], acc_0[1], acc_0[2], acc_0[3]));
+                _mm_storeu_ps(out_1 + j, reduce_add_sse3(
+                    acc_1[0], acc_1[1], acc_1[2], acc_1[3]));
+            }
+
+            for (; j < num_elements; ++j)
+            {
+                float const* elem = elements + j * dimensions;
+                out_0[j] = float_inner_prod_sse3(queries + i * dimensions,
+                    elem, dimensions);
+                out_1[j] = float_inner_prod_sse3(queries
+                    + (i + 1) * dimensions, elem, dimensions);
             }
         }
-#else
-        float const* descr_ptr = elements;
-        for (int i = 0; i < num_elements; ++i)
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = float_inner_prod_sse3(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
+    }
+#endif // NN_HAVE_SSE3_KERNEL
+
+#if NN_HAVE_AVX2_KERNEL
+    /* Sum of the lower and upper half of a register. */
+    NN_TARGET("avx2") inline __m128
+    fold_avx2 (__m256 a)
+    {
+        return _mm_add_ps(_mm256_castps256_ps128(a),
+            _mm256_extractf128_ps(a, 1));
+    }
+
+    /*
+     * Horizontal sums of four registers, stored in one register. The
+     * additions are in the same order as in float_inner_prod_avx2().
+     */
+    NN_TARGET("avx2") inline __m128
+    reduce_add_avx2 (__m128 a, __m128 b, __m128 c, __m128 d)
+    {
+        return _mm_hadd_ps(_mm_hadd_ps(a, b), _mm_hadd_ps(c, d));
+    }
+
+    /* The dimension size must be divisible by 8 for __m256 registers. */
+    NN_TARGET("avx2") inline float
+    float_inner_prod_avx2 (float const* a, float const* b, int dimensions)
+    {
+        __m256 reg_result = _mm256_setzero_ps();
+        for (int i = 0; i < dimensions; i += 8)
+            reg_result = _mm256_add_ps(reg_result, _mm256_mul_ps(
+                _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        __m128 sum = fold_avx2(reg_result);
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        return _mm_cvtss_f32(sum);
+    }
+
+    /* Computes blocks of 2 queries x 4 elements in 8 accumulators. */
+    NN_TARGET("avx2") void
+    float_block_avx2 (float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* out)
+    {
+        int i = 0;
+        for (; i + 2 <= num_queries; i += 2)
         {
-            float inner_product = 0.0f;
-            for (int j = 0; j < dimensions; ++j, ++descr_ptr)
-                inner_product += query[j] * *descr_ptr;
+            float const* query_0 = queries + i * dimensions;
+            float const* query_1 = query_0 + dimensions;
+            float* out_0 = out + i * num_elements;
+            float* out_1 = out_0 + num_elements;
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product >= result->dist_2nd_best)
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
             {
-                if (inner_product >= result->dist_1st_best)
+                float const* elems = elements + j * dimensions;
+                __m256 acc_0[4], acc_1[4];
+                for (int k = 0; k < 4; ++k)
+                    acc_0[k] = acc_1[k] = _mm256_setzero_ps();
+                for (int d = 0; d < dimensions; d += 8)
                 {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = i;
-                    result->dist_1st_best = inner_product;
+                    __m256 const reg_query_0 = _mm256_loadu_ps(query_0 + d);
+                    __m256 const reg_query_1 = _mm256_loadu_ps(query_1 + d);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m256 const reg_subject
+                            = _mm256_loadu_ps(elems + k * dimensions + d);
+                        acc_0[k] = _mm256_add_ps(acc_0[k],
+                            _mm256_mul_ps(reg_query_0, reg_subject));
+                        acc_1[k] = _mm256_add_ps(acc_1[k],
+                            _mm256_mul_ps(reg_query_1, reg_subject));
+                    }
                 }
-                else
+                _mm_storeu_ps(out_0 + j, reduce_add_avx2(
+                    fold_avx2(acc_0[0]), fold_avx2(acc_0[1]),
+                    fold_avx2(acc_0[2]), fold_avx2(acc_0[3])));
+                _mm_storeu_ps(out_1 + j, reduce_add_avx2(
+                    fold_avx2(acc_1[0]), fold_avx2(acc_1[1]),
+                    fold_avx2(acc_1[2]), fold_avx2(acc_1[3])));
+            }
+
+            for (; j < num_elements; ++j)
+            {
+                float const* elem = elements + j * dimensions;
+                out_0[j] = float_inner_prod_avx2(query_0, elem, dimensions);
+                out_1[j] = float_inner_prod_avx2(query_1, elem, dimensions);
+            }
+        }
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = float_inner_prod_avx2(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
+    }
+#endif // NN_HAVE_AVX2_KERNEL
+
+#if NN_HAVE_AVX512_KERNEL
+    /* The dimension size must be divisible by 16 for __m512 registers. */
+    NN_TARGET("avx512f") inline float
+    float_inner_prod_avx512 (float const* a, float const* b, int dimensions)
+    {
+        __m512 reg_result = _mm512_setzero_ps();
+        for (int i = 0; i < dimensions; i += 16)
+            reg_result = _mm512_add_ps(reg_result, _mm512_mul_ps(
+                _mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        __m128 sum = fold_avx2(fold_avx512(reg_result));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        return _mm_cvtss_f32(sum);
+    }
+
+    /* Computes blocks of 4 queries x 4 elements in 16 accumulators. */
+    NN_TARGET("avx512f") void
+    float_block_avx512 (float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* out)
+    {
+        int i = 0;
+        for (; i + 4 <= num_queries; i += 4)
+        {
+            int j = 0;
+            for (; j + 4 <= num_elements; j += 4)
+            {
+                __m512 acc[4][4];
+                for (int q = 0; q < 4; ++q)
+                    for (int k = 0; k < 4; ++k)
+                        acc[q][k] = _mm512_setzero_ps();
+                for (int d = 0; d < dimensions; d += 16)
                 {
-                    result->index_2nd_best = i;
-                    result->dist_2nd_best = inner_product;
+                    __m512 reg_query[4];
+                    for (int q = 0; q < 4; ++q)
+                        reg_query[q] = _mm512_loadu_ps(
+                            queries + (i + q) * dimensions + d);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        __m512 const reg_subject = _mm512_loadu_ps(
+                            elements + (j + k) * dimensions + d);
+                        for (int q = 0; q < 4; ++q)
+                            acc[q][k] = _mm512_add_ps(acc[q][k],
+                                _mm512_mul_ps(reg_query[q], reg_subject));
+                    }
                 }
+                for (int q = 0; q < 4; ++q)
+                    _mm_storeu_ps(out + (i + q) * num_elements + j,
+                        reduce_add_avx2(
+                        fold_avx2(fold_avx512(acc[q][0])),
+                        fold_avx2(fold_avx512(acc[q][1])),
+                        fold_avx2(fold_avx512(acc[q][2])),
+                        fold_avx2(fold_avx512(acc[q][3]))));
             }
+
+            for (; j < num_elements; ++j)
+                for (int q = 0; q < 4; ++q)
+                    out[(i + q) * num_elements + j] = float_inner_prod_avx512(
+                        queries + (i + q) * dimensions,
+                        elements + j * dimensions, dimensions);
         }
-#endif
+
+        for (; i < num_queries; ++i)
+            for (int j = 0; j < num_elements; ++j)
+                out[i * num_elements + j] = float_inner_prod_avx512(
+                    queries + i * dimensions, elements + j * dimensions,
+                    dimensions);
     }
+#endif // NN_HAVE_AVX512_KERNEL
 
+    void
+    inner_prod_block (int kernel, float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* out)
+    {
+        switch (kernel)
+        {
+#if NN_HAVE_AVX512_KERNEL
+            case KERNEL_AVX512:
+                float_block_avx512(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+#endif
+#if NN_HAVE_AVX2_KERNEL
+            case KERNEL_AVX2:
+                float_block_avx2(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+#endif
+#if NN_HAVE_SSE3_KERNEL
+            case KERNEL_SSE:
+                float_block_sse3(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+#endif
+            default:
+                float_block_scalar(queries, num_queries,
+                    elements, num_elements, dimensions, out);
+                return;
+        }
+    }
 }
 
-template <>
-void
-NearestNeighbor<short>::find (short const* query,
-    NearestNeighbor<short>::Result* result) const
+template <typename T>
+typename NearestNeighbor<T>::Kernel
+NearestNeighbor<T>::resolve_kernel (void) const
 {
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = 0;
-    result->dist_2nd_best = 0;
-    result->index_1st_best = 0;
-    result->index_2nd_best = 0;
+    bool const is_float = std::is_floating_point<T>::value;
+    int kernel = this->kernel == KERNEL_AUTO
+        ? static_cast<int>(KERNEL_AVX512_VNNI)
+        : static_cast<int>(this->kernel);
 
-    short_inner_prod<short>(query, result, this->elements,
-        this->num_elements, this->dimensions);
-
-    /*
-     * Compute actual square distances.
-     * The distance with 'signed char' vectors is: 2 * 127^2 - 2 * <Q, Ci>.
-     * The maximum distance is (2*127)^2, which unfortunately does not fit
-     * in a signed short. Therefore, the distance is clapmed at 127^2.
-     */
-    result->dist_1st_best = std::min(16129, std::max(0, (int)result->dist_1st_best));
-    result->dist_2nd_best = std::min(16129, std::max(0, (int)result->dist_2nd_best));
-    result->dist_1st_best = 32258 - 2 * result->dist_1st_best;
-    result->dist_2nd_best = 32258 - 2 * result->dist_2nd_best;
+    /* Fall back to smaller kernels until one is available and suitable. */
+    while (kernel > KERNEL_SCALAR)
+    {
+        int const width = kernel_register_bytes(kernel)
+            / sizeof(typename Widened<T>::Type);
+        if (kernel_available(kernel, is_float)
+            && this->dimensions % width == 0)
+            break;
+        kernel -= 1;
+    }
+    return static_cast<Kernel>(kernel);
 }
 
-template <>
+template <typename T>
 void
-NearestNeighbor<unsigned short>::find (unsigned short const* query,
-    NearestNeighbor<unsigned short>::Result* result) const
+NearestNeighbor<T>::find (T const* query, Result* result) const
 {
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = 0;
-    result->dist_2nd_best = 0;
-    result->index_1st_best = 0;
-    result->index_2nd_best = 0;
-
-    short_inner_prod<unsigned short>(query, result, this->elements,
-        this->num_elements, this->dimensions);
-
-    /*
-     * Compute actual square distances.
-     * The distance with 'unsigned char' vectors is: 2 * 255^2 - 2 * <Q, Ci>.
-     * The maximum distance is (2*255)^2, which unfortunately does not fit
-     * in a unsigned short. Therefore, the result distance is clapmed:
-     * 2 * 255^2 - 2 * <Q, Ci> = 2 * (255^2 - <Q, Ci>) and (255^2 - <Q, Ci>)
-     * is clamped to 32767 and then multiplied by 2.
-     */
-    result->dist_1st_best = std::min(65025, (int)result->dist_1st_best);
-    result->dist_2nd_best = std::min(65025, (int)result->dist_2nd_best);
-    result->dist_1st_best = 65025 - result->dist_1st_best;
-    result->dist_2nd_best = 65025 - result->dist_2nd_best;
-    result->dist_1st_best = std::min(32767, (int)result->dist_1st_best) * 2;
-    result->dist_2nd_best = std::min(32767, (int)result->dist_2nd_best) * 2;
+    this->find_all(query, 1, result, nullptr);
 }
 
-template <>
+template <typename T>
 void
-NearestNeighbor<float>::find (float const* query,
-    NearestNeighbor<float>::Result* result) const
+NearestNeighbor<T>::find_all (T const* queries, int num_queries,
+    Result* query_results, Result* element_results) const
 {
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = 0.0f;
-    result->dist_2nd_best = 0.0f;
-    result->index_1st_best = 0;
-    result->index_2nd_best = 0;
+    typedef typename std::conditional<std::is_floating_point<T>::value,
+        float, int>::type InnerProduct;
 
-    float_inner_prod(query, result, this->elements,
-        this->num_elements, this->dimensions);
+    for (int i = 0; i < num_queries; ++i)
+        reset_result<T>(query_results + i);
+    if (element_results != nullptr)
+        for (int i = 0; i < this->num_elements; ++i)
+            reset_result<T>(element_results + i);
 
     /*
-     * Compute actual (square) distances.
+     * The inner products are computed block by block. Blocks of queries
+     * and elements stay in the cache while all their inner products are
+     * computed. Queries and elements are traversed in increasing order,
+     * which yields the same results as a linear search.
      */
-    result->dist_1st_best = std::max(0.0f, 2.0f - 2.0f * result->dist_1st_best);
-    result->dist_2nd_best = std::max(0.0f, 2.0f - 2.0f * result->dist_2nd_best);
+    int const kernel = this->effective_kernel;
+    int const query_block = std::min(NN_QUERY_BLOCK_SIZE, num_queries);
+    int const element_block = std::min(NN_ELEMENT_BLOCK_SIZE,
+        this->num_elements);
+    /* A single query (as in find()) uses stack memory for the block. */
+    InnerProduct single_query_block[NN_ELEMENT_BLOCK_SIZE];
+    std::vector<InnerProduct> multi_query_block;
+    InnerProduct* block = single_query_block;
+    if (query_block > 1)
+    {
+        multi_query_block.resize(query_block * element_block);
+        block = multi_query_block.data();
+    }
+
+    for (int q0 = 0; q0 < num_queries; q0 += query_block)
+    {
+        int const nq = std::min(query_block, num_queries - q0);
+        for (int e0 = 0; e0 < this->num_elements; e0 += element_block)
+        {
+            int const ne = std::min(element_block, this->num_elements - e0);
+            inner_prod_block(kernel, queries + q0 * this->dimensions, nq,
+                this->elements + e0 * this->dimensions, ne,
+                this->dimensions, block);
+
+            InnerProduct const* inner_product = block;
+            for (int i = 0; i < nq; ++i)
+            {
+                Result* query_result = query_results + q0 + i;
+                for (int j = 0; j < ne; ++j, ++inner_product)
+                {
+                    update_result<T>(*inner_product, e0 + j, query_result);
+                    if (element_results != nullptr)
+                        update_result<T>(*inner_product, q0 + i,
+                            element_results + e0 + j);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < num_queries; ++i)
+        convert_to_distances(query_results + i);
+    if (element_results != nullptr)
+        for (int i = 0; i < this->num_elements; ++i)
+            convert_to_distances(element_results + i);
 }
 
+template class NearestNeighbor<short>;
+template class NearestNeighbor<unsigned short>;
+template class NearestNeighbor<unsigned char>;
+template class NearestNeighbor<float>;
+
 SFM_NAMESPACE_END
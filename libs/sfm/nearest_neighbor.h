@@ -14,9 +14,24 @@
 
 #define ENABLE_SSE2_NN_SEARCH 1
 #define ENABLE_SSE3_NN_SEARCH 1
+#define ENABLE_AVX2_NN_SEARCH 1
+#define ENABLE_AVX512_NN_SEARCH 1
 
 SFM_NAMESPACE_BEGIN
 
+/** Type of the (square) distances for elements of type T. */
+template <typename T>
+struct NearestNeighborDistance
+{
+    typedef T Type;
+};
+
+template <>
+struct NearestNeighborDistance<unsigned char>
+{
+    typedef unsigned short Type;
+};
+
 /**
  * Nearest (and second nearest) neighbor search for normalized vectors.
  *
@@ -34,11 +49,25 @@ SFM_NAMESPACE_BEGIN
  * of 8 (i.e. 128 bit registers for SSE). Query and elements must be 16 byte
  * aligned for efficient memory access.
  *
+ * The AVX2 and AVX-512 kernels are selected at runtime depending on the
+ * capabilities of the CPU, so a single binary runs on all machines. They
+ * require the dimension to be a multiple of the register width (16 or 32
+ * shorts, 8 or 16 floats), which holds for 64-d SURF and 128-d SIFT.
+ * Otherwise the next smaller kernel is used. The short kernels accumulate
+ * in 32 bit (using VNNI instructions if available) and give the same
+ * results as the SSE2 kernel for the value ranges below.
+ *
+ * Unsigned char vectors are widened to 16 bit in the registers and use the
+ * unsigned short kernels, so 8-bit descriptors are searched without
+ * converting them in memory. The distances are stored as unsigned short.
+ *
  * The following types are supported:
  *   - signed short using SSE2
  *     value range -127 to 127, normalized to 127, max distance 32258
  *   - unsigend short using SSE2
  *     value range 0 to 255, normalized to 255, max distance 65534
+ *   - unsigned char using SSE2
+ *     value range 0 to 255, normalized to 255, max distance 65534
  *   - float using SSE3
  *     any value range, normalized to 1, any distance possible
  */
@@ -46,15 +75,28 @@ template <typename T>
 class NearestNeighbor
 {
 public:
+    typedef typename NearestNeighborDistance<T>::Type Distance;
+
     /** Unlike the naming suggests, these are square distances. */
     struct Result
     {
-        T dist_1st_best;
-        T dist_2nd_best;
+        Distance dist_1st_best;
+        Distance dist_2nd_best;
         int index_1st_best;
         int index_2nd_best;
     };
 
+    /** Instruction set used to compute the inner products. */
+    enum Kernel
+    {
+        KERNEL_AUTO,
+        KERNEL_SCALAR,
+        KERNEL_SSE,
+        KERNEL_AVX2,
+        KERNEL_AVX512,
+        KERNEL_AVX512_VNNI
+    };
+
 public:
     NearestNeighbor (void);
     /** For SfM, this is the descriptor memory block. */
@@ -63,15 +105,44 @@ public:
     void set_element_dimensions (int element_dimensions);
     /** For SfM, this is the number of descriptors. */
     void set_num_elements (int num_elements);
+    /**
+     * Limits the kernel to the given instruction set. The default is
+     * KERNEL_AUTO, which selects the best kernel supported by the CPU.
+     * Kernels not supported by the CPU fall back to the best supported one.
+     */
+    void set_kernel (Kernel kernel);
     /** Find the nearest neighbor of 'query'. */
     void find (T const* query, Result* result) const;
 
+    /**
+     * Finds the nearest neighbors of all 'num_queries' queries, which are
+     * stored consecutively in 'queries'. The inner products are computed
+     * for blocks of queries and elements, which stay in the cache, using
+     * register-blocked kernels similar to a small matrix multiplication.
+     * If 'element_results' is not null, the nearest neighbors of all
+     * elements among the queries are computed from the same inner products.
+     * 'query_results' holds one result per query, 'element_results' one
+     * result per element. The results are identical to calling find()
+     * for each query.
+     */
+    void find_all (T const* queries, int num_queries,
+        Result* query_results, Result* element_results = nullptr) const;
+
     int get_element_dimensions (void) const;
 
+    /** Returns the kernel used for the current dimensions and CPU. */
+    Kernel get_effective_kernel (void) const;
+
+private:
+    /* Selects the kernel, called whenever the kernel or dimensions change. */
+    Kernel resolve_kernel (void) const;
+
 private:
     int dimensions;
     int num_elements;
     T const* elements;
+    Kernel kernel;
+    Kernel effective_kernel;
 };
 
 /* ---------------------------------------------------------------- */
@@ -82,7 +153,9 @@ NearestNeighbor<T>::NearestNeighbor (void)
     : dimensions(64)
     , num_elements(0)
     , elements(nullptr)
+    , kernel(KERNEL_AUTO)
 {
+    this->effective_kernel = this->resolve_kernel();
 }
 
 template <typename T>
@@ -97,6 +170,7 @@ inline void
 NearestNeighbor<T>::set_element_dimensions (int element_dimensions)
 {
     this->dimensions = element_dimensions;
+    this->effective_kernel = this->resolve_kernel();
 }
 
 template <typename T>
@@ -106,6 +180,14 @@ NearestNeighbor<T>::set_num_elements (int num_elements)
     this->num_elements = num_elements;
 }
 
+template <typename T>
+inline void
+NearestNeighbor<T>::set_kernel (Kernel kernel)
+{
+    this->kernel = kernel;
+    this->effective_kernel = this->resolve_kernel();
+}
+
 template <typename T>
 inline int
 NearestNeighbor<T>::get_element_dimensions (void) const
@@ -113,6 +195,13 @@ NearestNeighbor<T>::get_element_dimensions (void) const
     return this->dimensions;
 }
 
+template <typename T>
+inline typename NearestNeighbor<T>::Kernel
+NearestNeighbor<T>::get_effective_kernel (void) const
+{
+    return this->effective_kernel;
+}
+
 SFM_NAMESPACE_END
 
 #endif  /* SFM_NEAREST_NEIGHBOR_HEADER */
@@ -8,6 +8,7 @@
  */
 
 #include <cmath>
+#include <limits>
 
 #include "math/functions.h"
 #include "sfm/ransac.h"
@@ -20,8 +21,12 @@ compute_ransac_iterations (double inlier_ratio,
     double desired_success_rate)
 {
     double prob_all_good = math::fastpow(inlier_ratio, num_samples);
+    if (prob_all_good >= 1.0)
+        return 0;
     double num_iterations = std::log(1.0 - desired_success_rate)
         / std::log(1.0 - prob_all_good);
+    if (!(num_iterations < std::numeric_limits<int>::max()))
+        return std::numeric_limits<int>::max();
     return static_cast<int>(math::round(num_iterations));
 }
 
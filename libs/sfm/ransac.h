@@ -10,6 +10,14 @@
 #ifndef SFM_RANSAC_HEADER
 #define SFM_RANSAC_HEADER
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
 #include "sfm/defines.h"
 
 SFM_NAMESPACE_BEGIN
@@ -33,6 +41,300 @@ compute_ransac_iterations (double inlier_ratio,
     int num_samples,
     double desired_success_rate = 0.99);
 
+/**
+ * Generic RANSAC engine shared by the RANSAC estimators.
+ *
+ * Hypotheses are generated and scored in parallel. Every iteration draws
+ * its samples from a random number generator seeded with the iteration
+ * index, and ties are broken by the lower iteration index, so the result
+ * does not depend on the number of threads. Each hypothesis can optionally
+ * be pre-verified on a few random data points (the T(d,d) test) before it
+ * is scored against all data. RANSAC terminates early once the inlier
+ * ratio of the best hypothesis guarantees the desired success rate.
+ *
+ * With progressive sampling (PROSAC), the data must be ordered by
+ * decreasing quality. Samples are then drawn from a growing set of the
+ * best-ranked data, which finds good hypotheses much earlier if the
+ * ranking is informative. After max_iterations the sampling is uniform.
+ *
+ * The PROBLEM type provides the following interface:
+ *
+ *   typedef ... Model;
+ *   enum { SAMPLE_SIZE = ... };
+ *   std::size_t num_data (void) const;
+ *   void compute_models (int const* sample, std::vector<Model>* models) const;
+ *   double residual (Model const& model, std::size_t id) const;
+ *   void residuals (Model const& model, std::vector<double>* residuals) const;
+ *
+ * compute_models() computes zero or more models from SAMPLE_SIZE data IDs.
+ * residual() returns the squared residual of a single datum, residuals()
+ * computes the squared residuals of all data at once.
+ */
+template <typename PROBLEM>
+class RansacEngine
+{
+public:
+    typedef typename PROBLEM::Model Model;
+
+    struct Options
+    {
+        Options (void);
+
+        /** The maximum number of RANSAC iterations. */
+        int max_iterations;
+        /** Threshold on the squared residual to determine inliers. */
+        double square_threshold;
+        /** Success rate for early termination, 0 disables termination. */
+        double success_rate;
+        /** Number of data points for the T(d,d) test, 0 disables the test. */
+        int num_preverify;
+        /** Seed for the per-iteration random number generators. */
+        unsigned int random_seed;
+        /** Draw samples from the best-ranked data first (PROSAC). */
+        bool progressive_sampling;
+    };
+
+    struct Result
+    {
+        Result (void);
+
+        /** The model which led to the inliers. */
+        Model model;
+        /** The IDs of the inliers. */
+        std::vector<int> inliers;
+        /** The number of iterations until termination. */
+        int num_iterations;
+    };
+
+public:
+    explicit RansacEngine (Options const& options);
+    void estimate (PROBLEM const& problem, Result* result) const;
+
+private:
+    /* Iterations run between two termination checks. */
+    enum { ROUND_SIZE = 32 };
+
+    struct Hypothesis
+    {
+        Model model;
+        std::size_t num_inliers = 0;
+        int iteration = std::numeric_limits<int>::max();
+
+        /* More inliers are better, ties prefer the earlier iteration. */
+        bool is_worse_than (std::size_t inliers, int iter) const;
+    };
+
+private:
+    static unsigned int iteration_seed (unsigned int seed, int iteration);
+    void progressive_schedule (std::size_t num_data,
+        std::vector<int>* schedule) const;
+
+private:
+    Options opts;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+template <typename PROBLEM>
+inline
+RansacEngine<PROBLEM>::Options::Options (void)
+    : max_iterations(1000)
+    , square_threshold(0.0)
+    , success_rate(0.999)
+    , num_preverify(0)
+    , random_seed(0)
+    , progressive_sampling(false)
+{
+}
+
+template <typename PROBLEM>
+inline
+RansacEngine<PROBLEM>::Result::Result (void)
+    : num_iterations(0)
+{
+}
+
+template <typename PROBLEM>
+inline
+RansacEngine<PROBLEM>::RansacEngine (Options const& options)
+    : opts(options)
+{
+}
+
+template <typename PROBLEM>
+inline bool
+RansacEngine<PROBLEM>::Hypothesis::is_worse_than (std::size_t inliers,
+    int iter) const
+{
+    return this->num_inliers < inliers
+        || (this->num_inliers == inliers && this->iteration > iter);
+}
+
+template <typename PROBLEM>
+inline unsigned int
+RansacEngine<PROBLEM>::iteration_seed (unsigned int seed, int iteration)
+{
+    /* SplitMix64 finalizer, mapped to the valid seed range of minstd. */
+    uint64_t z = (static_cast<uint64_t>(seed) << 32)
+        + static_cast<uint32_t>(iteration) + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z = z ^ (z >> 31);
+    return static_cast<unsigned int>(1 + z % 2147483646ull);
+}
+
+template <typename PROBLEM>
+void
+RansacEngine<PROBLEM>::progressive_schedule (std::size_t num_data,
+    std::vector<int>* schedule) const
+{
+    /*
+     * The schedule stores for every sampling set size n, starting with
+     * the sample size m, the last iteration T'_n that uses the n-th datum.
+     * T_n is the expected number of samples out of max_iterations that
+     * only contain data from the first n data points.
+     */
+    int const m = PROBLEM::SAMPLE_SIZE;
+    double t_n = static_cast<double>(this->opts.max_iterations);
+    for (int i = 0; i < m; ++i)
+        t_n *= static_cast<double>(m - i) / static_cast<double>(num_data - i);
+
+    schedule->clear();
+    schedule->reserve(num_data - m + 1);
+    schedule->push_back(1);
+    double t_prime = 1.0;
+    for (std::size_t n = m; n < num_data; ++n)
+    {
+        double const t_next = t_n * static_cast<double>(n + 1)
+            / static_cast<double>(n + 1 - m);
+        t_prime += std::max(1.0, std::ceil(t_next - t_n));
+        t_n = t_next;
+        schedule->push_back(static_cast<int>(std::min(t_prime,
+            static_cast<double>(std::numeric_limits<int>::max()))));
+    }
+}
+
+template <typename PROBLEM>
+void
+RansacEngine<PROBLEM>::estimate (PROBLEM const& problem, Result* result) const
+{
+    int const sample_size = PROBLEM::SAMPLE_SIZE;
+    std::size_t const num_data = problem.num_data();
+    if (num_data < static_cast<std::size_t>(sample_size))
+        throw std::invalid_argument("Not enough data for RANSAC");
+
+    std::vector<int> schedule;
+    if (this->opts.progressive_sampling)
+        this->progressive_schedule(num_data, &schedule);
+
+    double const threshold = this->opts.square_threshold;
+    Hypothesis best;
+    int required_iterations = this->opts.max_iterations;
+    int iteration = 0;
+    while (iteration < required_iterations)
+    {
+        int const round_end = std::min(required_iterations,
+            iteration + static_cast<int>(ROUND_SIZE));
+
+#pragma omp parallel
+        {
+            Hypothesis local_best;
+            std::vector<Model> models;
+            std::vector<double> residuals;
+            int sample[sample_size];
+
+#pragma omp for schedule(dynamic)
+            for (int i = iteration; i < round_end; ++i)
+            {
+                /*
+                 * Progressive sampling uses the n-th datum and draws the
+                 * remaining samples from the first n - 1 data points.
+                 */
+                int num_random = sample_size;
+                int pool_size = static_cast<int>(num_data);
+                std::vector<int>::const_iterator stage
+                    = std::lower_bound(schedule.begin(), schedule.end(), i + 1);
+                if (stage != schedule.end())
+                {
+                    pool_size = sample_size - 1
+                        + static_cast<int>(stage - schedule.begin());
+                    num_random = sample_size - 1;
+                    sample[num_random] = pool_size;
+                }
+
+                /* Draw unique samples from the iteration's generator. */
+                std::minstd_rand rng(iteration_seed(this->opts.random_seed, i));
+                std::uniform_int_distribution<int> pool_dist(0, pool_size - 1);
+                for (int j = 0; j < num_random; ++j)
+                {
+                    sample[j] = pool_dist(rng);
+                    if (std::find(sample, sample + j, sample[j]) != sample + j)
+                        j -= 1;
+                }
+
+                models.clear();
+                problem.compute_models(sample, &models);
+                for (std::size_t j = 0; j < models.size(); ++j)
+                {
+                    /* Pre-verify the hypothesis on random data points. */
+                    std::uniform_int_distribution<int> dist(0, num_data - 1);
+                    bool passed = true;
+                    for (int k = 0; passed && k < this->opts.num_preverify; ++k)
+                        passed = problem.residual(models[j], dist(rng))
+                            < threshold;
+                    if (!passed)
+                        continue;
+
+                    problem.residuals(models[j], &residuals);
+                    std::size_t num_inliers = 0;
+#pragma omp simd reduction(+:num_inliers)
+                    for (std::size_t k = 0; k < num_data; ++k)
+                        num_inliers += residuals[k] < threshold ? 1 : 0;
+
+                    if (num_inliers > 0
+                        && local_best.is_worse_than(num_inliers, i))
+                    {
+                        local_best.model = models[j];
+                        local_best.num_inliers = num_inliers;
+                        local_best.iteration = i;
+                    }
+                }
+            }
+
+#pragma omp critical
+            if (best.is_worse_than(local_best.num_inliers, local_best.iteration))
+                best = local_best;
+        }
+        iteration = round_end;
+
+        /* Update the required number of iterations. */
+        if (this->opts.success_rate > 0.0 && best.num_inliers > 0)
+        {
+            double const inlier_ratio = static_cast<double>(best.num_inliers)
+                / static_cast<double>(num_data);
+            int const num_iterations = compute_ransac_iterations(inlier_ratio,
+                sample_size + this->opts.num_preverify,
+                this->opts.success_rate);
+            required_iterations = std::min(required_iterations,
+                num_iterations);
+        }
+    }
+
+    result->num_iterations = iteration;
+    result->inliers.clear();
+    if (best.num_inliers == 0)
+        return;
+
+    /* Collect the inliers of the best hypothesis. */
+    std::vector<double> residuals;
+    problem.residuals(best.model, &residuals);
+    result->model = best.model;
+    result->inliers.reserve(best.num_inliers);
+    for (std::size_t i = 0; i < num_data; ++i)
+        if (residuals[i] < threshold)
+            result->inliers.push_back(static_cast<int>(i));
+}
+
 SFM_NAMESPACE_END
 
 #endif /* SFM_RANSAC_HEADER */
@@ -7,17 +7,71 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
-#include <algorithm>
 #include <iostream>
-#include <set>
 #include <stdexcept>
+#include <vector>
 
-#include "util/system.h"
-#include "math/algo.h"
+#include "sfm/ransac.h"
 #include "sfm/ransac_fundamental.h"
 
 SFM_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Fundamental matrix estimation problem for the RANSAC engine. */
+    class FundamentalProblem
+    {
+    public:
+        typedef FundamentalMatrix Model;
+        enum { SAMPLE_SIZE = 8 };
+
+    public:
+        FundamentalProblem (Correspondences2D2D const& matches)
+            : matches(&matches) {}
+
+        std::size_t num_data (void) const
+        {
+            return this->matches->size();
+        }
+
+        void compute_models (int const* sample,
+            std::vector<Model>* models) const
+        {
+            math::Matrix<double, 3, 8> pset1, pset2;
+            for (int i = 0; i < 8; ++i)
+            {
+                Correspondence2D2D const& match = this->matches->at(sample[i]);
+                pset1(0, i) = match.p1[0];
+                pset1(1, i) = match.p1[1];
+                pset1(2, i) = 1.0;
+                pset2(0, i) = match.p2[0];
+                pset2(1, i) = match.p2[1];
+                pset2(2, i) = 1.0;
+            }
+
+            /* Compute fundamental matrix using normalized 8-point. */
+            FundamentalMatrix fundamental;
+            if (!sfm::fundamental_8_point(pset1, pset2, &fundamental))
+                return;
+            sfm::enforce_fundamental_constraints(&fundamental);
+            models->push_back(fundamental);
+        }
+
+        double residual (Model const& model, std::size_t id) const
+        {
+            return sampson_distance(model, this->matches->at(id));
+        }
+
+        void residuals (Model const& model, std::vector<double>* result) const
+        {
+            sampson_distances(model, *this->matches, result);
+        }
+
+    private:
+        Correspondences2D2D const* matches;
+    };
+}
+
 RansacFundamental::RansacFundamental (Options const& options)
     : opts(options)
 {
@@ -33,74 +87,30 @@ RansacFundamental::estimate (Correspondences2D2D const& matches, Result* result)
             << "..." << std::endl;
     }
 
-    std::vector<int> inliers;
-    inliers.reserve(matches.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
-    {
-        FundamentalMatrix fundamental;
-        this->estimate_8_point(matches, &fundamental);
-        this->find_inliers(matches, fundamental, &inliers);
-        if (inliers.size() > result->inliers.size())
-        {
-            if (this->opts.verbose_output)
-            {
-                std::cout << "RANSAC-F: Iteration " << iteration
-                    << ", inliers " << inliers.size() << " ("
-                    << (100.0 * inliers.size() / matches.size())
-                    << "%)" << std::endl;
-            }
-
-            result->fundamental = fundamental;
-            std::swap(result->inliers, inliers);
-            inliers.reserve(matches.size());
-        }
-    }
-}
-
-void
-RansacFundamental::estimate_8_point (Correspondences2D2D const& matches,
-    FundamentalMatrix* fundamental)
-{
     if (matches.size() < 8)
         throw std::invalid_argument("At least 8 matches required");
 
-    /*
-     * Draw 8 random numbers in the interval [0, matches.size() - 1]
-     * without duplicates. This is done by keeping a set with drawn numbers.
-     */
-    std::set<int> result;
-    while (result.size() < 8)
-        result.insert(util::system::rand_int() % matches.size());
-
-    math::Matrix<double, 3, 8> pset1, pset2;
-    std::set<int>::const_iterator iter = result.begin();
-    for (int i = 0; i < 8; ++i, ++iter)
-    {
-        Correspondence2D2D const& match = matches[*iter];
-        pset1(0, i) = match.p1[0];
-        pset1(1, i) = match.p1[1];
-        pset1(2, i) = 1.0;
-        pset2(0, i) = match.p2[0];
-        pset2(1, i) = match.p2[1];
-        pset2(2, i) = 1.0;
-    }
+    typedef RansacEngine<FundamentalProblem> Engine;
+    Engine::Options engine_opts;
+    engine_opts.max_iterations = this->opts.max_iterations;
+    engine_opts.square_threshold = MATH_POW2(this->opts.threshold);
+    engine_opts.success_rate = this->opts.success_rate;
+    engine_opts.num_preverify = this->opts.num_preverify;
+    engine_opts.random_seed = this->opts.random_seed;
+    engine_opts.progressive_sampling = this->opts.progressive_sampling;
 
-    /* Compute fundamental matrix using normalized 8-point. */
-    sfm::fundamental_8_point(pset1, pset2, fundamental);
-    sfm::enforce_fundamental_constraints(fundamental);
-}
+    Engine::Result engine_result;
+    Engine(engine_opts).estimate(FundamentalProblem(matches), &engine_result);
+    result->fundamental = engine_result.model;
+    std::swap(result->inliers, engine_result.inliers);
 
-void
-RansacFundamental::find_inliers (Correspondences2D2D const& matches,
-    FundamentalMatrix const& fundamental, std::vector<int>* result)
-{
-    result->resize(0);
-    double const squared_thres = this->opts.threshold * this->opts.threshold;
-    for (std::size_t i = 0; i < matches.size(); ++i)
+    if (this->opts.verbose_output)
     {
-        double error = sampson_distance(fundamental, matches[i]);
-        if (error < squared_thres)
-            result->push_back(i);
+        std::cout << "RANSAC-F: Finished after "
+            << engine_result.num_iterations << " iterations, inliers "
+            << result->inliers.size() << " ("
+            << (100.0 * result->inliers.size() / matches.size())
+            << "%)" << std::endl;
     }
 }
 
@@ -35,7 +35,7 @@ public:
         Options (void);
 
         /**
-         * The number of RANSAC iterations. Defaults to 1000.
+         * The maximum number of RANSAC iterations. Defaults to 1000.
          * Function compute_ransac_iterations() can be used to estimate the
          * required number of iterations for a certain RANSAC success rate.
          */
@@ -47,6 +47,35 @@ public:
          */
         double threshold;
 
+        /**
+         * Desired probability to draw at least one all-inlier sample.
+         * RANSAC terminates as soon as the inlier ratio of the best result
+         * reaches this success rate, see compute_ransac_iterations().
+         * Defaults to 0.999. If set to 0, max_iterations are always run.
+         */
+        double success_rate;
+
+        /**
+         * Number of random correspondences that must be inliers before a
+         * hypothesis is evaluated on all correspondences (T(d,d) test).
+         * Defaults to 0, which disables the pre-verification.
+         */
+        int num_preverify;
+
+        /**
+         * Seed for the random sampling. The result is deterministic for
+         * a given seed, independent of the number of threads.
+         */
+        unsigned int random_seed;
+
+        /**
+         * Draw samples from the best-ranked correspondences first (PROSAC).
+         * This requires the correspondences to be ordered by decreasing
+         * match quality, e.g., by increasing descriptor distance ratio.
+         * Defaults to false.
+         */
+        bool progressive_sampling;
+
         /**
          * Produce status messages on the console.
          */
@@ -72,12 +101,6 @@ public:
     explicit RansacFundamental (Options const& options);
     void estimate (Correspondences2D2D const& matches, Result* result);
 
-private:
-    void estimate_8_point (Correspondences2D2D const& matches,
-        FundamentalMatrix* fundamental);
-    void find_inliers (Correspondences2D2D const& matches,
-        FundamentalMatrix const& fundamental, std::vector<int>* result);
-
 private:
     Options opts;
 };
@@ -88,6 +111,10 @@ inline
 RansacFundamental::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.0015)
+    , success_rate(0.999)
+    , num_preverify(0)
+    , random_seed(0)
+    , progressive_sampling(false)
     , verbose_output(false)
 {
 }
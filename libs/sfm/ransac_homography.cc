@@ -7,18 +7,62 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
-#include <algorithm>
 #include <iostream>
-#include <set>
 #include <stdexcept>
+#include <vector>
 
-#include "util/system.h"
-#include "math/algo.h"
-#include "math/matrix_tools.h"
+#include "sfm/ransac.h"
 #include "sfm/ransac_homography.h"
 
 SFM_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Homography estimation problem for the RANSAC engine. */
+    class HomographyProblem
+    {
+    public:
+        typedef HomographyMatrix Model;
+        enum { SAMPLE_SIZE = 4 };
+
+    public:
+        HomographyProblem (Correspondences2D2D const& matches)
+            : matches(&matches) {}
+
+        std::size_t num_data (void) const
+        {
+            return this->matches->size();
+        }
+
+        void compute_models (int const* sample,
+            std::vector<Model>* models) const
+        {
+            Correspondences2D2D four_correspondeces(4);
+            for (std::size_t i = 0; i < 4; ++i)
+                four_correspondeces[i] = this->matches->at(sample[i]);
+
+            HomographyMatrix homography;
+            if (!sfm::homography_dlt(four_correspondeces, &homography))
+                return;
+            homography /= homography[8];
+            models->push_back(homography);
+        }
+
+        double residual (Model const& model, std::size_t id) const
+        {
+            return symmetric_transfer_error(model, this->matches->at(id));
+        }
+
+        void residuals (Model const& model, std::vector<double>* result) const
+        {
+            symmetric_transfer_errors(model, *this->matches, result);
+        }
+
+    private:
+        Correspondences2D2D const* matches;
+    };
+}
+
 RansacHomography::RansacHomography (Options const& options)
     : opts(options)
 {
@@ -34,66 +78,30 @@ RansacHomography::estimate (Correspondences2D2D const& matches, Result* result)
             << "..." << std::endl;
     }
 
-    std::vector<int> inliers;
-    inliers.reserve(matches.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
-    {
-        HomographyMatrix homography;
-        this->compute_homography(matches, &homography);
-        this->evaluate_homography(matches, homography, &inliers);
-        if (inliers.size() > result->inliers.size())
-        {
-            if (this->opts.verbose_output)
-            {
-                std::cout << "RANSAC-H: Iteration " << iteration
-                    << ", inliers " << inliers.size() << " ("
-                    << (100.0 * inliers.size() / matches.size())
-                    << "%)" << std::endl;
-            }
-
-            result->homography = homography;
-            std::swap(result->inliers, inliers);
-            inliers.reserve(matches.size());
-        }
-    }
-}
-
-void
-RansacHomography::compute_homography (Correspondences2D2D const& matches,
-    HomographyMatrix* homography)
-{
     if (matches.size() < 4)
         throw std::invalid_argument("At least 4 matches required");
 
-    /*
-     * Draw 4 random numbers in the interval [0, matches.size() - 1]
-     * without duplicates. This is done by keeping a set with drawn numbers.
-     */
-    std::set<int> result;
-    while (result.size() < 4)
-        result.insert(util::system::rand_int() % matches.size());
-
-    Correspondences2D2D four_correspondeces(4);
-    std::set<int>::const_iterator iter = result.begin();
-    for (std::size_t i = 0; i < 4; ++i, ++iter)
-        four_correspondeces[i] = matches[*iter];
-
-    sfm::homography_dlt(four_correspondeces, homography);
-    *homography /= (*homography)[8];
-}
+    typedef RansacEngine<HomographyProblem> Engine;
+    Engine::Options engine_opts;
+    engine_opts.max_iterations = this->opts.max_iterations;
+    engine_opts.square_threshold = MATH_POW2(this->opts.threshold);
+    engine_opts.success_rate = this->opts.success_rate;
+    engine_opts.num_preverify = this->opts.num_preverify;
+    engine_opts.random_seed = this->opts.random_seed;
+    engine_opts.progressive_sampling = this->opts.progressive_sampling;
 
-void
-RansacHomography::evaluate_homography (Correspondences2D2D const& matches,
-    HomographyMatrix const& homography, std::vector<int>* inliers)
-{
-    double const square_threshold = MATH_POW2(this->opts.threshold);
-    inliers->resize(0);
-    for (std::size_t i = 0; i < matches.size(); ++i)
+    Engine::Result engine_result;
+    Engine(engine_opts).estimate(HomographyProblem(matches), &engine_result);
+    result->homography = engine_result.model;
+    std::swap(result->inliers, engine_result.inliers);
+
+    if (this->opts.verbose_output)
     {
-        Correspondence2D2D const& match = matches[i];
-        double error = sfm::symmetric_transfer_error(homography, match);
-        if (error < square_threshold)
-            inliers->push_back(i);
+        std::cout << "RANSAC-H: Finished after "
+            << engine_result.num_iterations << " iterations, inliers "
+            << result->inliers.size() << " ("
+            << (100.0 * result->inliers.size() / matches.size())
+            << "%)" << std::endl;
     }
 }
 
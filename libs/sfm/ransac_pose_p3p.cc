@@ -7,17 +7,94 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
-#include <set>
-#include <atomic>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
-#include "util/system.h"
 #include "math/matrix_tools.h"
+#include "sfm/ransac.h"
 #include "sfm/ransac_pose_p3p.h"
 #include "sfm/pose_p3p.h"
 
 SFM_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Pose estimation problem for the RANSAC engine. */
+    class PoseP3PProblem
+    {
+    public:
+        typedef math::Matrix<double, 3, 4> Model;
+        enum { SAMPLE_SIZE = 3 };
+
+    public:
+        PoseP3PProblem (Correspondences2D3D const& corresp,
+            math::Matrix<double, 3, 3> const& k_matrix)
+            : corresp(&corresp)
+            , k_matrix(k_matrix)
+            , inv_k_matrix(math::matrix_inverse(k_matrix)) {}
+
+        std::size_t num_data (void) const
+        {
+            return this->corresp->size();
+        }
+
+        void compute_models (int const* sample,
+            std::vector<Model>* models) const
+        {
+            Correspondence2D3D const& c1(this->corresp->at(sample[0]));
+            Correspondence2D3D const& c2(this->corresp->at(sample[1]));
+            Correspondence2D3D const& c3(this->corresp->at(sample[2]));
+            pose_p3p_kneip(
+                math::Vec3d(c1.p3d), math::Vec3d(c2.p3d), math::Vec3d(c3.p3d),
+                this->inv_k_matrix.mult(math::Vec3d(c1.p2d[0], c1.p2d[1], 1.0)),
+                this->inv_k_matrix.mult(math::Vec3d(c2.p2d[0], c2.p2d[1], 1.0)),
+                this->inv_k_matrix.mult(math::Vec3d(c3.p2d[0], c3.p2d[1], 1.0)),
+                models);
+        }
+
+        double residual (Model const& model, std::size_t id) const
+        {
+            Correspondence2D3D const& c = this->corresp->at(id);
+            math::Vec4d p3d(c.p3d[0], c.p3d[1], c.p3d[2], 1.0);
+            math::Vec3d p2d = this->k_matrix * (model * p3d);
+            return MATH_POW2(p2d[0] / p2d[2] - c.p2d[0])
+                + MATH_POW2(p2d[1] / p2d[2] - c.p2d[1]);
+        }
+
+        void residuals (Model const& model, std::vector<double>* result) const
+        {
+            /* Project with P = K [R|t] using plain arrays to allow SIMD. */
+            math::Matrix<double, 3, 4> const proj = this->k_matrix * model;
+            double p[12];
+            std::copy(proj.begin(), proj.end(), p);
+
+            std::size_t const num = this->corresp->size();
+            Correspondence2D3D const* c = this->corresp->data();
+            result->resize(num);
+            double* r = result->data();
+#pragma omp simd
+            for (std::size_t i = 0; i < num; ++i)
+            {
+                double const x = c[i].p3d[0];
+                double const y = c[i].p3d[1];
+                double const z = c[i].p3d[2];
+                double const u = p[0] * x + p[1] * y + p[2] * z + p[3];
+                double const v = p[4] * x + p[5] * y + p[6] * z + p[7];
+                double const w = p[8] * x + p[9] * y + p[10] * z + p[11];
+                double const du = u / w - c[i].p2d[0];
+                double const dv = v / w - c[i].p2d[1];
+                r[i] = du * du + dv * dv;
+            }
+        }
+
+    private:
+        Correspondences2D3D const* corresp;
+        math::Matrix<double, 3, 3> k_matrix;
+        math::Matrix<double, 3, 3> inv_k_matrix;
+    };
+}
+
 RansacPoseP3P::RansacPoseP3P (Options const& options)
     : opts(options)
 {
@@ -34,90 +111,30 @@ RansacPoseP3P::estimate (Correspondences2D3D const& corresp,
             << "..." << std::endl;
     }
 
-    /* Pre-compute inverse K matrix to compute directions from corresp. */
-    math::Matrix<double, 3, 3> inv_k_matrix = math::matrix_inverse(k_matrix);
-    std::atomic<int> num_iterations;
-
-#pragma omp parallel
-    {
-        std::vector<int> inliers;
-        inliers.reserve(corresp.size());
-#pragma omp for
-        for (int i = 0; i < this->opts.max_iterations; ++i)
-        {
-            int iteration = i;
-            if (this->opts.verbose_output)
-                iteration = num_iterations++;
-
-            /* Compute up to four poses [R|t] using P3P algorithm. */
-            PutativePoses poses;
-            this->compute_p3p(corresp, inv_k_matrix, &poses);
-
-            /* Check all putative solutions and count inliers. */
-            for (std::size_t j = 0; j < poses.size(); ++j)
-            {
-                this->find_inliers(corresp, k_matrix, poses[j], &inliers);
-#pragma omp critical
-                if (inliers.size() > result->inliers.size())
-                {
-                    result->pose = poses[j];
-                    std::swap(result->inliers, inliers);
-                    inliers.reserve(corresp.size());
-
-                    if (this->opts.verbose_output)
-                    {
-                        std::cout << "RANSAC-3: Iteration " << iteration
-                            << ", inliers " << result->inliers.size() << " ("
-                            << (100.0 * result->inliers.size() / corresp.size())
-                            << "%)" << std::endl;
-                    }
-                }
-            }
-        }
-    }
-}
-
-void
-RansacPoseP3P::compute_p3p (Correspondences2D3D const& corresp,
-    math::Matrix<double, 3, 3> const& inv_k_matrix,
-    PutativePoses* poses) const
-{
     if (corresp.size() < 3)
         throw std::invalid_argument("At least 3 correspondences required");
 
-    /* Draw 3 unique random numbers. */
-    std::set<int> result;
-    while (result.size() < 3)
-        result.insert(util::system::rand_int() % corresp.size());
-
-    std::set<int>::const_iterator iter = result.begin();
-    Correspondence2D3D const& c1(corresp[*iter++]);
-    Correspondence2D3D const& c2(corresp[*iter++]);
-    Correspondence2D3D const& c3(corresp[*iter]);
-    pose_p3p_kneip(
-        math::Vec3d(c1.p3d), math::Vec3d(c2.p3d), math::Vec3d(c3.p3d),
-        inv_k_matrix.mult(math::Vec3d(c1.p2d[0], c1.p2d[1], 1.0)),
-        inv_k_matrix.mult(math::Vec3d(c2.p2d[0], c2.p2d[1], 1.0)),
-        inv_k_matrix.mult(math::Vec3d(c3.p2d[0], c3.p2d[1], 1.0)),
-        poses);
-}
+    typedef RansacEngine<PoseP3PProblem> Engine;
+    Engine::Options engine_opts;
+    engine_opts.max_iterations = this->opts.max_iterations;
+    engine_opts.square_threshold = MATH_POW2(this->opts.threshold);
+    engine_opts.success_rate = this->opts.success_rate;
+    engine_opts.num_preverify = this->opts.num_preverify;
+    engine_opts.random_seed = this->opts.random_seed;
 
-void
-RansacPoseP3P::find_inliers (Correspondences2D3D const& corresp,
-    math::Matrix<double, 3, 3> const& k_matrix,
-    Pose const& pose, std::vector<int>* inliers) const
-{
-    inliers->resize(0);
-    double const square_threshold = MATH_POW2(this->opts.threshold);
-    for (std::size_t i = 0; i < corresp.size(); ++i)
+    Engine::Result engine_result;
+    Engine(engine_opts).estimate(PoseP3PProblem(corresp, k_matrix),
+        &engine_result);
+    result->pose = engine_result.model;
+    std::swap(result->inliers, engine_result.inliers);
+
+    if (this->opts.verbose_output)
     {
-        Correspondence2D3D const& c = corresp[i];
-        math::Vec4d p3d(c.p3d[0], c.p3d[1], c.p3d[2], 1.0);
-        math::Vec3d p2d = k_matrix * (pose * p3d);
-        double square_error = MATH_POW2(p2d[0] / p2d[2] - c.p2d[0])
-            + MATH_POW2(p2d[1] / p2d[2] - c.p2d[1]);
-        if (square_error < square_threshold)
-            inliers->push_back(i);
+        std::cout << "RANSAC-3: Finished after "
+            << engine_result.num_iterations << " iterations, inliers "
+            << result->inliers.size() << " ("
+            << (100.0 * result->inliers.size() / corresp.size())
+            << "%)" << std::endl;
     }
 }
 
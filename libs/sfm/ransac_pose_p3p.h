@@ -42,7 +42,7 @@ public:
         Options (void);
 
         /**
-         * The number of RANSAC iterations. Defaults to 1000.
+         * The maximum number of RANSAC iterations. Defaults to 1000.
          * Function compute_ransac_iterations() can be used to estimate the
          * required number of iterations for a certain RANSAC success rate.
          */
@@ -54,6 +54,27 @@ public:
          */
         double threshold;
 
+        /**
+         * Desired probability to draw at least one all-inlier sample.
+         * RANSAC terminates as soon as the inlier ratio of the best result
+         * reaches this success rate, see compute_ransac_iterations().
+         * Defaults to 0.999. If set to 0, max_iterations are always run.
+         */
+        double success_rate;
+
+        /**
+         * Number of random correspondences that must be inliers before a
+         * hypothesis is evaluated on all correspondences (T(d,d) test).
+         * Defaults to 0, which disables the pre-verification.
+         */
+        int num_preverify;
+
+        /**
+         * Seed for the random sampling. The result is deterministic for
+         * a given seed, independent of the number of threads.
+         */
+        unsigned int random_seed;
+
         /**
          * Produce status messages on the console.
          */
@@ -76,19 +97,6 @@ public:
         math::Matrix<double, 3, 3> const& k_matrix,
         Result* result) const;
 
-private:
-    typedef math::Matrix<double, 3, 4> Pose;
-    typedef std::vector<Pose> PutativePoses;
-
-private:
-    void compute_p3p (Correspondences2D3D const& corresp,
-        math::Matrix<double, 3, 3> const& inv_k_matrix,
-        PutativePoses* poses) const;
-
-    void find_inliers (Correspondences2D3D const& corresp,
-        math::Matrix<double, 3, 3> const& k_matrix,
-        Pose const& pose, std::vector<int>* inliers) const;
-
 private:
     Options opts;
 };
@@ -99,6 +107,9 @@ inline
 RansacPoseP3P::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.005)
+    , success_rate(0.999)
+    , num_preverify(0)
+    , random_seed(0)
     , verbose_output(false)
 {
 }
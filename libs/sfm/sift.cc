@@ -7,6 +7,7 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
@@ -19,6 +20,11 @@
 #include "mve/image_tools.h"
 #include "sfm/sift.h"
 
+/* Number of DoG rows per band for parallel extrema detection. */
+#define SIFT_BAND_ROWS 64
+/* Number of keypoints per chunk for parallel descriptor generation. */
+#define SIFT_CHUNK_SIZE 64
+
 SFM_NAMESPACE_BEGIN
 
 Sift::Sift (Options const& options)
@@ -95,10 +101,11 @@ Sift::process (void)
     }
 
     /*
-     * Difference of Gaussian images are not needed anymore.
+     * Difference of Gaussian images are not needed anymore. They are
+     * reused for the gradient and orientation images.
      */
     for (std::size_t i = 0; i < this->octaves.size(); ++i)
-        this->octaves[i].dog.clear();
+        this->pyramid.release_images(&this->octaves[i].dog);
 
     /*
      * Generate the list of keypoint descriptors.
@@ -125,8 +132,8 @@ Sift::process (void)
             << " took " << total_timer.get_elapsed() << "ms." << std::endl;
     }
 
-    /* Free memory. */
-    this->octaves.clear();
+    /* Keep the images for the next call to process(). */
+    this->clear_octaves();
 }
 
 /* ---------------------------------------------------------------- */
@@ -169,7 +176,7 @@ Sift::set_float_image (mve::FloatImage::ConstPtr img)
 void
 Sift::create_octaves (void)
 {
-    this->octaves.clear();
+    this->clear_octaves();
 
     /*
      * Create octave -1. The original image is assumed to have blur
@@ -209,53 +216,31 @@ Sift::create_octaves (void)
 
 /* ---------------------------------------------------------------- */
 
+void
+Sift::clear_octaves (void)
+{
+    for (std::size_t i = 0; i < this->octaves.size(); ++i)
+    {
+        Octave& oct = this->octaves[i];
+        this->pyramid.release_images(&oct.img);
+        this->pyramid.release_images(&oct.dog);
+        this->pyramid.release_images(&oct.grad);
+        this->pyramid.release_images(&oct.ori);
+    }
+    this->octaves.clear();
+}
+
+/* ---------------------------------------------------------------- */
+
 void
 Sift::add_octave (mve::FloatImage::ConstPtr image,
         float has_sigma, float target_sigma)
 {
-    /*
-     * First, bring the provided image to the target blur.
-     * Since L * g(sigma1) * g(sigma2) = L * g(sqrt(sigma1^2 + sigma2^2)),
-     * we need to blur with sigma = sqrt(target_sigma^2 - has_sigma^2).
-     */
-    float sigma = std::sqrt(MATH_POW2(target_sigma) - MATH_POW2(has_sigma));
-    //std::cout << "Pre-blurring image to sigma " << target_sigma << " (has "
-    //    << has_sigma << ", blur = " << sigma << ")..." << std::endl;
-    mve::FloatImage::Ptr base = (target_sigma > has_sigma
-        ? mve::image::blur_gaussian<float>(image, sigma)
-        : image->duplicate());
-
-    /* Create the new octave and add initial image. */
+    /* Create the new octave with (s+3) images and (s+2) DoG images. */
     this->octaves.push_back(Octave());
     Octave& oct = this->octaves.back();
-    oct.img.push_back(base);
-
-    /* 'k' is the constant factor between the scales in scale space. */
-    float const k = std::pow(2.0f, 1.0f / this->options.num_samples_per_octave);
-    sigma = target_sigma;
-
-    /* Create other (s+2) samples of the octave to get a total of (s+3). */
-    for (int i = 1; i < this->options.num_samples_per_octave + 3; ++i)
-    {
-        /* Calculate the blur sigma the image will get. */
-        float sigmak = sigma * k;
-        float blur_sigma = std::sqrt(MATH_POW2(sigmak) - MATH_POW2(sigma));
-
-        /* Blur the image to create a new scale space sample. */
-        //std::cout << "Blurring image to sigma " << sigmak << " (has " << sigma
-        //    << ", blur = " << blur_sigma << ")..." << std::endl;
-        mve::FloatImage::Ptr img = mve::image::blur_gaussian<float>
-            (base, blur_sigma);
-        oct.img.push_back(img);
-
-        /* Create the Difference of Gaussian image (DoG). */
-        mve::FloatImage::Ptr dog = mve::image::subtract<float>(img, base);
-        oct.dog.push_back(dog);
-
-        /* Update previous image and sigma for next round. */
-        base = img;
-        sigma = sigmak;
-    }
+    this->pyramid.build_octave(image, has_sigma, target_sigma,
+        this->options.num_samples_per_octave, &oct.img, &oct.dog);
 }
 
 /* ---------------------------------------------------------------- */
@@ -266,25 +251,50 @@ Sift::extrema_detection (void)
     /* Delete previous keypoints. */
     this->keypoints.clear();
 
-    /* Detect keypoints in each octave... */
+    /*
+     * In each octave, take three subsequent DoG images and detect.
+     * Each triple is split into bands of rows which are processed in
+     * parallel. The bands read their neighboring rows from the full
+     * image, and concatenating the results in order yields the same
+     * keypoints as a serial scan.
+     */
+    struct Band { int octave, sample, y_begin, y_end; };
+    std::vector<Band> bands;
     for (std::size_t i = 0; i < this->octaves.size(); ++i)
     {
         Octave const& oct(this->octaves[i]);
-        /* In each octave, take three subsequent DoG images and detect. */
         for (int s = 0; s < (int)oct.dog.size() - 2; ++s)
         {
-            mve::FloatImage::ConstPtr samples[3] =
-            { oct.dog[s + 0], oct.dog[s + 1], oct.dog[s + 2] };
-            this->extrema_detection(samples, static_cast<int>(i)
-                + this->options.min_octave, s);
+            int const h = oct.dog[s]->height();
+            for (int y = 1; y < h - 1; y += SIFT_BAND_ROWS)
+                bands.push_back({ static_cast<int>(i), s, y,
+                    std::min(h - 1, y + SIFT_BAND_ROWS) });
         }
     }
+
+    std::vector<Keypoints> band_keypoints(bands.size());
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < bands.size(); ++i)
+    {
+        Band const& band = bands[i];
+        Octave const& oct(this->octaves[band.octave]);
+        mve::FloatImage::ConstPtr samples[3] = { oct.dog[band.sample + 0],
+            oct.dog[band.sample + 1], oct.dog[band.sample + 2] };
+        this->extrema_detection(samples, band.octave
+            + this->options.min_octave, band.sample, band.y_begin,
+            band.y_end, &band_keypoints[i]);
+    }
+
+    for (std::size_t i = 0; i < band_keypoints.size(); ++i)
+        this->keypoints.insert(this->keypoints.end(),
+            band_keypoints[i].begin(), band_keypoints[i].end());
 }
 
 /* ---------------------------------------------------------------- */
 
 std::size_t
-Sift::extrema_detection (mve::FloatImage::ConstPtr s[3], int oi, int si)
+Sift::extrema_detection (mve::FloatImage::ConstPtr s[3], int oi, int si,
+    int y_begin, int y_end, Keypoints* result) const
 {
     int const w = s[1]->width();
     int const h = s[1]->height();
@@ -293,12 +303,14 @@ Sift::extrema_detection (mve::FloatImage::ConstPtr s[3], int oi, int si)
     int noff[9] = { -1 - w, 0 - w, 1 - w, -1, 0, 1, -1 + w, 0 + w, 1 + w };
 
     /*
-     * Iterate over all pixels in s[1], and check if pixel is maximum
-     * (or minumum) in its 27-neighborhood.
+     * Iterate over all pixels in rows [y_begin, y_end) of s[1], and check
+     * if pixel is maximum (or minumum) in its 27-neighborhood.
      */
+    y_begin = std::max(1, y_begin);
+    y_end = std::min(h - 1, y_end);
     int detected = 0;
-    int off = w;
-    for (int y = 1; y < h - 1; ++y, off += w)
+    int off = y_begin * w;
+    for (int y = y_begin; y < y_end; ++y, off += w)
         for (int x = 1; x < w - 1; ++x)
         {
             int idx = off + x;
@@ -327,7 +339,7 @@ Sift::extrema_detection (mve::FloatImage::ConstPtr s[3], int oi, int si)
             kp.x = static_cast<float>(x);
             kp.y = static_cast<float>(y);
             kp.sample = static_cast<float>(si);
-            this->keypoints.push_back(kp);
+            result->push_back(kp);
             detected += 1;
         }
 
@@ -345,8 +357,10 @@ Sift::keypoint_localization (void)
      * around the keypoint.
      */
 
+    /* Keypoints are localized in parallel and compacted afterwards. */
     int num_singular = 0;
-    int num_keypoints = 0; // Write iterator
+    std::vector<char> accepted(this->keypoints.size(), 0);
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:num_singular)
     for (std::size_t i = 0; i < this->keypoints.size(); ++i)
     {
         /* Copy keypoint. */
@@ -470,12 +484,16 @@ Sift::keypoint_localization (void)
             continue;
         }
 
-        /* Keypoint is accepted, copy to write iter and advance. */
-        this->keypoints[num_keypoints] = kp;
-        num_keypoints += 1;
+        /* Keypoint is accepted, store the localized keypoint. */
+        this->keypoints[i] = kp;
+        accepted[i] = 1;
     }
 
-    /* Limit vector size to number of accepted keypoints. */
+    /* Keep accepted keypoints in order. */
+    std::size_t num_keypoints = 0; // Write iterator
+    for (std::size_t i = 0; i < this->keypoints.size(); ++i)
+        if (accepted[i])
+            this->keypoints[num_keypoints++] = this->keypoints[i];
     this->keypoints.resize(num_keypoints);
 
     if (this->options.debug_output && num_singular > 0)
@@ -504,51 +522,74 @@ Sift::descriptor_generation (void)
      * To ensure efficiency, the octave index must always increase, never
      * decrease, which is enforced during the algorithm.
      */
-    int octave_index = this->keypoints[0].octave;
-    Octave* octave = &this->octaves[octave_index - this->options.min_octave];
-    this->generate_grad_ori_images(octave);
-
-    /* Walk over all keypoints and compute descriptors. */
-    for (std::size_t i = 0; i < this->keypoints.size(); ++i)
+    Octave* octave = nullptr;
+    for (std::size_t begin = 0; begin < this->keypoints.size();)
     {
-        Keypoint const& kp(this->keypoints[i]);
+        int const octave_index = this->keypoints[begin].octave;
+        std::size_t end = begin;
+        while (end < this->keypoints.size()
+            && this->keypoints[end].octave == octave_index)
+            end += 1;
+        if (end < this->keypoints.size()
+            && this->keypoints[end].octave < octave_index)
+            throw std::runtime_error("Decreasing octave index!");
 
-        /* Generate new gradient and orientation images if octave changed. */
-        if (kp.octave > octave_index)
+        /*
+         * Setup new octave gradient and orientation images. The images
+         * of the old octave are larger and their buffers are reused.
+         */
+        Octave* old_octave = octave;
+        octave = &this->octaves[octave_index - this->options.min_octave];
+        if (old_octave != nullptr)
         {
-            /* Clear old octave gradient and orientation images. */
-            if (octave)
-            {
-                octave->grad.clear();
-                octave->ori.clear();
-            }
-            /* Setup new octave gradient and orientation images. */
-            octave_index = kp.octave;
-            octave = &this->octaves[octave_index - this->options.min_octave];
-            this->generate_grad_ori_images(octave);
+            std::swap(octave->grad, old_octave->grad);
+            std::swap(octave->ori, old_octave->ori);
         }
-        else if (kp.octave < octave_index)
+        this->generate_grad_ori_images(octave);
+
+        /*
+         * Compute descriptors for chunks of keypoints in parallel. The
+         * chunks are concatenated in order to retain the serial order.
+         */
+        std::size_t const num_chunks = (end - begin + SIFT_CHUNK_SIZE - 1)
+            / SIFT_CHUNK_SIZE;
+        std::vector<Descriptors> chunk_descriptors(num_chunks);
+#pragma omp parallel for schedule(dynamic)
+        for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
         {
-            throw std::runtime_error("Decreasing octave index!");
-        }
+            std::size_t const chunk_begin = begin + chunk * SIFT_CHUNK_SIZE;
+            std::size_t const chunk_end = std::min(end,
+                chunk_begin + SIFT_CHUNK_SIZE);
+            std::vector<float> orientations;
+            orientations.reserve(8);
+            for (std::size_t i = chunk_begin; i < chunk_end; ++i)
+            {
+                Keypoint const& kp(this->keypoints[i]);
 
-        /* Orientation assignment. This returns multiple orientations. */
-        std::vector<float> orientations;
-        orientations.reserve(8);
-        this->orientation_assignment(kp, octave, orientations);
+                /* Orientation assignment. This returns multiple orientations. */
+                orientations.clear();
+                this->orientation_assignment(kp, octave, orientations);
 
-        /* Feature vector extraction. */
-        for (std::size_t j = 0; j < orientations.size(); ++j)
-        {
-            Descriptor desc;
-            float const scale_factor = std::pow(2.0f, kp.octave);
-            desc.x = scale_factor * (kp.x + 0.5f) - 0.5f;
-            desc.y = scale_factor * (kp.y + 0.5f) - 0.5f;
-            desc.scale = this->keypoint_absolute_scale(kp);
-            desc.orientation = orientations[j];
-            if (this->descriptor_assignment(kp, desc, octave))
-                this->descriptors.push_back(desc);
+                /* Feature vector extraction. */
+                for (std::size_t j = 0; j < orientations.size(); ++j)
+                {
+                    Descriptor desc;
+                    float const scale_factor = std::pow(2.0f, kp.octave);
+                    desc.x = scale_factor * (kp.x + 0.5f) - 0.5f;
+                    desc.y = scale_factor * (kp.y + 0.5f) - 0.5f;
+                    desc.scale = this->keypoint_absolute_scale(kp);
+                    desc.orientation = orientations[j];
+                    if (this->descriptor_assignment(kp, desc, octave))
+                        chunk_descriptors[chunk].push_back(desc);
+                }
+            }
         }
+
+        for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+            this->descriptors.insert(this->descriptors.end(),
+                chunk_descriptors[chunk].begin(),
+                chunk_descriptors[chunk].end());
+        begin = end;
     }
 }
 
@@ -557,10 +598,9 @@ Sift::descriptor_generation (void)
 void
 Sift::generate_grad_ori_images (Octave* octave)
 {
-    octave->grad.clear();
-    octave->grad.reserve(octave->img.size());
-    octave->ori.clear();
-    octave->ori.reserve(octave->img.size());
+    /* Existing images (e.g. of a previous octave) are reused. */
+    octave->grad.resize(octave->img.size());
+    octave->ori.resize(octave->img.size());
 
     int const width = octave->img[0]->width();
     int const height = octave->img[0]->height();
@@ -569,11 +609,19 @@ Sift::generate_grad_ori_images (Octave* octave)
     for (std::size_t i = 0; i < octave->img.size(); ++i)
     {
         mve::FloatImage::ConstPtr img = octave->img[i];
-        mve::FloatImage::Ptr grad = mve::FloatImage::create(width, height, 1);
-        mve::FloatImage::Ptr ori = mve::FloatImage::create(width, height, 1);
-
-        int image_iter = width + 1;
-        for (int y = 1; y < height - 1; ++y, image_iter += 2)
+        if (octave->grad[i] == nullptr)
+            octave->grad[i] = this->pyramid.acquire_image(width, height);
+        if (octave->ori[i] == nullptr)
+            octave->ori[i] = this->pyramid.acquire_image(width, height);
+        mve::FloatImage::Ptr grad = octave->grad[i];
+        mve::FloatImage::Ptr ori = octave->ori[i];
+        grad->allocate(width, height, 1);
+        ori->allocate(width, height, 1);
+
+#pragma omp parallel for schedule(static)
+        for (int y = 1; y < height - 1; ++y)
+        {
+            int image_iter = y * width + 1;
             for (int x = 1; x < width - 1; ++x, ++image_iter)
             {
                 float m1x = img->at(image_iter - 1);
@@ -588,8 +636,7 @@ Sift::generate_grad_ori_images (Octave* octave)
                 ori->at(image_iter) = atan2f < 0.0f
                     ? atan2f + MATH_PI * 2.0f : atan2f;
             }
-        octave->grad.push_back(grad);
-        octave->ori.push_back(ori);
+        }
     }
 }
 
@@ -24,6 +24,7 @@
 #include "math/vector.h"
 #include "mve/image.h"
 #include "sfm/defines.h"
+#include "sfm/gaussian_pyramid.h"
 
 SFM_NAMESPACE_BEGIN
 
@@ -194,11 +195,12 @@ protected:
 
 protected:
     void create_octaves (void);
+    void clear_octaves (void);
     void add_octave (mve::FloatImage::ConstPtr image,
         float has_sigma, float target_sigma);
     void extrema_detection (void);
     std::size_t extrema_detection (mve::FloatImage::ConstPtr s[3],
-        int oi, int si);
+        int oi, int si, int y_begin, int y_end, Keypoints* result) const;
     void keypoint_localization (void);
 
     void descriptor_generation (void);
@@ -215,6 +217,7 @@ private:
     Options options;
     mve::FloatImage::ConstPtr orig; // Original input image
     Octaves octaves; // The image pyramid (the octaves)
+    GaussianPyramid pyramid; // Builder for the octaves
     Keypoints keypoints; // Detected keypoints
     Descriptors descriptors; // Final SIFT descriptors
 };
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+#include "sfm/vocabulary_tree.h"
+
+/* Minimum number of descriptors to parallelize the k-means assignment. */
+#define VOCTREE_PARALLEL_THRES 4096
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    float
+    square_distance (float const* a, float const* b, int dimensions)
+    {
+        float dist = 0.0f;
+        for (int i = 0; i < dimensions; ++i)
+        {
+            float const diff = a[i] - b[i];
+            dist += diff * diff;
+        }
+        return dist;
+    }
+
+    int
+    closest_center (float const* descr, float const* centers,
+        int num_centers, int dimensions)
+    {
+        int best_id = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (int i = 0; i < num_centers; ++i)
+        {
+            float const dist = square_distance(descr,
+                centers + i * dimensions, dimensions);
+            if (dist < best_dist)
+            {
+                best_dist = dist;
+                best_id = i;
+            }
+        }
+        return best_id;
+    }
+}
+
+void
+VocabularyTree::build (float const* descriptors, int num_descriptors,
+    int dimensions)
+{
+    if (dimensions <= 0)
+        throw std::invalid_argument("Invalid descriptor dimensions");
+    if (this->opts.branching_factor < 2)
+        throw std::invalid_argument("Branching factor must be at least 2");
+
+    this->dimensions = dimensions;
+    this->num_words = 0;
+    this->nodes.clear();
+    this->centers.clear();
+    this->nodes.push_back(Node());
+    this->centers.resize(dimensions, 0.0f);
+
+    std::vector<int> indices(num_descriptors);
+    for (int i = 0; i < num_descriptors; ++i)
+        indices[i] = i;
+    this->build_node(0, descriptors, &indices, 0);
+}
+
+void
+VocabularyTree::build_node (int node_id, float const* descriptors,
+    std::vector<int>* indices, int level)
+{
+    int const k = this->opts.branching_factor;
+    int const dims = this->dimensions;
+    int const num = static_cast<int>(indices->size());
+
+    /* Create a visual word if the node cannot be split further. */
+    if (level >= this->opts.num_levels || num <= k)
+    {
+        Node& leaf = this->nodes[node_id];
+        leaf.first_child = 0;
+        leaf.num_children = 0;
+        leaf.word_id = this->num_words++;
+        return;
+    }
+
+    /*
+     * Initialize the cluster centers using k-means++ seeding, i.e., new
+     * centers are sampled proportional to the squared distance to the
+     * closest existing center.
+     */
+    std::mt19937 generator(this->opts.seed + node_id);
+    std::vector<float> node_centers(k * dims);
+    {
+        std::vector<float> min_dists(num, std::numeric_limits<float>::max());
+        int sample = std::uniform_int_distribution<int>(0, num - 1)(generator);
+        for (int c = 0; c < k; ++c)
+        {
+            float const* center = descriptors + indices->at(sample) * dims;
+            std::copy(center, center + dims, node_centers.begin() + c * dims);
+            if (c + 1 == k)
+                break;
+
+            double sum = 0.0;
+            for (int i = 0; i < num; ++i)
+            {
+                min_dists[i] = std::min(min_dists[i], square_distance(
+                    descriptors + indices->at(i) * dims, center, dims));
+                sum += min_dists[i];
+            }
+
+            /* Pick uniformly if all descriptors coincide with a center. */
+            if (sum <= 0.0)
+            {
+                sample = std::uniform_int_distribution<int>(0, num - 1)
+                    (generator);
+                continue;
+            }
+            double threshold = std::uniform_real_distribution<double>
+                (0.0, sum)(generator);
+            for (sample = 0; sample < num - 1; ++sample)
+            {
+                threshold -= min_dists[sample];
+                if (threshold < 0.0)
+                    break;
+            }
+        }
+    }
+
+    /* Lloyd iterations, empty clusters retain their previous center. */
+    std::vector<int> assignment(num, -1);
+    std::vector<int> counts(k);
+    std::vector<double> sums(k * dims);
+    for (int iter = 0; iter < this->opts.kmeans_iterations; ++iter)
+    {
+        int num_changed = 0;
+#pragma omp parallel for schedule(static) reduction(+:num_changed) \
+    if (num >= VOCTREE_PARALLEL_THRES)
+        for (int i = 0; i < num; ++i)
+        {
+            int const cluster = closest_center(descriptors
+                + indices->at(i) * dims, node_centers.data(), k, dims);
+            if (cluster != assignment[i])
+                num_changed += 1;
+            assignment[i] = cluster;
+        }
+        if (num_changed == 0)
+            break;
+
+        std::fill(counts.begin(), counts.end(), 0);
+        std::fill(sums.begin(), sums.end(), 0.0);
+        for (int i = 0; i < num; ++i)
+        {
+            float const* descr = descriptors + indices->at(i) * dims;
+            double* sum = sums.data() + assignment[i] * dims;
+            for (int d = 0; d < dims; ++d)
+                sum[d] += descr[d];
+            counts[assignment[i]] += 1;
+        }
+        for (int c = 0; c < k; ++c)
+        {
+            if (counts[c] == 0)
+                continue;
+            for (int d = 0; d < dims; ++d)
+                node_centers[c * dims + d] = static_cast<float>(
+                    sums[c * dims + d] / static_cast<double>(counts[c]));
+        }
+    }
+
+    /* Create the child nodes and distribute the descriptors. */
+    int const first_child = static_cast<int>(this->nodes.size());
+    this->nodes[node_id].first_child = first_child;
+    this->nodes[node_id].num_children = k;
+    this->nodes[node_id].word_id = -1;
+    this->nodes.resize(first_child + k);
+    this->centers.insert(this->centers.end(),
+        node_centers.begin(), node_centers.end());
+
+    std::vector<std::vector<int>> child_indices(k);
+    for (int i = 0; i < num; ++i)
+        child_indices[assignment[i]].push_back(indices->at(i));
+    indices->clear();
+    indices->shrink_to_fit();
+
+    for (int c = 0; c < k; ++c)
+    {
+        this->build_node(first_child + c, descriptors,
+            &child_indices[c], level + 1);
+        child_indices[c].clear();
+        child_indices[c].shrink_to_fit();
+    }
+}
+
+int
+VocabularyTree::lookup (float const* descriptor) const
+{
+    if (this->nodes.empty())
+        throw std::runtime_error("Vocabulary tree has not been built");
+
+    int node_id = 0;
+    while (this->nodes[node_id].num_children > 0)
+    {
+        Node const& node = this->nodes[node_id];
+        node_id = node.first_child + closest_center(descriptor,
+            this->centers.data() + node.first_child * this->dimensions,
+            node.num_children, this->dimensions);
+    }
+    return this->nodes[node_id].word_id;
+}
+
+SFM_NAMESPACE_END
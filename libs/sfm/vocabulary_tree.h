@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_VOCABULARY_TREE_HEADER
+#define SFM_VOCABULARY_TREE_HEADER
+
+#include <vector>
+
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Visual vocabulary built using hierarchical k-means clustering.
+ *
+ * The training descriptors are clustered into 'branching_factor' clusters
+ * using k-means, and each cluster is recursively clustered again until the
+ * maximum number of levels is reached or a cluster becomes too small to be
+ * split. The leaf nodes of the tree are the visual words. A descriptor is
+ * quantized by greedily descending to the closest child center at every
+ * level, which requires branching_factor * num_levels distance evaluations.
+ *
+ * Descriptors are plain float arrays of arbitrary (but fixed) dimension.
+ */
+class VocabularyTree
+{
+public:
+    struct Options
+    {
+        /** Number of children per node, i.e. the k in k-means. */
+        int branching_factor = 10;
+        /** Number of levels, the tree has at most k^levels words. */
+        int num_levels = 4;
+        /** Number of k-means iterations for every node. */
+        int kmeans_iterations = 10;
+        /** Seed for the random k-means initialization. */
+        unsigned int seed = 0;
+    };
+
+public:
+    explicit VocabularyTree (Options const& options);
+
+    /**
+     * Builds the vocabulary from 'num_descriptors' training descriptors
+     * with 'dimensions' floats each, stored consecutively in memory.
+     */
+    void build (float const* descriptors, int num_descriptors,
+        int dimensions);
+
+    /** Returns the visual word ID for the given descriptor. */
+    int lookup (float const* descriptor) const;
+
+    /** Returns the number of visual words (leaf nodes). */
+    int get_num_words (void) const;
+
+    /** Returns the descriptor dimensions the tree has been built for. */
+    int get_dimensions (void) const;
+
+private:
+    struct Node
+    {
+        /** ID of the first child node, children are consecutive. */
+        int first_child;
+        /** Number of children, zero for leaf nodes. */
+        int num_children;
+        /** The visual word ID for leaf nodes, -1 for inner nodes. */
+        int word_id;
+    };
+
+    void build_node (int node_id, float const* descriptors,
+        std::vector<int>* indices, int level);
+
+private:
+    Options opts;
+    int dimensions;
+    int num_words;
+    /** The nodes of the tree, the root node is the first node. */
+    std::vector<Node> nodes;
+    /** The cluster center for every node, the root center is unused. */
+    std::vector<float> centers;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+VocabularyTree::VocabularyTree (Options const& options)
+    : opts(options)
+    , dimensions(0)
+    , num_words(0)
+{
+}
+
+inline int
+VocabularyTree::get_num_words (void) const
+{
+    return this->num_words;
+}
+
+inline int
+VocabularyTree::get_dimensions (void) const
+{
+    return this->dimensions;
+}
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_VOCABULARY_TREE_HEADER */
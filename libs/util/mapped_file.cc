@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else // Linux, OSX, ...
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#include "util/exception.h"
+#include "util/mapped_file.h"
+
+UTIL_NAMESPACE_BEGIN
+UTIL_FS_NAMESPACE_BEGIN
+
+void
+MappedFile::open (std::string const& filename)
+{
+    this->close();
+
+#ifdef _WIN32
+    HANDLE file = ::CreateFileA(filename.c_str(), GENERIC_READ,
+        FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw util::FileException(filename, "Cannot open file");
+
+    LARGE_INTEGER file_size;
+    if (!::GetFileSizeEx(file, &file_size))
+    {
+        ::CloseHandle(file);
+        throw util::FileException(filename, "Cannot determine file size");
+    }
+    this->file_handle = file;
+    this->length = static_cast<std::size_t>(file_size.QuadPart);
+    if (this->length == 0)
+        return;
+
+    HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY,
+        0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        this->close();
+        throw util::FileException(filename, "Cannot create file mapping");
+    }
+    this->mapping_handle = mapping;
+
+    void* view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr)
+    {
+        this->close();
+        throw util::FileException(filename, "Cannot map file");
+    }
+    this->ptr = static_cast<char const*>(view);
+#else // _WIN32
+    int const fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw util::FileException(filename, std::strerror(errno));
+
+    struct stat statbuf;
+    if (::fstat(fd, &statbuf) < 0)
+    {
+        int const error = errno;
+        ::close(fd);
+        throw util::FileException(filename, std::strerror(error));
+    }
+    this->length = static_cast<std::size_t>(statbuf.st_size);
+    if (this->length == 0)
+    {
+        ::close(fd);
+        return;
+    }
+
+    /* The mapping remains valid after closing the file descriptor. */
+    void* addr = ::mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    int const error = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        this->length = 0;
+        throw util::FileException(filename, std::strerror(error));
+    }
+    this->ptr = static_cast<char const*>(addr);
+#endif // _WIN32
+}
+
+void
+MappedFile::close (void)
+{
+#ifdef _WIN32
+    if (this->ptr != nullptr)
+        ::UnmapViewOfFile(this->ptr);
+    if (this->mapping_handle != nullptr)
+        ::CloseHandle(static_cast<HANDLE>(this->mapping_handle));
+    if (this->file_handle != nullptr)
+        ::CloseHandle(static_cast<HANDLE>(this->file_handle));
+    this->mapping_handle = nullptr;
+    this->file_handle = nullptr;
+#else // _WIN32
+    if (this->ptr != nullptr)
+        ::munmap(const_cast<char*>(this->ptr), this->length);
+#endif // _WIN32
+    this->ptr = nullptr;
+    this->length = 0;
+}
+
+UTIL_FS_NAMESPACE_END
+UTIL_NAMESPACE_END
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015, Simon Fuhrmann
+ * TU Darmstadt - Graphics, Capture and Massively Parallel Computing
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_MAPPED_FILE_HEADER
+#define UTIL_MAPPED_FILE_HEADER
+
+#include <cstddef>
+#include <string>
+
+#include "util/defines.h"
+
+UTIL_NAMESPACE_BEGIN
+UTIL_FS_NAMESPACE_BEGIN
+
+/**
+ * Read-only memory mapping of a whole file. The file contents are paged
+ * in on demand by the operating system. The mapping is released when the
+ * object is destroyed or closed. Objects cannot be copied.
+ */
+class MappedFile
+{
+public:
+    MappedFile (void) = default;
+    explicit MappedFile (std::string const& filename);
+    ~MappedFile (void);
+
+    MappedFile (MappedFile const& other) = delete;
+    MappedFile& operator= (MappedFile const& other) = delete;
+
+    /** Maps the file, throws util::FileException on error. */
+    void open (std::string const& filename);
+    /** Releases the mapping. */
+    void close (void);
+
+    /** Returns the file contents, or nullptr for empty files. */
+    char const* data (void) const;
+    /** Returns the size of the file in bytes. */
+    std::size_t size (void) const;
+
+private:
+    char const* ptr = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+MappedFile::MappedFile (std::string const& filename)
+{
+    this->open(filename);
+}
+
+inline
+MappedFile::~MappedFile (void)
+{
+    this->close();
+}
+
+inline char const*
+MappedFile::data (void) const
+{
+    return this->ptr;
+}
+
+inline std::size_t
+MappedFile::size (void) const
+{
+    return this->length;
+}
+
+UTIL_FS_NAMESPACE_END
+UTIL_NAMESPACE_END
+
+#endif /* UTIL_MAPPED_FILE_HEADER */
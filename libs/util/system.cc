@@ -69,5 +69,31 @@ print_stack_trace (void)
     ::exit(1);
 }
 
+/* ---------------------------------------------------------------- */
+
+bool
+cpu_supports (CpuFeature feature)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    /* The builtin also checks OS support for the extended registers. */
+    switch (feature)
+    {
+        case CPU_FEATURE_SSE2: return __builtin_cpu_supports("sse2");
+        case CPU_FEATURE_SSE3: return __builtin_cpu_supports("sse3");
+        case CPU_FEATURE_SSE4_1: return __builtin_cpu_supports("sse4.1");
+        case CPU_FEATURE_AVX2: return __builtin_cpu_supports("avx2");
+        case CPU_FEATURE_FMA: return __builtin_cpu_supports("fma");
+        case CPU_FEATURE_AVX512F: return __builtin_cpu_supports("avx512f");
+        case CPU_FEATURE_AVX512BW: return __builtin_cpu_supports("avx512bw");
+        case CPU_FEATURE_AVX512VNNI:
+            return __builtin_cpu_supports("avx512vnni");
+        default: return false;
+    }
+#else
+    (void)feature;
+    return false;
+#endif
+}
+
 UTIL_SYSTEM_NAMESPACE_END
 UTIL_NAMESPACE_END
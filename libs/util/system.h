@@ -66,6 +66,30 @@ void signal_segfault_handler (int code);
 /** Prints a stack trace. */
 void print_stack_trace (void);
 
+/*
+ * --------------------------- CPU features --------------------------
+ */
+
+/** Instruction set extensions that can be queried at runtime. */
+enum CpuFeature
+{
+    CPU_FEATURE_SSE2,
+    CPU_FEATURE_SSE3,
+    CPU_FEATURE_SSE4_1,
+    CPU_FEATURE_AVX2,
+    CPU_FEATURE_FMA,
+    CPU_FEATURE_AVX512F,
+    CPU_FEATURE_AVX512BW,
+    CPU_FEATURE_AVX512VNNI
+};
+
+/**
+ * Returns true if the executing CPU and OS support the given feature.
+ * This allows a single binary to dispatch to SIMD kernels at runtime.
+ * Always returns false for compilers or architectures without support.
+ */
+bool cpu_supports (CpuFeature feature);
+
 /*
  * ----------------------- Endian conversions ------------------------
  */
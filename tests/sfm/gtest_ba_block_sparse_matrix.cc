@@ -0,0 +1,199 @@
+// Test cases for SfM block sparse matrix class.
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "sfm/ba_dense_vector.h"
+#include "sfm/ba_block_sparse_matrix.h"
+
+namespace
+{
+    typedef std::vector<std::vector<double>> DenseMatrix;
+
+    template <int BR, int BC>
+    DenseMatrix
+    to_dense (sfm::ba::BlockSparseMatrix<double, BR, BC> const& m)
+    {
+        DenseMatrix ret(m.num_rows(), std::vector<double>(m.num_cols(), 0.0));
+        for (std::size_t row = 0; row < m.num_block_rows(); ++row)
+            for (std::size_t i = m.row_begin(row); i < m.row_end(row); ++i)
+                for (int r = 0; r < BR; ++r)
+                    for (int c = 0; c < BC; ++c)
+                        ret[row * BR + r][m.block_col(i) * BC + c]
+                            = m.block(i)[r * BC + c];
+        return ret;
+    }
+
+    DenseMatrix
+    dense_multiply (DenseMatrix const& a, DenseMatrix const& b)
+    {
+        DenseMatrix ret(a.size(), std::vector<double>(b[0].size(), 0.0));
+        for (std::size_t i = 0; i < a.size(); ++i)
+            for (std::size_t j = 0; j < b[0].size(); ++j)
+                for (std::size_t k = 0; k < b.size(); ++k)
+                    ret[i][j] += a[i][k] * b[k][j];
+        return ret;
+    }
+
+    /* 3x4 blocks of size 2x3, blocks at (0,1), (0,3), (2,0), (2,1). */
+    sfm::ba::BlockSparseMatrix<double, 2, 3>
+    create_test_matrix (void)
+    {
+        sfm::ba::BlockSparseMatrix<double, 2, 3> m(3, 4);
+        m.set_pattern({ 0, 2, 2, 4 }, { 1, 3, 0, 1 });
+        for (std::size_t i = 0; i < m.num_blocks(); ++i)
+            for (int k = 0; k < 6; ++k)
+                m.block(i)[k] = 1.0 + i * 6 + k;
+        return m;
+    }
+}
+
+TEST(BlockSparseMatrixTest, PatternAndDimensions)
+{
+    sfm::ba::BlockSparseMatrix<double, 2, 3> m = create_test_matrix();
+    EXPECT_EQ(3, m.num_block_rows());
+    EXPECT_EQ(4, m.num_block_cols());
+    EXPECT_EQ(6, m.num_rows());
+    EXPECT_EQ(12, m.num_cols());
+    EXPECT_EQ(4, m.num_blocks());
+    EXPECT_EQ(m.row_begin(1), m.row_end(1));
+    EXPECT_EQ(3, m.block_col(1));
+
+    DenseMatrix d = to_dense(m);
+    EXPECT_EQ(1.0, d[0][3]);
+    EXPECT_EQ(6.0, d[1][5]);
+    EXPECT_EQ(7.0, d[0][9]);
+    EXPECT_EQ(13.0, d[4][0]);
+    EXPECT_EQ(0.0, d[2][3]);
+
+    EXPECT_THROW(m.set_pattern({ 0, 1 }, { 0 }), std::invalid_argument);
+}
+
+TEST(BlockSparseMatrixTest, MultiplyVector)
+{
+    sfm::ba::BlockSparseMatrix<double, 2, 3> m = create_test_matrix();
+    sfm::ba::DenseVector<double> x(12);
+    for (std::size_t i = 0; i < x.size(); ++i)
+        x[i] = 0.5 * i - 2.0;
+
+    sfm::ba::DenseVector<double> y = m.multiply(x);
+    DenseMatrix d = to_dense(m);
+    ASSERT_EQ(6, y.size());
+    for (std::size_t r = 0; r < d.size(); ++r)
+    {
+        double expected = 0.0;
+        for (std::size_t c = 0; c < d[r].size(); ++c)
+            expected += d[r][c] * x[c];
+        EXPECT_DOUBLE_EQ(expected, y[r]);
+    }
+
+    EXPECT_THROW(m.multiply(sfm::ba::DenseVector<double>(3)),
+        std::invalid_argument);
+}
+
+TEST(BlockSparseMatrixTest, Transpose)
+{
+    sfm::ba::BlockSparseMatrix<double, 2, 3> m = create_test_matrix();
+    sfm::ba::BlockSparseMatrix<double, 3, 2> t = m.transpose();
+    EXPECT_EQ(4, t.num_block_rows());
+    EXPECT_EQ(3, t.num_block_cols());
+    EXPECT_EQ(4, t.num_blocks());
+
+    DenseMatrix d = to_dense(m);
+    DenseMatrix dt = to_dense(t);
+    for (std::size_t r = 0; r < d.size(); ++r)
+        for (std::size_t c = 0; c < d[r].size(); ++c)
+            EXPECT_EQ(d[r][c], dt[c][r]);
+
+    /* Block columns of the transposed matrix are sorted. */
+    EXPECT_EQ(0, t.block_col(t.row_begin(1)));
+    EXPECT_EQ(2, t.block_col(t.row_begin(1) + 1));
+}
+
+TEST(BlockSparseMatrixTest, MultiplyMatrix)
+{
+    sfm::ba::BlockSparseMatrix<double, 2, 3> m = create_test_matrix();
+    sfm::ba::BlockSparseMatrix<double, 3, 2> t = m.transpose();
+
+    /* A^T A has 3x3 blocks, A A^T has 2x2 blocks. */
+    sfm::ba::BlockSparseMatrix<double, 3, 3> ata = t.multiply(m);
+    sfm::ba::BlockSparseMatrix<double, 2, 2> aat = m.multiply(t);
+    EXPECT_EQ(7, ata.num_blocks());
+    EXPECT_EQ(4, aat.num_blocks());
+
+    DenseMatrix expected = dense_multiply(to_dense(t), to_dense(m));
+    DenseMatrix result = to_dense(ata);
+    for (std::size_t r = 0; r < expected.size(); ++r)
+        for (std::size_t c = 0; c < expected[r].size(); ++c)
+            EXPECT_NEAR(expected[r][c], result[r][c], 1e-10);
+
+    expected = dense_multiply(to_dense(m), to_dense(t));
+    result = to_dense(aat);
+    for (std::size_t r = 0; r < expected.size(); ++r)
+        for (std::size_t c = 0; c < expected[r].size(); ++c)
+            EXPECT_NEAR(expected[r][c], result[r][c], 1e-10);
+
+    sfm::ba::BlockSparseMatrix<double, 3, 3> wrong_size(3, 3);
+    EXPECT_THROW(m.multiply(wrong_size), std::invalid_argument);
+}
+
+TEST(BlockSparseMatrixTest, Subtract)
+{
+    sfm::ba::BlockSparseMatrix<double, 2, 3> m1 = create_test_matrix();
+    sfm::ba::BlockSparseMatrix<double, 2, 3> m2(3, 4);
+    m2.set_pattern({ 0, 1, 2, 2 }, { 1, 2 });
+    for (int k = 0; k < 6; ++k)
+    {
+        m2.block(0)[k] = 1.0;
+        m2.block(1)[k] = 2.0;
+    }
+
+    sfm::ba::BlockSparseMatrix<double, 2, 3> diff = m1.subtract(m2);
+    EXPECT_EQ(5, diff.num_blocks());
+    DenseMatrix d1 = to_dense(m1);
+    DenseMatrix d2 = to_dense(m2);
+    DenseMatrix dd = to_dense(diff);
+    for (std::size_t r = 0; r < d1.size(); ++r)
+        for (std::size_t c = 0; c < d1[r].size(); ++c)
+            EXPECT_EQ(d1[r][c] - d2[r][c], dd[r][c]);
+}
+
+TEST(BlockSparseMatrixTest, DiagonalAndInverse)
+{
+    sfm::ba::BlockSparseMatrix<double, 2, 2> m(3, 3);
+    m.set_pattern({ 0, 1, 2, 3 }, { 0, 1, 2 });
+    double const blocks[3][4] = {
+        { 4.0, 2.0, 2.0, 3.0 },
+        { 1.0, 0.0, 0.0, 2.0 },
+        { 0.0, 0.0, 0.0, 0.0 } };
+    for (int i = 0; i < 3; ++i)
+        std::copy(blocks[i], blocks[i] + 4, m.block(i));
+
+    sfm::ba::DenseVector<double> diag = m.diagonal();
+    ASSERT_EQ(6, diag.size());
+    EXPECT_EQ(4.0, diag[0]);
+    EXPECT_EQ(3.0, diag[1]);
+    EXPECT_EQ(2.0, diag[3]);
+
+    m.mult_diagonal(2.0);
+    EXPECT_EQ(8.0, m.block(0)[0]);
+    EXPECT_EQ(2.0, m.block(0)[1]);
+    EXPECT_EQ(6.0, m.block(0)[3]);
+
+    /* Inverse of [8 2; 2 6] is [6 -2; -2 8] / 44. */
+    m.invert_block_diagonal();
+    EXPECT_NEAR(6.0 / 44.0, m.block(0)[0], 1e-12);
+    EXPECT_NEAR(-2.0 / 44.0, m.block(0)[1], 1e-12);
+    EXPECT_NEAR(-2.0 / 44.0, m.block(0)[2], 1e-12);
+    EXPECT_NEAR(8.0 / 44.0, m.block(0)[3], 1e-12);
+    EXPECT_NEAR(0.5, m.block(1)[0], 1e-12);
+    EXPECT_NEAR(0.25, m.block(1)[3], 1e-12);
+    /* Singular blocks are set to zero. */
+    for (int k = 0; k < 4; ++k)
+        EXPECT_EQ(0.0, m.block(2)[k]);
+
+    /* Inversion requires a block diagonal matrix. */
+    sfm::ba::BlockSparseMatrix<double, 2, 2> m2(2, 2);
+    m2.set_pattern({ 0, 1, 1 }, { 1 });
+    EXPECT_THROW(m2.invert_block_diagonal(), std::invalid_argument);
+}
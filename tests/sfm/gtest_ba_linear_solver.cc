@@ -0,0 +1,87 @@
+// Test cases for the SfM bundle adjustment linear solver.
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "sfm/ba_linear_solver.h"
+
+namespace
+{
+    typedef sfm::ba::LinearSolver::CameraJacobianType<6> CameraJacobian;
+    typedef sfm::ba::LinearSolver::PointJacobianType PointJacobian;
+    typedef sfm::ba::DenseVector<double> DenseVectorType;
+
+    /* 4 cameras and 6 points, every point is observed by 3 cameras. */
+    void
+    create_test_problem (CameraJacobian* jac_cams, PointJacobian* jac_points,
+        DenseVectorType* vector_f)
+    {
+        int const num_cams = 4;
+        int const num_points = 6;
+        int const num_obs = num_points * 3;
+
+        std::vector<std::size_t> outer(num_obs + 1);
+        std::vector<std::size_t> cam_inner(num_obs);
+        std::vector<std::size_t> point_inner(num_obs);
+        for (int i = 0; i < num_obs; ++i)
+        {
+            outer[i + 1] = i + 1;
+            cam_inner[i] = (i / 3 + i % 3) % num_cams;
+            point_inner[i] = i / 3;
+        }
+
+        jac_cams->allocate(num_obs, num_cams);
+        jac_cams->set_pattern(outer, cam_inner);
+        jac_points->allocate(num_obs, num_points);
+        jac_points->set_pattern(outer, point_inner);
+
+        /* Deterministic pseudo-random entries. */
+        unsigned int seed = 1;
+        auto next_value = [&seed] (void)
+        {
+            seed = seed * 1103515245u + 12345u;
+            return static_cast<double>((seed >> 16) % 2001) / 1000.0 - 1.0;
+        };
+        for (int i = 0; i < num_obs; ++i)
+        {
+            for (int k = 0; k < 12; ++k)
+                jac_cams->block(i)[k] = next_value();
+            for (int k = 0; k < 6; ++k)
+                jac_points->block(i)[k] = next_value();
+        }
+
+        vector_f->resize(num_obs * 2);
+        for (std::size_t i = 0; i < vector_f->size(); ++i)
+            vector_f->at(i) = next_value();
+    }
+}
+
+TEST(BundleAdjustmentLinearSolverTest, ImplicitSchurMatchesExplicit)
+{
+    CameraJacobian jac_cams;
+    PointJacobian jac_points;
+    DenseVectorType vector_f;
+    create_test_problem(&jac_cams, &jac_points, &vector_f);
+
+    sfm::ba::LinearSolver::Options opts;
+    opts.trust_region_radius = 10.0;
+    DenseVectorType delta_explicit;
+    sfm::ba::LinearSolver::Status status_explicit
+        = sfm::ba::LinearSolver(opts).solve(jac_cams, jac_points,
+        vector_f, &delta_explicit);
+
+    opts.implicit_schur = true;
+    DenseVectorType delta_implicit;
+    sfm::ba::LinearSolver::Status status_implicit
+        = sfm::ba::LinearSolver(opts).solve(jac_cams, jac_points,
+        vector_f, &delta_implicit);
+
+    EXPECT_TRUE(status_explicit.success);
+    EXPECT_TRUE(status_implicit.success);
+    ASSERT_EQ(24 + 18, delta_explicit.size());
+    ASSERT_EQ(delta_explicit.size(), delta_implicit.size());
+    for (std::size_t i = 0; i < delta_explicit.size(); ++i)
+        EXPECT_NEAR(delta_explicit[i], delta_implicit[i], 1e-8);
+    EXPECT_NEAR(status_explicit.predicted_error_decrease,
+        status_implicit.predicted_error_decrease, 1e-8);
+}
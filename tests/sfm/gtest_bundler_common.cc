@@ -0,0 +1,229 @@
+// Test cases for the bundler prebundle file format.
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "util/file_system.h"
+#include "sfm/bundler_common.h"
+
+namespace
+{
+    struct TempFile : public std::string
+    {
+        TempFile (std::string const& postfix)
+            : std::string(std::tmpnam(nullptr))
+        {
+            this->append(postfix);
+        }
+
+        ~TempFile (void)
+        {
+            util::fs::unlink(this->c_str());
+        }
+    };
+
+    void
+    create_prebundle (sfm::bundler::ViewportList* viewports,
+        sfm::bundler::PairwiseMatching* matching)
+    {
+        /* Odd counts make sure the sections require padding. */
+        viewports->resize(3);
+        for (std::size_t i = 0; i < viewports->size(); ++i)
+        {
+            sfm::FeatureSet& features = viewports->at(i).features;
+            for (std::size_t j = 0; j < 2 * i + 1; ++j)
+            {
+                features.positions.push_back(math::Vec2f(i + 0.5f, j - 0.25f));
+                features.colors.push_back(math::Vec3uc(i, j, i + j));
+            }
+        }
+
+        matching->resize(2);
+        matching->at(0).view_1_id = 1;
+        matching->at(0).view_2_id = 0;
+        matching->at(0).matches.push_back(sfm::CorrespondenceIndex(2, 0));
+        matching->at(1).view_1_id = 2;
+        matching->at(1).view_2_id = 1;
+        matching->at(1).matches.push_back(sfm::CorrespondenceIndex(0, 1));
+        matching->at(1).matches.push_back(sfm::CorrespondenceIndex(4, 2));
+        matching->at(1).matches.push_back(sfm::CorrespondenceIndex(3, 0));
+    }
+
+    /* Writes the previous, per-element prebundle format. */
+    void
+    save_legacy_prebundle (sfm::bundler::ViewportList const& viewports,
+        sfm::bundler::PairwiseMatching const& matching,
+        std::string const& filename)
+    {
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        out.write("MVE_PREBUNDLE\n", 14);
+        int32_t value = viewports.size();
+        out.write(reinterpret_cast<char const*>(&value), sizeof(int32_t));
+        for (std::size_t i = 0; i < viewports.size(); ++i)
+        {
+            sfm::FeatureSet const& features = viewports[i].features;
+            value = features.positions.size();
+            out.write(reinterpret_cast<char const*>(&value), sizeof(int32_t));
+            for (std::size_t j = 0; j < features.positions.size(); ++j)
+                out.write(reinterpret_cast<char const*>(
+                    &features.positions[j]), sizeof(math::Vec2f));
+            value = features.colors.size();
+            out.write(reinterpret_cast<char const*>(&value), sizeof(int32_t));
+            for (std::size_t j = 0; j < features.colors.size(); ++j)
+                out.write(reinterpret_cast<char const*>(
+                    &features.colors[j]), sizeof(math::Vec3uc));
+        }
+        value = matching.size();
+        out.write(reinterpret_cast<char const*>(&value), sizeof(int32_t));
+        for (std::size_t i = 0; i < matching.size(); ++i)
+        {
+            int32_t header[3] = { matching[i].view_1_id,
+                matching[i].view_2_id,
+                static_cast<int32_t>(matching[i].matches.size()) };
+            out.write(reinterpret_cast<char const*>(header), sizeof(header));
+            for (std::size_t j = 0; j < matching[i].matches.size(); ++j)
+            {
+                int32_t ids[2] = { matching[i].matches[j].first,
+                    matching[i].matches[j].second };
+                out.write(reinterpret_cast<char const*>(ids), sizeof(ids));
+            }
+        }
+    }
+
+    void
+    expect_equal (sfm::bundler::ViewportList const& viewports1,
+        sfm::bundler::PairwiseMatching const& matching1,
+        sfm::bundler::ViewportList const& viewports2,
+        sfm::bundler::PairwiseMatching const& matching2)
+    {
+        ASSERT_EQ(viewports1.size(), viewports2.size());
+        for (std::size_t i = 0; i < viewports1.size(); ++i)
+        {
+            EXPECT_EQ(viewports1[i].features.positions,
+                viewports2[i].features.positions);
+            EXPECT_EQ(viewports1[i].features.colors,
+                viewports2[i].features.colors);
+        }
+        ASSERT_EQ(matching1.size(), matching2.size());
+        for (std::size_t i = 0; i < matching1.size(); ++i)
+        {
+            EXPECT_EQ(matching1[i].view_1_id, matching2[i].view_1_id);
+            EXPECT_EQ(matching1[i].view_2_id, matching2[i].view_2_id);
+            EXPECT_EQ(matching1[i].matches, matching2[i].matches);
+        }
+    }
+}
+
+TEST(BundlerCommonTest, PrebundleRoundTrip)
+{
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::PairwiseMatching matching;
+    create_prebundle(&viewports, &matching);
+
+    TempFile filename("prebundle.sfm");
+    sfm::bundler::save_prebundle_to_file(viewports, matching, filename);
+
+    sfm::bundler::ViewportList loaded_viewports;
+    sfm::bundler::PairwiseMatching loaded_matching;
+    sfm::bundler::load_prebundle_from_file(filename,
+        &loaded_viewports, &loaded_matching);
+    expect_equal(viewports, matching, loaded_viewports, loaded_matching);
+}
+
+TEST(BundlerCommonTest, PrebundleEmpty)
+{
+    TempFile filename("prebundle.sfm");
+    sfm::bundler::save_prebundle_to_file(sfm::bundler::ViewportList(),
+        sfm::bundler::PairwiseMatching(), filename);
+
+    sfm::bundler::MappedPrebundle prebundle(filename);
+    EXPECT_EQ(0, prebundle.get_num_viewports());
+    EXPECT_EQ(0, prebundle.get_num_pairs());
+}
+
+TEST(BundlerCommonTest, PrebundleMatchingRefs)
+{
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::PairwiseMatching matching;
+    create_prebundle(&viewports, &matching);
+
+    TempFile filename("prebundle.sfm");
+    sfm::bundler::save_prebundle_to_file(viewports, matching, filename);
+
+    sfm::bundler::MappedPrebundle prebundle(filename);
+    EXPECT_EQ(3, prebundle.get_num_viewports());
+    ASSERT_EQ(2, prebundle.get_num_pairs());
+
+    sfm::bundler::PairwiseMatchingRef refs;
+    prebundle.get_matching_refs(&refs);
+    ASSERT_EQ(2, refs.size());
+    for (std::size_t i = 0; i < refs.size(); ++i)
+    {
+        EXPECT_EQ(matching[i].view_1_id, refs[i].view_1_id);
+        EXPECT_EQ(matching[i].view_2_id, refs[i].view_2_id);
+        ASSERT_EQ(matching[i].matches.size(), refs[i].num_matches);
+        EXPECT_EQ(0, reinterpret_cast<uintptr_t>(refs[i].matches) % 8);
+        for (std::size_t j = 0; j < refs[i].num_matches; ++j)
+            EXPECT_EQ(matching[i].matches[j], refs[i].matches[j]);
+    }
+
+    /* References to in-memory matching point to the original data. */
+    sfm::bundler::make_matching_refs(matching, &refs);
+    ASSERT_EQ(2, refs.size());
+    EXPECT_EQ(matching[1].matches.data(), refs[1].matches);
+    EXPECT_EQ(3, refs[1].num_matches);
+}
+
+TEST(BundlerCommonTest, PrebundleLegacyFormat)
+{
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::PairwiseMatching matching;
+    create_prebundle(&viewports, &matching);
+
+    TempFile filename("prebundle.sfm");
+    save_legacy_prebundle(viewports, matching, filename);
+
+    sfm::bundler::ViewportList loaded_viewports;
+    sfm::bundler::PairwiseMatching loaded_matching;
+    sfm::bundler::load_prebundle_from_file(filename,
+        &loaded_viewports, &loaded_matching);
+    expect_equal(viewports, matching, loaded_viewports, loaded_matching);
+
+    sfm::bundler::MappedPrebundle prebundle(filename);
+    sfm::bundler::PairwiseMatchingRef refs;
+    prebundle.get_matching_refs(&refs);
+    ASSERT_EQ(2, refs.size());
+    ASSERT_EQ(3, refs[1].num_matches);
+    EXPECT_EQ(matching[1].matches[2], refs[1].matches[2]);
+}
+
+TEST(BundlerCommonTest, PrebundleInvalid)
+{
+    TempFile filename("prebundle.sfm");
+    util::fs::write_string_to_file("NOT_A_PREBUNDLE\n", filename);
+    EXPECT_THROW(sfm::bundler::MappedPrebundle prebundle(filename),
+        std::invalid_argument);
+
+    /* Truncated files are rejected. */
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::PairwiseMatching matching;
+    create_prebundle(&viewports, &matching);
+    sfm::bundler::save_prebundle_to_file(viewports, matching, filename);
+    std::string data;
+    util::fs::read_file_to_string(filename, &data);
+    data.resize(data.size() - 1);
+    util::fs::write_string_to_file(data, filename);
+    EXPECT_THROW(sfm::bundler::MappedPrebundle prebundle(filename),
+        std::exception);
+
+    save_legacy_prebundle(viewports, matching, filename);
+    util::fs::read_file_to_string(filename, &data);
+    data.resize(data.size() - 1);
+    util::fs::write_string_to_file(data, filename);
+    EXPECT_THROW(sfm::bundler::MappedPrebundle prebundle(filename),
+        std::exception);
+}
@@ -0,0 +1,155 @@
+// Test cases for the bundler features component.
+
+#include <gtest/gtest.h>
+
+#include "sfm/bundler_features.h"
+
+namespace
+{
+    mve::ByteImage::Ptr
+    create_test_image (void)
+    {
+        mve::ByteImage::Ptr image = mve::ByteImage::create(16, 8, 1);
+        for (int i = 0; i < image->get_value_amount(); ++i)
+            image->at(i) = static_cast<uint8_t>(i * 7);
+        return image;
+    }
+
+    void
+    create_test_features (sfm::FeatureSet* features)
+    {
+        features->width = 640;
+        features->height = 480;
+        sfm::Sift::Descriptors sift_descriptors(2);
+        features->surf_descriptors.resize(1);
+        for (int i = 0; i < 3; ++i)
+        {
+            features->positions.push_back(math::Vec2f(i * 10.0f, i + 0.5f));
+            features->colors.push_back(math::Vec3uc(i, 2 * i, 3 * i));
+        }
+        for (std::size_t i = 0; i < sift_descriptors.size(); ++i)
+        {
+            sfm::Sift::Descriptor& d = sift_descriptors[i];
+            d.x = i * 10.0f;
+            d.y = i + 0.5f;
+            d.scale = 1.5f;
+            d.orientation = 0.25f * i;
+            d.data.fill(0.01f * i);
+        }
+        features->set_sift_descriptors(sift_descriptors);
+        sfm::Surf::Descriptor& d = features->surf_descriptors[0];
+        d.x = 20.0f;
+        d.y = 2.5f;
+        d.scale = 3.0f;
+        d.orientation = -1.0f;
+        d.data.fill(-0.5f);
+    }
+}
+
+TEST(BundlerFeaturesTest, FeatureCacheKey)
+{
+    mve::ByteImage::Ptr image = create_test_image();
+    sfm::FeatureSet::Options options;
+    uint64_t const key = sfm::bundler::feature_cache_key(*image, 1000, options);
+    EXPECT_EQ(key, sfm::bundler::feature_cache_key(*image, 1000, options));
+
+    /* The key depends on the maximum image size. */
+    EXPECT_NE(key, sfm::bundler::feature_cache_key(*image, 500, options));
+
+    /* The key depends on the feature options, but not on console output. */
+    sfm::FeatureSet::Options options2 = options;
+    options2.sift_opts.verbose_output = true;
+    EXPECT_EQ(key, sfm::bundler::feature_cache_key(*image, 1000, options2));
+    options2.sift_opts.edge_ratio_threshold = 5.0f;
+    EXPECT_NE(key, sfm::bundler::feature_cache_key(*image, 1000, options2));
+    options2 = options;
+    options2.feature_types = sfm::FeatureSet::FEATURE_ALL;
+    EXPECT_NE(key, sfm::bundler::feature_cache_key(*image, 1000, options2));
+
+    /* The key depends on the image content. */
+    image->at(5) += 1;
+    EXPECT_NE(key, sfm::bundler::feature_cache_key(*image, 1000, options));
+}
+
+TEST(BundlerFeaturesTest, FeatureCacheRoundTrip)
+{
+    sfm::FeatureSet features;
+    create_test_features(&features);
+    mve::ByteImage::Ptr blob = sfm::bundler::feature_cache_to_blob(features, 42);
+
+    sfm::FeatureSet loaded;
+    ASSERT_TRUE(sfm::bundler::feature_cache_from_blob(*blob, 42, &loaded));
+    EXPECT_EQ(features.width, loaded.width);
+    EXPECT_EQ(features.height, loaded.height);
+    EXPECT_EQ(features.positions, loaded.positions);
+    EXPECT_EQ(features.colors, loaded.colors);
+    ASSERT_EQ(2, loaded.sift_descriptors.size());
+    for (std::size_t i = 0; i < features.sift_descriptors.size(); ++i)
+        EXPECT_EQ(features.sift_descriptors[i], loaded.sift_descriptors[i]);
+    EXPECT_EQ(features.sift_geometry.scales, loaded.sift_geometry.scales);
+    EXPECT_EQ(features.sift_geometry.orientations,
+        loaded.sift_geometry.orientations);
+    EXPECT_EQ(0.25f, loaded.sift_geometry.orientations[1]);
+    EXPECT_EQ(3, loaded.sift_descriptors[1][0]);
+    ASSERT_EQ(1, loaded.surf_descriptors.size());
+    EXPECT_EQ(features.surf_descriptors[0].orientation,
+        loaded.surf_descriptors[0].orientation);
+    EXPECT_EQ(features.surf_descriptors[0].data,
+        loaded.surf_descriptors[0].data);
+}
+
+TEST(BundlerFeaturesTest, FeatureCacheRejectsInvalid)
+{
+    sfm::FeatureSet features;
+    create_test_features(&features);
+    mve::ByteImage::Ptr blob = sfm::bundler::feature_cache_to_blob(features, 42);
+
+    /* Wrong key leaves the features untouched. */
+    sfm::FeatureSet loaded;
+    loaded.width = 1;
+    EXPECT_FALSE(sfm::bundler::feature_cache_from_blob(*blob, 43, &loaded));
+    EXPECT_EQ(1, loaded.width);
+    EXPECT_TRUE(loaded.positions.empty());
+
+    /* Truncated BLOB. */
+    mve::ByteImage::Ptr truncated = mve::ByteImage::create(
+        blob->get_byte_size() - 1, 1, 1);
+    std::copy(blob->begin(), blob->begin() + truncated->get_byte_size(),
+        truncated->begin());
+    EXPECT_FALSE(sfm::bundler::feature_cache_from_blob(*truncated, 42, &loaded));
+
+    /* Corrupted signature. */
+    blob->at(0) = 'X';
+    EXPECT_FALSE(sfm::bundler::feature_cache_from_blob(*blob, 42, &loaded));
+}
+
+TEST(BundlerFeaturesTest, QuantizedSiftDescriptors)
+{
+    sfm::Sift::Descriptors descriptors(1);
+    descriptors[0].scale = 2.0f;
+    descriptors[0].orientation = -0.5f;
+    descriptors[0].data.fill(0.0f);
+    descriptors[0].data[0] = 0.8f;
+    descriptors[0].data[1] = 0.6f;
+
+    sfm::FeatureSet features;
+    features.set_sift_descriptors(descriptors);
+    ASSERT_EQ(1, features.sift_descriptors.size());
+    EXPECT_EQ(204, features.sift_descriptors[0][0]);
+    EXPECT_EQ(153, features.sift_descriptors[0][1]);
+    EXPECT_EQ(0, features.sift_descriptors[0][2]);
+    EXPECT_EQ(2.0f, features.sift_geometry.scales[0]);
+    EXPECT_EQ(-0.5f, features.sift_geometry.orientations[0]);
+
+    /* RootSIFT maps to the square root of the L1-normalized values. */
+    sfm::FeatureSet::Options options;
+    options.use_root_sift = true;
+    features.set_options(options);
+    features.set_sift_descriptors(descriptors);
+    EXPECT_EQ(193, features.sift_descriptors[0][0]);
+    EXPECT_EQ(167, features.sift_descriptors[0][1]);
+
+    features.clear_descriptors();
+    EXPECT_TRUE(features.sift_descriptors.empty());
+    EXPECT_TRUE(features.sift_geometry.scales.empty());
+}
@@ -0,0 +1,116 @@
+// Test cases for the incremental SfM component.
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "sfm/bundler_common.h"
+#include "sfm/bundler_incremental.h"
+
+namespace
+{
+    /*
+     * Creates 8 cameras on a line looking down the z-axis and 70 points.
+     * Point j is observed by the cameras c = j % 7 and c + 1, every third
+     * row of points also by camera c + 2.
+     */
+    void
+    create_scene (sfm::bundler::ViewportList* viewports,
+        sfm::bundler::TrackList* tracks, std::vector<math::Vec3f>* points)
+    {
+        int const num_views = 8;
+        viewports->clear();
+        viewports->resize(num_views);
+        for (int i = 0; i < num_views; ++i)
+        {
+            sfm::bundler::Viewport& view = viewports->at(i);
+            view.focal_length = 1.0f;
+            view.pose.set_k_matrix(1.0, 0.0, 0.0);
+            view.pose.R.fill(0.0);
+            view.pose.R(0, 0) = view.pose.R(1, 1) = view.pose.R(2, 2) = 1.0;
+            view.pose.t = math::Vec3d(-0.3 * i, 0.0, 0.0);
+        }
+
+        tracks->clear();
+        points->clear();
+        for (int j = 0; j < 70; ++j)
+        {
+            int const c = j % 7;
+            math::Vec3f const pos(0.3f * c + 0.15f
+                + 0.05f * static_cast<float>(j / 7 % 3),
+                -0.5f + 0.1f * static_cast<float>(j / 7), 5.0f + 0.1f * c);
+            points->push_back(pos);
+
+            std::vector<int> view_ids = { c, c + 1 };
+            if (j / 7 % 3 == 0 && c + 2 < num_views)
+                view_ids.push_back(c + 2);
+
+            sfm::bundler::Track track;
+            track.color = math::Vec3uc(0, 0, 0);
+            for (int view_id : view_ids)
+            {
+                sfm::bundler::Viewport& view = viewports->at(view_id);
+                math::Vec3d const x = view.pose.R * math::Vec3d(pos)
+                    + view.pose.t;
+                int const feature_id = view.features.positions.size();
+                view.features.positions.push_back(
+                    math::Vec2f(x[0] / x[2], x[1] / x[2]));
+                view.features.colors.push_back(math::Vec3uc(0, 0, 0));
+                view.track_ids.push_back(tracks->size());
+                track.features.emplace_back(view_id, feature_id);
+            }
+            tracks->push_back(track);
+        }
+    }
+}
+
+TEST(BundlerIncrementalTest, LocalBundleAdjustmentWindow)
+{
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::TrackList tracks;
+    std::vector<math::Vec3f> points;
+    create_scene(&viewports, &tracks, &points);
+
+    sfm::bundler::Incremental::Options opts;
+    opts.ba_local_num_neighbors = 1;
+    opts.verbose_output = false;
+    sfm::bundler::Incremental incremental(opts);
+    incremental.initialize(&viewports, &tracks);
+    for (std::size_t i = 0; i < tracks.size(); ++i)
+        tracks[i].pos = points[i];
+
+    /* Perturb the last camera and all points. */
+    viewports[7].pose.t[0] += 0.02;
+    viewports[7].pose.t[1] -= 0.01;
+    for (std::size_t i = 0; i < tracks.size(); ++i)
+        tracks[i].pos[2] += (i % 2 ? 0.02f : -0.02f);
+
+    sfm::bundler::ViewportList const before_views = viewports;
+    sfm::bundler::TrackList const before_tracks = tracks;
+    incremental.bundle_adjustment_local(std::vector<int>(1, 7));
+
+    /*
+     * The window is view 7 and its most co-visible neighbor 6. Views 4
+     * and 5 observe tracks of the window and are constant.
+     */
+    for (int i = 0; i < 6; ++i)
+    {
+        EXPECT_EQ(before_views[i].pose.t, viewports[i].pose.t) << i;
+        EXPECT_EQ(before_views[i].pose.R, viewports[i].pose.R) << i;
+    }
+    EXPECT_NE(before_views[6].pose.t, viewports[6].pose.t);
+    EXPECT_NE(before_views[7].pose.t, viewports[7].pose.t);
+
+    /* Only tracks observed by views 6 or 7 move. */
+    int num_moved = 0;
+    for (std::size_t i = 0; i < tracks.size(); ++i)
+    {
+        bool in_window = false;
+        for (std::size_t j = 0; j < tracks[i].features.size(); ++j)
+            in_window |= tracks[i].features[j].view_id >= 6;
+        if (!in_window)
+            EXPECT_EQ(before_tracks[i].pos, tracks[i].pos) << i;
+        else if (!(before_tracks[i].pos == tracks[i].pos))
+            num_moved += 1;
+    }
+    EXPECT_GT(num_moved, 0);
+}
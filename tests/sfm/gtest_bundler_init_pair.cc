@@ -0,0 +1,110 @@
+// Test cases for the initial pair search.
+
+#include <cmath>
+#include <random>
+#include <gtest/gtest.h>
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
+
+#include "sfm/bundler_common.h"
+#include "sfm/bundler_init_pair.h"
+
+namespace
+{
+    /* Creates cameras on a line and noisy observations of random points. */
+    void
+    create_scene (sfm::bundler::ViewportList* viewports,
+        sfm::bundler::TrackList* tracks)
+    {
+        int const num_views = 6;
+        int const num_points = 1000;
+        std::mt19937 generator(3);
+        std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+        viewports->clear();
+        viewports->resize(num_views);
+        for (int i = 0; i < num_views; ++i)
+            viewports->at(i).focal_length = 1.0f;
+
+        tracks->clear();
+        tracks->resize(num_points);
+        for (int i = 0; i < num_points; ++i)
+        {
+            math::Vec3d const pos(0.1 * num_views * (dist(generator) + 1.0),
+                dist(generator), 4.0 + dist(generator));
+            for (int j = 0; j < num_views; ++j)
+            {
+                math::Vec3d const x = pos - math::Vec3d(0.2 * j, 0.0, 0.0);
+                math::Vec2f pos2d(x[0] / x[2], x[1] / x[2]);
+                if (std::abs(pos2d[0]) > 0.5f)
+                    continue;
+                pos2d[0] += 0.001f * dist(generator);
+                pos2d[1] += 0.001f * dist(generator);
+
+                sfm::bundler::Viewport& view = viewports->at(j);
+                tracks->at(i).features.emplace_back(j,
+                    view.features.positions.size());
+                view.features.positions.push_back(pos2d);
+            }
+        }
+    }
+
+    void
+    set_num_threads (int num_threads)
+    {
+#ifdef _OPENMP
+        omp_set_num_threads(num_threads);
+#else
+        (void)num_threads;
+#endif
+    }
+}
+
+TEST(BundlerInitPairTest, SamePairForAllThreadCounts)
+{
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::TrackList tracks;
+    create_scene(&viewports, &tracks);
+
+    sfm::bundler::InitialPair::Options opts;
+    opts.homography_opts.threshold = 0.005f;
+
+    /* Search the pair twice, rejecting the first result in between. */
+    int first_pair[2] = { -1, -1 };
+    int second_pair[2] = { -1, -1 };
+    int const num_threads[] = { 1, 2, 4 };
+    for (int threads : num_threads)
+    {
+        set_num_threads(threads);
+        sfm::bundler::InitialPair init_pair(opts);
+        init_pair.initialize(viewports, tracks);
+
+        sfm::bundler::InitialPair::Result result;
+        init_pair.compute_pair(&result);
+        ASSERT_GE(result.view_1_id, 0);
+        ASSERT_GE(result.view_2_id, 0);
+        if (first_pair[0] < 0)
+        {
+            first_pair[0] = result.view_1_id;
+            first_pair[1] = result.view_2_id;
+        }
+        EXPECT_EQ(first_pair[0], result.view_1_id) << threads;
+        EXPECT_EQ(first_pair[1], result.view_2_id) << threads;
+
+        init_pair.reject_pair(result.view_1_id, result.view_2_id);
+        init_pair.compute_pair(&result);
+        ASSERT_GE(result.view_1_id, 0);
+        ASSERT_GE(result.view_2_id, 0);
+        EXPECT_FALSE(result.view_1_id == first_pair[0]
+            && result.view_2_id == first_pair[1]);
+        if (second_pair[0] < 0)
+        {
+            second_pair[0] = result.view_1_id;
+            second_pair[1] = result.view_2_id;
+        }
+        EXPECT_EQ(second_pair[0], result.view_1_id) << threads;
+        EXPECT_EQ(second_pair[1], result.view_2_id) << threads;
+    }
+    set_num_threads(1);
+}
@@ -0,0 +1,116 @@
+// Test cases for the bundler matching component.
+
+#include <random>
+#include <gtest/gtest.h>
+
+#include "sfm/bundler_matching.h"
+
+namespace
+{
+    /*
+     * Creates views of random 3D points with cameras translated along
+     * the x-axis. Each point has a random descriptor which is perturbed
+     * by noise in every view.
+     */
+    void
+    create_scene (int num_views, int num_points,
+        sfm::bundler::ViewportList* viewports)
+    {
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        std::normal_distribution<float> noise(0.0f, 0.005f);
+
+        std::vector<math::Vec3f> points(num_points);
+        std::vector<math::Vec128f> descriptors(num_points);
+        for (int i = 0; i < num_points; ++i)
+        {
+            points[i] = math::Vec3f(uniform(generator), uniform(generator),
+                5.0f + uniform(generator));
+            for (int j = 0; j < 128; ++j)
+                descriptors[i][j] = 0.5f + 0.5f * uniform(generator);
+        }
+
+        viewports->clear();
+        viewports->resize(num_views);
+        for (int v = 0; v < num_views; ++v)
+        {
+            sfm::FeatureSet& features = viewports->at(v).features;
+            features.positions.resize(num_points);
+            features.colors.resize(num_points, math::Vec3uc(0, 0, 0));
+            sfm::Sift::Descriptors sift_descriptors(num_points);
+            for (int i = 0; i < num_points; ++i)
+            {
+                math::Vec3f const& p = points[i];
+                float const cam_x = 0.3f * static_cast<float>(v);
+                features.positions[i] = math::Vec2f((p[0] - cam_x) / p[2],
+                    p[1] / p[2]);
+
+                sfm::Sift::Descriptor& descr = sift_descriptors[i];
+                descr.x = features.positions[i][0];
+                descr.y = features.positions[i][1];
+                for (int j = 0; j < 128; ++j)
+                    descr.data[j] = descriptors[i][j] + noise(generator);
+                descr.data.normalize();
+            }
+            features.set_sift_descriptors(sift_descriptors);
+        }
+    }
+
+    void
+    run_matching (sfm::bundler::Matching::Options const& options,
+        sfm::bundler::PairwiseMatching* pairwise_matching)
+    {
+        sfm::bundler::ViewportList viewports;
+        create_scene(5, 200, &viewports);
+        sfm::bundler::Matching::Progress progress;
+        sfm::bundler::Matching matching(options, &progress);
+        matching.init(&viewports);
+        matching.compute(pairwise_matching);
+        EXPECT_EQ(progress.num_total, progress.num_done);
+    }
+}
+
+TEST(BundlerMatchingTest, AllPairsOrderedAndReproducible)
+{
+    sfm::bundler::Matching::Options options;
+    options.ransac_opts.verbose_output = false;
+
+    sfm::bundler::PairwiseMatching result_1, result_2;
+    run_matching(options, &result_1);
+    run_matching(options, &result_2);
+
+    /* All ten pairs are matched and ordered by view IDs. */
+    ASSERT_EQ(10, result_1.size());
+    std::size_t index = 0;
+    for (int i = 1; i < 5; ++i)
+        for (int j = 0; j < i; ++j, ++index)
+        {
+            EXPECT_EQ(i, result_1[index].view_1_id);
+            EXPECT_EQ(j, result_1[index].view_2_id);
+            EXPECT_GT(result_1[index].matches.size(), 150);
+        }
+
+    ASSERT_EQ(result_1.size(), result_2.size());
+    for (std::size_t i = 0; i < result_1.size(); ++i)
+    {
+        EXPECT_EQ(result_1[i].view_1_id, result_2[i].view_1_id);
+        EXPECT_EQ(result_1[i].view_2_id, result_2[i].view_2_id);
+        EXPECT_EQ(result_1[i].matches, result_2[i].matches);
+    }
+}
+
+TEST(BundlerMatchingTest, PreviousFramesOnly)
+{
+    sfm::bundler::Matching::Options options;
+    options.ransac_opts.verbose_output = false;
+    options.match_num_previous_frames = 1;
+
+    sfm::bundler::PairwiseMatching result;
+    run_matching(options, &result);
+    ASSERT_EQ(4, result.size());
+    for (std::size_t i = 0; i < result.size(); ++i)
+    {
+        EXPECT_EQ(static_cast<int>(i) + 1, result[i].view_1_id);
+        EXPECT_EQ(static_cast<int>(i), result[i].view_2_id);
+    }
+}
@@ -0,0 +1,113 @@
+// Test cases for the Gaussian pyramid builder.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "mve/image_tools.h"
+#include "sfm/gaussian_pyramid.h"
+
+namespace
+{
+    mve::FloatImage::Ptr
+    create_random_image (int width, int height)
+    {
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        mve::FloatImage::Ptr image = mve::FloatImage::create(width, height, 1);
+        for (int i = 0; i < image->get_value_amount(); ++i)
+            image->at(i) = uniform(generator);
+        return image;
+    }
+}
+
+TEST(GaussianPyramidTest, BlurEqualsReference)
+{
+    mve::FloatImage::Ptr image = create_random_image(57, 31);
+    sfm::GaussianPyramid pyramid;
+    float const sigmas[] = { 0.05f, 0.8f, 1.6f, 3.2f, 12.0f };
+    for (float sigma : sigmas)
+    {
+        mve::FloatImage::Ptr expected
+            = mve::image::blur_gaussian<float>(image, sigma);
+        mve::FloatImage result;
+        pyramid.blur(*image, sigma, &result);
+        ASSERT_EQ(expected->width(), result.width());
+        ASSERT_EQ(expected->height(), result.height());
+        for (int i = 0; i < result.get_value_amount(); ++i)
+            EXPECT_NEAR(expected->at(i), result.at(i), 1e-5f);
+    }
+}
+
+TEST(GaussianPyramidTest, BlurDoG)
+{
+    mve::FloatImage::Ptr image = create_random_image(40, 25);
+    sfm::GaussianPyramid pyramid;
+    mve::FloatImage blurred, dog;
+    pyramid.blur_dog(*image, 1.3f, &blurred, &dog);
+    ASSERT_EQ(40, dog.width());
+    ASSERT_EQ(25, dog.height());
+    for (int i = 0; i < dog.get_value_amount(); ++i)
+        EXPECT_FLOAT_EQ(blurred.at(i) - image->at(i), dog.at(i));
+}
+
+TEST(GaussianPyramidTest, BuildOctave)
+{
+    mve::FloatImage::Ptr image = create_random_image(64, 48);
+    sfm::GaussianPyramid pyramid;
+    sfm::GaussianPyramid::ImageVector img, dog;
+    pyramid.build_octave(image, 0.5f, 1.6f, 3, &img, &dog);
+    ASSERT_EQ(6, img.size());
+    ASSERT_EQ(5, dog.size());
+
+    /* The first image is blurred from 0.5 to 1.6. */
+    float const sigma = std::sqrt(1.6f * 1.6f - 0.5f * 0.5f);
+    mve::FloatImage::Ptr expected
+        = mve::image::blur_gaussian<float>(image, sigma);
+    for (int i = 0; i < expected->get_value_amount(); ++i)
+        EXPECT_NEAR(expected->at(i), img[0]->at(i), 1e-5f);
+
+    for (std::size_t s = 0; s < dog.size(); ++s)
+        for (int i = 0; i < dog[s]->get_value_amount(); ++i)
+            EXPECT_FLOAT_EQ(img[s + 1]->at(i) - img[s]->at(i),
+                dog[s]->at(i));
+}
+
+TEST(GaussianPyramidTest, ReleasedImagesAreReused)
+{
+    mve::FloatImage::Ptr image = create_random_image(64, 48);
+    sfm::GaussianPyramid pyramid;
+    sfm::GaussianPyramid::ImageVector img, dog;
+    pyramid.build_octave(image, 0.5f, 1.6f, 3, &img, &dog);
+    std::vector<float const*> buffers;
+    for (std::size_t i = 0; i < img.size(); ++i)
+        buffers.push_back(img[i]->get_data_pointer());
+    for (std::size_t i = 0; i < dog.size(); ++i)
+        buffers.push_back(dog[i]->get_data_pointer());
+    std::vector<float> expected(img.back()->begin(), img.back()->end());
+    pyramid.release_images(&img);
+    pyramid.release_images(&dog);
+    EXPECT_TRUE(img.empty());
+    EXPECT_TRUE(dog.empty());
+
+    /* A smaller octave fits into the released buffers. */
+    mve::FloatImage::Ptr half = create_random_image(32, 24);
+    pyramid.build_octave(half, 0.5f, 1.6f, 3, &img, &dog);
+    for (std::size_t i = 0; i < img.size(); ++i)
+        EXPECT_NE(buffers.end(), std::find(buffers.begin(), buffers.end(),
+            img[i]->get_data_pointer())) << "Image " << i;
+    pyramid.release_images(&img);
+    pyramid.release_images(&dog);
+
+    /* Reused buffers give the same result. */
+    pyramid.build_octave(image, 0.5f, 1.6f, 3, &img, &dog);
+    for (int i = 0; i < img.back()->get_value_amount(); ++i)
+        EXPECT_EQ(expected[i], img.back()->at(i));
+
+    /* Images referenced elsewhere are not reused. */
+    mve::FloatImage::Ptr kept = img[0];
+    pyramid.release_images(&img);
+    EXPECT_EQ(1, kept.use_count());
+}
@@ -0,0 +1,82 @@
+// Test cases for kd-tree feature matching.
+
+#include <algorithm>
+#include <random>
+#include <gtest/gtest.h>
+
+#include "sfm/bundler_common.h"
+#include "sfm/kdtree_matching.h"
+
+namespace
+{
+    void
+    fill_viewports (sfm::bundler::ViewportList* viewports, int num_features)
+    {
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::normal_distribution<float> noise(0.0f, 0.01f);
+
+        /* The second view contains noisy, reversed copies of the first. */
+        viewports->resize(2);
+        sfm::Sift::Descriptors descr_1(num_features);
+        sfm::Sift::Descriptors descr_2(num_features);
+        for (int i = 0; i < num_features; ++i)
+        {
+            sfm::Sift::Descriptor& d1 = descr_1[i];
+            sfm::Sift::Descriptor& d2 = descr_2[num_features - i - 1];
+            for (int j = 0; j < 128; ++j)
+            {
+                d1.data[j] = uniform(generator);
+                d2.data[j] = std::max(0.0f, d1.data[j] + noise(generator));
+            }
+            d1.data.normalize();
+            d2.data.normalize();
+        }
+        viewports->at(0).features.set_sift_descriptors(descr_1);
+        viewports->at(1).features.set_sift_descriptors(descr_2);
+    }
+}
+
+TEST(KdTreeMatchingTest, MatchesNoisyCopies)
+{
+    int const num_features = 1000;
+    sfm::bundler::ViewportList viewports;
+    fill_viewports(&viewports, num_features);
+
+    sfm::KdTreeMatching::Options options;
+    options.max_checks = 64;
+    sfm::KdTreeMatching matcher(options);
+    matcher.init(&viewports);
+
+    sfm::Matching::Result result;
+    matcher.pairwise_match(0, 1, &result);
+    ASSERT_EQ(num_features, result.matches_1_2.size());
+    ASSERT_EQ(num_features, result.matches_2_1.size());
+
+    int num_correct = 0;
+    for (int i = 0; i < num_features; ++i)
+    {
+        if (result.matches_1_2[i] < 0)
+            continue;
+        EXPECT_EQ(num_features - i - 1, result.matches_1_2[i]);
+        num_correct += result.matches_1_2[i] == num_features - i - 1;
+    }
+    EXPECT_GT(num_correct, num_features * 9 / 10);
+}
+
+TEST(KdTreeMatchingTest, EmptyAndTinyViews)
+{
+    sfm::bundler::ViewportList viewports;
+    fill_viewports(&viewports, 1);
+    viewports.resize(3);
+
+    sfm::KdTreeMatching matcher((sfm::KdTreeMatching::Options()));
+    matcher.init(&viewports);
+
+    sfm::Matching::Result result;
+    matcher.pairwise_match(0, 1, &result);
+    EXPECT_EQ(0, result.matches_1_2[0]);
+    EXPECT_EQ(0, result.matches_2_1[0]);
+    matcher.pairwise_match(2, 0, &result);
+    EXPECT_TRUE(result.matches_1_2.empty());
+}
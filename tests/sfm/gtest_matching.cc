@@ -1,8 +1,11 @@
 // Test cases for feature matching.
 // Written by Simon Fuhrmann.
 
+#include <cstdlib>
+#include <vector>
 #include <gtest/gtest.h>
 
+#include "util/aligned_memory.h"
 #include "sfm/matching.h"
 
 TEST(MatchingTest, RemoveInconsistentMatches)
@@ -29,3 +32,44 @@ TEST(MatchingTest, RemoveInconsistentMatches)
     EXPECT_EQ(2, result.matches_2_1[3]);
     EXPECT_EQ(-1, result.matches_2_1[4]);
 }
+
+TEST(MatchingTest, TwowayMatchEqualsOnewayMatches)
+{
+    int const num_1 = 50, num_2 = 70, dims = 64;
+    util::AlignedMemory<short, 16> set_1(num_1 * dims);
+    util::AlignedMemory<short, 16> set_2(num_2 * dims);
+    std::srand(1);
+    for (std::size_t i = 0; i < set_1.size(); ++i)
+        set_1[i] = std::rand() % 55 - 27;
+    /* Second set contains noisy copies of the first set. */
+    for (int i = 0; i < num_2; ++i)
+        for (int j = 0; j < dims; ++j)
+            set_2[i * dims + j] = i < num_1
+                ? set_1[((i * 7) % num_1) * dims + j] + std::rand() % 3 - 1
+                : std::rand() % 55 - 27;
+
+    sfm::Matching::Options options{ dims, 0.8f, 20000.0f };
+    sfm::Matching::Result twoway;
+    sfm::Matching::twoway_match(options, set_1.data(), num_1,
+        set_2.data(), num_2, &twoway);
+    std::vector<int> oneway_1_2, oneway_2_1;
+    sfm::Matching::oneway_match(options, set_1.data(), num_1,
+        set_2.data(), num_2, &oneway_1_2);
+    sfm::Matching::oneway_match(options, set_2.data(), num_2,
+        set_1.data(), num_1, &oneway_2_1);
+
+    EXPECT_EQ(oneway_1_2, twoway.matches_1_2);
+    EXPECT_EQ(oneway_2_1, twoway.matches_2_1);
+    EXPECT_GT(sfm::Matching::count_consistent_matches(twoway), 40);
+
+    /* Valid matches keep their distance ratio below the threshold. */
+    ASSERT_EQ(num_1, twoway.ratios_1_2.size());
+    ASSERT_EQ(num_2, twoway.ratios_2_1.size());
+    for (int i = 0; i < num_1; ++i)
+    {
+        if (twoway.matches_1_2[i] < 0)
+            EXPECT_EQ(1.0f, twoway.ratios_1_2[i]);
+        else
+            EXPECT_LE(twoway.ratios_1_2[i], 0.8f * 0.8f);
+    }
+}
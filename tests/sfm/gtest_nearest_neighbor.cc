@@ -1,6 +1,9 @@
 // Test cases for nearest neighbor search.
 // Written by Simon Fuhrmann.
 
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "util/aligned_memory.h"
@@ -200,3 +203,228 @@ TEST(NearestNeighborTest, TestFloat)
     EXPECT_EQ(2, result.index_1st_best);
     EXPECT_EQ(1, result.index_2nd_best);
 }
+
+namespace
+{
+    template <typename T>
+    void
+    fill_random (T* data, int num, int min_value, int max_value)
+    {
+        for (int i = 0; i < num; ++i)
+            data[i] = static_cast<T>(min_value
+                + std::rand() % (max_value - min_value + 1));
+    }
+
+    template <typename T>
+    void
+    test_all_kernels (int dimensions, int min_value, int max_value)
+    {
+        typedef sfm::NearestNeighbor<T> NN;
+        int const num_elements = 100;
+        util::AlignedMemory<T> elements(num_elements * dimensions);
+        util::AlignedMemory<T> queries(10 * dimensions);
+        /* Small values to keep the inner products in the short range. */
+        fill_random(elements.data(), elements.size(), min_value, max_value);
+        fill_random(queries.data(), queries.size(), min_value, max_value);
+
+        NN nn;
+        nn.set_elements(elements.data());
+        nn.set_num_elements(num_elements);
+        nn.set_element_dimensions(dimensions);
+
+        typename NN::Kernel const kernels[] = { NN::KERNEL_SSE,
+            NN::KERNEL_AVX2, NN::KERNEL_AVX512, NN::KERNEL_AVX512_VNNI };
+        for (int i = 0; i < 10; ++i)
+        {
+            T const* query = queries.data() + i * dimensions;
+            typename NN::Result reference;
+            nn.set_kernel(NN::KERNEL_SCALAR);
+            EXPECT_EQ(NN::KERNEL_SCALAR, nn.get_effective_kernel());
+            nn.find(query, &reference);
+
+            for (typename NN::Kernel kernel : kernels)
+            {
+                typename NN::Result result;
+                nn.set_kernel(kernel);
+                EXPECT_LE(nn.get_effective_kernel(), kernel);
+                nn.find(query, &result);
+                EXPECT_EQ(reference.dist_1st_best, result.dist_1st_best);
+                EXPECT_EQ(reference.dist_2nd_best, result.dist_2nd_best);
+                EXPECT_EQ(reference.index_1st_best, result.index_1st_best);
+                EXPECT_EQ(reference.index_2nd_best, result.index_2nd_best);
+            }
+        }
+
+        /* All queries at once to cover the register-blocked paths. */
+        std::vector<typename NN::Result> reference(10);
+        nn.set_kernel(NN::KERNEL_SCALAR);
+        nn.find_all(queries.data(), 10, reference.data());
+        for (typename NN::Kernel kernel : kernels)
+        {
+            std::vector<typename NN::Result> results(10);
+            nn.set_kernel(kernel);
+            nn.find_all(queries.data(), 10, results.data());
+            for (int i = 0; i < 10; ++i)
+            {
+                EXPECT_EQ(reference[i].dist_1st_best,
+                    results[i].dist_1st_best);
+                EXPECT_EQ(reference[i].dist_2nd_best,
+                    results[i].dist_2nd_best);
+                EXPECT_EQ(reference[i].index_1st_best,
+                    results[i].index_1st_best);
+                EXPECT_EQ(reference[i].index_2nd_best,
+                    results[i].index_2nd_best);
+            }
+        }
+    }
+}
+
+TEST(NearestNeighborTest, TestKernelsSiftUnsignedShort)
+{
+    std::srand(1);
+    test_all_kernels<unsigned short>(128, 0, 22);
+}
+
+TEST(NearestNeighborTest, TestKernelsSiftUnsignedChar)
+{
+    std::srand(8);
+    test_all_kernels<unsigned char>(128, 0, 22);
+    test_all_kernels<unsigned char>(24, 0, 40);
+}
+
+TEST(NearestNeighborTest, TestUnsignedCharMatchesUnsignedShort)
+{
+    std::srand(9);
+    int const dimensions = 128;
+    int const num_elements = 300;
+    int const num_queries = 40;
+    util::AlignedMemory<unsigned char> elements(num_elements * dimensions);
+    util::AlignedMemory<unsigned char> queries(num_queries * dimensions);
+    fill_random(elements.data(), elements.size(), 0, 22);
+    fill_random(queries.data(), queries.size(), 0, 22);
+    util::AlignedMemory<unsigned short> elements_us(elements.size());
+    util::AlignedMemory<unsigned short> queries_us(queries.size());
+    std::copy(elements.begin(), elements.end(), elements_us.begin());
+    std::copy(queries.begin(), queries.end(), queries_us.begin());
+
+    sfm::NearestNeighbor<unsigned char> nn;
+    nn.set_elements(elements.data());
+    nn.set_num_elements(num_elements);
+    nn.set_element_dimensions(dimensions);
+    sfm::NearestNeighbor<unsigned short> nn_us;
+    nn_us.set_elements(elements_us.data());
+    nn_us.set_num_elements(num_elements);
+    nn_us.set_element_dimensions(dimensions);
+
+    std::vector<sfm::NearestNeighbor<unsigned char>::Result>
+        results(num_queries);
+    std::vector<sfm::NearestNeighbor<unsigned short>::Result>
+        results_us(num_queries);
+    nn.find_all(queries.data(), num_queries, results.data());
+    nn_us.find_all(queries_us.data(), num_queries, results_us.data());
+    for (int i = 0; i < num_queries; ++i)
+    {
+        EXPECT_EQ(results_us[i].dist_1st_best, results[i].dist_1st_best);
+        EXPECT_EQ(results_us[i].dist_2nd_best, results[i].dist_2nd_best);
+        EXPECT_EQ(results_us[i].index_1st_best, results[i].index_1st_best);
+        EXPECT_EQ(results_us[i].index_2nd_best, results[i].index_2nd_best);
+    }
+}
+
+TEST(NearestNeighborTest, TestKernelsSurfSignedShort)
+{
+    std::srand(2);
+    test_all_kernels<short>(64, -15, 15);
+}
+
+TEST(NearestNeighborTest, TestKernelsDimensionFallback)
+{
+    std::srand(3);
+    test_all_kernels<short>(24, -20, 20);
+    test_all_kernels<float>(12, -1, 1);
+}
+
+TEST(NearestNeighborTest, TestKernelsFloat)
+{
+    std::srand(4);
+    /* Integer valued floats give exact inner products for all kernels. */
+    test_all_kernels<float>(128, -4, 4);
+}
+
+namespace
+{
+    template <typename T>
+    void
+    test_find_all (int dimensions, int num_queries, int num_elements,
+        int min_value, int max_value)
+    {
+        typedef sfm::NearestNeighbor<T> NN;
+        util::AlignedMemory<T> elements(num_elements * dimensions);
+        util::AlignedMemory<T> queries(num_queries * dimensions);
+        fill_random(elements.data(), elements.size(), min_value, max_value);
+        fill_random(queries.data(), queries.size(), min_value, max_value);
+
+        NN nn;
+        nn.set_elements(elements.data());
+        nn.set_num_elements(num_elements);
+        nn.set_element_dimensions(dimensions);
+        std::vector<typename NN::Result> query_results(num_queries);
+        std::vector<typename NN::Result> element_results(num_elements);
+        nn.find_all(queries.data(), num_queries,
+            query_results.data(), element_results.data());
+
+        for (int i = 0; i < num_queries; ++i)
+        {
+            typename NN::Result result;
+            nn.find(queries.data() + i * dimensions, &result);
+            EXPECT_EQ(result.dist_1st_best, query_results[i].dist_1st_best);
+            EXPECT_EQ(result.dist_2nd_best, query_results[i].dist_2nd_best);
+            EXPECT_EQ(result.index_1st_best, query_results[i].index_1st_best);
+            EXPECT_EQ(result.index_2nd_best, query_results[i].index_2nd_best);
+        }
+
+        /* Reverse search of the elements among the queries. */
+        NN reverse;
+        reverse.set_elements(queries.data());
+        reverse.set_num_elements(num_queries);
+        reverse.set_element_dimensions(dimensions);
+        for (int i = 0; i < num_elements; ++i)
+        {
+            typename NN::Result result;
+            reverse.find(elements.data() + i * dimensions, &result);
+            EXPECT_EQ(result.dist_1st_best, element_results[i].dist_1st_best);
+            EXPECT_EQ(result.dist_2nd_best, element_results[i].dist_2nd_best);
+            EXPECT_EQ(result.index_1st_best,
+                element_results[i].index_1st_best);
+            EXPECT_EQ(result.index_2nd_best,
+                element_results[i].index_2nd_best);
+        }
+    }
+}
+
+TEST(NearestNeighborTest, TestFindAllUnsignedShort)
+{
+    std::srand(5);
+    /* Sizes that are not multiples of the block and register sizes. */
+    test_find_all<unsigned short>(128, 75, 531, 0, 22);
+    test_find_all<unsigned short>(128, 3, 2, 0, 22);
+}
+
+TEST(NearestNeighborTest, TestFindAllUnsignedChar)
+{
+    std::srand(10);
+    test_find_all<unsigned char>(128, 75, 531, 0, 22);
+}
+
+TEST(NearestNeighborTest, TestFindAllSignedShort)
+{
+    std::srand(6);
+    test_find_all<short>(64, 67, 301, -15, 15);
+    test_find_all<short>(8, 9, 5, -40, 40);
+}
+
+TEST(NearestNeighborTest, TestFindAllFloat)
+{
+    std::srand(7);
+    test_find_all<float>(64, 33, 257, -4, 4);
+}
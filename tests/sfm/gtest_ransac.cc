@@ -0,0 +1,152 @@
+// Test cases for the generic SfM RANSAC engine.
+
+#include <cmath>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "math/vector.h"
+#include "sfm/ransac.h"
+
+namespace
+{
+    /* Fits a 2D line y = a * x + b to points. */
+    class LineProblem
+    {
+    public:
+        typedef math::Vec2d Model;
+        enum { SAMPLE_SIZE = 2 };
+
+    public:
+        LineProblem (std::vector<math::Vec2d> const& points)
+            : points(&points) {}
+
+        std::size_t num_data (void) const
+        {
+            return this->points->size();
+        }
+
+        void compute_models (int const* sample,
+            std::vector<Model>* models) const
+        {
+            math::Vec2d const& p1 = this->points->at(sample[0]);
+            math::Vec2d const& p2 = this->points->at(sample[1]);
+            if (p1[0] == p2[0])
+                return;
+            double const a = (p2[1] - p1[1]) / (p2[0] - p1[0]);
+            models->push_back(Model(a, p1[1] - a * p1[0]));
+        }
+
+        double residual (Model const& model, std::size_t id) const
+        {
+            math::Vec2d const& p = this->points->at(id);
+            return MATH_POW2(model[0] * p[0] + model[1] - p[1]);
+        }
+
+        void residuals (Model const& model, std::vector<double>* result) const
+        {
+            result->resize(this->points->size());
+            for (std::size_t i = 0; i < result->size(); ++i)
+                result->at(i) = this->residual(model, i);
+        }
+
+    private:
+        std::vector<math::Vec2d> const* points;
+    };
+
+    /* 80 points on y = 2x + 1 and 20 outliers. */
+    std::vector<math::Vec2d>
+    create_points (void)
+    {
+        std::vector<math::Vec2d> points;
+        for (int i = 0; i < 100; ++i)
+        {
+            double const x = static_cast<double>(i);
+            if (i % 5 == 0)
+                points.push_back(math::Vec2d(x, 1000.0 + 7.0 * (i % 13)));
+            else
+                points.push_back(math::Vec2d(x, 2.0 * x + 1.0));
+        }
+        return points;
+    }
+}
+
+TEST(RansacEngineTest, FindsModelAndTerminatesEarly)
+{
+    std::vector<math::Vec2d> points = create_points();
+    typedef sfm::RansacEngine<LineProblem> Engine;
+    Engine::Options opts;
+    opts.max_iterations = 10000;
+    opts.square_threshold = 1e-6;
+
+    Engine::Result result;
+    Engine(opts).estimate(LineProblem(points), &result);
+    EXPECT_NEAR(2.0, result.model[0], 1e-10);
+    EXPECT_NEAR(1.0, result.model[1], 1e-10);
+    ASSERT_EQ(80, result.inliers.size());
+    for (std::size_t i = 0; i < result.inliers.size(); ++i)
+        EXPECT_NE(0, result.inliers[i] % 5);
+    EXPECT_LT(result.num_iterations, opts.max_iterations);
+
+    /* Without early termination all iterations are used. */
+    opts.max_iterations = 100;
+    opts.success_rate = 0.0;
+    Engine(opts).estimate(LineProblem(points), &result);
+    EXPECT_EQ(100, result.num_iterations);
+    EXPECT_EQ(80, result.inliers.size());
+}
+
+TEST(RansacEngineTest, ReproducibleForSeed)
+{
+    std::vector<math::Vec2d> points = create_points();
+    typedef sfm::RansacEngine<LineProblem> Engine;
+    Engine::Options opts;
+    opts.max_iterations = 50;
+    opts.square_threshold = 1e-6;
+    opts.num_preverify = 1;
+    opts.random_seed = 42;
+
+    Engine::Result result_1, result_2;
+    Engine(opts).estimate(LineProblem(points), &result_1);
+    Engine(opts).estimate(LineProblem(points), &result_2);
+    EXPECT_EQ(result_1.num_iterations, result_2.num_iterations);
+    EXPECT_EQ(result_1.model, result_2.model);
+    EXPECT_EQ(result_1.inliers, result_2.inliers);
+
+    /* Too few data points for a sample. */
+    points.resize(1);
+    EXPECT_THROW(Engine(opts).estimate(LineProblem(points), &result_1),
+        std::invalid_argument);
+}
+
+TEST(RansacEngineTest, ProgressiveSampling)
+{
+    /* Ranked data: 10 inliers first, followed by 190 outliers. */
+    std::vector<math::Vec2d> points;
+    for (int i = 0; i < 200; ++i)
+    {
+        double const x = static_cast<double>(i);
+        points.push_back(math::Vec2d(x, i < 10
+            ? 2.0 * x + 1.0 : 1000.0 + (i * i * 37) % 1009));
+    }
+
+    typedef sfm::RansacEngine<LineProblem> Engine;
+    Engine::Options opts;
+    opts.max_iterations = 1000;
+    opts.square_threshold = 1e-6;
+    opts.success_rate = 0.0;
+    opts.progressive_sampling = true;
+
+    /* The first samples are drawn from the best-ranked data only. */
+    opts.max_iterations = 1;
+    Engine::Result result;
+    Engine(opts).estimate(LineProblem(points), &result);
+    EXPECT_NEAR(2.0, result.model[0], 1e-10);
+    EXPECT_EQ(10, result.inliers.size());
+
+    /* After max_iterations sampling falls back to uniform sampling. */
+    opts.max_iterations = 1000;
+    Engine(opts).estimate(LineProblem(points), &result);
+    EXPECT_EQ(1000, result.num_iterations);
+    EXPECT_NEAR(1.0, result.model[1], 1e-10);
+    EXPECT_EQ(10, result.inliers.size());
+}
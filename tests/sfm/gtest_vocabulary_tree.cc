@@ -0,0 +1,124 @@
+// Test cases for the vocabulary tree and image retrieval.
+
+#include <random>
+#include <set>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "sfm/bundler_retrieval.h"
+#include "sfm/vocabulary_tree.h"
+
+TEST(VocabularyTreeTest, SeparatesClusters)
+{
+    int const num_clusters = 8;
+    int const num_per_cluster = 50;
+    int const dims = 16;
+
+    /* Well separated cluster centers along the coordinate axes. */
+    std::mt19937 generator(1);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<float> descriptors;
+    for (int c = 0; c < num_clusters; ++c)
+        for (int i = 0; i < num_per_cluster; ++i)
+            for (int d = 0; d < dims; ++d)
+                descriptors.push_back((d == c ? 1.0f : 0.0f)
+                    + noise(generator));
+
+    sfm::VocabularyTree::Options options;
+    options.branching_factor = num_clusters;
+    options.num_levels = 1;
+    sfm::VocabularyTree tree(options);
+    tree.build(descriptors.data(), num_clusters * num_per_cluster, dims);
+    EXPECT_EQ(num_clusters, tree.get_num_words());
+    EXPECT_EQ(dims, tree.get_dimensions());
+
+    /* All descriptors of a cluster map to the same, unique word. */
+    std::set<int> words;
+    for (int c = 0; c < num_clusters; ++c)
+    {
+        float const* cluster = descriptors.data() + c * num_per_cluster * dims;
+        int const word = tree.lookup(cluster);
+        for (int i = 1; i < num_per_cluster; ++i)
+            EXPECT_EQ(word, tree.lookup(cluster + i * dims));
+        words.insert(word);
+    }
+    EXPECT_EQ(num_clusters, static_cast<int>(words.size()));
+}
+
+TEST(VocabularyTreeTest, MultipleLevels)
+{
+    std::mt19937 generator(2);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> descriptors(1000 * 8);
+    for (std::size_t i = 0; i < descriptors.size(); ++i)
+        descriptors[i] = uniform(generator);
+
+    sfm::VocabularyTree::Options options;
+    options.branching_factor = 4;
+    options.num_levels = 3;
+    sfm::VocabularyTree tree(options);
+    tree.build(descriptors.data(), 1000, 8);
+    EXPECT_LE(tree.get_num_words(), 64);
+    EXPECT_GT(tree.get_num_words(), 16);
+    for (int i = 0; i < 1000; ++i)
+    {
+        int const word = tree.lookup(descriptors.data() + i * 8);
+        EXPECT_GE(word, 0);
+        EXPECT_LT(word, tree.get_num_words());
+    }
+}
+
+TEST(RetrievalTest, PairsViewsOfSameScene)
+{
+    /* Three scenes with two views each, views of a scene share features. */
+    int const num_scenes = 3;
+    int const num_features = 200;
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+
+    sfm::bundler::ViewportList viewports(2 * num_scenes);
+    for (int s = 0; s < num_scenes; ++s)
+    {
+        sfm::Sift::Descriptors descr_1(num_features);
+        sfm::Sift::Descriptors descr_2(num_features);
+        for (int i = 0; i < num_features; ++i)
+        {
+            for (int j = 0; j < 128; ++j)
+            {
+                descr_1[i].data[j] = uniform(generator);
+                descr_2[i].data[j] = descr_1[i].data[j] + noise(generator);
+            }
+            descr_1[i].data.normalize();
+            descr_2[i].data.normalize();
+        }
+        viewports[2 * s].features.set_sift_descriptors(descr_1);
+        viewports[2 * s + 1].features.set_sift_descriptors(descr_2);
+    }
+
+    sfm::bundler::Retrieval::Options options;
+    options.num_candidates = 1;
+    options.vocabulary_opts.branching_factor = 8;
+    options.vocabulary_opts.num_levels = 3;
+    sfm::bundler::Retrieval retrieval(options);
+    sfm::bundler::ViewPairList pairs;
+    retrieval.compute(viewports, &pairs);
+
+    ASSERT_EQ(3, pairs.size());
+    EXPECT_EQ(std::make_pair(1, 0), pairs[0]);
+    EXPECT_EQ(std::make_pair(3, 2), pairs[1]);
+    EXPECT_EQ(std::make_pair(5, 4), pairs[2]);
+}
+
+TEST(RetrievalTest, DisabledOrEmpty)
+{
+    sfm::bundler::ViewportList viewports(3);
+    sfm::bundler::Retrieval::Options options;
+    sfm::bundler::ViewPairList pairs(1, std::make_pair(1, 0));
+    sfm::bundler::Retrieval(options).compute(viewports, &pairs);
+    EXPECT_TRUE(pairs.empty());
+
+    options.num_candidates = 2;
+    sfm::bundler::Retrieval(options).compute(viewports, &pairs);
+    EXPECT_TRUE(pairs.empty());
+}